@@ -21,6 +21,8 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <vector>
 
 namespace {
@@ -89,6 +91,61 @@ const std::vector<std::string> Defaults = {
   "nqbnrkrb/pppppppp/8/8/8/8/PPPPPPPP/NQBNRKRB w KQkq - 0 1",
   "setoption name UCI_Chess960 value false"
 };
+
+// Position sets for profile-guided builds, which can train on the phases of
+// the game that matter to them. See PGOSETS in the Makefile.
+const std::vector<std::string> Openings = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves e2e4 c7c5 g1f3 d7d6 d2d4 c5d4 f3d4 g8f6 b1c3 a7a6",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves e2e4 e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1 f8e7",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves e2e4 e7e6 d2d4 d7d5 b1c3 g8f6 c1g5 f8e7",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves d2d4 g8f6 c2c4 e7e6 b1c3 f8b4",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves d2d4 d7d5 c2c4 c7c6 g1f3 g8f6 b1c3 d5c4",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves d2d4 g8f6 c2c4 g7g6 b1c3 f8g7 e2e4 d7d6 g1f3 e8g8",
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves c2c4 e7e5 b1c3 g8f6 g2g3 d7d5 c4d5 f6d5"
+};
+
+const std::vector<std::string> Middlegames = {
+  "r1bq1rk1/pp2bppp/2n1pn2/2pp4/3P4/2PBPN2/PP1N1PPP/R1BQ1RK1 w - - 0 9",
+  "r2q1rk1/1b2bppp/p2ppn2/1p6/3NP3/1BN1B3/PPP2PPP/R2Q1RK1 w - - 0 12",
+  "2r2rk1/pp1bqppp/2n1pn2/3p4/3P4/P1NBPN2/1P3PPP/R2Q1RK1 w - - 3 14",
+  "r1b2rk1/2q1bppp/p2ppn2/1p6/3NP3/1BN1BQ2/PPP2PPP/R4RK1 w - - 0 12",
+  "2kr3r/ppqn1pp1/2pbp2p/7P/3P4/3Q1NN1/PPPB1PP1/2KR3R w - - 2 17",
+  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  "r2qr1k1/pp1nbppp/2p1pn2/3p4/2PP4/1PN1PN2/PB1Q1PPP/R4RK1 w - - 1 12",
+  "3r1rk1/pp2qppp/2n1pn2/8/2BP4/P3PN2/1Q3PPP/R4RK1 b - - 4 16"
+};
+
+const std::vector<std::string> Endgames = {
+  "8/5pk1/6p1/3R4/2r4P/6P1/5PK1/8 w - - 0 40",
+  "8/pp3k2/2p1pp2/3p4/3P1P2/2P1K1P1/PP6/8 w - - 0 35",
+  "4b3/2p2k2/1p1p2p1/pP1P1pP1/P1P2P2/4BK2/8/8 w - - 0 45",
+  "8/3n1k2/p3p1p1/1p1pP1P1/1P1P4/P2N1K2/8/8 w - - 0 50",
+  "6k1/pp3ppp/8/3r4/8/2R5/PP3PPP/6K1 w - - 0 30",
+  "2r3k1/5pp1/p3p2p/1p6/3P4/P3QP2/1q4PP/2R3K1 w - - 0 30",
+  "8/1p4k1/p1b3p1/P4p1p/1P3P1P/4B1P1/5K2/8 b - - 0 42",
+  "5k2/p4p2/1p2pn2/8/2P5/1P2B3/P4PPP/6K1 w - - 0 28"
+};
+
+// Positions of at most seven pieces, which are probed with a SyzygyPath
+const std::vector<std::string> Tablebases = {
+  "8/8/8/4k3/8/8/4P3/4K3 w - - 0 1",
+  "8/8/4k3/8/2R5/8/3K4/5r2 b - - 0 1",
+  "8/6k1/8/6P1/8/2r5/8/4K2R w - - 0 1",
+  "8/8/1k6/8/4N3/3B4/8/4K3 w - - 0 1",
+  "6k1/8/6PP/8/8/8/5r2/2R3K1 w - - 0 1",
+  "8/7k/8/3QK3/8/8/6q1/8 w - - 0 1",
+  "8/2k5/8/1p1p4/1P1P4/2K5/8/8 w - - 0 1",
+  "8/8/3kp3/8/3PK3/8/2B5/6n1 w - - 0 1"
+};
+
+const std::map<std::string, const std::vector<std::string>*> PositionSets = {
+  {"default",    &Defaults},
+  {"opening",    &Openings},
+  {"middlegame", &Middlegames},
+  {"endgame",    &Endgames},
+  {"tb",         &Tablebases}
+};
 // clang-format on
 
 }  // namespace
@@ -106,6 +163,7 @@ namespace Stockfish::Benchmark {
 // bench 64 1 100000 default nodes  : search default positions for 100K nodes each
 // bench 64 4 5000 current movetime : search current position with 4 threads for 5 sec
 // bench 16 1 5 blah perft          : run a perft 5 on positions in file "blah"
+// bench 16 2 12 endgame,tb         : search the endgame and tablebase sets with 2 threads
 std::vector<std::string> setup_bench(const std::string& currentFen, std::istream& is) {
 
     std::vector<std::string> fens, list;
@@ -120,28 +178,36 @@ std::vector<std::string> setup_bench(const std::string& currentFen, std::istream
 
     go = limitType == "eval" ? "eval" : "go " + limitType + " " + limit;
 
-    if (fenFile == "default")
-        fens = Defaults;
+    // A comma separated list of position sets, of "current" and of files
+    std::istringstream sources(fenFile);
+    std::string        source;
 
-    else if (fenFile == "current")
-        fens.push_back(currentFen);
-
-    else
+    while (std::getline(sources, source, ','))
     {
-        std::string   fen;
-        std::ifstream file(fenFile);
+        if (PositionSets.count(source))
+            fens.insert(fens.end(), PositionSets.at(source)->begin(),
+                        PositionSets.at(source)->end());
+
+        else if (source == "current")
+            fens.push_back(currentFen);
 
-        if (!file.is_open())
+        else
         {
-            std::cerr << "Unable to open file " << fenFile << std::endl;
-            exit(EXIT_FAILURE);
-        }
+            std::string   fen;
+            std::ifstream file(source);
 
-        while (getline(file, fen))
-            if (!fen.empty())
-                fens.push_back(fen);
+            if (!file.is_open())
+            {
+                std::cerr << "Unable to open file " << source << std::endl;
+                exit(EXIT_FAILURE);
+            }
 
-        file.close();
+            while (getline(file, fen))
+                if (!fen.empty())
+                    fens.push_back(fen);
+
+            file.close();
+        }
     }
 
     list.emplace_back("setoption name Threads value " + threads);
@@ -37,12 +37,21 @@ Bitboard PawnAttacks[COLOR_NB][SQUARE_NB];
 Magic RookMagics[SQUARE_NB];
 Magic BishopMagics[SQUARE_NB];
 
+#ifdef COMPACT_MAGICS
+MagicAttacks RookTable[0x19000];   // To store rook attacks
+MagicAttacks BishopTable[0x1480];  // To store bishop attacks
+#endif
+
 namespace {
 
+#ifndef COMPACT_MAGICS
+using MagicAttacks = Bitboard;
+
 Bitboard RookTable[0x19000];   // To store rook attacks
 Bitboard BishopTable[0x1480];  // To store bishop attacks
+#endif
 
-void init_magics(PieceType pt, Bitboard table[], Magic magics[]);
+void init_magics(PieceType pt, MagicAttacks table[], Magic magics[]);
 
 // Returns the bitboard of target square for the given step
 // from the given square. If the step is off the board, returns empty bitboard.
@@ -142,7 +151,7 @@ Bitboard sliding_attack(PieceType pt, Square sq, Bitboard occupied) {
 // bitboards are used to look up attacks of sliding pieces. As a reference see
 // www.chessprogramming.org/Magic_Bitboards. In particular, here we use the so
 // called "fancy" approach.
-void init_magics(PieceType pt, Bitboard table[], Magic magics[]) {
+void init_magics(PieceType pt, MagicAttacks table[], Magic magics[]) {
 
     // Optimal PRNG seeds to pick the correct magics in the shortest time
     int seeds[][RANK_NB] = {{8977, 44560, 54343, 38998, 5731, 95205, 104912, 17020},
@@ -167,7 +176,24 @@ void init_magics(PieceType pt, Bitboard table[], Magic magics[]) {
 
         // Set the offset for the attacks table of the square. We have individual
         // table sizes for each square with "Fancy Magic Bitboards".
-        m.attacks = s == SQ_A1 ? table : magics[s - 1].attacks + size;
+#ifndef COMPACT_MAGICS
+        m.attacks             = s == SQ_A1 ? table : magics[s - 1].attacks + size;
+        MagicAttacks* attacks = m.attacks;
+#else
+        m.offset              = s == SQ_A1 ? 0 : magics[s - 1].offset + size;
+        MagicAttacks* attacks = table + m.offset;
+
+        // In PEXT builds the entries only keep the bits of the empty board attacks
+        const Bitboard rays = sliding_attack(pt, s, 0);
+        m.magic             = rays;
+#endif
+        const auto compress = [&](Bitboard a) {
+#if defined(COMPACT_MAGICS) && defined(USE_PEXT)
+            return MagicAttacks(pext(a, rays));
+#else
+            return MagicAttacks(a);
+#endif
+        };
 
         // Use Carry-Rippler trick to enumerate all subsets of masks[s] and
         // store the corresponding sliding attack bitboard in reference[].
@@ -178,7 +204,7 @@ void init_magics(PieceType pt, Bitboard table[], Magic magics[]) {
             reference[size] = sliding_attack(pt, s, b);
 
             if (HasPext)
-                m.attacks[pext(b, m.mask)] = reference[size];
+                attacks[pext(b, m.mask)] = compress(reference[size]);
 
             size++;
             b = (b - m.mask) & m.mask;
@@ -208,10 +234,10 @@ void init_magics(PieceType pt, Bitboard table[], Magic magics[]) {
 
                 if (epoch[idx] < cnt)
                 {
-                    epoch[idx]     = cnt;
-                    m.attacks[idx] = reference[i];
+                    epoch[idx]   = cnt;
+                    attacks[idx] = compress(reference[i]);
                 }
-                else if (m.attacks[idx] != reference[i])
+                else if (attacks[idx] != compress(reference[i]))
                     break;
             }
         }
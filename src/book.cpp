@@ -0,0 +1,297 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "book.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "movegen.h"
+#include "position.h"
+#include "tt.h"
+#include "uci.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#else
+    #if !defined(NOMINMAX)
+        #define NOMINMAX  // Disable min()/max() macros
+    #endif
+    #include <windows.h>
+#endif
+
+namespace Stockfish {
+
+namespace {
+
+constexpr char   BookMagic[8] = {'S', 'F', 'B', 'O', 'O', 'K', '0', '1'};
+constexpr size_t HeaderSize   = 16;  // BookMagic and the entry count
+
+}
+
+bool Book::open(const std::string& path) {
+
+    close();
+
+#ifndef _WIN32
+    struct stat statbuf;
+    int         fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    fstat(fd, &statbuf);
+
+    const size_t size = statbuf.st_size;
+
+    if (size < HeaderSize || (size - HeaderSize) % sizeof(Entry))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (view == MAP_FAILED)
+        return false;
+
+    base    = view;
+    mapping = size;
+#else
+    HANDLE fd = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+    if (fd == INVALID_HANDLE_VALUE)
+        return false;
+
+    DWORD        sizeHigh;
+    DWORD        sizeLow = GetFileSize(fd, &sizeHigh);
+    const size_t size    = (uint64_t(sizeHigh) << 32) | sizeLow;
+
+    if (size < HeaderSize || (size - HeaderSize) % sizeof(Entry))
+    {
+        CloseHandle(fd);
+        return false;
+    }
+
+    HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_READONLY, sizeHigh, sizeLow, nullptr);
+    CloseHandle(fd);
+
+    if (!mmap)
+        return false;
+
+    base    = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+    mapping = uint64_t(mmap);
+
+    if (!base)
+    {
+        CloseHandle(mmap);
+        return false;
+    }
+#endif
+
+    const char* data = static_cast<const char*>(base);
+    uint64_t    n;
+    std::memcpy(&n, data + sizeof(BookMagic), sizeof(n));
+
+    if (std::memcmp(data, BookMagic, sizeof(BookMagic)) || n != (size - HeaderSize) / sizeof(Entry))
+    {
+        close();
+        return false;
+    }
+
+    entries = reinterpret_cast<const Entry*>(data + HeaderSize);
+    count   = n;
+    return true;
+}
+
+void Book::close() {
+
+    if (!base)
+        return;
+
+#ifndef _WIN32
+    munmap(base, mapping);
+#else
+    UnmapViewOfFile(base);
+    CloseHandle((HANDLE) mapping);
+#endif
+
+    base    = nullptr;
+    entries = nullptr;
+    count   = 0;
+}
+
+// The first entry of the position with the given key, or nullptr
+const Book::Entry* Book::first(Key key) const {
+
+    const Entry* e = std::lower_bound(entries, entries + count, key,
+                                      [](const Entry& a, Key k) { return a.key < k; });
+
+    return e != entries + count && e->key == key ? e : nullptr;
+}
+
+const Book::Entry* Book::probe(const Position& pos) const {
+
+    const Entry* e = first(pos.key());
+
+    // Skip the moves which are not legal here, in case of a key collision
+    for (; e && e != entries + count && e->key == pos.key(); ++e)
+        if (pos.pseudo_legal(Move(e->move)) && pos.legal(Move(e->move)))
+            return e;
+
+    return nullptr;
+}
+
+size_t Book::seed(Position& pos, TranspositionTable& tt) const {
+
+    size_t stored = 0;
+
+    const auto store = [&](const Position& p) {
+        const Entry* e = probe(p);
+
+        if (!e || !e->depth)
+            return;
+
+        auto [ttHit, ttData, ttWriter] = tt.probe(p.key());
+        ttWriter.write(p.key(), Value(e->value), true, BOUND_EXACT, Depth(e->depth),
+                       Move(e->move), VALUE_NONE, tt.generation());
+        stored++;
+    };
+
+    store(pos);
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        StateInfo st;
+        pos.do_move(m, st);
+        store(pos);
+        pos.undo_move(m);
+    }
+
+    return stored;
+}
+
+std::string Book::build(const std::string& epdPath, const std::string& bookPath) {
+
+    std::ifstream in(epdPath);
+    if (!in)
+        return "Could not open " + epdPath;
+
+    std::vector<Entry> book;
+    std::string        line;
+    size_t             lines = 0, skipped = 0;
+
+    while (std::getline(in, line))
+    {
+        std::istringstream is(line);
+        std::string        fen, field, token, bm;
+        int                ce = 0, acd = 0;
+
+        // The four fields of an EPD position, then the opcodes
+        for (int i = 0; i < 4 && is >> field; ++i)
+            fen += field + " ";
+
+        if (fen.empty())
+            continue;
+
+        lines++;
+
+        while (is >> token)
+        {
+            std::string operand;
+            is >> operand;
+
+            if (!operand.empty() && operand.back() == ';')
+                operand.pop_back();
+
+            if (token == "bm")
+                bm = operand;
+            else if (token == "ce")
+                ce = std::atoi(operand.c_str());
+            else if (token == "acd")
+                acd = std::atoi(operand.c_str());
+        }
+
+        StateInfo st;
+        Position  pos;
+        pos.set(fen + "0 1", false, &st);
+
+        const Move m = UCIEngine::to_move(pos, bm);
+
+        if (m == Move::none())
+        {
+            skipped++;
+            continue;
+        }
+
+        Entry e;
+        e.key     = pos.key();
+        e.move    = m.raw();
+        e.weight  = 1;
+        e.value   = int16_t(UCIEngine::to_value(ce, pos));
+        e.depth   = uint8_t(std::clamp(acd, 0, MAX_PLY - 1));
+        e.padding = 0;
+        book.push_back(e);
+    }
+
+    // Repeated moves of a position add up their weights and keep the deepest result
+    std::sort(book.begin(), book.end(), [](const Entry& a, const Entry& b) {
+        return a.key != b.key   ? a.key < b.key
+             : a.move != b.move ? a.move < b.move
+                                : a.depth > b.depth;
+    });
+
+    size_t n = 0;
+    for (const Entry& e : book)
+        if (n && book[n - 1].key == e.key && book[n - 1].move == e.move)
+            book[n - 1].weight = uint16_t(std::min(book[n - 1].weight + 1, 65535));
+        else
+            book[n++] = e;
+    book.resize(n);
+
+    std::stable_sort(book.begin(), book.end(), [](const Entry& a, const Entry& b) {
+        return a.key != b.key ? a.key < b.key : a.weight > b.weight;
+    });
+
+    std::ofstream out(bookPath, std::ios::binary);
+    uint64_t      entryCount = book.size();
+
+    out.write(BookMagic, sizeof(BookMagic));
+    out.write(reinterpret_cast<const char*>(&entryCount), sizeof(entryCount));
+    out.write(reinterpret_cast<const char*>(book.data()), std::streamsize(n * sizeof(Entry)));
+
+    if (!out)
+        return "Could not write " + bookPath;
+
+    std::stringstream ss;
+    ss << "Wrote " << n << " book entries from " << lines << " positions to " << bookPath;
+    if (skipped)
+        ss << ", skipped " << skipped << " without a legal bm";
+    return ss.str();
+}
+
+}  // namespace Stockfish
@@ -0,0 +1,83 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOK_H_INCLUDED
+#define BOOK_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "types.h"
+
+namespace Stockfish {
+
+class Position;
+class TranspositionTable;
+
+// An opening book of stored search results. The file is a 16 byte header
+// followed by the entries sorted by Position::key(), and the entries of a
+// position by decreasing weight. It is memory mapped, so that the engines
+// of a server share one copy in the page cache, and it is looked up by a
+// binary search without any allocation.
+class Book {
+   public:
+    struct Entry {
+        Key      key;
+        uint16_t move;    // Move::raw()
+        uint16_t weight;  // How often the move was seen in the position
+        int16_t  value;   // From the side to move, with the search depth below
+        uint8_t  depth;
+        uint8_t  padding;
+    };
+    static_assert(sizeof(Entry) == 16, "Unexpected Entry size");
+
+    Book() = default;
+    ~Book() { close(); }
+
+    Book(const Book&)            = delete;
+    Book& operator=(const Book&) = delete;
+
+    bool   open(const std::string& path);
+    void   close();
+    size_t size() const { return count; }
+
+    // The entry with the highest weight whose move is legal in pos, or nullptr
+    const Entry* probe(const Position& pos) const;
+
+    // Stores the best entries of pos and of the positions after each of its
+    // legal moves in the TT, as exact results of a search of the stored depth.
+    // Returns the number of entries stored.
+    size_t seed(Position& pos, TranspositionTable& tt) const;
+
+    // Converts an EPD file with "bm" (in UCI notation), "ce" and "acd" opcodes
+    // into a book. Returns a summary or an error message.
+    static std::string build(const std::string& epdPath, const std::string& bookPath);
+
+   private:
+    const Entry* first(Key key) const;
+
+    const Entry* entries = nullptr;
+    size_t       count   = 0;
+    void*        base    = nullptr;
+    uint64_t     mapping = 0;
+};
+
+}  // namespace Stockfish
+
+#endif  // #ifndef BOOK_H_INCLUDED
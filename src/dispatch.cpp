@@ -0,0 +1,101 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Entry point of the fat binary built with `make fat`. The whole engine is
+// compiled once for every architecture in FATARCHS, each build living in its
+// own relocatable object where all symbols but its renamed main() are local.
+// At startup we pick the best build the host CPU supports, run the static
+// constructors of that build only (they may use its instruction set) and
+// hand over control to it.
+
+#include <iterator>
+
+#include "evaluate.h"
+#include "incbin/incbin.h"
+
+#if !defined(NNUE_EMBEDDING_OFF)
+INCBIN(EmbeddedNNUEBig, EvalFileDefaultNameBig);
+INCBIN(EmbeddedNNUESmall, EvalFileDefaultNameSmall);
+#endif
+
+using InitFunction = void (*)();
+
+// The Makefile renames the .init_array section of each build to fat_init_<arch>,
+// for which the linker provides the __start_ and __stop_ symbols.
+#define FAT_BUILD(arch) \
+    extern "C" InitFunction __start_fat_init_##arch[], __stop_fat_init_##arch[]; \
+    int                     fat_main_##arch(int argc, char* argv[])
+
+FAT_BUILD(x86_64_vnni256);
+FAT_BUILD(x86_64_avx512);
+FAT_BUILD(x86_64_bmi2);
+FAT_BUILD(x86_64_avx2);
+FAT_BUILD(x86_64_sse41_popcnt);
+FAT_BUILD(x86_64);
+
+namespace {
+
+struct Build {
+    bool supported;
+    int (*main)(int argc, char* argv[]);
+    InitFunction* initBegin;
+    InitFunction* initEnd;
+};
+
+#define FAT_ENTRY(arch, supported) \
+    Build { supported, fat_main_##arch, __start_fat_init_##arch, __stop_fat_init_##arch }
+
+// Same choice as scripts/get_native_properties.sh, best first. Zen 1 and Zen 2
+// implement pext in microcode, so the bmi2 build is slower there than avx2.
+Build select_build() {
+
+    __builtin_cpu_init();
+
+    const bool avx512   = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    const bool vnni512  = avx512 && __builtin_cpu_supports("avx512vnni")
+                      && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+    const bool slowPext = __builtin_cpu_is("znver1") || __builtin_cpu_is("znver2");
+    const bool bmi2     = !slowPext && __builtin_cpu_supports("bmi2");
+    const bool avx2     = __builtin_cpu_supports("avx2");
+    const bool sse41    = __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt");
+
+    const Build builds[] = {FAT_ENTRY(x86_64_vnni256, vnni512),
+                            FAT_ENTRY(x86_64_avx512, avx512),
+                            FAT_ENTRY(x86_64_bmi2, bmi2),
+                            FAT_ENTRY(x86_64_avx2, avx2),
+                            FAT_ENTRY(x86_64_sse41_popcnt, sse41),
+                            FAT_ENTRY(x86_64, true)};
+
+    for (const Build& build : builds)
+        if (build.supported)
+            return build;
+
+    return builds[std::size(builds) - 1];
+}
+
+}
+
+int main(int argc, char* argv[]) {
+
+    const Build build = select_build();
+
+    for (InitFunction* f = build.initBegin; f != build.initEnd; ++f)
+        (*f)();
+
+    return build.main(argc, argv);
+}
@@ -0,0 +1,483 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "distributed.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <utility>
+
+#include "position.h"
+#include "uci.h"
+
+#if !defined(_WIN32)
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+namespace Stockfish::Distributed {
+
+namespace {
+
+#if defined(MSG_NOSIGNAL)
+constexpr int SendFlags = MSG_NOSIGNAL;  // A lost peer must not kill the process
+#else
+constexpr int SendFlags = 0;
+#endif
+
+constexpr size_t EntriesPerLine = 256;
+
+static_assert(sizeof(TTExport) == 16, "Entries are sent as 16 bytes, nodes share endianness");
+
+// Parses the parts of an "info" line the master needs
+struct InfoLine {
+    Depth                    depth = 0;
+    std::string              scoreType;  // "cp" or "mate"
+    int                      score = 0;
+    bool                     bound = false, multiPV = false;
+    uint64_t                 nodes = 0;
+    std::vector<std::string> pv;
+
+    explicit InfoLine(const std::string& line) {
+        std::istringstream is(line);
+        std::string        token;
+
+        while (is >> token)
+            if (token == "depth")
+                is >> depth;
+            else if (token == "multipv")
+            {
+                int n;
+                is >> n;
+                multiPV = n > 1;
+            }
+            else if (token == "score")
+                is >> scoreType >> score;
+            else if (token == "lowerbound" || token == "upperbound")
+                bound = true;
+            else if (token == "nodes")
+                is >> nodes;
+            else if (token == "pv")
+                while (is >> token)
+                    pv.push_back(token);
+    }
+};
+
+}
+
+#if !defined(_WIN32)
+
+Connection::~Connection() { ::close(fd); }
+
+std::unique_ptr<Connection> Connection::connect(const std::string& address) {
+
+    const auto colon = address.rfind(':');
+    if (colon == std::string::npos)
+        return nullptr;
+
+    const std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+    addrinfo  hints{};
+    addrinfo* result = nullptr;
+
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result))
+        return nullptr;
+
+    int fd = -1;
+    for (addrinfo* a = result; a && fd < 0; a = a->ai_next)
+    {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen))
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0)
+        return nullptr;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return std::make_unique<Connection>(fd);
+}
+
+bool Connection::read_line(std::string& line) {
+
+    size_t end;
+    while ((end = pending.find('\n')) == std::string::npos)
+    {
+        char    buffer[1 << 16];
+        ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        pending.append(buffer, size_t(n));
+    }
+
+    line.assign(pending, 0, end);
+    pending.erase(0, end + 1);
+
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+
+    return true;
+}
+
+bool Connection::write(std::string_view data) {
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+
+    while (!data.empty())
+    {
+        ssize_t n = ::send(fd, data.data(), data.size(), SendFlags);
+        if (n <= 0)
+            return false;
+        data.remove_prefix(size_t(n));
+    }
+    return true;
+}
+
+void Connection::shutdown() { ::shutdown(fd, SHUT_RDWR); }
+
+Listener::Listener(const std::string& address, int port) {
+
+    addrinfo  hints{};
+    addrinfo* result = nullptr;
+
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+
+    if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &result))
+        return;
+
+    for (addrinfo* a = result; a && fd < 0; a = a->ai_next)
+    {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (::bind(fd, a->ai_addr, a->ai_addrlen) || ::listen(fd, 1))
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+}
+
+Listener::~Listener() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+std::unique_ptr<Connection> Listener::accept() {
+
+    int connectionFd = ::accept(fd, nullptr, nullptr);
+    if (connectionFd < 0)
+        return nullptr;
+
+    int one = 1;
+    setsockopt(connectionFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return std::make_unique<Connection>(connectionFd);
+}
+
+#else
+
+// Not implemented on Windows, see Supported: no node can be reached and none can listen
+Connection::~Connection() {}
+std::unique_ptr<Connection> Connection::connect(const std::string&) { return nullptr; }
+bool                        Connection::read_line(std::string&) { return false; }
+bool                        Connection::write(std::string_view) { return false; }
+void                        Connection::shutdown() {}
+Listener::Listener(const std::string&, int) {}
+Listener::~Listener() {}
+std::unique_ptr<Connection> Listener::accept() { return nullptr; }
+
+#endif
+
+int OutputBuffer::overflow(int c) {
+
+    if (c == traits_type::eof())
+        return traits_type::not_eof(c);
+
+    line += char(c);
+    if (c == '\n')
+    {
+        connection.write(line);
+        line.clear();
+    }
+    return c;
+}
+
+std::string encode_entries(const TTExport* entries, size_t count) {
+
+    constexpr char Digits[] = "0123456789abcdef";
+
+    const auto* bytes = reinterpret_cast<const unsigned char*>(entries);
+    std::string hex;
+
+    hex.reserve(2 * count * sizeof(TTExport));
+    for (size_t i = 0; i < count * sizeof(TTExport); ++i)
+    {
+        hex += Digits[bytes[i] >> 4];
+        hex += Digits[bytes[i] & 0xF];
+    }
+    return hex;
+}
+
+std::vector<TTExport> decode_entries(std::string_view hex) {
+
+    auto nibble = [](char c) { return c <= '9' ? c - '0' : c - 'a' + 10; };
+
+    std::vector<TTExport> entries(hex.size() / (2 * sizeof(TTExport)));
+    auto*                 bytes = reinterpret_cast<unsigned char*>(entries.data());
+
+    for (size_t i = 0; i < entries.size() * sizeof(TTExport); ++i)
+        bytes[i] = (nibble(hex[2 * i]) << 4) | nibble(hex[2 * i + 1]);
+
+    return entries;
+}
+
+Exchange::Exchange(std::function<std::vector<TTExport>()> take,
+                   std::function<void(const std::string&)> send) {
+
+    thread = std::thread([this, take, send]() {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (!cv.wait_for(lock, std::chrono::milliseconds(5), [&] { return done; }))
+        {
+            const auto entries = take();
+
+            for (size_t i = 0; i < entries.size(); i += EntriesPerLine)
+                send("tt "
+                     + encode_entries(&entries[i], std::min(EntriesPerLine, entries.size() - i))
+                     + "\n");
+        }
+    });
+}
+
+Exchange::~Exchange() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+Master::Master(TranspositionTable& transpositionTable, const std::string& addresses) :
+    tt(transpositionTable) {
+
+    std::istringstream is(addresses);
+    std::string        address;
+
+    while (std::getline(is, address, ','))
+    {
+        address.erase(std::remove(address.begin(), address.end(), ' '), address.end());
+        if (address.empty())
+            continue;
+
+        auto& node      = *nodes.emplace_back(std::make_unique<Node>());
+        node.address    = address;
+        node.connection = Connection::connect(address);
+    }
+
+    // Start receiving only once the list is complete, as received entries are
+    // relayed to all the other nodes.
+    for (auto& node : nodes)
+        if (node->connection)
+            node->receiver = std::thread([this, &node = *node]() { receive(node); });
+}
+
+Master::~Master() {
+
+    exchange.reset();
+
+    for (auto& node : nodes)
+        if (node->connection)
+        {
+            node->connection->write("quit\n");
+            node->connection->shutdown();
+            node->receiver.join();
+        }
+}
+
+std::string Master::status() const {
+
+    std::string str = "Distributed search with " + std::to_string(nodes.size()) + " node(s):";
+
+    for (auto& node : nodes)
+        str += " " + node->address + (node->connection ? " connected" : " unreachable");
+
+    return str;
+}
+
+void Master::send(const std::string& line) {
+    for (auto& node : nodes)
+        if (node->connection)
+            node->connection->write(line);
+}
+
+uint64_t Master::nodes_searched() const {
+
+    uint64_t sum = 0;
+    for (auto& node : nodes)
+        sum += node->nodes.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Master::receive(Node& node) {
+
+    std::string line;
+
+    while (node.connection->read_line(line))
+    {
+        if (line.compare(0, 3, "tt ") == 0)
+        {
+            tt.import_entries(decode_entries(std::string_view(line).substr(3)));
+
+            line += '\n';
+            for (auto& other : nodes)
+                if (other.get() != &node && other->connection)
+                    other->connection->write(line);
+        }
+        else if (line.compare(0, 11, "info depth ") == 0)
+        {
+            const InfoLine info(line);
+
+            if (info.nodes)
+                node.nodes = info.nodes;
+
+            if (!info.pv.empty() && !info.bound && !info.multiPV)
+            {
+                std::lock_guard<std::mutex> lock(node.mutex);
+                node.lastInfo = line;
+            }
+        }
+        else if (line.compare(0, 9, "bestmove ") == 0)
+        {
+            std::lock_guard<std::mutex> lock(node.mutex);
+            node.searching = false;
+            node.cv.notify_one();
+        }
+    }
+
+    // The node is gone, do not wait for it at the end of the search
+    std::lock_guard<std::mutex> lock(node.mutex);
+    node.searching = false;
+    node.cv.notify_one();
+}
+
+void Master::start_search(const std::string& position, const std::string& go, Depth exportDepth) {
+
+    for (auto& node : nodes)
+    {
+        std::lock_guard<std::mutex> lock(node->mutex);
+        node->nodes     = 0;
+        node->searching = node->connection != nullptr;
+        node->lastInfo.clear();
+    }
+
+    send(position + "\n" + go + "\n");
+
+    // Entries queued before this search were meant for nobody
+    tt.take_exports();
+    tt.set_export_depth(exportDepth);
+
+    exchange = std::make_unique<Exchange>([this]() { return tt.take_exports(); },
+                                          [this](const std::string& s) { send(s); });
+}
+
+bool Master::stop_search(const Position& rootPos, Search::RootMoves& rootMoves, Depth& depth) {
+
+    exchange.reset();
+    tt.set_export_depth(TranspositionTable::NoExport);
+
+    send("stop\n");
+
+    // Find the deepest line among the nodes which answer in time
+    std::string bestInfo;
+    Depth       bestDepth = depth;
+
+    for (auto& node : nodes)
+    {
+        std::unique_lock<std::mutex> lock(node->mutex);
+        node->cv.wait_for(lock, std::chrono::seconds(2), [&] { return !node->searching; });
+
+        if (!node->lastInfo.empty() && InfoLine(node->lastInfo).depth > bestDepth)
+        {
+            bestInfo  = node->lastInfo;
+            bestDepth = InfoLine(bestInfo).depth;
+        }
+    }
+
+    if (bestInfo.empty() || rootMoves[0].pv[0] == Move::none())
+        return false;
+
+    const InfoLine info(bestInfo);
+
+    // Replay the PV from the root, it is only kept up to the first move we do
+    // not find legal.
+    std::deque<StateInfo> states(1);
+    Position              pos;
+    std::vector<Move>     pv;
+
+    pos.set(rootPos.fen(), rootPos.is_chess960(), &states.back());
+
+    for (const auto& str : info.pv)
+    {
+        Move m = UCIEngine::to_move(pos, str);
+        if (m == Move::none())
+            break;
+
+        pv.push_back(m);
+        pos.do_move(m, states.emplace_back());
+    }
+
+    auto rm = pv.empty() ? rootMoves.end() : std::find(rootMoves.begin(), rootMoves.end(), pv[0]);
+    if (rm == rootMoves.end())
+        return false;
+
+    const Value score = info.scoreType == "mate"
+                        ? (info.score > 0 ? mate_in(2 * info.score - 1) : mated_in(-2 * info.score))
+                        : UCIEngine::to_value(info.score, rootPos);
+
+    rm->pv              = pv;
+    rm->score           = rm->uciScore = score;
+    rm->scoreLowerbound = rm->scoreUpperbound = false;
+    std::rotate(rootMoves.begin(), rm, rm + 1);
+
+    depth = bestDepth;
+    return true;
+}
+
+}  // namespace Stockfish::Distributed
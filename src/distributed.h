@@ -0,0 +1,175 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DISTRIBUTED_H_INCLUDED
+#define DISTRIBUTED_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "search.h"
+#include "tt.h"
+#include "types.h"
+
+namespace Stockfish {
+
+class Position;
+
+// Distributed search over plain TCP. Every node runs its usual Lazy SMP search
+// with its own threads and TT. The other nodes are started with the "cluster
+// <port>" command and then behave as a UCI engine driven over the connection:
+// the master forwards its position and runs "go infinite" on them for as long
+// as its own search lasts. While searching, all nodes send the TT entries they
+// write with at least ClusterTTDepth in batches of "tt <hex>" lines, which the
+// master also relays to the other nodes. The master adds the node counts of
+// the other nodes to its own and, at the end, adopts the line of a node which
+// completed a deeper iteration than itself. Only the master talks UCI.
+//
+// There is no authentication: a node only binds to the ClusterBind address,
+// the loopback interface by default, and only accepts the commands the master
+// sends, see UCIEngine::cluster().
+namespace Distributed {
+
+// Sockets are only implemented for POSIX systems
+constexpr bool Supported =
+#if defined(_WIN32)
+  false;
+#else
+  true;
+#endif
+
+// A TCP connection carrying newline terminated lines of text
+class Connection {
+   public:
+    explicit Connection(int socketFd) :
+        fd(socketFd) {}
+    ~Connection();
+
+    Connection(const Connection&)            = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Connects to "host:port", returns nullptr on failure
+    static std::unique_ptr<Connection> connect(const std::string& address);
+
+    bool read_line(std::string& line);
+    bool write(std::string_view data);  // Safe to call from several threads
+    void shutdown();                    // Makes a pending read_line() fail
+
+   private:
+    int         fd;
+    std::string pending;
+    std::mutex  writeMutex;
+};
+
+// The socket on which a node waits for its master. The address is a host name
+// or a numeric IPv4 or IPv6 address of a local interface.
+class Listener {
+   public:
+    Listener(const std::string& address, int port);
+    ~Listener();
+
+    bool                        is_open() const { return fd >= 0; }
+    std::unique_ptr<Connection> accept();
+
+   private:
+    int fd = -1;
+};
+
+// Stream buffer sending what is written to it over a connection, line by line
+class OutputBuffer: public std::streambuf {
+   public:
+    explicit OutputBuffer(Connection& c) :
+        connection(c) {}
+
+   protected:
+    int overflow(int c) override;
+
+   private:
+    Connection& connection;
+    std::string line;
+};
+
+std::string           encode_entries(const TTExport* entries, size_t count);
+std::vector<TTExport> decode_entries(std::string_view hex);
+
+// Sends the entries queued for export by the local search every few milliseconds
+class Exchange {
+   public:
+    Exchange(std::function<std::vector<TTExport>()> take,
+             std::function<void(const std::string&)> send);
+    ~Exchange();
+
+   private:
+    std::mutex              mutex;
+    std::condition_variable cv;
+    bool                    done = false;
+    std::thread             thread;
+};
+
+// The connections of the master to the other nodes
+class Master {
+   public:
+    // addresses is a comma separated list of host:port
+    Master(TranspositionTable& tt, const std::string& addresses);
+    ~Master();
+
+    std::string status() const;
+
+    void start_search(const std::string& position, const std::string& go, Depth exportDepth);
+
+    // Stops the other nodes. When one of them completed a deeper iteration than
+    // depth, its line replaces the best one of rootMoves and depth is updated.
+    bool stop_search(const Position& rootPos, Search::RootMoves& rootMoves, Depth& depth);
+
+    void     send(const std::string& line);  // To all the nodes
+    uint64_t nodes_searched() const;
+
+   private:
+    struct Node {
+        std::string                 address;
+        std::unique_ptr<Connection> connection;
+        std::thread                 receiver;
+        std::atomic<uint64_t>       nodes{0};
+
+        std::mutex              mutex;
+        std::condition_variable cv;
+        bool                    searching = false;
+        std::string             lastInfo;  // Last "info depth" line with an exact PV
+    };
+
+    void receive(Node& node);
+
+    TranspositionTable&                tt;
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::unique_ptr<Exchange>          exchange;
+};
+
+}  // namespace Distributed
+
+}  // namespace Stockfish
+
+#endif  // #ifndef DISTRIBUTED_H_INCLUDED
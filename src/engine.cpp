@@ -19,9 +19,11 @@
 #include "engine.h"
 
 #include <cassert>
-#include <deque>
+#include <iomanip>
 #include <iosfwd>
 #include <memory>
+#include <numeric>
+#include <set>
 #include <ostream>
 #include <sstream>
 #include <string_view>
@@ -30,7 +32,10 @@
 
 #include "evaluate.h"
 #include "misc.h"
+#include "movegen.h"
+#include "movepick.h"
 #include "nnue/network.h"
+#include "nnue/nnue_accumulator.h"
 #include "nnue/nnue_common.h"
 #include "perft.h"
 #include "position.h"
@@ -47,76 +52,225 @@ namespace NN = Eval::NNUE;
 constexpr auto StartFEN  = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 constexpr int  MaxHashMB = Is64Bit ? 33554432 : 2048;
 
-Engine::Engine(std::string path) :
+namespace {
+
+// Combo values are matched without regard to case, so compare through the option
+Tablebases::Preload tablebase_preload(const Option& o) {
+    return o == "all" ? Tablebases::Preload::All
+         : o == "wdl" ? Tablebases::Preload::WDL
+                      : Tablebases::Preload::None;
+}
+
+}
+
+Engine::Engine(std::string path, const Engine* shareWith) :
     binaryDirectory(CommandLine::get_binary_directory(path)),
-    numaContext(NumaConfig::from_system()),
-    states(new std::deque<StateInfo>(1)),
+    numaContext(shareWith ? shareWith->numaContext
+                          : std::make_shared<NumaReplicationContext>(NumaConfig::from_system())),
+    states(std::make_unique<StateList>(1)),
     threads(),
-    networks(
-      numaContext,
-      NN::Networks(
-        NN::NetworkBig({EvalFileDefaultNameBig, "None", ""}, NN::EmbeddedNNUEType::BIG),
-        NN::NetworkSmall({EvalFileDefaultNameSmall, "None", ""}, NN::EmbeddedNNUEType::SMALL))) {
+    networks(shareWith
+               ? shareWith->networks
+               : std::make_shared<NumaReplicated<NN::Networks>>(
+                   *numaContext,
+                   NN::Networks(
+                     NN::NetworkBig({EvalFileDefaultNameBig, "None", ""},
+                                    NN::EmbeddedNNUEType::BIG),
+                     NN::NetworkSmall({EvalFileDefaultNameSmall, "None", ""},
+                                      NN::EmbeddedNNUEType::SMALL)))),
+    sharedHistories(*numaContext),
+    host(shareWith) {
     pos.set(StartFEN, false, &states->back());
-    capSq = SQ_NONE;
+    capSq       = SQ_NONE;
+    positionFen = StartFEN;
 
     options["Debug Log File"] << Option("", [](const Option& o) {
         start_logger(o);
         return std::nullopt;
     });
 
-    options["NumaPolicy"] << Option("auto", [this](const Option& o) {
-        set_numa_config_from_option(o);
-        return numa_config_information_as_string() + "\n" + thread_binding_information_as_string();
+    // With a host, the policy only decides whether our threads are bound, the NUMA
+    // configuration itself is the one of the host.
+    const std::string numaPolicy = host ? std::string(host->options["NumaPolicy"]) : "auto";
+
+    options["NumaPolicy"] << Option(numaPolicy.c_str(), [this](const Option& o) {
+        if (host)
+            resize_threads();
+        else if (auto error = set_numa_config_from_option(o))
+            return error;
+        return std::optional<std::string>(numa_config_information_as_string() + "\n"
+                                          + thread_binding_information_as_string() + "\n"
+                                          + network_memory_information_as_string());
+    });
+
+    options["NumaHash"] << Option(false, [this](const Option&) {
+        set_tt_size(options["Hash"]);
+        return std::nullopt;
     });
 
     options["Threads"] << Option(1, 1, 1024, [this](const Option&) {
-        resize_threads();
-        return thread_binding_information_as_string();
+        if (auto error = resize_threads())
+            return error;
+        return std::optional<std::string>(thread_binding_information_as_string());
     });
 
     options["Hash"] << Option(16, 1, MaxHashMB, [this](const Option& o) {
-        set_tt_size(o);
-        return std::nullopt;
+        if (auto warning = set_tt_size(o))
+            return warning;
+        return options["HugePages"] == "auto"
+               ? std::nullopt
+               : std::optional<std::string>(tt_information_as_string());
+    });
+
+    options["MemoryBudget"] << Option(0, 0, MaxHashMB, [this](const Option&) {
+        return set_tt_size(options["Hash"]);
+    });
+
+    options["HugePages"] << Option("auto var auto var 2MB var 1GB", "auto", [this](const Option&) {
+        auto warning = set_tt_size(options["Hash"]);
+        return std::optional<std::string>((warning ? *warning + "\n" : "")
+                                          + tt_information_as_string());
+    });
+
+    options["HugePagesRequired"] << Option(false, [this](const Option&) {
+        auto warning = set_tt_size(options["Hash"]);
+        return std::optional<std::string>((warning ? *warning + "\n" : "")
+                                          + tt_information_as_string());
     });
 
     options["Clear Hash"] << Option([this](const Option&) {
         search_clear();
         return std::nullopt;
     });
+    options["AnalysisAging"] << Option(false, [this](const Option& o) {
+        wait_for_search_finished();
+        tt.set_path_aging(o);
+        return std::nullopt;
+    });
+    options["EvalCache"] << Option(0, 0, 65536, [this](const Option& o) {
+        wait_for_search_finished();
+        threads.resize_eval_caches(size_t(o));
+        return std::nullopt;
+    });
+    options["PrefetchDistance"] << Option(0, 0, Search::Worker::MaxPrefetchDistance);
     options["Ponder"] << Option(false);
     options["MultiPV"] << Option(1, 1, MAX_MOVES);
+    options["MultiPVOnePass"] << Option(false);
+    options["SplitRootMoves"] << Option(false);  // Analysis only, see ThreadPool::start_thinking()
+    options["DeterministicSMP"] << Option(false);
+    options["SharedHistory"] << Option(false);  // Ignored with DeterministicSMP
+    options["IdleSpin"] << Option(0, 0, 100000);
+    options["AsyncOutput"] << Option(false);
+    options["InfoInterval"] << Option(0, 0, 10000);
+    options["ClusterNodes"] << Option("", [this](const Option& o) {
+        wait_for_search_finished();
+        threads.cluster = nullptr;
+        cluster.reset();
+
+        if (std::string(o).empty())
+            return std::optional<std::string>();
+
+        if (!Distributed::Supported)
+            return std::optional<std::string>(
+              "Distributed search is not supported on this platform");
+
+        cluster         = std::make_unique<Distributed::Master>(tt, o);
+        threads.cluster = cluster.get();
+        return std::optional<std::string>(cluster->status());
+    });
+    options["ClusterTTDepth"] << Option(10, 1, MAX_PLY);
+    options["ClusterBind"] << Option("127.0.0.1");  // Interface the cluster command listens on
+    options["BookFile"] << Option("", [this](const Option& o) {
+        wait_for_search_finished();
+        book.close();
+
+        if (std::string(o).empty())
+            return std::optional<std::string>();
+
+        if (!book.open(o))
+            return std::optional<std::string>("Could not open book " + std::string(o));
+
+        return std::optional<std::string>("Book of " + std::to_string(book.size())
+                                          + " entries");
+    });
+    options["BookPreseed"] << Option(false);
     options["Skill Level"] << Option(20, 0, 20);
     options["Move Overhead"] << Option(10, 0, 5000);
     options["nodestime"] << Option(0, 0, 10000);
+    options["LatencySLA"] << Option(0, 0, 1000000);  // Hard, even before depth 1 completes
+    options["TMLog"] << Option("");
+    options["SearchTrace"] << Option("", [](const Option& o) {
+        if (!Search::SearchTrace::Enabled && !std::string(o).empty())
+            return std::optional<std::string>(
+              "Search tracing is not available, build with trace=yes");
+        return std::optional<std::string>();
+    });
+    options["SearchTraceRate"] << Option(1024, 1, 1 << 20);
     options["UCI_Chess960"] << Option(false);
     options["UCI_LimitStrength"] << Option(false);
     options["UCI_Elo"] << Option(1320, 1320, 3190);
     options["UCI_ShowWDL"] << Option(false);
-    options["SyzygyPath"] << Option("<empty>", [](const Option& o) {
-        Tablebases::init(o);
-        return std::nullopt;
-    });
     options["SyzygyProbeDepth"] << Option(1, 1, 100);
     options["Syzygy50MoveRule"] << Option(true);
     options["SyzygyProbeLimit"] << Option(7, 0, 7);
-    options["EvalFile"] << Option(EvalFileDefaultNameBig, [this](const Option& o) {
-        load_big_network(o);
-        return std::nullopt;
-    });
-    options["EvalFileSmall"] << Option(EvalFileDefaultNameSmall, [this](const Option& o) {
-        load_small_network(o);
-        return std::nullopt;
-    });
 
-    load_networks();
+    // Tablebases and networks belong to the host, only the host can change them
+    if (!host)
+    {
+        options["SyzygyPath"] << Option("<empty>", [this](const Option& o) {
+            Tablebases::init(o, tablebase_preload(options["SyzygyPreload"]));
+            return std::nullopt;
+        });
+        options["SyzygyPreload"] << Option("none var none var wdl var all", "none",
+                                           [this](const Option& o) {
+                                               Tablebases::init(options["SyzygyPath"],
+                                                                tablebase_preload(o));
+                                               return std::nullopt;
+                                           });
+        options["SyzygyBlockCache"] << Option(0, 0, 1024, [](const Option& o) {
+            const size_t blocks = Tablebases::set_block_cache_size(o);
+
+            if (!blocks)
+                return std::optional<std::string>();
+            return std::optional<std::string>("Syzygy block cache of " + std::to_string(blocks)
+                                              + " decoded blocks per thread");
+        });
+        options["SyzygyIO"] << Option("mmap var mmap var pread", "mmap", [this](const Option& o) {
+            Tablebases::set_read_blocks(o == "pread");
+            Tablebases::init(options["SyzygyPath"], tablebase_preload(options["SyzygyPreload"]));
+            return std::nullopt;
+        });
+        options["SyzygyWDLCache"] << Option(0, 0, 1024, [this](const Option& o) {
+            wait_for_search_finished();
+            Tablebases::set_wdl_cache_size(o);
+            return std::nullopt;
+        });
+        options["EvalFile"] << Option(EvalFileDefaultNameBig, [this](const Option& o) {
+            load_big_network(o);
+            return std::nullopt;
+        });
+        options["EvalFileSmall"] << Option(EvalFileDefaultNameSmall, [this](const Option& o) {
+            load_small_network(o);
+            return std::nullopt;
+        });
+        options["NumaNetworks"] << Option("all var all var transformer var none", "all",
+                                          [this](const Option& o) {
+                                              set_network_replication(o);
+                                              return network_memory_information_as_string();
+                                          });
+
+        load_networks();
+    }
+
     resize_threads();
 }
 
-std::uint64_t Engine::perft(const std::string& fen, Depth depth, bool isChess960) {
+std::uint64_t Engine::perft(
+  const std::string& fen, Depth depth, bool isChess960, size_t threadCount, size_t hashMB) {
     verify_networks();
+    wait_for_search_finished();
 
-    return Benchmark::perft(fen, depth, isChess960);
+    return Benchmark::perft(fen, depth, isChess960, threads, threadCount, hashMB);
 }
 
 void Engine::go(Search::LimitsType& limits) {
@@ -124,6 +278,36 @@ void Engine::go(Search::LimitsType& limits) {
     verify_networks();
     limits.capSq = capSq;
 
+    // A book move is played at once in games, where the search would have been
+    // limited by time. Otherwise the book can still give the TT its stored results.
+    if (book.size() && (limits.use_time_management() || limits.movetime) && !limits.ponderMode
+        && limits.searchmoves.empty())
+        if (const Book::Entry* e = book.probe(pos))
+        {
+            updateContext.onBestmove(UCIEngine::move(Move(e->move), pos.is_chess960()), "");
+            return;
+        }
+
+    if (book.size() && options["BookPreseed"])
+        book.seed(pos, tt);
+
+    if (cluster)
+    {
+        std::string position = "position fen " + positionFen, go = "go infinite";
+
+        if (!positionMoves.empty())
+            position += " moves";
+        for (Move m : positionMoves)
+            position += " " + UCIEngine::move(m, pos.is_chess960());
+
+        if (!limits.searchmoves.empty())
+            go += " searchmoves";
+        for (const auto& move : limits.searchmoves)
+            go += " " + move;
+
+        cluster->start_search(position, go, int(options["ClusterTTDepth"]));
+    }
+
     threads.start_thinking(options, pos, states, limits);
 }
 void Engine::stop() { threads.stop = true; }
@@ -134,8 +318,13 @@ void Engine::search_clear() {
     tt.clear(threads);
     threads.clear();
 
-    // @TODO wont work with multiple instances
-    Tablebases::init(options["SyzygyPath"]);  // Free mapped files
+    if (cluster)
+        cluster->send("ucinewgame\n");
+
+    // Tablebases are global, other instances sharing this process may be probing them.
+    // Preloaded files stay mapped, reading them again for every game defeats the point.
+    if (!host && options["SyzygyPreload"] == "none")
+        Tablebases::init(options["SyzygyPath"]);  // Free mapped files
 }
 
 void Engine::set_on_update_no_moves(std::function<void(const Engine::InfoShort&)>&& f) {
@@ -157,64 +346,214 @@ void Engine::set_on_bestmove(std::function<void(std::string_view, std::string_vi
 void Engine::wait_for_search_finished() { threads.main_thread()->wait_for_search_finished(); }
 
 void Engine::set_position(const std::string& fen, const std::vector<std::string>& moves) {
-    // Drop the old state and create a new one
-    states = StateListPtr(new std::deque<StateInfo>(1));
-    pos.set(fen, options["UCI_Chess960"], &states->back());
+    // Reuse the states of the last search, it does not read them anymore
+    if (!states)
+        states = threads.release_setup_states();
 
-    capSq = SQ_NONE;
-    for (const auto& move : moves)
+    const bool chess960 = options["UCI_Chess960"];
+    size_t     common   = 0;
+
+    if (states && fen == positionFen && pos.is_chess960() == chess960
+        && states->size() == positionMoves.size() + 1)
+    {
+        while (common < positionMoves.size() && common < moves.size()
+               && UCIEngine::to_lower(moves[common])
+                    == UCIEngine::move(positionMoves[common], chess960))
+            ++common;
+
+        // Take back the moves after the last common one, usually none
+        while (positionMoves.size() > common)
+        {
+            pos.undo_move(positionMoves.back());
+            positionMoves.pop_back();
+        }
+        states->resize(common + 1);
+    }
+    else
     {
-        auto m = UCIEngine::to_move(pos, move);
+        if (!states)
+            states = std::make_unique<StateList>();
+
+        states->resize(1);
+        pos.set(fen, chess960, &states->back());
+
+        positionFen = fen;
+        positionMoves.clear();
+    }
+
+    // Only make the moves we do not have yet
+    for (size_t i = common; i < moves.size(); ++i)
+    {
+        auto m = UCIEngine::to_move(pos, moves[i]);
 
         if (m == Move::none())
             break;
 
-        states->emplace_back();
-        pos.do_move(m, states->back());
+        pos.do_move(m, states->emplace_back());
+        positionMoves.push_back(m);
+    }
 
-        capSq          = SQ_NONE;
+    capSq = SQ_NONE;
+    if (!positionMoves.empty())
+    {
         DirtyPiece& dp = states->back().dirtyPiece;
         if (dp.dirty_num > 1 && dp.to[1] == SQ_NONE)
-            capSq = m.to_sq();
+            capSq = positionMoves.back().to_sq();
     }
 }
 
 // modifiers
 
-void Engine::set_numa_config_from_option(const std::string& o) {
+std::optional<std::string> Engine::set_numa_config_from_option(const std::string& o) {
+    NumaConfig config;
+
     if (o == "auto" || o == "system")
     {
-        numaContext.set_numa_config(NumaConfig::from_system());
+        config = NumaConfig::from_system();
     }
     else if (o == "hardware")
     {
         // Don't respect affinity set in the system.
-        numaContext.set_numa_config(NumaConfig::from_system(false));
+        config = NumaConfig::from_system(false);
     }
-    else if (o == "none")
+    else if (o != "none")
     {
-        numaContext.set_numa_config(NumaConfig{});
+        config = NumaConfig::from_string(o);
     }
-    else
+
+    // Keep the current config if its copies of the networks leave less than 1 MB for the hash
+    const size_t budget = size_t(options["MemoryBudget"]) * 1024 * 1024;
+
+    if (budget)
     {
-        numaContext.set_numa_config(NumaConfig::from_string(o));
+        size_t total = 0;
+        for (const auto& [part, bytes] : memory_usage(threads.num_threads(), 1024 * 1024, config))
+            total += bytes;
+
+        if (total > budget)
+        {
+            if (options.count("NumaPolicy"))
+                options["NumaPolicy"].currentValue = appliedNumaPolicy;
+
+            return "ERROR: The networks for " + std::to_string(config.num_numa_nodes())
+                 + " NUMA nodes do not fit in the MemoryBudget of "
+                 + std::string(options["MemoryBudget"]) + " MB, keeping NumaPolicy "
+                 + appliedNumaPolicy;
+        }
     }
 
+    appliedNumaPolicy = o;
+    numaContext->set_numa_config(std::move(config));
+
     // Force reallocation of threads in case affinities need to change.
-    resize_threads();
+    return resize_threads();
+}
+
+// Which parts of the networks each NUMA node gets a copy of: everything, only the
+// feature transformers, which take most of the memory bandwidth of the evaluation,
+// or nothing. Without copies the feature transformers are interleaved over the nodes.
+void Engine::set_network_replication(const Option& mode) {
+    wait_for_search_finished();
+
+    const bool                    copyTransformer = mode != "none";
+    const bool                    copyLayers      = mode == "all";
+    const NumaReplicationContext* ctx             = numaContext.get();
+
+    networks->set_replicator(
+      [=](const NN::Networks& source, NumaIndex, const NN::Networks* first) {
+          if (first && !copyTransformer)
+              return NN::Networks(first->big.replica(false, false),
+                                  first->small.replica(false, false));
+
+          NN::Networks copy(source.big.replica(copyTransformer, copyLayers),
+                            source.small.replica(copyTransformer, copyLayers));
+
+          if (!copyTransformer)
+          {
+              const NumaConfig& cfg        = ctx->get_numa_config();
+              const auto        interleave = [&cfg](void* dst, const void* src, size_t size) {
+                  cfg.copy_interleaved(dst, src, size);
+              };
+
+              copy.big.relocate_transformer(interleave);
+              copy.small.relocate_transformer(interleave);
+          }
+
+          return copy;
+      });
 }
 
-void Engine::resize_threads() {
+std::optional<std::string> Engine::resize_threads() {
     threads.wait_for_search_finished();
-    threads.set(numaContext.get_numa_config(), {options, threads, tt, networks}, updateContext);
+
+    // Keep the current threads if the new ones leave less than 1 MB for the hash
+    const size_t budget = size_t(options["MemoryBudget"]) * 1024 * 1024;
+
+    if (budget && threads.num_threads())
+    {
+        size_t total = 0;
+        for (const auto& [part, bytes] : memory_usage(size_t(options["Threads"]), 1024 * 1024,
+                                                      numaContext->get_numa_config()))
+            total += bytes;
+
+        if (total > budget)
+        {
+            const std::string error =
+              "ERROR: " + std::to_string(size_t(options["Threads"]))
+              + " threads do not fit in the MemoryBudget of " + std::string(options["MemoryBudget"])
+              + " MB, keeping " + std::to_string(threads.num_threads()) + " threads";
+
+            // The option already holds the refused value, show the kept one instead
+            options["Threads"].currentValue = std::to_string(threads.num_threads());
+            return error;
+        }
+    }
+
+    threads.set(numaContext->get_numa_config(), {options, threads, tt, *networks, sharedHistories},
+                updateContext);
 
     // Reallocate the hash with the new threadpool size
-    set_tt_size(options["Hash"]);
+    return set_tt_size(options["Hash"]);
 }
 
-void Engine::set_tt_size(size_t mb) {
+std::optional<std::string> Engine::set_tt_size(size_t mb) {
     wait_for_search_finished();
-    tt.resize(mb, threads);
+
+    // The table gets what the MemoryBudget leaves, at least 1 MB
+    const size_t               MB     = 1024 * 1024;
+    const size_t               budget = size_t(options["MemoryBudget"]) * MB;
+    std::optional<std::string> warning;
+
+    if (budget)
+    {
+        size_t others = 0;
+        for (const auto& [part, bytes] :
+             memory_usage(threads.num_threads(), 0, numaContext->get_numa_config()))
+            others += bytes;
+
+        const size_t available = budget > others ? (budget - others) / MB : 0;
+
+        if (mb > std::max<size_t>(available, 1))
+        {
+            warning = (available ? "Hash reduced to " + std::to_string(available) + " MB"
+                                 : std::string("ERROR: Hash reduced to 1 MB"))
+                    + " to fit the MemoryBudget of " + std::string(options["MemoryBudget"])
+                    + " MB, see the memory command";
+            mb = std::max<size_t>(available, 1);
+        }
+    }
+
+    // With explicit huge pages, the table comes from the huge page pool of the system
+    const size_t pageSize = options["HugePages"] == "2MB" ? 2 * 1024 * 1024
+                          : options["HugePages"] == "1GB" ? 1024 * 1024 * 1024
+                                                          : 0;
+
+    if (!tt.resize(mb, threads, options["NumaHash"], pageSize, options["HugePagesRequired"]))
+        warning = (warning ? *warning + "\n" : "") + "ERROR: Not enough "
+                + std::string(options["HugePages"]) + " huge pages for a " + std::to_string(mb)
+                + " MB hash, using normal pages";
+
+    return warning;
 }
 
 void Engine::set_ponderhit(bool b) { threads.main_manager()->ponder = b; }
@@ -222,47 +561,179 @@ void Engine::set_ponderhit(bool b) { threads.main_manager()->ponder = b; }
 // network related
 
 void Engine::verify_networks() const {
-    networks->big.verify(options["EvalFile"]);
-    networks->small.verify(options["EvalFileSmall"]);
+    // The networks of the host cannot change while it hosts us, so they are reported once
+    if (host)
+    {
+        if (!hostNetworksVerified)
+            host->verify_networks();
+        hostNetworksVerified = true;
+        return;
+    }
+
+    (*networks)->big.verify(options["EvalFile"]);
+    (*networks)->small.verify(options["EvalFileSmall"]);
 }
 
 void Engine::load_networks() {
-    networks.modify_and_replicate([this](NN::Networks& networks_) {
+    networks->modify_and_replicate([this](NN::Networks& networks_) {
         networks_.big.load(binaryDirectory, options["EvalFile"]);
         networks_.small.load(binaryDirectory, options["EvalFileSmall"]);
     });
     threads.clear();
 }
 
+// The new net is read aside, while the current one is untouched, and then swapped in.
+// Threads are kept and only the refresh caches of the replaced net are invalidated.
 void Engine::load_big_network(const std::string& file) {
-    networks.modify_and_replicate(
-      [this, &file](NN::Networks& networks_) { networks_.big.load(binaryDirectory, file); });
-    threads.clear();
+    NN::NetworkBig network({EvalFileDefaultNameBig, "None", ""}, NN::EmbeddedNNUEType::BIG);
+    network.load(binaryDirectory, file);
+
+    networks->modify_and_replicate(
+      [&network](NN::Networks& networks_) { networks_.big = std::move(network); });
+    threads.clear_refresh_tables(true);
 }
 
 void Engine::load_small_network(const std::string& file) {
-    networks.modify_and_replicate(
-      [this, &file](NN::Networks& networks_) { networks_.small.load(binaryDirectory, file); });
-    threads.clear();
+    NN::NetworkSmall network({EvalFileDefaultNameSmall, "None", ""}, NN::EmbeddedNNUEType::SMALL);
+    network.load(binaryDirectory, file);
+
+    networks->modify_and_replicate(
+      [&network](NN::Networks& networks_) { networks_.small = std::move(network); });
+    threads.clear_refresh_tables(false);
 }
 
 void Engine::save_network(const std::pair<std::optional<std::string>, std::string> files[2]) {
-    networks.modify_and_replicate([&files](NN::Networks& networks_) {
+    if (host)
+    {
+        sync_cout << "info string Networks are shared, export them from the hosting engine"
+                  << sync_endl;
+        return;
+    }
+
+    networks->modify_and_replicate([&files](NN::Networks& networks_) {
         networks_.big.save(files[0].first);
         networks_.small.save(files[1].first);
     });
 }
 
+void Engine::save_network_image(
+  const std::pair<std::optional<std::string>, std::string> files[2]) {
+    (*networks)->big.save_image(files[0].first);
+    (*networks)->small.save_image(files[1].first);
+}
+
+void Engine::save_hash(const std::string& file) {
+    wait_for_search_finished();
+
+    sync_cout << (tt.save(file) ? "Hash saved successfully to " + file : "Failed to save hash")
+              << sync_endl;
+}
+
+void Engine::set_tt_export_depth(Depth d) { tt.set_export_depth(d); }
+
+std::vector<TTExport> Engine::take_tt_exports() { return tt.take_exports(); }
+
+void Engine::import_tt_entries(const std::vector<TTExport>& entries) { tt.import_entries(entries); }
+
+void Engine::load_hash(const std::string& file) {
+    wait_for_search_finished();
+
+    sync_cout << (tt.load(file) ? "Hash loaded successfully from " + file
+                                : "Failed to load hash. "
+                                  "The snapshot must be saved with the same Hash size")
+              << sync_endl;
+}
+
 // utility functions
 
 void Engine::trace_eval() const {
-    StateListPtr trace_states(new std::deque<StateInfo>(1));
-    Position     p;
+    StateListPtr                  trace_states = std::make_unique<StateList>(1);
+    std::vector<AccumulatorState> accumulators(1);
+    Position                      p;
+    p.set_accumulators(accumulators.data(), accumulators.size());
     p.set(pos.fen(), options["UCI_Chess960"], &trace_states->back());
 
     verify_networks();
 
-    sync_cout << "\n" << Eval::trace(p, *networks) << sync_endl;
+    sync_cout << "\n" << Eval::trace(p, **networks) << sync_endl;
+}
+
+std::string Engine::nnue_benchmark_as_string(const std::vector<std::string>& fens,
+                                             size_t                          rounds) const {
+
+    // Each position after a move keeps its own states, with the accumulators of
+    // the position before the move computed
+    struct Sample {
+        StateInfo        states[2];
+        AccumulatorState accumulators[2];
+        Position         pos;
+    };
+
+    verify_networks();
+
+    auto caches = std::make_unique<Eval::NNUE::AccumulatorCaches>(**networks);
+
+    std::vector<std::unique_ptr<Sample>> samples;
+    std::vector<Position*>               positions;
+
+    for (const auto& fen : fens)
+    {
+        StateInfo st;
+        Position  p;
+        p.set(fen, options["UCI_Chess960"], &st);
+
+        for (const auto& m : MoveList<LEGAL>(p))
+        {
+            auto& s = *samples.emplace_back(std::make_unique<Sample>());
+
+            s.pos.set_accumulators(s.accumulators, 2);
+            s.pos.set(fen, options["UCI_Chess960"], &s.states[0]);
+            (*networks)->big.hint_common_access(s.pos, &caches->big);
+            (*networks)->small.hint_common_access(s.pos, &caches->small);
+            s.pos.do_move(m, s.states[1]);
+            positions.push_back(&s.pos);
+        }
+    }
+
+    const auto big   = (*networks)->big.time_stages(positions, rounds, &caches->big);
+    const auto small = (*networks)->small.time_stages(positions, rounds, &caches->small);
+
+    // The batched evaluation must agree with evaluate(), whatever kernels it uses
+    std::vector<Eval::NNUE::NetworkOutput> outputs(positions.size());
+    size_t                                 mismatches = 0;
+
+    (*networks)->big.evaluate_batch(positions.data(), positions.size(), &caches->big,
+                                    outputs.data());
+    for (size_t i = 0; i < positions.size(); ++i)
+        mismatches += outputs[i] != (*networks)->big.evaluate(*positions[i], &caches->big);
+
+    (*networks)->small.evaluate_batch(positions.data(), positions.size(), &caches->small,
+                                      outputs.data());
+    for (size_t i = 0; i < positions.size(); ++i)
+        mismatches += outputs[i] != (*networks)->small.evaluate(*positions[i], &caches->small);
+
+    std::stringstream ss;
+    ss << "NNUE positions : " << fens.size() << " positions, " << positions.size()
+       << " moves, " << rounds << " rounds" << std::fixed;
+
+    for (const auto& [net, timings] : {std::pair{"big", &big}, std::pair{"small", &small}})
+        for (const auto& t : *timings)
+        {
+            ss << "\nNNUE " << std::left << std::setw(5) << net << " " << std::setw(20) << t.name
+               << std::right << std::setprecision(1) << std::setw(8) << t.ns << " ns/call";
+
+            if (t.bytes)
+                ss << std::setw(8) << (t.ns > 0 ? t.bytes / t.ns : 0) << " GB/s";
+
+            if (t.instructions > 0)
+                ss << std::setprecision(0) << std::setw(8) << t.instructions
+                   << " instructions/call";
+        }
+
+    ss << "\nNNUE batch check : " << mismatches << " of " << 2 * positions.size()
+       << " batched evaluations differ from evaluate()";
+
+    return ss.str();
 }
 
 const OptionsMap& Engine::get_options() const { return options; }
@@ -270,7 +741,18 @@ OptionsMap&       Engine::get_options() { return options; }
 
 std::string Engine::fen() const { return pos.fen(); }
 
-void Engine::flip() { pos.flip(); }
+std::pair<std::string, std::vector<std::string>> Engine::get_position() const {
+    std::vector<std::string> moves;
+    for (Move m : positionMoves)
+        moves.push_back(UCIEngine::move(m, pos.is_chess960()));
+    return {positionFen, moves};
+}
+
+void Engine::flip() {
+    pos.flip();
+    positionFen = pos.fen();
+    positionMoves.clear();
+}
 
 std::string Engine::visualize() const {
     std::stringstream ss;
@@ -280,7 +762,7 @@ std::string Engine::visualize() const {
 
 std::vector<std::pair<size_t, size_t>> Engine::get_bound_thread_count_by_numa_node() const {
     auto                                   counts = threads.get_bound_thread_count_by_numa_node();
-    const NumaConfig&                      cfg    = numaContext.get_numa_config();
+    const NumaConfig&                      cfg    = numaContext->get_numa_config();
     std::vector<std::pair<size_t, size_t>> ratios;
     NumaIndex                              n = 0;
     for (; n < counts.size(); ++n)
@@ -292,7 +774,7 @@ std::vector<std::pair<size_t, size_t>> Engine::get_bound_thread_count_by_numa_no
 }
 
 std::string Engine::get_numa_config_as_string() const {
-    return numaContext.get_numa_config().to_string();
+    return numaContext->get_numa_config().to_string();
 }
 
 std::string Engine::numa_config_information_as_string() const {
@@ -300,6 +782,133 @@ std::string Engine::numa_config_information_as_string() const {
     return "Available Processors: " + cfgStr;
 }
 
+// Counts each block of weights once, on the first node whose networks use it
+std::string Engine::network_memory_information_as_string() const {
+    const size_t MB = 1024 * 1024;
+
+    std::set<const void*> seen;
+    std::stringstream     ss;
+    size_t                total = 0;
+
+    ss << "NNUE weights:";
+
+    for (NumaIndex n = 0; n < networks->size(); ++n)
+    {
+        const NN::Networks& nets = networks->instance(n);
+        size_t              own  = 0;
+
+        for (const auto& blocks : {nets.big.memory_blocks(), nets.small.memory_blocks()})
+            for (const auto& [ptr, size] : blocks)
+                if (ptr && seen.insert(ptr).second)
+                    own += size;
+
+        ss << (n ? ", " : " ") << own / MB << " MB on node " << n;
+        total += own;
+    }
+
+    ss << ", " << total / MB << " MB in total";
+    return ss.str();
+}
+
+// The components of the engine which grow with the options. The weights of the
+// networks are counted once per copy, see network_memory_information_as_string().
+std::vector<std::pair<std::string, size_t>> Engine::memory_usage(
+  size_t threadCount, size_t ttBytes, const NumaConfig& numaConfig) const {
+
+    using namespace Search;
+
+    const size_t historyBytes = sizeof(PawnHistory) + sizeof(CorrectionHistory);
+    const bool   sharedHistory = options["SharedHistory"] && !options["DeterministicSMP"];
+
+    // With DeterministicSMP each thread buffers its writes to the table, about
+    // one per node of an epoch, and with a SearchTrace it samples into a ring.
+    const size_t threadBytes =
+      sizeof(Thread) + sizeof(Worker) + size_t(options["EvalCache"]) * 1024
+      + (MAX_PLY + 1) * sizeof(AccumulatorState) + (sharedHistory ? 0 : historyBytes)
+      + (options["DeterministicSMP"] ? TTBuffer::bytes(ThreadPool::EpochNodes) : 0)
+      + (SearchTrace::Enabled && !std::string(options["SearchTrace"]).empty()
+           ? SearchTrace::Capacity * sizeof(SearchTrace::Record)
+           : 0);
+
+    // The networks of the first node, and the parts of them which NumaNetworks
+    // copies for each other node the config replicates to.
+    const NumaIndex nodes =
+      numaConfig.requires_memory_replication() ? numaConfig.num_numa_nodes() : 1;
+    const OptionsMap& netOptions = host ? host->options : options;
+    const bool        replicate  = netOptions.count("NumaNetworks");
+    const bool copyTransformer   = replicate && netOptions["NumaNetworks"] != "none";
+    const bool copyLayers        = replicate && netOptions["NumaNetworks"] == "all";
+
+    const NN::Networks&   nets = networks->instance(0);
+    std::set<const void*> seen;
+    size_t                networkBytes = 0, copyBytes = 0;
+
+    for (const auto& blocks : {nets.big.memory_blocks(), nets.small.memory_blocks()})
+    {
+        for (const auto& [ptr, size] : blocks)
+            if (ptr && seen.insert(ptr).second)
+                networkBytes += size;
+
+        copyBytes += (copyTransformer ? blocks[0].second : 0) + (copyLayers ? blocks[1].second : 0);
+    }
+
+    return {{"hash", ttBytes},
+            {"threads", threadCount * threadBytes},
+            {"shared histories", nodes * historyBytes},
+            {"networks", networkBytes + (nodes - 1) * copyBytes}};
+}
+
+std::string Engine::memory_information_as_string() const {
+    const size_t MB = 1024 * 1024;
+
+    std::stringstream ss;
+    size_t            total = 0;
+
+    ss << "Memory:";
+
+    for (const auto& [part, bytes] :
+         memory_usage(threads.num_threads(), tt.size_bytes(), numaContext->get_numa_config()))
+    {
+        ss << " " << part << " " << (bytes + MB / 2) / MB << " MB,";
+        total += bytes;
+    }
+
+    ss << " " << (total + MB / 2) / MB << " MB in total";
+
+    if (size_t(options["MemoryBudget"]))
+        ss << " of a MemoryBudget of " << std::string(options["MemoryBudget"]) << " MB";
+
+    return ss.str();
+}
+
+std::string Engine::tt_information_as_string() const {
+    const size_t MB = 1024 * 1024;
+
+    std::stringstream ss;
+    ss << "Transposition table: " << tt.size_bytes() / MB << " MB, " << tt.huge_page_bytes() / MB
+       << " MB on huge pages";
+    return ss.str();
+}
+
+// The occupation of the table by the age of the entries, in searches or with
+// AnalysisAging in plies from the current root
+std::string Engine::hashfull_statistics_as_string() const {
+    constexpr int MaxAge = 7;
+
+    std::stringstream ss;
+    ss << "Hashfull by " << (tt.path_aging() ? "plies from the root" : "searches ago") << ":";
+
+    for (int age = 0, previous = 0; age <= MaxAge; ++age)
+    {
+        const int full = tt.hashfull(age);
+        ss << " " << age << ":" << full - previous;
+        previous = full;
+    }
+
+    ss << " older:" << tt.hashfull(255) - tt.hashfull(MaxAge) << ", total " << tt.hashfull(255);
+    return ss.str();
+}
+
 std::string Engine::thread_binding_information_as_string() const {
     auto boundThreadsByNode = get_bound_thread_count_by_numa_node();
     if (boundThreadsByNode.empty())
@@ -321,4 +930,196 @@ std::string Engine::thread_binding_information_as_string() const {
     return ss.str();
 }
 
+std::uint64_t Engine::accumulator_updates(bool big) const {
+    return threads.accumulator_updates(big);
+}
+
+std::uint64_t Engine::accumulator_refreshes(bool big) const {
+    return threads.accumulator_refreshes(big);
+}
+
+std::string Engine::accumulator_statistics_as_string() const {
+    std::stringstream ss;
+
+    for (bool big : {true, false})
+        ss << "\nAccumulator updates (" << (big ? "big" : "small")
+           << " net): " << accumulator_updates(big) << " incremental, "
+           << accumulator_refreshes(big) << " refreshes";
+
+    // Features changed per refresh, which is what the refresh cache layout trades off
+    for (bool big : {true, false})
+    {
+        const auto     diffs = threads.accumulator_refresh_diffs(big);
+        const uint64_t total = std::accumulate(diffs.begin(), diffs.end(), uint64_t(0));
+
+        if (!total)
+            continue;
+
+        uint64_t sum = 0, seen = 0;
+        for (size_t i = 0; i < diffs.size(); ++i)
+            sum += i * diffs[i];
+
+        ss << "\nRefresh diffs (" << (big ? "big" : "small") << " net): mean " << std::fixed
+           << std::setprecision(2) << double(sum) / total;
+
+        for (int pct : {50, 90, 99})
+        {
+            size_t i = 0;
+            for (seen = diffs[0]; seen * 100 < total * pct; seen += diffs[++i])
+            {}
+            ss << ", " << pct << "% <= " << i;
+        }
+
+        if (NN::AccumulatorCaches::Slots < SQUARE_NB)
+            ss << ", " << threads.accumulator_evictions(big) << " evictions ("
+               << NN::AccumulatorCaches::Slots << " slots)";
+    }
+
+    return ss.str();
+}
+
+// Empty unless PrefetchDistance is set, so the default bench output is unchanged
+std::string Engine::prefetch_statistics_as_string() const {
+    const uint64_t issued = threads.prefetches_issued();
+
+    if (!issued)
+        return "";
+
+    const uint64_t    used = threads.prefetches_used();
+    std::stringstream ss;
+    ss << "\nLookahead prefetch : " << issued << " issued, " << used << " moves searched ("
+       << std::fixed << std::setprecision(1) << 100.0 * used / issued << "%)";
+    return ss.str();
+}
+
+// Empty unless EvalCache is set, so the default bench output is unchanged
+std::string Engine::eval_cache_statistics_as_string() const {
+    const uint64_t probes = threads.eval_cache_probes();
+
+    if (!probes)
+        return "";
+
+    const uint64_t    hits = threads.eval_cache_hits();
+    std::stringstream ss;
+    ss << "\nEval cache      : " << probes << " probes, " << hits << " hits (" << std::fixed
+       << std::setprecision(1) << 100.0 * hits / probes << "%)";
+    return ss.str();
+}
+
+// The tablebase probes of the search, and how many of them SyzygyWDLCache saved
+std::string Engine::tablebase_statistics_as_string() const {
+    const uint64_t probes = threads.tb_probes();
+
+    if (!probes)
+        return "";
+
+    const uint64_t    hits = threads.tb_cache_hits();
+    std::stringstream ss;
+    ss << "\nTablebase probes: " << probes << ", " << hits << " from the WDL cache ("
+       << std::fixed << std::setprecision(1) << 100.0 * hits / probes << "%)";
+    return ss.str();
+}
+
+// How long the threads take to start searching after 'go', which IdleSpin cuts down
+std::string Engine::start_latency_statistics_as_string() const {
+    const uint64_t starts = threads.search_starts();
+
+    if (!starts)
+        return "";
+
+    std::stringstream ss;
+    ss << "\nGo to first node : mean " << threads.start_latency_sum() / starts << " us, max "
+       << threads.start_latency_max() << " us over " << starts << " thread starts";
+    return ss.str();
+}
+
+// How often the LatencySLA deadline was missed, and by how much
+std::string Engine::response_statistics_as_string() const {
+    const auto& st = threads.response_stats();
+
+    if (!st.searches)
+        return "";
+
+    std::stringstream ss;
+    ss << "\nResponse time   : mean " << st.sum / TimePoint(st.searches) << " ms, max " << st.max
+       << " ms, " << st.misses << " of " << st.searches << " searches over LatencySLA";
+    if (st.misses)
+        ss << " by " << st.overshootSum / TimePoint(st.misses) << " ms on average, "
+           << st.overshootMax << " ms at most";
+    return ss.str();
+}
+
+// The memory each search thread spends on history tables, most of which is read
+// at random by the move ordering of every node.
+std::string Engine::history_statistics_as_string() const {
+    using W = Search::Worker;
+
+    // With SharedHistory the pawn and correction histories are per NUMA node
+    const bool   shared       = options["SharedHistory"] && !options["DeterministicSMP"];
+    const size_t continuation = sizeof(W::continuationHistory);
+    const size_t pawn         = shared ? 0 : sizeof(PawnHistory);
+    const size_t other        = sizeof(W::counterMoves) + sizeof(W::mainHistory)
+                       + sizeof(W::captureHistory) + (shared ? 0 : sizeof(CorrectionHistory));
+
+    std::stringstream ss;
+    ss << "\nHistory tables  : " << (continuation + pawn + other) / 1024 << " KB per thread ("
+       << continuation / 1024 << " KB continuation, " << pawn / 1024 << " KB pawn, "
+       << sizeof(PieceToHistory) * 8 / (PIECE_SLOT_NB * SQUARE_NB) << " bit values)";
+
+    if (shared)
+        ss << ", " << (sizeof(PawnHistory) + sizeof(CorrectionHistory)) / 1024
+           << " KB per NUMA node";
+
+    return ss.str();
+}
+
+// The weights of the feature transformers, which the accumulator updates stream
+// from memory, so that the benches of ftint8 builds and default ones compare
+std::string Engine::feature_weights_statistics_as_string() const {
+    const auto [big, bigRounded]     = (*networks)->big.feature_weights();
+    const auto [small, smallRounded] = (*networks)->small.feature_weights();
+
+    std::stringstream ss;
+    ss << "\nFeature weights : " << big / (1024 * 1024) << " MB big net, " << small / 1024
+       << " KB small net (" << sizeof(NN::WeightType) * 8 << " bit";
+
+    if (sizeof(NN::WeightType) == 1)
+        ss << ", " << std::fixed << std::setprecision(2) << 100 * bigRounded << "% / "
+           << 100 * smallRounded << "% rounded";
+
+    ss << ")";
+    return ss.str();
+}
+
+Search::SearchStats::Snapshot Engine::search_stats() const { return threads.search_stats(); }
+
+std::string Engine::search_statistics_as_string() const {
+    using S = Search::SearchStats;
+
+    if (!S::Enabled)
+        return "Search statistics are not available, build with stats=yes";
+
+    const S::Snapshot st    = threads.search_stats();
+    const uint64_t    nodes = threads.nodes_searched();
+
+    auto ratio = [](uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0.0; };
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+
+    ss << "Nodes " << nodes << ", qsearch " << ratio(st[S::QNodes], nodes) << "%"
+       << "\nTT probes " << st[S::TTProbes] << ", hits " << ratio(st[S::TTHits], st[S::TTProbes])
+       << "%"
+       << "\nNull move tries " << st[S::NullMoveTries] << ", cutoffs "
+       << ratio(st[S::NullMoveCutoffs], st[S::NullMoveTries]) << "%"
+       << "\nLMR searches " << st[S::LmrSearches] << ", re-searches "
+       << ratio(st[S::LmrResearches], st[S::LmrSearches]) << "%"
+       << "\nCutoffs " << st[S::Cutoffs] << ", by move index 1/2/3/4/5-8/9+:";
+
+    for (int c = S::CutoffsFirstMove; c <= S::CutoffsMove9Plus; ++c)
+        ss << (c == S::CutoffsFirstMove ? " " : "/") << ratio(st[c], st[S::Cutoffs]) << "%";
+
+    return ss.str() + accumulator_statistics_as_string();
+}
+
 }
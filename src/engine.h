@@ -22,12 +22,15 @@
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
 
+#include "book.h"
+#include "distributed.h"
 #include "nnue/network.h"
 #include "numa.h"
 #include "position.h"
@@ -47,7 +50,9 @@ class Engine {
     using InfoFull  = Search::InfoFull;
     using InfoIter  = Search::InfoIteration;
 
-    Engine(std::string path = "");
+    // When shareWith is given, the engine uses the NUMA configuration, networks and
+    // tablebases of that engine, which must outlive it, and has no options to change them.
+    Engine(std::string path = "", const Engine* shareWith = nullptr);
 
     // Can't be movable due to components holding backreferences to fields
     Engine(const Engine&)            = delete;
@@ -57,7 +62,12 @@ class Engine {
 
     ~Engine() { wait_for_search_finished(); }
 
-    std::uint64_t perft(const std::string& fen, Depth depth, bool isChess960);
+    // threadCount is capped to the size of the thread pool, hashMB = 0 disables the perft hash
+    std::uint64_t perft(const std::string& fen,
+                        Depth              depth,
+                        bool               isChess960,
+                        size_t             threadCount = 1,
+                        size_t             hashMB      = 0);
 
     // non blocking call to start searching
     void go(Search::LimitsType&);
@@ -71,9 +81,12 @@ class Engine {
 
     // modifiers
 
-    void set_numa_config_from_option(const std::string& o);
-    void resize_threads();
-    void set_tt_size(size_t mb);
+    // Returns an error if the copies of the networks would not fit in the MemoryBudget
+    std::optional<std::string> set_numa_config_from_option(const std::string& o);
+    void set_network_replication(const Option& mode);
+    // Both return an error or warning when the MemoryBudget option limits them
+    std::optional<std::string> resize_threads();
+    std::optional<std::string> set_tt_size(size_t mb);
     void set_ponderhit(bool);
     void search_clear();
 
@@ -89,37 +102,90 @@ class Engine {
     void load_big_network(const std::string& file);
     void load_small_network(const std::string& file);
     void save_network(const std::pair<std::optional<std::string>, std::string> files[2]);
+    void save_network_image(const std::pair<std::optional<std::string>, std::string> files[2]);
+
+    // transposition table snapshots
+
+    void save_hash(const std::string& file);
+    void load_hash(const std::string& file);
+
+    // distributed search, entries of at least the export depth are queued for other nodes
+
+    void                  set_tt_export_depth(Depth d);
+    std::vector<TTExport> take_tt_exports();
+    void                  import_tt_entries(const std::vector<TTExport>& entries);
 
     // utility functions
 
     void trace_eval() const;
+    // Times the stages of the evaluation of both networks, see bench nnue
+    std::string nnue_benchmark_as_string(const std::vector<std::string>& fens,
+                                         size_t                          rounds) const;
 
     const OptionsMap& get_options() const;
     OptionsMap&       get_options();
 
     std::string                            fen() const;
+    // The FEN and the moves of the last set_position(), to set it again later
+    std::pair<std::string, std::vector<std::string>> get_position() const;
     void                                   flip();
     std::string                            visualize() const;
     std::vector<std::pair<size_t, size_t>> get_bound_thread_count_by_numa_node() const;
     std::string                            get_numa_config_as_string() const;
     std::string                            numa_config_information_as_string() const;
     std::string                            thread_binding_information_as_string() const;
+    std::string                            tt_information_as_string() const;
+    std::string                            hashfull_statistics_as_string() const;
+    std::string                            network_memory_information_as_string() const;
+    std::string                            memory_information_as_string() const;
+    std::uint64_t                          accumulator_updates(bool big) const;
+    std::uint64_t                          accumulator_refreshes(bool big) const;
+    std::string                            accumulator_statistics_as_string() const;
+    std::string                            prefetch_statistics_as_string() const;
+    std::string                            eval_cache_statistics_as_string() const;
+    std::string                            tablebase_statistics_as_string() const;
+    std::string                            start_latency_statistics_as_string() const;
+    std::string                            response_statistics_as_string() const;
+    std::string                            history_statistics_as_string() const;
+    std::string                            feature_weights_statistics_as_string() const;
+    std::string                            search_statistics_as_string() const;
+    Search::SearchStats::Snapshot          search_stats() const;
 
    private:
+    // The bytes of the parts of the engine counted against the MemoryBudget option,
+    // with the given number of threads, transposition table size and NUMA config
+    std::vector<std::pair<std::string, size_t>>
+    memory_usage(size_t threadCount, size_t ttBytes, const NumaConfig& numaConfig) const;
+
     const std::string binaryDirectory;
 
-    NumaReplicationContext numaContext;
+    std::shared_ptr<NumaReplicationContext> numaContext;
 
     Position     pos;
     StateListPtr states;
     Square       capSq;
 
-    OptionsMap                           options;
-    ThreadPool                           threads;
-    TranspositionTable                   tt;
-    NumaReplicated<Eval::NNUE::Networks> networks;
+    // The FEN and the moves made from it to reach pos. A new position command is
+    // applied from the last move it shares with them, and the other nodes of a
+    // distributed search replay them.
+    std::string       positionFen;
+    std::vector<Move> positionMoves;
+
+    OptionsMap                                            options;
+    ThreadPool                                            threads;
+    TranspositionTable                                    tt;
+    std::unique_ptr<Distributed::Master>                  cluster;
+    Book                                                  book;
+    std::shared_ptr<NumaReplicated<Eval::NNUE::Networks>> networks;
+    NumaReplicated<Search::SharedHistories>               sharedHistories;
 
     Search::SearchManager::UpdateContext updateContext;
+
+    const Engine* const host;
+    mutable bool        hostNetworksVerified = false;
+
+    // The NumaPolicy the NUMA config was made from, kept when a change is refused
+    std::string appliedNumaPolicy = "auto";
 };
 
 }  // namespace Stockfish
@@ -63,19 +63,41 @@ Value Eval::evaluate(const Eval::NNUE::Networks&    networks,
     bool smallNet   = use_smallnet(pos);
     int  v;
 
-    auto [psqt, positional] = smallNet ? networks.small.evaluate(pos, &caches.small)
-                                       : networks.big.evaluate(pos, &caches.big);
+    Value nnue;
+    int   nnueComplexity;
 
-    Value nnue           = (125 * psqt + 131 * positional) / 128;
-    int   nnueComplexity = std::abs(psqt - positional);
+    // The network outputs only depend on the pieces and the side to move
+    const Key key   = pos.state()->key;
+    auto*     entry = caches.evals.probe(key);
 
-    // Re-evaluate the position when higher eval accuracy is worth the time spent
-    if (smallNet && (nnue * simpleEval < 0 || std::abs(nnue) < 227))
+    if (entry)
+        caches.evals.probes += 1;
+
+    if (entry && entry->key == key)
+    {
+        caches.evals.hits += 1;
+        nnue           = entry->nnue;
+        nnueComplexity = entry->complexity;
+    }
+    else
     {
-        std::tie(psqt, positional) = networks.big.evaluate(pos, &caches.big);
-        nnue                       = (125 * psqt + 131 * positional) / 128;
-        nnueComplexity             = std::abs(psqt - positional);
-        smallNet                   = false;
+        auto [psqt, positional] = smallNet ? networks.small.evaluate(pos, &caches.small)
+                                           : networks.big.evaluate(pos, &caches.big);
+
+        nnue           = (125 * psqt + 131 * positional) / 128;
+        nnueComplexity = std::abs(psqt - positional);
+
+        // Re-evaluate the position when higher eval accuracy is worth the time spent
+        if (smallNet && (nnue * simpleEval < 0 || std::abs(nnue) < 227))
+        {
+            std::tie(psqt, positional) = networks.big.evaluate(pos, &caches.big);
+            nnue                       = (125 * psqt + 131 * positional) / 128;
+            nnueComplexity             = std::abs(psqt - positional);
+            smallNet                   = false;
+        }
+
+        if (entry)
+            *entry = {key, nnue, nnueComplexity};
     }
 
     // Blend optimism and eval with nnue complexity
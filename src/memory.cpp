@@ -19,13 +19,23 @@
 #include "memory.h"
 
 #include <cstdlib>
+#include <mutex>
+#include <unordered_map>
 
 #if __has_include("features.h")
     #include <features.h>
 #endif
 
-#if defined(__linux__) && !defined(__ANDROID__)
+#if defined(__linux__)
+    #include <cstdio>
+    #include <fstream>
+#endif
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
     #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
 #endif
 
 #if defined(__APPLE__) || defined(__ANDROID__) || defined(__OpenBSD__) \
@@ -64,6 +74,38 @@ using AdjustTokenPrivileges_t =
 
 namespace Stockfish {
 
+namespace {
+
+// Allocations known to be fully backed by large pages, with their size: the
+// explicit huge page mappings on Linux and the large page VirtualAlloc() on
+// Windows. The former need munmap() with their size to be freed.
+std::mutex                         largePagesMutex;
+std::unordered_map<void*, size_t>& large_page_allocations() {
+    static std::unordered_map<void*, size_t> allocations;
+    return allocations;
+}
+
+void register_large_pages(void* mem, size_t size) {
+    std::lock_guard<std::mutex> lk(largePagesMutex);
+    large_page_allocations()[mem] = size;
+}
+
+// Returns the size of the allocation if it was registered, 0 otherwise
+size_t unregister_large_pages(void* mem) {
+    std::lock_guard<std::mutex> lk(largePagesMutex);
+    auto&                       allocations = large_page_allocations();
+    auto                        it          = allocations.find(mem);
+
+    if (it == allocations.end())
+        return 0;
+
+    const size_t size = it->second;
+    allocations.erase(it);
+    return size;
+}
+
+}
+
 // Wrapper for systems where the c++17 implementation
 // does not guarantee the availability of aligned_alloc(). Memory allocated with
 // std_aligned_alloc() must be freed with std_aligned_free().
@@ -167,6 +209,9 @@ static void* aligned_large_pages_alloc_windows([[maybe_unused]] size_t allocSize
 
     CloseHandle(hProcessToken);
 
+    if (mem)
+        register_large_pages(mem, allocSize);
+
     return mem;
 
     #endif
@@ -184,6 +229,13 @@ void* aligned_large_pages_alloc(size_t allocSize) {
     return mem;
 }
 
+// The large page size is fixed on Windows
+void* aligned_huge_pages_alloc(size_t allocSize, size_t, bool required) {
+
+    return required ? aligned_large_pages_alloc_windows(allocSize)
+                    : aligned_large_pages_alloc(allocSize);
+}
+
 #else
 
 void* aligned_large_pages_alloc(size_t allocSize) {
@@ -203,6 +255,34 @@ void* aligned_large_pages_alloc(size_t allocSize) {
     return mem;
 }
 
+void* aligned_huge_pages_alloc(size_t allocSize, [[maybe_unused]] size_t pageSize, bool required) {
+
+    #if defined(__linux__) && defined(MAP_HUGETLB)
+        #if !defined(MAP_HUGE_SHIFT)
+            #define MAP_HUGE_SHIFT 26
+        #endif
+
+    if (pageSize == 2 * 1024 * 1024 || pageSize == 1024 * 1024 * 1024)
+    {
+        // The page size is encoded as its log2 in the flags
+        const int    log2Size = pageSize == 2 * 1024 * 1024 ? 21 : 30;
+        const size_t size     = ((allocSize + pageSize - 1) / pageSize) * pageSize;
+        void*        mem      = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+                                       | (log2Size << MAP_HUGE_SHIFT),
+                                     -1, 0);
+
+        if (mem != MAP_FAILED)
+        {
+            register_large_pages(mem, size);
+            return mem;
+        }
+    }
+    #endif
+
+    return required ? nullptr : aligned_large_pages_alloc(allocSize);
+}
+
 #endif
 
 
@@ -212,6 +292,9 @@ void* aligned_large_pages_alloc(size_t allocSize) {
 
 void aligned_large_pages_free(void* mem) {
 
+    if (mem)
+        unregister_large_pages(mem);
+
     if (mem && !VirtualFree(mem, 0, MEM_RELEASE))
     {
         DWORD err = GetLastError();
@@ -223,7 +306,131 @@ void aligned_large_pages_free(void* mem) {
 
 #else
 
-void aligned_large_pages_free(void* mem) { std_aligned_free(mem); }
+void aligned_large_pages_free(void* mem) {
+
+    if (!mem)
+        return;
+
+    if (const size_t size = unregister_large_pages(mem))
+        munmap(mem, size);
+    else
+        std_aligned_free(mem);
+}
+
+#endif
+
+
+// large_page_bytes() tells how much of an allocation actually got large pages. The
+// registered allocations are fully backed, otherwise on Linux the transparent huge
+// pages are counted in /proc/self/smaps.
+
+size_t large_page_bytes(const void* mem, size_t size) {
+
+    {
+        std::lock_guard<std::mutex> lk(largePagesMutex);
+        auto& allocations = large_page_allocations();
+        auto  it          = allocations.find(const_cast<void*>(mem));
+
+        if (it != allocations.end())
+            return std::min(size, it->second);
+    }
+
+#if defined(__linux__)
+    std::ifstream smaps("/proc/self/smaps");
+    std::string   line;
+    const auto    begin = uintptr_t(mem), end = begin + size;
+    size_t        overlap = 0, bytes = 0;
+
+    while (std::getline(smaps, line))
+    {
+        unsigned long long first, last, kB;
+
+        // A mapping starts with its address range, then come its fields
+        if (std::sscanf(line.c_str(), "%llx-%llx ", &first, &last) == 2
+            && line.find(':') > line.find(' '))
+            overlap = first < end && last > begin
+                      ? std::min<uintptr_t>(last, end) - std::max<uintptr_t>(first, begin)
+                      : 0;
+
+        else if (overlap && std::sscanf(line.c_str(), "AnonHugePages: %llu kB", &kB) == 1)
+            bytes += std::min<size_t>(overlap, kB * 1024);
+    }
+
+    return std::min(bytes, size);
+#else
+    return 0;
+#endif
+}
+
+
+// map_file() maps a view of the file, writes go to private copies of the pages
+
+#if defined(_WIN32)
+
+void* map_file(const std::string& file, size_t offset, size_t size) {
+
+    HANDLE fd = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+    if (fd == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    CloseHandle(fd);
+
+    if (!mmap)
+        return nullptr;
+
+    const uint64_t off = offset;
+    void*          mem = MapViewOfFile(mmap, FILE_MAP_COPY, DWORD(off >> 32), DWORD(off), size);
+    CloseHandle(mmap);  // The view keeps the mapping alive
+
+    return mem;
+}
+
+void unmap_file(void* mem, size_t) {
+
+    if (mem)
+        UnmapViewOfFile(mem);
+}
+
+#else
+
+void* map_file(const std::string& file, size_t offset, size_t size) {
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        return nullptr;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) || size_t(statbuf.st_size) < offset + size)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, off_t(offset));
+    ::close(fd);
+
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    #if defined(MADV_HUGEPAGE)
+    madvise(mem, size, MADV_HUGEPAGE);
+    #endif
+    #if defined(MADV_WILLNEED)
+    madvise(mem, size, MADV_WILLNEED);
+    #endif
+    return mem;
+}
+
+void unmap_file(void* mem, size_t size) {
+
+    if (mem)
+        munmap(mem, size);
+}
 
 #endif
+
 }  // namespace Stockfish
@@ -24,6 +24,7 @@
 #include <cstdint>
 #include <memory>
 #include <new>
+#include <string>
 #include <type_traits>
 #include <utility>
 
@@ -35,8 +36,20 @@ void* std_aligned_alloc(size_t alignment, size_t size);
 void  std_aligned_free(void* ptr);
 // memory aligned by page size, min alignment: 4096 bytes
 void* aligned_large_pages_alloc(size_t size);
+// As above, but with pageSize set to 2MB or 1GB it maps explicit huge pages of that size
+// on Linux (MAP_HUGETLB), reserved when mapped. When the huge page pool is short, falls
+// back to aligned_large_pages_alloc() unless required, then nullptr is returned. On
+// Windows, required fails if large pages can not be used. Free with aligned_large_pages_free().
+void* aligned_huge_pages_alloc(size_t size, size_t pageSize, bool required);
 // nop if mem == nullptr
 void aligned_large_pages_free(void* mem);
+// Bytes of the allocation [mem, mem + size) backed by huge or large pages
+size_t large_page_bytes(const void* mem, size_t size);
+// Maps size bytes of file, starting at offset (a multiple of 2MB), copy-on-write so that
+// unmodified pages are shared with other processes through the page cache. Returns
+// nullptr on failure. The memory must be released with unmap_file().
+void* map_file(const std::string& file, size_t offset, size_t size);
+void  unmap_file(void* mem, size_t size);
 
 // frees memory which was placed there with placement new.
 // works for both single objects and arrays of unknown bound
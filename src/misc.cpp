@@ -33,6 +33,12 @@
 
 #include "types.h"
 
+#if defined(__linux__) && !defined(__ANDROID__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
 namespace Stockfish {
 
 namespace {
@@ -356,6 +362,39 @@ void dbg_print() {
 }
 
 
+#if defined(__linux__) && !defined(__ANDROID__)
+
+InstructionCounter::InstructionCounter() {
+    perf_event_attr attr{};
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+InstructionCounter::~InstructionCounter() {
+    if (fd != -1)
+        close(fd);
+}
+
+uint64_t InstructionCounter::count() const {
+    uint64_t value = 0;
+    if (fd != -1 && read(fd, &value, sizeof(value)) != sizeof(value))
+        value = 0;
+    return value;
+}
+
+#else
+
+InstructionCounter::InstructionCounter() {}
+InstructionCounter::~InstructionCounter() {}
+uint64_t InstructionCounter::count() const { return 0; }
+
+#endif
+
 // Used to serialize access to std::cout
 // to avoid multiple threads writing at the same time.
 std::ostream& operator<<(std::ostream& os, SyncCout sc) {
@@ -371,6 +410,19 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
     return os;
 }
 
+namespace {
+thread_local std::ostream* syncCoutStream = nullptr;
+}
+
+std::ostream& sync_cout_stream() { return syncCoutStream ? *syncCoutStream : std::cout; }
+
+SyncCoutRedirect::SyncCoutRedirect(std::ostream& os) :
+    previous(syncCoutStream) {
+    syncCoutStream = &os;
+}
+
+SyncCoutRedirect::~SyncCoutRedirect() { syncCoutStream = previous; }
+
 void sync_cout_start() { std::cout << IO_LOCK; }
 void sync_cout_end() { std::cout << IO_UNLOCK; }
 
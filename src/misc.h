@@ -70,6 +70,23 @@ void dbg_stdev_of(int64_t value, int slot = 0);
 void dbg_correl_of(int64_t value1, int64_t value2, int slot = 0);
 void dbg_print();
 
+// Counts the user space instructions retired by the calling thread, on Linux
+// when the kernel and the machine allow it. Otherwise the count stays 0.
+class InstructionCounter {
+   public:
+    InstructionCounter();
+    ~InstructionCounter();
+
+    InstructionCounter(const InstructionCounter&)            = delete;
+    InstructionCounter& operator=(const InstructionCounter&) = delete;
+
+    bool     available() const { return fd != -1; }
+    uint64_t count() const;
+
+   private:
+    int fd = -1;
+};
+
 using TimePoint = std::chrono::milliseconds::rep;  // A value in milliseconds
 static_assert(sizeof(TimePoint) == sizeof(int64_t), "TimePoint should be 64 bits");
 inline TimePoint now() {
@@ -109,7 +126,25 @@ enum SyncCout {
 };
 std::ostream& operator<<(std::ostream&, SyncCout);
 
-#define sync_cout std::cout << IO_LOCK
+// The stream sync_cout writes to from the calling thread, std::cout unless redirected
+std::ostream& sync_cout_stream();
+
+// Redirects sync_cout of the calling thread to os while in scope, e.g. so that
+// the messages of lower layers reach the client of a server instance tagged
+// with its id. Other threads keep writing to their own stream.
+class SyncCoutRedirect {
+   public:
+    explicit SyncCoutRedirect(std::ostream& os);
+    ~SyncCoutRedirect();
+
+    SyncCoutRedirect(const SyncCoutRedirect&)            = delete;
+    SyncCoutRedirect& operator=(const SyncCoutRedirect&) = delete;
+
+   private:
+    std::ostream* previous;
+};
+
+#define sync_cout ::Stockfish::sync_cout_stream() << IO_LOCK
 #define sync_endl std::endl << IO_UNLOCK
 
 void sync_cout_start();
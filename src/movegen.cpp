@@ -24,10 +24,43 @@
 #include "bitboard.h"
 #include "position.h"
 
+#if defined(USE_AVX512)
+    #include <immintrin.h>
+#endif
+
 namespace Stockfish {
 
 namespace {
 
+#if defined(USE_AVX512)
+
+// Writes the moves to all the squares of b, 8 squares at a time. The move to
+// square s is s * M + add, so M = 1 and add = from << 6 gives the moves of a
+// piece, and M = 65 and add = -64 * D the moves of pawns in direction D. The
+// moves of the set squares are compressed into consecutive ExtMoves with a zero
+// value, keeping the order of pop_lsb(). Up to 7 entries past the end of the list
+// are overwritten.
+template<int M>
+ExtMove* splat_moves(ExtMove* moveList, Bitboard b, int add) {
+
+    static_assert(sizeof(ExtMove) == 8);
+
+    const __m512i step  = _mm512_set1_epi64(8 * M);
+    __m512i       codes = _mm512_add_epi64(
+      _mm512_setr_epi64(0, M, 2 * M, 3 * M, 4 * M, 5 * M, 6 * M, 7 * M), _mm512_set1_epi64(add));
+
+    for (; b; b >>= 8, codes = _mm512_add_epi64(codes, step))
+        if (const __mmask8 mask = __mmask8(b))
+        {
+            _mm512_storeu_si512(moveList, _mm512_maskz_compress_epi64(mask, codes));
+            moveList += popcount(mask);
+        }
+
+    return moveList;
+}
+
+#endif
+
 template<GenType Type, Direction D, bool Enemy>
 ExtMove* make_promotions(ExtMove* moveList, [[maybe_unused]] Square to) {
 
@@ -47,8 +80,12 @@ ExtMove* make_promotions(ExtMove* moveList, [[maybe_unused]] Square to) {
 }
 
 
-template<Color Us, GenType Type>
-ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
+// Generates the moves of the given pawns. When generating legal moves, a pinned
+// pawn is passed on its own, with ray set to the line through it and our king,
+// where it must stay.
+template<Color Us, GenType Type, bool Legal>
+ExtMove* generate_pawn_moves(
+  const Position& pos, ExtMove* moveList, Bitboard pawns, Bitboard target, Bitboard ray) {
 
     constexpr Color     Them     = ~Us;
     constexpr Bitboard  TRank7BB = (Us == WHITE ? Rank7BB : Rank2BB);
@@ -57,11 +94,11 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
     constexpr Direction UpRight  = (Us == WHITE ? NORTH_EAST : SOUTH_WEST);
     constexpr Direction UpLeft   = (Us == WHITE ? NORTH_WEST : SOUTH_EAST);
 
-    const Bitboard emptySquares = ~pos.pieces();
-    const Bitboard enemies      = Type == EVASIONS ? pos.checkers() : pos.pieces(Them);
+    const Bitboard emptySquares = ~pos.pieces() & ray;
+    const Bitboard enemies      = (Type == EVASIONS ? pos.checkers() : pos.pieces(Them)) & ray;
 
-    Bitboard pawnsOn7    = pos.pieces(Us, PAWN) & TRank7BB;
-    Bitboard pawnsNotOn7 = pos.pieces(Us, PAWN) & ~TRank7BB;
+    Bitboard pawnsOn7    = pawns & TRank7BB;
+    Bitboard pawnsNotOn7 = pawns & ~TRank7BB;
 
     // Single and double pawn pushes, no promotions
     if constexpr (Type != CAPTURES)
@@ -86,6 +123,10 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
             b2 &= pawn_attacks_bb(Them, ksq) | shift<Up + Up>(dcCandidatePawns);
         }
 
+#if defined(USE_AVX512)
+        moveList = splat_moves<65>(moveList, b1, -64 * Up);
+        moveList = splat_moves<65>(moveList, b2, -64 * (Up + Up));
+#else
         while (b1)
         {
             Square to   = pop_lsb(b1);
@@ -97,6 +138,7 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
             Square to   = pop_lsb(b2);
             *moveList++ = Move(to - Up - Up, to);
         }
+#endif
     }
 
     // Promotions and underpromotions
@@ -125,6 +167,10 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
         Bitboard b1 = shift<UpRight>(pawnsNotOn7) & enemies;
         Bitboard b2 = shift<UpLeft>(pawnsNotOn7) & enemies;
 
+#if defined(USE_AVX512)
+        moveList = splat_moves<65>(moveList, b1, -64 * UpRight);
+        moveList = splat_moves<65>(moveList, b2, -64 * UpLeft);
+#else
         while (b1)
         {
             Square to   = pop_lsb(b1);
@@ -136,6 +182,7 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
             Square to   = pop_lsb(b2);
             *moveList++ = Move(to - UpLeft, to);
         }
+#endif
 
         if (pos.ep_square() != SQ_NONE)
         {
@@ -147,10 +194,16 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
 
             b1 = pawnsNotOn7 & pawn_attacks_bb(Them, pos.ep_square());
 
-            assert(b1);
+            assert(Legal || b1);
 
+            // The captured pawn may uncover an attack on our king along the rank,
+            // which the pins do not tell, so leave en passant to legal().
             while (b1)
-                *moveList++ = Move::make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+            {
+                Move m = Move::make<EN_PASSANT>(pop_lsb(b1), pos.ep_square());
+                if (!Legal || pos.legal(m))
+                    *moveList++ = m;
+            }
         }
     }
 
@@ -158,31 +211,45 @@ ExtMove* generate_pawn_moves(const Position& pos, ExtMove* moveList, Bitboard ta
 }
 
 
-template<Color Us, PieceType Pt, bool Checks>
+template<Color Us, PieceType Pt, bool Checks, bool Legal>
 ExtMove* generate_moves(const Position& pos, ExtMove* moveList, Bitboard target) {
 
     static_assert(Pt != KING && Pt != PAWN, "Unsupported piece type in generate_moves()");
 
-    Bitboard bb = pos.pieces(Us, Pt);
+    const Bitboard pinned = Legal ? pos.blockers_for_king(Us) & pos.pieces(Us) : 0;
+    Bitboard       bb     = pos.pieces(Us, Pt);
+
+    // A pinned knight can never stay on the pinning ray
+    if constexpr (Pt == KNIGHT)
+        bb &= ~pinned;
 
     while (bb)
     {
         Square   from = pop_lsb(bb);
         Bitboard b    = attacks_bb<Pt>(from, pos.pieces()) & target;
 
+        if (Pt != KNIGHT && (pinned & from))
+            b &= line_bb(pos.square<KING>(Us), from);
+
         // To check, you either move freely a blocker or make a direct check.
         if (Checks && (Pt == QUEEN || !(pos.blockers_for_king(~Us) & from)))
             b &= pos.check_squares(Pt);
 
+#if defined(USE_AVX512)
+        moveList = splat_moves<1>(moveList, b, from << 6);
+#else
         while (b)
             *moveList++ = Move(from, pop_lsb(b));
+#endif
     }
 
     return moveList;
 }
 
 
-template<Color Us, GenType Type>
+// Generates the pseudo-legal moves, or with Legal only the legal ones, see
+// generate<LEGAL>().
+template<Color Us, GenType Type, bool Legal>
 ExtMove* generate_all(const Position& pos, ExtMove* moveList) {
 
     static_assert(Type != LEGAL, "Unsupported type in generate_all()");
@@ -199,11 +266,24 @@ ExtMove* generate_all(const Position& pos, ExtMove* moveList) {
                : Type == CAPTURES     ? pos.pieces(~Us)
                                       : ~pos.pieces();  // QUIETS || QUIET_CHECKS
 
-        moveList = generate_pawn_moves<Us, Type>(pos, moveList, target);
-        moveList = generate_moves<Us, KNIGHT, Checks>(pos, moveList, target);
-        moveList = generate_moves<Us, BISHOP, Checks>(pos, moveList, target);
-        moveList = generate_moves<Us, ROOK, Checks>(pos, moveList, target);
-        moveList = generate_moves<Us, QUEEN, Checks>(pos, moveList, target);
+        const Bitboard pinned = Legal ? pos.blockers_for_king(Us) & pos.pieces(Us) : 0;
+
+        moveList = generate_pawn_moves<Us, Type, Legal>(
+          pos, moveList, pos.pieces(Us, PAWN) & ~pinned, target, ~Bitboard(0));
+
+        // When in check a pinned piece has no legal move
+        if (Type != EVASIONS)
+            for (Bitboard b = pos.pieces(Us, PAWN) & pinned; b;)
+            {
+                Square s = pop_lsb(b);
+                moveList = generate_pawn_moves<Us, Type, Legal>(pos, moveList, square_bb(s),
+                                                                target, line_bb(ksq, s));
+            }
+
+        moveList = generate_moves<Us, KNIGHT, Checks, Legal>(pos, moveList, target);
+        moveList = generate_moves<Us, BISHOP, Checks, Legal>(pos, moveList, target);
+        moveList = generate_moves<Us, ROOK, Checks, Legal>(pos, moveList, target);
+        moveList = generate_moves<Us, QUEEN, Checks, Legal>(pos, moveList, target);
     }
 
     if (!Checks || pos.blockers_for_king(~Us) & ksq)
@@ -212,13 +292,31 @@ ExtMove* generate_all(const Position& pos, ExtMove* moveList) {
         if (Checks)
             b &= ~attacks_bb<QUEEN>(pos.square<KING>(~Us));
 
+        // Drop the squares attacked by the opponent. Our king is removed from the
+        // occupancy so that it cannot step back along the ray of a checking slider.
+        if constexpr (Legal)
+            for (Bitboard bb = b; bb;)
+            {
+                Square s = pop_lsb(bb);
+                if (pos.attackers_to(s, pos.pieces() ^ ksq) & pos.pieces(~Us))
+                    b ^= s;
+            }
+
+#if defined(USE_AVX512)
+        moveList = splat_moves<1>(moveList, b, ksq << 6);
+#else
         while (b)
             *moveList++ = Move(ksq, pop_lsb(b));
+#endif
 
         if ((Type == QUIETS || Type == NON_EVASIONS) && pos.can_castle(Us & ANY_CASTLING))
             for (CastlingRights cr : {Us & KING_SIDE, Us & QUEEN_SIDE})
                 if (!pos.castling_impeded(cr) && pos.can_castle(cr))
-                    *moveList++ = Move::make<CASTLING>(ksq, pos.castling_rook_square(cr));
+                {
+                    Move m = Move::make<CASTLING>(ksq, pos.castling_rook_square(cr));
+                    if (!Legal || pos.legal(m))
+                        *moveList++ = m;
+                }
     }
 
     return moveList;
@@ -243,8 +341,8 @@ ExtMove* generate(const Position& pos, ExtMove* moveList) {
 
     Color us = pos.side_to_move();
 
-    return us == WHITE ? generate_all<WHITE, Type>(pos, moveList)
-                       : generate_all<BLACK, Type>(pos, moveList);
+    return us == WHITE ? generate_all<WHITE, Type, false>(pos, moveList)
+                       : generate_all<BLACK, Type, false>(pos, moveList);
 }
 
 // Explicit template instantiations
@@ -255,26 +353,21 @@ template ExtMove* generate<QUIET_CHECKS>(const Position&, ExtMove*);
 template ExtMove* generate<NON_EVASIONS>(const Position&, ExtMove*);
 
 
-// generate<LEGAL> generates all the legal moves in the given position
+// generate<LEGAL> generates all the legal moves in the given position. Moves of
+// pinned pieces are restricted to the pinning ray and king moves to unattacked
+// squares, so that no move is left for Position::legal() to reject. This is
+// slower than the pseudo-legal generation when most moves are never tried, so
+// the search generates its moves lazily and checks the ones it plays.
 
 template<>
 ExtMove* generate<LEGAL>(const Position& pos, ExtMove* moveList) {
 
-    Color    us     = pos.side_to_move();
-    Bitboard pinned = pos.blockers_for_king(us) & pos.pieces(us);
-    Square   ksq    = pos.square<KING>(us);
-    ExtMove* cur    = moveList;
-
-    moveList =
-      pos.checkers() ? generate<EVASIONS>(pos, moveList) : generate<NON_EVASIONS>(pos, moveList);
-    while (cur != moveList)
-        if (((pinned & cur->from_sq()) || cur->from_sq() == ksq || cur->type_of() == EN_PASSANT)
-            && !pos.legal(*cur))
-            *cur = *(--moveList);
-        else
-            ++cur;
-
-    return moveList;
+    if (pos.side_to_move() == WHITE)
+        return pos.checkers() ? generate_all<WHITE, EVASIONS, true>(pos, moveList)
+                              : generate_all<WHITE, NON_EVASIONS, true>(pos, moveList);
+    else
+        return pos.checkers() ? generate_all<BLACK, EVASIONS, true>(pos, moveList)
+                              : generate_all<BLACK, NON_EVASIONS, true>(pos, moveList);
 }
 
 }  // namespace Stockfish
@@ -26,6 +26,10 @@
 #include "bitboard.h"
 #include "position.h"
 
+#if defined(USE_AVX2) && !defined(COMPACT_HISTORY)
+    #include <immintrin.h>
+#endif
+
 namespace Stockfish {
 
 namespace {
@@ -162,6 +166,9 @@ void MovePicker::score() {
         threatenedPieces = (pos.pieces(us, QUEEN) & threatenedByRook)
                          | (pos.pieces(us, ROOK) & threatenedByMinor)
                          | (pos.pieces(us, KNIGHT, BISHOP) & threatenedByPawn);
+
+        // histories
+        score_quiet_histories();
     }
 
     for (auto& m : *this)
@@ -172,20 +179,10 @@ void MovePicker::score() {
 
         else if constexpr (Type == QUIETS)
         {
-            Piece     pc   = pos.moved_piece(m);
-            PieceType pt   = type_of(pc);
+            PieceType pt   = type_of(pos.moved_piece(m));
             Square    from = m.from_sq();
             Square    to   = m.to_sq();
 
-            // histories
-            m.value = (*mainHistory)[pos.side_to_move()][m.from_to()];
-            m.value += 2 * (*pawnHistory)[pawn_structure_index(pos)][pc][to];
-            m.value += 2 * (*continuationHistory[0])[pc][to];
-            m.value += (*continuationHistory[1])[pc][to];
-            m.value += (*continuationHistory[2])[pc][to] / 3;
-            m.value += (*continuationHistory[3])[pc][to];
-            m.value += (*continuationHistory[5])[pc][to];
-
             // bonus for checks
             m.value += bool(pos.check_squares(pt) & to) * 16384;
 
@@ -214,6 +211,83 @@ void MovePicker::score() {
         }
 }
 
+// Sets the value of each quiet move to its history score. The offsets of the moves
+// into the tables are computed first, and then each table is read in one pass,
+// with AVX2 gathers of 8 moves at a time when the entries have 16 bits.
+void MovePicker::score_quiet_histories() {
+
+    const int n = int(endMoves - cur);
+
+    // Padded to whole vectors with offsets of the same, valid, first move
+    alignas(32) int pieceTo[MAX_MOVES + 8], fromTo[MAX_MOVES + 8], value[MAX_MOVES + 8];
+
+    for (int i = 0; i < n; ++i)
+    {
+        pieceTo[i] = piece_slot(pos.moved_piece(cur[i])) * SQUARE_NB + cur[i].to_sq();
+        fromTo[i]  = cur[i].from_to();
+    }
+
+    const auto* mh = (*mainHistory)[pos.side_to_move()].data();
+    const auto* ph = (*pawnHistory)[pawn_structure_index(pos)].entries();
+    const auto* c0 = continuationHistory[0]->entries();
+    const auto* c1 = continuationHistory[1]->entries();
+    const auto* c2 = continuationHistory[2]->entries();
+    const auto* c3 = continuationHistory[3]->entries();
+    const auto* c5 = continuationHistory[5]->entries();
+
+    int i = 0;
+
+#if defined(USE_AVX2) && !defined(COMPACT_HISTORY)
+
+    static_assert(sizeof(*mh) == 2 && sizeof(*ph) == 2 && sizeof(*c0) == 2);
+
+    for (int j = n; j < (n + 7) / 8 * 8; ++j)
+    {
+        pieceTo[j] = pieceTo[0];
+        fromTo[j]  = fromTo[0];
+    }
+
+    // Each entry is gathered as the high half of the 32 bits ending with it. No
+    // offset is 0, since moves have distinct squares and move real pieces, so all
+    // the reads stay inside the tables.
+    auto gather = [](const void* table, __m256i offsets) {
+        const int* words = reinterpret_cast<const int*>(static_cast<const int16_t*>(table) - 1);
+        return _mm256_srai_epi32(_mm256_i32gather_epi32(words, offsets, 2), 16);
+    };
+
+    const __m256 three = _mm256_set1_ps(3.0f);
+
+    for (; i < n; i += 8)
+    {
+        const __m256i pt = _mm256_load_si256(reinterpret_cast<const __m256i*>(pieceTo + i));
+        const __m256i ft = _mm256_load_si256(reinterpret_cast<const __m256i*>(fromTo + i));
+
+        __m256i v = _mm256_add_epi32(gather(ph, pt), gather(c0, pt));
+        v         = _mm256_add_epi32(v, v);
+        v         = _mm256_add_epi32(v, gather(mh, ft));
+        v         = _mm256_add_epi32(v, gather(c1, pt));
+        v         = _mm256_add_epi32(v, _mm256_add_epi32(gather(c3, pt), gather(c5, pt)));
+
+        // Exact division by 3, truncated: the quotient of a multiple of 3 is exact
+        // in single precision, and the others are at least 1/3 away from an integer.
+        const __m256 c2f = _mm256_cvtepi32_ps(gather(c2, pt));
+        v = _mm256_add_epi32(v, _mm256_cvttps_epi32(_mm256_div_ps(c2f, three)));
+
+        _mm256_store_si256(reinterpret_cast<__m256i*>(value + i), v);
+    }
+
+#endif
+
+    for (; i < n; ++i)
+    {
+        const int pt = pieceTo[i];
+        value[i] = mh[fromTo[i]] + 2 * ph[pt] + 2 * c0[pt] + c1[pt] + c2[pt] / 3 + c3[pt] + c5[pt];
+    }
+
+    for (int j = 0; j < n; ++j)
+        cur[j].value = value[j];
+}
+
 // Returns the next move satisfying a predicate function.
 // It never returns the TT move.
 template<MovePicker::PickType T, typename Pred>
@@ -379,4 +453,32 @@ top:
     return Move::none();  // Silence warning
 }
 
+// Writes to out the moves among the next 'distance' candidates of the current
+// stage which have not been returned by a previous call, and returns how many.
+// Only the stages which iterate a sorted move list in order take part.
+int MovePicker::upcoming_moves(int distance, Move* out) {
+
+    if (stage != GOOD_CAPTURE && stage != GOOD_QUIET && stage != BAD_CAPTURE
+        && stage != BAD_QUIET && stage != QCAPTURE)
+        return 0;
+
+    const ExtMove* first =
+      upcomingStage == stage ? std::max<const ExtMove*>(cur, upcomingEnd) : cur;
+    const ExtMove* last  = std::min<const ExtMove*>(cur + distance, endMoves);
+    int            count = 0;
+
+    for (const ExtMove* m = first; m < last; ++m)
+        if (*m != ttMove)
+            out[count++] = *m;
+
+    upcomingStage = stage;
+    upcomingEnd   = std::max(first, last);
+    return count;
+}
+
+// Whether the move just returned by next_move() was returned by upcoming_moves() before
+bool MovePicker::last_move_was_upcoming() const {
+    return upcomingStage == stage && cur - 1 < upcomingEnd;
+}
+
 }  // namespace Stockfish
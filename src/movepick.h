@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
@@ -80,6 +81,50 @@ class StatsEntry {
     }
 };
 
+// A history of type Packed<S> stores its values in the integer type S, in steps of
+// the smallest power of two that makes D fit, which for a narrow S saves cache at
+// the cost of precision, as each update is rounded to the nearest step. Entries are
+// read and written with relaxed atomics, so that threads can share such a table.
+// Concurrent updates of the same entry may then overwrite each other, which is
+// harmless for a history.
+template<typename S>
+struct Packed {};
+
+template<typename S, int D>
+class StatsEntry<Packed<S>, D> {
+
+    static constexpr int shift() {
+        int s = 0;
+        while ((D >> s) > std::numeric_limits<S>::max())
+            ++s;
+        return s;
+    }
+
+    static constexpr int Shift = shift();
+
+    std::atomic<S> entry;
+
+    void store(int v) {
+        entry.store(S((v + (1 << Shift >> 1)) >> Shift), std::memory_order_relaxed);
+    }
+
+   public:
+    StatsEntry() = default;
+    StatsEntry(const StatsEntry& e) :
+        entry(e.entry.load(std::memory_order_relaxed)) {}
+
+    void operator=(int v) { store(v); }
+    operator int() const { return int(entry.load(std::memory_order_relaxed)) * (1 << Shift); }
+
+    void operator<<(int bonus) {
+        int clampedBonus = std::clamp(bonus, -D, D);
+        int v            = int(*this);
+        store(v + clampedBonus - v * std::abs(clampedBonus) / D);
+
+        assert(std::abs(int(*this)) <= D + (1 << Shift));
+    }
+};
+
 // Stats is a generic N-dimensional array used to store various statistics.
 // The first template parameter T is the base type of the array, and the second
 // template parameter D limits the range of updates in [-D, D] when we update
@@ -89,7 +134,8 @@ template<typename T, int D, int Size, int... Sizes>
 struct Stats: public std::array<Stats<T, D, Sizes...>, Size> {
     using stats = Stats<T, D, Size, Sizes...>;
 
-    void fill(const T& v) {
+    template<typename V>
+    void fill(const V& v) {
 
         // For standard-layout 'this' points to the first struct member
         assert(std::is_standard_layout_v<stats>);
@@ -103,6 +149,28 @@ struct Stats: public std::array<Stats<T, D, Sizes...>, Size> {
 template<typename T, int D, int Size>
 struct Stats<T, D, Size>: public std::array<StatsEntry<T, D>, Size> {};
 
+// Only 12 of the PIECE_NB piece codes are real pieces, so tables addressed by
+// [piece][to] store rows for those and for NO_PIECE only, which is used as a
+// sentinel. The unused codes 7, 8 and 15 would otherwise waste a fifth of the
+// memory, twice over for the continuation histories.
+constexpr int PIECE_SLOT_NB = 13;
+
+constexpr int piece_slot(Piece pc) {
+    assert(pc == NO_PIECE || ((pc & 7) && (pc & 7) <= KING));
+    return pc - 2 * (pc >> 3);
+}
+
+template<typename T, int D>
+struct PieceToStats: public Stats<T, D, PIECE_SLOT_NB, SQUARE_NB> {
+    using Base = Stats<T, D, PIECE_SLOT_NB, SQUARE_NB>;
+
+    auto&       operator[](Piece pc) { return Base::operator[](piece_slot(pc)); }
+    const auto& operator[](Piece pc) const { return Base::operator[](piece_slot(pc)); }
+
+    // The entries as a flat array, addressed by piece_slot(pc) * SQUARE_NB + to
+    const StatsEntry<T, D>* entries() const { return Base::operator[](0).data(); }
+};
+
 // In stats table, D=0 means that the template parameter is not used
 enum StatsParams {
     NOT_USED = 0
@@ -125,21 +193,35 @@ using CounterMoveHistory = Stats<Move, NOT_USED, PIECE_NB, SQUARE_NB>;
 // CapturePieceToHistory is addressed by a move's [piece][to][captured piece type]
 using CapturePieceToHistory = Stats<int16_t, 10692, PIECE_NB, SQUARE_NB, PIECE_TYPE_NB>;
 
+// The continuation and pawn histories are the big tables. With COMPACT_HISTORY
+// (make compacthistory=yes) they store 8 bit values.
+#if defined(COMPACT_HISTORY)
+using BigHistoryValue = Packed<int8_t>;
+#else
+using BigHistoryValue = Packed<int16_t>;
+#endif
+
 // PieceToHistory is like ButterflyHistory but is addressed by a move's [piece][to]
-using PieceToHistory = Stats<int16_t, 29952, PIECE_NB, SQUARE_NB>;
+using PieceToHistory = PieceToStats<BigHistoryValue, 29952>;
 
 // ContinuationHistory is the combined history of a given pair of moves, usually
 // the current one given a previous one. The nested history table is based on
 // PieceToHistory instead of ButterflyBoards.
 // (~63 elo)
-using ContinuationHistory = Stats<PieceToHistory, NOT_USED, PIECE_NB, SQUARE_NB>;
+using ContinuationHistory = PieceToStats<PieceToHistory, NOT_USED>;
 
 // PawnHistory is addressed by the pawn structure and a move's [piece][to]
-using PawnHistory = Stats<int16_t, 8192, PAWN_HISTORY_SIZE, PIECE_NB, SQUARE_NB>;
+struct PawnHistory: public std::array<PieceToStats<BigHistoryValue, 8192>, PAWN_HISTORY_SIZE> {
+    template<typename V>
+    void fill(const V& v) {
+        for (auto& h : *this)
+            h.fill(v);
+    }
+};
 
 // CorrectionHistory is addressed by color and pawn structure
 using CorrectionHistory =
-  Stats<int16_t, CORRECTION_HISTORY_LIMIT, COLOR_NB, CORRECTION_HISTORY_SIZE>;
+  Stats<Packed<int16_t>, CORRECTION_HISTORY_LIMIT, COLOR_NB, CORRECTION_HISTORY_SIZE>;
 
 // MovePicker class is used to pick one pseudo-legal move at a time from the
 // current position. The most important method is next_move(), which returns a
@@ -176,11 +258,17 @@ class MovePicker {
     MovePicker(const Position&, Move, int, const CapturePieceToHistory*);
     Move next_move(bool skipQuiets = false);
 
+    // Lookahead over the moves that the following next_move() calls will consider
+    // in the current stage, so that the caller can prefetch data for them.
+    int  upcoming_moves(int distance, Move* out);
+    bool last_move_was_upcoming() const;
+
    private:
     template<PickType T, typename Pred>
     Move select(Pred);
     template<GenType>
     void     score();
+    void     score_quiet_histories();
     ExtMove* begin() { return cur; }
     ExtMove* end() { return endMoves; }
 
@@ -195,6 +283,9 @@ class MovePicker {
     int     threshold;
     Depth   depth;
     ExtMove moves[MAX_MOVES];
+
+    const ExtMove* upcomingEnd   = nullptr;  // End of the moves already returned
+    int            upcomingStage = -1;       // by upcoming_moves() in this stage
 };
 
 }  // namespace Stockfish
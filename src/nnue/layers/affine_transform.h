@@ -21,6 +21,8 @@
 #ifndef NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
 #define NNUE_LAYERS_AFFINE_TRANSFORM_H_INCLUDED
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 
@@ -295,6 +297,25 @@ class AffineTransform {
 #endif
     }
 
+    // Forward propagation of several inputs at once, with AMX tiles when available
+    void propagate_batch(const InputType* const* input,
+                         OutputType* const*      output,
+                         std::size_t             count) const {
+#if defined(USE_AMX)
+        if constexpr ((OutputDimensions == 16 || OutputDimensions == 32)
+                      && (PaddedInputDimensions % 64 == 0 || PaddedInputDimensions == 32))
+            if (Simd::amx_available())
+            {
+                for (std::size_t i = 0; i < count; i += 16)
+                    Simd::amx_affine_16<PaddedInputDimensions, OutputDimensions>(
+                      input + i, output + i, std::min<std::size_t>(16, count - i), weights, biases);
+                return;
+            }
+#endif
+        for (std::size_t i = 0; i < count; ++i)
+            propagate(input[i], output[i]);
+    }
+
    private:
     using BiasType   = OutputType;
     using WeightType = std::int8_t;
@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 
@@ -265,6 +266,124 @@ class AffineTransformSparseInput {
 #endif
     }
 
+    // Forward propagation of an input which differs from prevInput, for which the
+    // output was prevOutput, in some of its 32 bit blocks. The columns of those are
+    // applied as the difference of their new and old contributions, which gives
+    // exactly the output of propagate().
+    void propagate_delta(const InputType*  input,
+                         const InputType*  prevInput,
+                         const OutputType* prevOutput,
+                         OutputType*       output) const {
+
+#if (USE_SSSE3 | (USE_NEON >= 8))
+    #if defined(USE_AVX512)
+        using invec_t  = __m512i;
+        using outvec_t = __m512i;
+        #define vec_set_32 _mm512_set1_epi32
+        #define vec_zero_32 _mm512_setzero_si512
+        #define vec_sub_32 _mm512_sub_epi32
+        #define vec_add_dpbusd_32 Simd::m512_add_dpbusd_epi32
+    #elif defined(USE_AVX2)
+        using invec_t  = __m256i;
+        using outvec_t = __m256i;
+        #define vec_set_32 _mm256_set1_epi32
+        #define vec_zero_32 _mm256_setzero_si256
+        #define vec_sub_32 _mm256_sub_epi32
+        #define vec_add_dpbusd_32 Simd::m256_add_dpbusd_epi32
+    #elif defined(USE_SSSE3)
+        using invec_t  = __m128i;
+        using outvec_t = __m128i;
+        #define vec_set_32 _mm_set1_epi32
+        #define vec_zero_32 _mm_setzero_si128
+        #define vec_sub_32 _mm_sub_epi32
+        #define vec_add_dpbusd_32 Simd::m128_add_dpbusd_epi32
+    #elif defined(USE_NEON_DOTPROD)
+        using invec_t  = int8x16_t;
+        using outvec_t = int32x4_t;
+        #define vec_set_32(a) vreinterpretq_s8_u32(vdupq_n_u32(a))
+        #define vec_zero_32() vdupq_n_s32(0)
+        #define vec_sub_32 vsubq_s32
+        #define vec_add_dpbusd_32 Simd::dotprod_m128_add_dpbusd_epi32
+    #elif defined(USE_NEON)
+        using invec_t  = int8x16_t;
+        using outvec_t = int32x4_t;
+        #define vec_set_32(a) vreinterpretq_s8_u32(vdupq_n_u32(a))
+        #define vec_zero_32() vdupq_n_s32(0)
+        #define vec_sub_32 vsubq_s32
+        #define vec_add_dpbusd_32 Simd::neon_m128_add_dpbusd_epi32
+    #endif
+        static constexpr IndexType OutputSimdWidth = sizeof(outvec_t) / sizeof(OutputType);
+
+        constexpr IndexType NumChunks = ceil_to_multiple<IndexType>(InputDimensions, 8) / ChunkSize;
+        constexpr IndexType NumRegs   = OutputDimensions / OutputSimdWidth;
+        std::uint16_t       nnz[NumChunks];
+        IndexType           count;
+
+        const auto input32     = reinterpret_cast<const std::int32_t*>(input);
+        const auto prevInput32 = reinterpret_cast<const std::int32_t*>(prevInput);
+
+        // Find indices of the changed 32-bit blocks
+        alignas(CacheLineSize) std::int32_t changed[NumChunks];
+        for (IndexType i = 0; i < NumChunks; ++i)
+            changed[i] = input32[i] != prevInput32[i];
+
+        find_nnz<NumChunks>(changed, nnz, count);
+
+        const outvec_t* prevvec = reinterpret_cast<const outvec_t*>(prevOutput);
+        outvec_t        acc[NumRegs], sub[NumRegs];
+        for (IndexType k = 0; k < NumRegs; ++k)
+        {
+            acc[k] = prevvec[k];
+            sub[k] = vec_zero_32();
+        }
+
+        for (IndexType j = 0; j < count; ++j)
+        {
+            const auto    i   = nnz[j];
+            const invec_t in  = vec_set_32(input32[i]);
+            const invec_t old = vec_set_32(prevInput32[i]);
+            const auto    col =
+              reinterpret_cast<const invec_t*>(&weights[i * OutputDimensions * ChunkSize]);
+            for (IndexType k = 0; k < NumRegs; ++k)
+            {
+                vec_add_dpbusd_32(acc[k], in, col[k]);
+                vec_add_dpbusd_32(sub[k], old, col[k]);
+            }
+        }
+
+        outvec_t* outptr = reinterpret_cast<outvec_t*>(output);
+        for (IndexType k = 0; k < NumRegs; ++k)
+            outptr[k] = vec_sub_32(acc[k], sub[k]);
+    #undef vec_set_32
+    #undef vec_zero_32
+    #undef vec_sub_32
+    #undef vec_add_dpbusd_32
+#else
+        (void) prevInput;
+        (void) prevOutput;
+        propagate(input, output);
+#endif
+    }
+
+    // Forward propagation of several inputs at once, with AMX tiles when available
+    void propagate_batch(const InputType* const* input,
+                         OutputType* const*      output,
+                         std::size_t             count) const {
+#if defined(USE_AMX)
+        if constexpr ((OutputDimensions == 16 || OutputDimensions == 32)
+                      && (PaddedInputDimensions % 64 == 0 || PaddedInputDimensions == 32))
+            if (Simd::amx_available())
+            {
+                for (std::size_t i = 0; i < count; i += 16)
+                    Simd::amx_affine_16<PaddedInputDimensions, OutputDimensions>(
+                      input + i, output + i, std::min<std::size_t>(16, count - i), weights, biases);
+                return;
+            }
+#endif
+        for (std::size_t i = 0; i < count; ++i)
+            propagate(input[i], output[i]);
+    }
+
    private:
     using BiasType   = OutputType;
     using WeightType = std::int8_t;
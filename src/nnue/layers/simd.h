@@ -35,6 +35,17 @@
     #include <arm_neon.h>
 #endif
 
+#if defined(USE_AMX)
+    #include <cpuid.h>
+    #include <cstddef>
+    #include <cstdint>
+    #include <cstring>
+    #if defined(__linux__)
+        #include <sys/syscall.h>
+        #include <unistd.h>
+    #endif
+#endif
+
 namespace Stockfish::Simd {
 
 #if defined(USE_AVX512)
@@ -128,6 +139,101 @@ dotprod_m128_add_dpbusd_epi32(int32x4_t& acc, int8x16_t a, int8x16_t b) {
     int16x8_t sum      = vpaddq_s16(product0, product1);
     acc                = vpadalq_s16(acc, sum);
 }
+#endif
+
+#if defined(USE_AMX)
+
+// AMX needs CPU support and, on Linux, permission from the kernel to use the
+// tile data state. Without either, callers fall back to the AVX-512 kernels.
+[[maybe_unused]] static bool amx_available() {
+    static const bool available = []() {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+
+        const bool amxInt8 = (edx >> 24) & (edx >> 25) & 1;  // AMX-TILE and AMX-INT8
+    #if defined(__linux__)
+        constexpr int ArchReqXcompPerm = 0x1023, XFeatureXtiledata = 18;
+        return amxInt8 && !syscall(SYS_arch_prctl, ArchReqXcompPerm, XFeatureXtiledata);
+    #else
+        return amxInt8;
+    #endif
+    }();
+
+    return available;
+}
+
+// Computes output[r] = biases + weights * input[r] for up to 16 rows at once, where
+// weights use the layout of the affine layers with SSSE3, i.e. 4 consecutive inputs
+// per output, for each group of 4 inputs. Each input row holds K uint8 values.
+template<std::size_t K, std::size_t N>
+[[maybe_unused]] static void amx_affine_16(const std::uint8_t* const* input,
+                                           std::int32_t* const*       output,
+                                           std::size_t                rows,
+                                           const std::int8_t*         weights,
+                                           const std::int32_t*        biases) {
+    static_assert(N == 16 || N == 32, "One or two accumulator tiles");
+
+    constexpr std::size_t KStep = K < 64 ? K : 64;
+    static_assert(K % KStep == 0 && KStep % 4 == 0);
+
+    struct alignas(64) TileConfig {
+        std::uint8_t  palette;
+        std::uint8_t  startRow;
+        std::uint8_t  reserved[14];
+        std::uint16_t colsb[16];
+        std::uint8_t  rows[16];
+    } cfg{};
+
+    // tmm0-1: accumulators, tmm4: inputs, tmm5: weights
+    cfg.palette = 1;
+    for (int t : {0, 1, 4})
+    {
+        cfg.rows[t]  = std::uint8_t(rows);
+        cfg.colsb[t] = t == 4 ? KStep : 64;
+    }
+    cfg.rows[5]  = KStep / 4;
+    cfg.colsb[5] = 64;
+
+    // The input rows are copied one slice of KStep columns at a time, which keeps
+    // the tile buffers at a few KB of stack for the wide first layer
+    alignas(64) std::uint8_t a[16 * KStep];
+    alignas(64) std::int32_t c[16 * N];
+
+    for (std::size_t r = 0; r < rows; ++r)
+        std::memcpy(c + r * N, biases, N * sizeof(std::int32_t));
+
+    _tile_loadconfig(&cfg);
+    _tile_loadd(0, c, N * 4);
+    if constexpr (N == 32)
+        _tile_loadd(1, c + 16, N * 4);
+
+    for (std::size_t k = 0; k < K; k += KStep)
+    {
+        for (std::size_t r = 0; r < rows; ++r)
+            std::memcpy(a + r * KStep, input[r] + k, KStep);
+
+        _tile_loadd(4, a, KStep);
+
+        _tile_loadd(5, weights + k * N, N * 4);
+        _tile_dpbusd(0, 4, 5);
+
+        if constexpr (N == 32)
+        {
+            _tile_loadd(5, weights + k * N + 64, N * 4);
+            _tile_dpbusd(1, 4, 5);
+        }
+    }
+
+    _tile_stored(0, c, N * 4);
+    if constexpr (N == 32)
+        _tile_stored(1, c + 16, N * 4);
+    _tile_release();
+
+    for (std::size_t r = 0; r < rows; ++r)
+        std::memcpy(output[r], c + r * N, N * sizeof(std::int32_t));
+}
+
 #endif
 }
 
@@ -18,7 +18,11 @@
 
 #include "network.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -44,7 +48,12 @@ namespace {
 //     const unsigned char *const gEmbeddedNNUEEnd;     // a marker to the end
 //     const unsigned int         gEmbeddedNNUESize;    // the size of the embedded file
 // Note that this does not work in Microsoft Visual Studio.
-#if !defined(_MSC_VER) && !defined(NNUE_EMBEDDING_OFF)
+// In a fat binary (make fat) the nets are embedded once by dispatch.cpp and
+// the engine builds for the different architectures share them.
+#if !defined(_MSC_VER) && !defined(NNUE_EMBEDDING_OFF) && defined(NNUE_EMBEDDING_EXTERN)
+INCBIN_EXTERN(EmbeddedNNUEBig);
+INCBIN_EXTERN(EmbeddedNNUESmall);
+#elif !defined(_MSC_VER) && !defined(NNUE_EMBEDDING_OFF)
 INCBIN(EmbeddedNNUEBig, EvalFileDefaultNameBig);
 INCBIN(EmbeddedNNUESmall, EvalFileDefaultNameSmall);
 #else
@@ -106,6 +115,61 @@ bool write_parameters(std::ostream& stream, const T& reference) {
 
 }  // namespace Detail
 
+namespace {
+
+// A net image holds the parameters exactly as laid out in memory, i.e. already
+// permuted and scaled for this build, so that the feature transformer can be
+// mapped from the file rather than parsed. Images are only valid for binaries of
+// the same SIMD architecture and endianness, which the header records.
+constexpr char          ImageMagic[4]  = {'S', 'F', 'N', 'I'};
+constexpr std::uint32_t ImageVersion   = 1;
+constexpr std::size_t   ImageAlignment = 2 * 1024 * 1024;  // Allows huge pages for the payload
+constexpr auto          ImageSuffix    = ".img";
+
+struct ImageHeader {
+    char          magic[4];
+    std::uint32_t version;
+    std::uint32_t hash;
+    std::uint32_t layout;
+    std::uint64_t transformerSize;
+    std::uint64_t archSize;
+    std::uint64_t transformerOffset;
+    std::uint32_t descriptionSize;
+};
+
+// The weight permutations of the layers depend on the instruction set
+constexpr std::uint32_t image_layout() {
+    std::uint32_t layout = 0;
+#if defined(USE_SSE2)
+    layout |= 1 << 0;
+#endif
+#if defined(USE_SSSE3)
+    layout |= 1 << 1;
+#endif
+#if defined(USE_AVX2)
+    layout |= 1 << 2;
+#endif
+#if defined(USE_AVX512)
+    layout |= 1 << 3;
+#endif
+#if defined(USE_NEON)
+    layout |= std::uint32_t(USE_NEON) << 8;
+#endif
+#if defined(USE_NEON_DOTPROD)
+    layout |= 1 << 16;
+#endif
+    return layout;
+}
+
+bool is_image(const std::string& path) {
+    std::ifstream stream(path, std::ios::binary);
+    char          magic[4];
+
+    return stream.read(magic, sizeof(magic)) && !std::memcmp(magic, ImageMagic, sizeof(magic));
+}
+
+}
+
 template<typename Arch, typename Transformer>
 Network<Arch, Transformer>::Network(const Network<Arch, Transformer>& other) :
     evalFile(other.evalFile),
@@ -143,6 +207,49 @@ Network<Arch, Transformer>::operator=(const Network<Arch, Transformer>& other) {
     return *this;
 }
 
+template<typename Arch, typename Transformer>
+Network<Arch, Transformer> Network<Arch, Transformer>::replica(bool copyTransformer,
+                                                               bool copyLayers) const {
+    Network copy(evalFile, embeddedType);
+
+    copy.featureTransformer = copyTransformer && featureTransformer
+                              ? make_unique_large_page<Transformer>(*featureTransformer)
+                              : featureTransformer;
+
+    if (copyLayers && network)
+    {
+        auto layers = make_unique_aligned<Arch[]>(LayerStacks);
+        for (std::size_t i = 0; i < LayerStacks; ++i)
+            layers[i] = network[i];
+
+        copy.network = std::move(layers);
+    }
+    else
+        copy.network = network;
+
+    return copy;
+}
+
+template<typename Arch, typename Transformer>
+void Network<Arch, Transformer>::relocate_transformer(
+  const std::function<void(void*, const void*, std::size_t)>& copy) {
+
+    static_assert(std::is_trivially_copyable_v<Transformer>);
+
+    // A mapped net image is already shared through the page cache
+    auto deleter = std::get_deleter<TransformerDeleter>(featureTransformer);
+    if (!featureTransformer || (deleter && deleter->mapped))
+        return;
+
+    // Not constructed in place, so that no page is touched before copy() writes it
+    auto mem = static_cast<Transformer*>(aligned_large_pages_alloc(sizeof(Transformer)));
+    if (!mem)
+        return;
+
+    copy(mem, featureTransformer.get(), sizeof(Transformer));
+    featureTransformer = std::shared_ptr<Transformer>(mem, LargePageDeleter<Transformer>());
+}
+
 template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::load(const std::string& rootDirectory, std::string evalfilePath) {
 #if defined(DEFAULT_NNUE_DIRECTORY)
@@ -155,6 +262,21 @@ void Network<Arch, Transformer>::load(const std::string& rootDirectory, std::str
     if (evalfilePath.empty())
         evalfilePath = evalFile.defaultName;
 
+    // An image of the default net, saved next to it, spares parsing the embedded copy
+    if (evalfilePath == evalFile.defaultName)
+        for (const auto& directory : dirs)
+            if (directory != "<internal>" && evalFile.current != evalfilePath
+                && is_image(directory + evalfilePath + ImageSuffix))
+            {
+                auto description = load_image(directory + evalfilePath + ImageSuffix);
+
+                if (description.has_value())
+                {
+                    evalFile.current        = evalfilePath;
+                    evalFile.netDescription = description.value();
+                }
+            }
+
     for (const auto& directory : dirs)
     {
         if (evalFile.current != evalfilePath)
@@ -204,35 +326,297 @@ bool Network<Arch, Transformer>::save(const std::optional<std::string>& filename
 }
 
 
+template<typename Arch, typename Transformer>
+bool Network<Arch, Transformer>::save_image(const std::optional<std::string>& filename) const {
+    static_assert(std::is_trivially_copyable_v<Transformer> && std::is_trivially_copyable_v<Arch>);
+
+    const std::string actualFilename =
+      filename.has_value() ? filename.value() : evalFile.current + ImageSuffix;
+
+    if (!featureTransformer || evalFile.current.empty() || evalFile.current == "None")
+    {
+        sync_cout << "Failed to export a net image" << sync_endl;
+        return false;
+    }
+
+    ImageHeader header{};
+    std::memcpy(header.magic, ImageMagic, sizeof(ImageMagic));
+    header.version           = ImageVersion;
+    header.hash              = Network::hash;
+    header.layout            = image_layout();
+    header.transformerSize   = sizeof(Transformer);
+    header.archSize          = sizeof(Arch);
+    header.descriptionSize   = std::uint32_t(evalFile.netDescription.size());
+    header.transformerOffset = ImageAlignment;
+
+    const std::size_t headerSize = sizeof(header) + header.descriptionSize;
+    assert(headerSize <= ImageAlignment);
+
+    std::ofstream stream(actualFilename, std::ios_base::binary);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(evalFile.netDescription.data(), header.descriptionSize);
+    stream.write(std::vector<char>(ImageAlignment - headerSize).data(),
+                 ImageAlignment - headerSize);
+    stream.write(reinterpret_cast<const char*>(featureTransformer.get()), sizeof(Transformer));
+
+    for (std::size_t i = 0; i < LayerStacks; ++i)
+        stream.write(reinterpret_cast<const char*>(&network[i]), sizeof(Arch));
+
+    const bool saved = bool(stream);
+
+    sync_cout << (saved ? "Network image saved successfully to " + actualFilename
+                        : "Failed to export a net image")
+              << sync_endl;
+    return saved;
+}
+
+
 template<typename Arch, typename Transformer>
 NetworkOutput
 Network<Arch, Transformer>::evaluate(const Position&                         pos,
                                      AccumulatorCaches::Cache<FTDimensions>* cache) const {
+    const int bucket = (pos.count<ALL_PIECES>() - 1) / 4;
+
+#if defined(INCREMENTAL_L1)
+    // The features are transformed next to the accumulator, where the first layer
+    // of the next positions finds them. It starts from the last evaluation of the
+    // parent or grandparent with the same layer stack, which share most inputs.
+    auto& accumulator = Transformer::accumulator(pos.state());
+
+    static_assert(sizeof(accumulator.l1Output)
+                  >= sizeof(typename decltype(network[0].fc_0)::OutputBuffer));
+
+    const auto psqt = featureTransformer->transform(pos, cache, accumulator.l1Input, bucket);
+
+    const Accumulator<FTDimensions>* prev = nullptr;
+    const StateInfo*                 st   = pos.state()->previous;
+    for (int i = 0; i < 2 && st && st->acc && !prev; ++i, st = st->previous)
+        if (Transformer::accumulator(st).l1Bucket == bucket + 1)
+            prev = &Transformer::accumulator(st);
+
+    const auto positional =
+      network[bucket].propagate(accumulator.l1Input, prev ? prev->l1Input : nullptr,
+                                prev ? prev->l1Output : nullptr, accumulator.l1Output);
+
+    accumulator.l1Bucket = bucket + 1;
+#else
     // We manually align the arrays on the stack because with gcc < 9.3
     // overaligning stack variables with alignas() doesn't work correctly.
 
     constexpr uint64_t alignment = CacheLineSize;
 
-#if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
+    #if defined(ALIGNAS_ON_STACK_VARIABLES_BROKEN)
     TransformedFeatureType
       transformedFeaturesUnaligned[FeatureTransformer<FTDimensions, nullptr>::BufferSize
                                    + alignment / sizeof(TransformedFeatureType)];
 
     auto* transformedFeatures = align_ptr_up<alignment>(&transformedFeaturesUnaligned[0]);
-#else
+    #else
     alignas(alignment) TransformedFeatureType
       transformedFeatures[FeatureTransformer<FTDimensions, nullptr>::BufferSize];
-#endif
+    #endif
 
     ASSERT_ALIGNED(transformedFeatures, alignment);
 
-    const int  bucket     = (pos.count<ALL_PIECES>() - 1) / 4;
     const auto psqt       = featureTransformer->transform(pos, cache, transformedFeatures, bucket);
     const auto positional = network[bucket].propagate(transformedFeatures);
+#endif
+
     return {static_cast<Value>(psqt / OutputScale), static_cast<Value>(positional / OutputScale)};
 }
 
 
+template<typename Arch, typename Transformer>
+void Network<Arch, Transformer>::evaluate_batch(const Position* const*                  positions,
+                                           std::size_t                             count,
+                                           AccumulatorCaches::Cache<FTDimensions>* cache,
+                                           NetworkOutput*                          output) const {
+
+    // Only the AMX kernels of the affine layers evaluate several positions at once.
+    // Without them, going through the batch buffers is slower than evaluate().
+#if defined(USE_AMX)
+    if (!Simd::amx_available())
+#endif
+    {
+        for (std::size_t i = 0; i < count; ++i)
+            output[i] = evaluate(*positions[i], cache);
+        return;
+    }
+
+    struct alignas(CacheLineSize) TransformedFeatures {
+        TransformedFeatureType data[FeatureTransformer<FTDimensions, nullptr>::BufferSize];
+    };
+
+    auto features = make_unique_aligned<TransformedFeatures[]>(count);
+    auto buffers  = make_unique_aligned<typename Arch::Buffer[]>(count);
+
+    std::vector<const TransformedFeatureType*> featurePtrs(count);
+    std::vector<std::int32_t>                  psqt(count), positional(count), batchOut(count);
+    std::vector<int>                           buckets(count);
+    std::vector<std::size_t>                   order;
+
+    order.reserve(count);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        buckets[i] = (positions[i]->count<ALL_PIECES>() - 1) / 4;
+        psqt[i] = featureTransformer->transform(*positions[i], cache, features[i].data, buckets[i]);
+    }
+
+    // Group the positions by layer stack, as each bucket has its own weights
+    for (int bucket = 0; bucket < int(LayerStacks); ++bucket)
+    {
+        order.clear();
+        for (std::size_t i = 0; i < count; ++i)
+            if (buckets[i] == bucket)
+            {
+                featurePtrs[order.size()] = features[i].data;
+                order.push_back(i);
+            }
+
+        if (order.empty())
+            continue;
+
+        network[bucket].propagate_batch(featurePtrs.data(), buffers.get(), order.size(),
+                                        batchOut.data());
+
+        for (std::size_t j = 0; j < order.size(); ++j)
+            positional[order[j]] = batchOut[j];
+    }
+
+    for (std::size_t i = 0; i < count; ++i)
+        output[i] = {static_cast<Value>(psqt[i] / OutputScale),
+                     static_cast<Value>(positional[i] / OutputScale)};
+}
+
+
+template<typename Arch, typename Transformer>
+std::vector<StageTiming>
+Network<Arch, Transformer>::time_stages(const std::vector<Position*>&           positions,
+                                        std::size_t                             rounds,
+                                        AccumulatorCaches::Cache<FTDimensions>* cache) const {
+
+    struct alignas(CacheLineSize) TransformedFeatures {
+        TransformedFeatureType data[FeatureTransformer<FTDimensions, nullptr>::BufferSize];
+    };
+
+    const std::size_t count    = positions.size();
+    auto              features = make_unique_aligned<TransformedFeatures[]>(count);
+    auto              buffers  = make_unique_aligned<typename Arch::Buffer[]>(count);
+
+    std::vector<int> buckets(count);
+    std::size_t      changedRows = 0;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const DirtyPiece& dp = positions[i]->state()->dirtyPiece;
+
+        buckets[i] = (positions[i]->count<ALL_PIECES>() - 1) / 4;
+        for (int j = 0; j < dp.dirty_num; ++j)
+            changedRows += (dp.from[j] != SQ_NONE) + (dp.to[j] != SQ_NONE);
+    }
+
+    const auto invalidate = [&](std::size_t i) {
+        auto& accumulator = Transformer::accumulator(positions[i]->state());
+        accumulator.computed[WHITE] = accumulator.computed[BLACK] = false;
+    };
+
+    std::vector<StageTiming> timings;
+    InstructionCounter       counter;
+    volatile std::int32_t    sink = 0;
+
+    const auto time = [&](const char* name, std::size_t bytes, auto&& stage) {
+        const std::uint64_t instructions = counter.count();
+        const auto          start        = std::chrono::steady_clock::now();
+
+        for (std::size_t r = 0; r < rounds; ++r)
+            for (std::size_t i = 0; i < count; ++i)
+                stage(i);
+
+        const double ns =
+          std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+            .count();
+        const double calls = double(std::max<std::size_t>(rounds * count, 1));
+
+        timings.push_back(
+          {name, ns / calls, bytes, double(counter.count() - instructions) / calls});
+    };
+
+    // Both perspectives read one accumulator and write another, and an update
+    // also reads the weights of the changed features
+    constexpr std::size_t AccumulatorBytes =
+      sizeof(BiasType) * FTDimensions + sizeof(PSQTWeightType) * PSQTBuckets;
+    constexpr std::size_t RowBytes = Transformer::WeightsSize / Transformer::InputDimensions
+                                   + sizeof(PSQTWeightType) * PSQTBuckets;
+    const std::size_t     changedBytes = count ? 2 * changedRows * RowBytes / count : 0;
+
+    // The stages which read the accumulators invalidate them first, the
+    // refreshes leave them computed for the output of the feature transformer
+    time("accumulator update", 4 * AccumulatorBytes + changedBytes, [&](std::size_t i) {
+        invalidate(i);
+        featureTransformer->update_accumulators(*positions[i], cache);
+    });
+
+    time("accumulator refresh", 6 * AccumulatorBytes, [&](std::size_t i) {
+        invalidate(i);
+        featureTransformer->refresh_accumulators(*positions[i], cache);
+    });
+
+    time("transform", 2 * sizeof(BiasType) * FTDimensions + sizeof(features[0]),
+         [&](std::size_t i) {
+             sink += featureTransformer->transform(*positions[i], cache, features[i].data,
+                                                   buckets[i]);
+         });
+
+    time("sparse affine", sizeof(network[0].fc_0) + sizeof(features[0]), [&](std::size_t i) {
+        network[buckets[i]].fc_0.propagate(features[i].data, buffers[i].fc_0_out);
+    });
+
+    time("clipped relu",
+         sizeof(buffers[0].fc_0_out) + sizeof(buffers[0].ac_sqr_0_out)
+           + sizeof(buffers[0].ac_0_out),
+         [&](std::size_t i) {
+             auto& layers = network[buckets[i]];
+             auto& buffer = buffers[i];
+
+             layers.ac_sqr_0.propagate(buffer.fc_0_out, buffer.ac_sqr_0_out);
+             layers.ac_0.propagate(buffer.fc_0_out, buffer.ac_0_out);
+             std::memcpy(buffer.ac_sqr_0_out + Arch::FC_0_OUTPUTS, buffer.ac_0_out,
+                         Arch::FC_0_OUTPUTS * sizeof(buffer.ac_0_out[0]));
+         });
+
+    time("dense layers",
+         sizeof(network[0].fc_1) + sizeof(network[0].fc_2) + sizeof(buffers[0].ac_sqr_0_out)
+           + sizeof(buffers[0].fc_1_out) + sizeof(buffers[0].ac_1_out),
+         [&](std::size_t i) {
+             auto& layers = network[buckets[i]];
+             auto& buffer = buffers[i];
+
+             layers.fc_1.propagate(buffer.ac_sqr_0_out, buffer.fc_1_out);
+             layers.ac_1.propagate(buffer.fc_1_out, buffer.ac_1_out);
+             layers.fc_2.propagate(buffer.ac_1_out, buffer.fc_2_out);
+             sink += buffer.fc_2_out[0];
+         });
+
+    // The whole evaluation, of one position at a time and of batches
+    constexpr std::size_t      BatchSize = 64;
+    std::vector<NetworkOutput> outputs(count);
+
+    time("evaluate", 0, [&](std::size_t i) {
+        const auto [psqt, positional] = evaluate(*positions[i], cache);
+        sink += psqt + positional;
+    });
+
+    time("evaluate batch", 0, [&](std::size_t i) {
+        if (i % BatchSize == 0)
+            evaluate_batch(positions.data() + i, std::min(BatchSize, count - i), cache,
+                           outputs.data() + i);
+    });
+
+    return timings;
+}
+
+
 template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::verify(std::string evalfilePath) const {
     if (evalfilePath.empty())
@@ -313,7 +697,8 @@ template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::load_user_net(const std::string& dir,
                                                const std::string& evalfilePath) {
     std::ifstream stream(dir + evalfilePath, std::ios::binary);
-    auto          description = load(stream);
+    auto          description =
+      is_image(dir + evalfilePath) ? load_image(dir + evalfilePath) : load(stream);
 
     if (description.has_value())
     {
@@ -350,6 +735,59 @@ void Network<Arch, Transformer>::load_internal() {
 }
 
 
+// Loads a net image written by save_image(). The feature transformer is mapped
+// copy-on-write from the file, so processes using the same image share its pages.
+template<typename Arch, typename Transformer>
+std::optional<std::string> Network<Arch, Transformer>::load_image(const std::string& path) {
+    std::ifstream stream(path, std::ios::binary);
+    ImageHeader   header;
+
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, ImageMagic, sizeof(ImageMagic)))
+        return std::nullopt;
+
+    if (header.version != ImageVersion || header.hash != Network::hash
+        || header.layout != image_layout() || header.transformerSize != sizeof(Transformer)
+        || header.archSize != sizeof(Arch) || header.transformerOffset % ImageAlignment)
+    {
+        sync_cout << "info string The net image " << path
+                  << " was saved by an incompatible binary, use export_net_image to recreate it"
+                  << sync_endl;
+        return std::nullopt;
+    }
+
+    std::string description(header.descriptionSize, '\0');
+    stream.read(description.data(), header.descriptionSize);
+
+    auto arch = make_unique_aligned<Arch[]>(LayerStacks);
+    stream.seekg(std::streamoff(header.transformerOffset + sizeof(Transformer)));
+
+    for (std::size_t i = 0; i < LayerStacks; ++i)
+        stream.read(reinterpret_cast<char*>(&arch[i]), sizeof(Arch));
+
+    if (!stream)
+        return std::nullopt;
+
+    void* mem = map_file(path, header.transformerOffset, sizeof(Transformer));
+
+    if (mem)
+        featureTransformer = decltype(featureTransformer)(static_cast<Transformer*>(mem),
+                                                          TransformerDeleter(true));
+    else  // Can't map, e.g. on a filesystem without mmap support, so copy the payload
+    {
+        featureTransformer = make_unique_large_page<Transformer>();
+        stream.seekg(std::streamoff(header.transformerOffset));
+        stream.read(reinterpret_cast<char*>(featureTransformer.get()), sizeof(Transformer));
+
+        if (!stream)
+            return std::nullopt;
+    }
+
+    network = std::move(arch);
+    return description;
+}
+
+
 template<typename Arch, typename Transformer>
 void Network<Arch, Transformer>::initialize() {
     featureTransformer = make_unique_large_page<Transformer>();
@@ -446,10 +884,10 @@ bool Network<Arch, Transformer>::write_parameters(std::ostream&      stream,
 
 template class Network<
   NetworkArchitecture<TransformedFeatureDimensionsBig, L2Big, L3Big>,
-  FeatureTransformer<TransformedFeatureDimensionsBig, &StateInfo::accumulatorBig>>;
+  FeatureTransformer<TransformedFeatureDimensionsBig, &AccumulatorState::accumulatorBig>>;
 
 template class Network<
   NetworkArchitecture<TransformedFeatureDimensionsSmall, L2Small, L3Small>,
-  FeatureTransformer<TransformedFeatureDimensionsSmall, &StateInfo::accumulatorSmall>>;
+  FeatureTransformer<TransformedFeatureDimensionsSmall, &AccumulatorState::accumulatorSmall>>;
 
 }  // namespace Stockfish::Eval::NNUE
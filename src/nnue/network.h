@@ -19,11 +19,16 @@
 #ifndef NETWORK_H_INCLUDED
 #define NETWORK_H_INCLUDED
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
 #include <tuple>
+#include <vector>
 #include <utility>
 
 #include "../memory.h"
@@ -43,6 +48,14 @@ enum class EmbeddedNNUEType {
 
 using NetworkOutput = std::tuple<Value, Value>;
 
+// Averages per call of a stage of the evaluation, see Network::time_stages()
+struct StageTiming {
+    std::string name;
+    double      ns;
+    std::size_t bytes;         // Read and written, a lower bound for sparse stages, 0 if unknown
+    double      instructions;  // 0 if they cannot be counted
+};
+
 template<typename Arch, typename Transformer>
 class Network {
     static constexpr IndexType FTDimensions = Arch::TransformedFeatureDimensions;
@@ -60,18 +73,54 @@ class Network {
 
     void load(const std::string& rootDirectory, std::string evalfilePath);
     bool save(const std::optional<std::string>& filename) const;
+    // Saves the parameters as laid out in memory, see load_image()
+    bool save_image(const std::optional<std::string>& filename) const;
 
     NetworkOutput evaluate(const Position&                         pos,
                            AccumulatorCaches::Cache<FTDimensions>* cache) const;
 
+    // Evaluates count positions at once, for bulk scoring outside of search.
+    // The positions must be independent, i.e. not share StateInfo objects.
+    // It only pays off with AMX (ARCH=x86-64-amx on a CPU that has it), where the
+    // affine layers multiply a whole batch at once. Otherwise it just calls
+    // evaluate() on each position.
+    void evaluate_batch(const Position* const*                  positions,
+                        std::size_t                             count,
+                        AccumulatorCaches::Cache<FTDimensions>* cache,
+                        NetworkOutput*                          output) const;
 
     void hint_common_access(const Position&                         pos,
                             AccumulatorCaches::Cache<FTDimensions>* cache) const;
 
+    // Runs each stage of the evaluation, rounds times, over positions whose
+    // previous positions have computed accumulators. For bench nnue.
+    std::vector<StageTiming> time_stages(const std::vector<Position*>&           positions,
+                                         std::size_t                             rounds,
+                                         AccumulatorCaches::Cache<FTDimensions>* cache) const;
+
     void          verify(std::string evalfilePath) const;
+    // Bytes of feature transformer weights and the fraction of them rounded to fit
+    std::pair<std::size_t, double> feature_weights() const {
+        return {Transformer::WeightsSize, featureTransformer->rounded_weights()};
+    }
     NnueEvalTrace trace_evaluate(const Position&                         pos,
                                  AccumulatorCaches::Cache<FTDimensions>* cache) const;
 
+    // A copy for another NUMA node. The parts which are not copied, into memory
+    // first touched by the calling thread, are shared with this network.
+    Network replica(bool copyTransformer, bool copyLayers) const;
+
+    // Moves the feature transformer into new memory, filled by copy(dst, src, size),
+    // for instance to spread its pages over the NUMA nodes.
+    void relocate_transformer(const std::function<void(void*, const void*, std::size_t)>& copy);
+
+    // Address and size of the feature transformer and of the layer stacks,
+    // which replicas may share.
+    std::array<std::pair<const void*, std::size_t>, 2> memory_blocks() const {
+        return {{{featureTransformer.get(), sizeof(Transformer)},
+                 {network.get(), sizeof(Arch) * LayerStacks}}};
+    }
+
    private:
     void load_user_net(const std::string&, const std::string&);
     void load_internal();
@@ -87,11 +136,31 @@ class Network {
     bool read_parameters(std::istream&, std::string&) const;
     bool write_parameters(std::ostream&, const std::string&) const;
 
-    // Input feature converter
-    LargePagePtr<Transformer> featureTransformer;
+    std::optional<std::string> load_image(const std::string& path);
+
+    // The feature transformer is either allocated or mapped from a net image
+    struct TransformerDeleter {
+        TransformerDeleter(bool m = false) :
+            mapped(m) {}
+        TransformerDeleter(LargePageDeleter<Transformer>) :
+            mapped(false) {}
+
+        void operator()(Transformer* ptr) const {
+            if (mapped)
+                unmap_file(ptr, sizeof(Transformer));
+            else
+                LargePageDeleter<Transformer>()(ptr);
+        }
+
+        bool mapped;
+    };
+
+    // Input feature converter. The parameters are shared between the replicas of
+    // the networks which do not copy them, see replica().
+    std::shared_ptr<Transformer> featureTransformer;
 
     // Evaluation function
-    AlignedPtr<Arch[]> network;
+    std::shared_ptr<Arch[]> network;
 
     EvalFile         evalFile;
     EmbeddedNNUEType embeddedType;
@@ -105,12 +174,12 @@ class Network {
 
 // Definitions of the network types
 using SmallFeatureTransformer =
-  FeatureTransformer<TransformedFeatureDimensionsSmall, &StateInfo::accumulatorSmall>;
+  FeatureTransformer<TransformedFeatureDimensionsSmall, &AccumulatorState::accumulatorSmall>;
 using SmallNetworkArchitecture =
   NetworkArchitecture<TransformedFeatureDimensionsSmall, L2Small, L3Small>;
 
 using BigFeatureTransformer =
-  FeatureTransformer<TransformedFeatureDimensionsBig, &StateInfo::accumulatorBig>;
+  FeatureTransformer<TransformedFeatureDimensionsBig, &AccumulatorState::accumulatorBig>;
 using BigNetworkArchitecture = NetworkArchitecture<TransformedFeatureDimensionsBig, L2Big, L3Big>;
 
 using NetworkBig   = Network<BigNetworkArchitecture, BigFeatureTransformer>;
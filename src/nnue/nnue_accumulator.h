@@ -21,7 +21,12 @@
 #ifndef NNUE_ACCUMULATOR_H_INCLUDED
 #define NNUE_ACCUMULATOR_H_INCLUDED
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
 #include "nnue_architecture.h"
 #include "nnue_common.h"
@@ -38,6 +43,15 @@ struct alignas(CacheLineSize) Accumulator {
     std::int16_t accumulation[COLOR_NB][Size];
     std::int32_t psqtAccumulation[COLOR_NB][PSQTBuckets];
     bool         computed[COLOR_NB];
+
+#if defined(INCREMENTAL_L1)
+    // Input and output of the first layer at the last evaluation of the position,
+    // with layer stack l1Bucket - 1. No evaluation yet when l1Bucket is 0.
+    int l1Bucket;
+    alignas(CacheLineSize) TransformedFeatureType l1Input[Size];
+    alignas(CacheLineSize) std::int32_t
+      l1Output[ceil_to_multiple<IndexType>(std::max(L2Big, L2Small) + 1, MaxSimdWidth)];
+#endif
 };
 
 
@@ -54,6 +68,20 @@ struct AccumulatorCaches {
         clear(networks);
     }
 
+    // Number of refresh entries per perspective. With fewer slots than squares,
+    // the entries hold the most recently used king squares, which trades full
+    // refreshes on a miss for a smaller cache footprint.
+#if defined(FINNY_SLOTS)
+    static constexpr int Slots = FINNY_SLOTS;
+#else
+    static constexpr int Slots = SQUARE_NB;
+#endif
+    static_assert(Slots >= 1 && Slots <= SQUARE_NB);
+
+    // Refreshes are bucketed by the number of features changed, the last bucket
+    // counting all refreshes of at least MaxDiff - 1 features.
+    static constexpr int MaxDiff = 33;
+
     template<IndexType Size>
     struct alignas(CacheLineSize) Cache {
 
@@ -75,29 +103,117 @@ struct AccumulatorCaches {
 
         template<typename Network>
         void clear(const Network& network) {
+            reset(network.featureTransformer->biases);
+        }
+
+        void reset(const BiasType* biases) {
             for (auto& entries1D : entries)
                 for (auto& entry : entries1D)
-                    entry.clear(network.featureTransformer->biases);
+                    entry.clear(biases);
+
+            for (Color c : {WHITE, BLACK})
+                for (int i = 0; i < Slots; ++i)
+                {
+                    lru[c][i]   = std::uint8_t(i);
+                    owner[c][i] = Slots == SQUARE_NB ? Square(i) : SQ_NONE;
+                }
+        }
+
+        // Returns the entry of the king square. If the king square has no entry,
+        // the least recently used one is reset with the biases and taken over.
+        Entry& get(Square ksq, Color c, const BiasType* biases) {
+            if constexpr (Slots == SQUARE_NB)
+                return entries[ksq][c];
+            else
+            {
+                int i = 0;
+                while (i < Slots - 1 && owner[c][lru[c][i]] != ksq)
+                    ++i;
+
+                const int slot = lru[c][i];
+                std::rotate(lru[c], lru[c] + i, lru[c] + i + 1);
+
+                if (owner[c][slot] != ksq)
+                {
+                    entries[slot][c].clear(biases);
+                    owner[c][slot] = ksq;
+                    evictions += 1;
+                }
+                return entries[slot][c];
+            }
+        }
+
+        // Entry of the king square for prefetching, nullptr if not cached
+        const Entry* find(Square ksq, Color c) const {
+            if constexpr (Slots == SQUARE_NB)
+                return &entries[ksq][c];
+
+            for (int i = 0; i < Slots; ++i)
+                if (owner[c][i] == ksq)
+                    return &entries[i][c];
+            return nullptr;
+        }
+
+        std::array<std::array<Entry, COLOR_NB>, Slots> entries;
+        std::uint8_t                                   lru[COLOR_NB][Slots];
+        Square                                         owner[COLOR_NB][Slots];
+
+        // Number of accumulators (per perspective) computed incrementally from
+        // an earlier position or refreshed from this cache, the number of entries
+        // taken over by another king square, and the refreshes by features changed,
+        // which are only counted with USE_STATS (make stats=yes). Not reset by clear().
+        std::uint64_t incrementalUpdates = 0;
+        std::uint64_t refreshes          = 0;
+        std::uint64_t evictions          = 0;
+        std::uint64_t refreshDiffs[MaxDiff]{};
+    };
+
+    // Direct mapped cache of the network evaluations by position key, so that
+    // positions evaluated again, after their TT entry was replaced, skip the
+    // networks. It is empty unless resized, and only valid for the nets it was
+    // filled with.
+    struct EvalCache {
+
+        struct Entry {
+            Key          key;
+            std::int32_t nnue;
+            std::int32_t complexity;
+        };
+
+        // Sets the size in KB, rounded down to a power of two number of entries
+        void resize(std::size_t kb) {
+            std::size_t count = kb * 1024 / sizeof(Entry);
+            while (count & (count - 1))
+                count &= count - 1;
+
+            if (count != entries.size())
+                entries.assign(count, Entry{});
         }
 
-        void clear(const BiasType* biases) {
-            for (auto& entry : entries)
-                entry.clear(biases);
+        void clear() { std::fill(entries.begin(), entries.end(), Entry{}); }
+
+        // The entry of the key, nullptr when the cache is empty
+        Entry* probe(Key key) {
+            return entries.empty() ? nullptr : &entries[key & (entries.size() - 1)];
         }
 
-        std::array<Entry, COLOR_NB>& operator[](Square sq) { return entries[sq]; }
+        std::vector<Entry> entries;
 
-        std::array<std::array<Entry, COLOR_NB>, SQUARE_NB> entries;
+        // Not reset by clear()
+        std::uint64_t probes = 0;
+        std::uint64_t hits   = 0;
     };
 
     template<typename Networks>
     void clear(const Networks& networks) {
         big.clear(networks.big);
         small.clear(networks.small);
+        evals.clear();
     }
 
     Cache<TransformedFeatureDimensionsBig>   big;
     Cache<TransformedFeatureDimensionsSmall> small;
+    EvalCache                                evals;
 };
 
 }  // namespace Stockfish::Eval::NNUE
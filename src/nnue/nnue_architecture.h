@@ -21,9 +21,11 @@
 #ifndef NNUE_ARCHITECTURE_H_INCLUDED
 #define NNUE_ARCHITECTURE_H_INCLUDED
 
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <iosfwd>
+#include <vector>
 
 #include "features/half_ka_v2_hm.h"
 #include "layers/affine_transform.h"
@@ -91,29 +93,61 @@ struct NetworkArchitecture {
             && fc_2.write_parameters(stream);
     }
 
-    std::int32_t propagate(const TransformedFeatureType* transformedFeatures) {
-        struct alignas(CacheLineSize) Buffer {
-            alignas(CacheLineSize) typename decltype(fc_0)::OutputBuffer fc_0_out;
-            alignas(CacheLineSize) typename decltype(ac_sqr_0)::OutputType
-              ac_sqr_0_out[ceil_to_multiple<IndexType>(FC_0_OUTPUTS * 2, 32)];
-            alignas(CacheLineSize) typename decltype(ac_0)::OutputBuffer ac_0_out;
-            alignas(CacheLineSize) typename decltype(fc_1)::OutputBuffer fc_1_out;
-            alignas(CacheLineSize) typename decltype(ac_1)::OutputBuffer ac_1_out;
-            alignas(CacheLineSize) typename decltype(fc_2)::OutputBuffer fc_2_out;
-
-            Buffer() { std::memset(this, 0, sizeof(*this)); }
-        };
+    struct alignas(CacheLineSize) Buffer {
+        alignas(CacheLineSize) typename decltype(fc_0)::OutputBuffer fc_0_out;
+        alignas(CacheLineSize) typename decltype(ac_sqr_0)::OutputType
+          ac_sqr_0_out[ceil_to_multiple<IndexType>(FC_0_OUTPUTS * 2, 32)];
+        alignas(CacheLineSize) typename decltype(ac_0)::OutputBuffer ac_0_out;
+        alignas(CacheLineSize) typename decltype(fc_1)::OutputBuffer fc_1_out;
+        alignas(CacheLineSize) typename decltype(ac_1)::OutputBuffer ac_1_out;
+        alignas(CacheLineSize) typename decltype(fc_2)::OutputBuffer fc_2_out;
+
+        Buffer() { std::memset(this, 0, sizeof(*this)); }
+    };
 
+    static Buffer& thread_buffer() {
 #if defined(__clang__) && (__APPLE__)
         // workaround for a bug reported with xcode 12
         static thread_local auto tlsBuffer = std::make_unique<Buffer>();
         // Access TLS only once, cache result.
-        Buffer& buffer = *tlsBuffer;
+        return *tlsBuffer;
 #else
         alignas(CacheLineSize) static thread_local Buffer buffer;
+        return buffer;
 #endif
+    }
+
+    std::int32_t propagate(const TransformedFeatureType* transformedFeatures) {
+
+        Buffer& buffer = thread_buffer();
 
         fc_0.propagate(transformedFeatures, buffer.fc_0_out);
+        return propagate_hidden(buffer);
+    }
+
+    // Same as propagate(), but the first layer is computed from its input and
+    // output of an earlier evaluation when prevFeatures is set, only applying the
+    // inputs which differ. The output of the first layer is copied to l1Output.
+    std::int32_t propagate(const TransformedFeatureType* transformedFeatures,
+                           const TransformedFeatureType* prevFeatures,
+                           const std::int32_t*           prevL1Output,
+                           std::int32_t*                 l1Output) {
+
+        Buffer& buffer = thread_buffer();
+
+        if (prevFeatures)
+            fc_0.propagate_delta(transformedFeatures, prevFeatures, prevL1Output,
+                                 buffer.fc_0_out);
+        else
+            fc_0.propagate(transformedFeatures, buffer.fc_0_out);
+
+        std::memcpy(l1Output, buffer.fc_0_out, sizeof(buffer.fc_0_out));
+        return propagate_hidden(buffer);
+    }
+
+    // The layers after the first one, with its output in buffer.fc_0_out
+    std::int32_t propagate_hidden(Buffer& buffer) {
+
         ac_sqr_0.propagate(buffer.fc_0_out, buffer.ac_sqr_0_out);
         ac_0.propagate(buffer.fc_0_out, buffer.ac_0_out);
         std::memcpy(buffer.ac_sqr_0_out + FC_0_OUTPUTS, buffer.ac_0_out,
@@ -122,6 +156,51 @@ struct NetworkArchitecture {
         ac_1.propagate(buffer.fc_1_out, buffer.ac_1_out);
         fc_2.propagate(buffer.ac_1_out, buffer.fc_2_out);
 
+        return output_value(buffer);
+    }
+
+    // Same as propagate(), but for a batch of positions. The layers are applied
+    // one at a time to the whole batch, so each layer's weights are loaded into
+    // cache once per batch instead of once per position.
+    void propagate_batch(const TransformedFeatureType* const* transformedFeatures,
+                         Buffer*                              buffers,
+                         std::size_t                          count,
+                         std::int32_t*                        output) {
+
+        std::vector<const std::uint8_t*> in(count);
+        std::vector<std::int32_t*>       out(count);
+
+        for (std::size_t i = 0; i < count; ++i)
+            out[i] = buffers[i].fc_0_out;
+
+        fc_0.propagate_batch(transformedFeatures, out.data(), count);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            ac_sqr_0.propagate(buffers[i].fc_0_out, buffers[i].ac_sqr_0_out);
+            ac_0.propagate(buffers[i].fc_0_out, buffers[i].ac_0_out);
+            std::memcpy(buffers[i].ac_sqr_0_out + FC_0_OUTPUTS, buffers[i].ac_0_out,
+                        FC_0_OUTPUTS * sizeof(typename decltype(ac_0)::OutputType));
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            in[i]  = buffers[i].ac_sqr_0_out;
+            out[i] = buffers[i].fc_1_out;
+        }
+
+        fc_1.propagate_batch(in.data(), out.data(), count);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            ac_1.propagate(buffers[i].fc_1_out, buffers[i].ac_1_out);
+            fc_2.propagate(buffers[i].ac_1_out, buffers[i].fc_2_out);
+            output[i] = output_value(buffers[i]);
+        }
+    }
+
+   private:
+    static std::int32_t output_value(const Buffer& buffer) {
         // buffer.fc_0_out[FC_0_OUTPUTS] is such that 1.0 is equal to 127*(1<<WeightScaleBits) in
         // quantized form, but we want 1.0 to be equal to 600*OutputScale
         std::int32_t fwdOut =
@@ -27,6 +27,7 @@
 #include <cstring>
 #include <iosfwd>
 #include <utility>
+#include <vector>
 
 #include "../position.h"
 #include "../types.h"
@@ -37,9 +38,18 @@
 namespace Stockfish::Eval::NNUE {
 
 using BiasType       = std::int16_t;
-using WeightType     = std::int16_t;
 using PSQTWeightType = std::int32_t;
 
+// With NNUE_FT_INT8 the weights of the feature transformer are kept in 8 bits,
+// which halves the memory traffic of the accumulator updates. Each block of
+// ScaleBlock outputs has its own power of two scale, and the accumulation is
+// in units of it.
+#if defined(NNUE_FT_INT8)
+using WeightType = std::int8_t;
+#else
+using WeightType = std::int16_t;
+#endif
+
 // If vector instructions are enabled, we update and refresh the
 // accumulator tile by tile such that each tile fits in the CPU's
 // vector registers.
@@ -61,6 +71,13 @@ using psqt_vec_t = __m256i;
     #define vec_max_16(a, b) _mm512_max_epi16(a, b)
     #define vec_min_16(a, b) _mm512_min_epi16(a, b)
     #define vec_slli_16(a, b) _mm512_slli_epi16(a, b)
+    #define vec_mullo_16(a, b) _mm512_mullo_epi16(a, b)
+    #if defined(NNUE_FT_INT8)
+        #define vec_load_weights(a) \
+            _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(a)))
+    #else
+        #define vec_load_weights(a) _mm512_load_si512(a)
+    #endif
     // Inverse permuted at load time
     #define vec_packus_16(a, b) _mm512_packus_epi16(a, b)
     #define vec_load_psqt(a) _mm256_load_si256(a)
@@ -84,6 +101,13 @@ using psqt_vec_t = __m256i;
     #define vec_max_16(a, b) _mm256_max_epi16(a, b)
     #define vec_min_16(a, b) _mm256_min_epi16(a, b)
     #define vec_slli_16(a, b) _mm256_slli_epi16(a, b)
+    #define vec_mullo_16(a, b) _mm256_mullo_epi16(a, b)
+    #if defined(NNUE_FT_INT8)
+        #define vec_load_weights(a) \
+            _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(a)))
+    #else
+        #define vec_load_weights(a) _mm256_load_si256(reinterpret_cast<const __m256i*>(a))
+    #endif
     // Inverse permuted at load time
     #define vec_packus_16(a, b) _mm256_packus_epi16(a, b)
     #define vec_load_psqt(a) _mm256_load_si256(a)
@@ -107,6 +131,19 @@ using psqt_vec_t = __m128i;
     #define vec_max_16(a, b) _mm_max_epi16(a, b)
     #define vec_min_16(a, b) _mm_min_epi16(a, b)
     #define vec_slli_16(a, b) _mm_slli_epi16(a, b)
+    #define vec_mullo_16(a, b) _mm_mullo_epi16(a, b)
+    #if defined(NNUE_FT_INT8) && defined(USE_SSE41)
+        #define vec_load_weights(a) \
+            _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a)))
+    #elif defined(NNUE_FT_INT8)
+        #define vec_load_weights(a) \
+            _mm_srai_epi16( \
+              _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a)), \
+                                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a))), \
+              8)
+    #else
+        #define vec_load_weights(a) (*reinterpret_cast<const __m128i*>(a))
+    #endif
     #define vec_packus_16(a, b) _mm_packus_epi16(a, b)
     #define vec_load_psqt(a) (*(a))
     #define vec_store_psqt(a, b) *(a) = (b)
@@ -130,6 +167,12 @@ using psqt_vec_t = int32x4_t;
     #define vec_max_16(a, b) vmaxq_s16(a, b)
     #define vec_min_16(a, b) vminq_s16(a, b)
     #define vec_slli_16(a, b) vshlq_s16(a, vec_set_16(b))
+    #define vec_mullo_16(a, b) vmulq_s16(a, b)
+    #if defined(NNUE_FT_INT8)
+        #define vec_load_weights(a) vmovl_s8(vld1_s8(a))
+    #else
+        #define vec_load_weights(a) vld1q_s16(a)
+    #endif
     #define vec_packus_16(a, b) reinterpret_cast<vec_t>(vcombine_u8(vqmovun_s16(a), vqmovun_s16(b)))
     #define vec_load_psqt(a) (*(a))
     #define vec_store_psqt(a, b) *(a) = (b)
@@ -189,7 +232,7 @@ static constexpr int BestRegisterCount() {
 
 // Input feature converter
 template<IndexType                                 TransformedFeatureDimensions,
-         Accumulator<TransformedFeatureDimensions> StateInfo::*accPtr>
+         Accumulator<TransformedFeatureDimensions> AccumulatorState::*accPtr>
 class FeatureTransformer {
 
     // Number of output dimensions for one side
@@ -198,7 +241,7 @@ class FeatureTransformer {
    private:
 #ifdef VECTOR
     static constexpr int NumRegs =
-      BestRegisterCount<vec_t, WeightType, TransformedFeatureDimensions, NumRegistersSIMD>();
+      BestRegisterCount<vec_t, BiasType, TransformedFeatureDimensions, NumRegistersSIMD>();
     static constexpr int NumPsqtRegs =
       BestRegisterCount<psqt_vec_t, PSQTWeightType, PSQTBuckets, NumRegistersSIMD>();
 
@@ -206,6 +249,16 @@ class FeatureTransformer {
     static constexpr IndexType PsqtTileHeight = NumPsqtRegs * sizeof(psqt_vec_t) / 4;
     static_assert(HalfDimensions % TileHeight == 0, "TileHeight must divide HalfDimensions");
     static_assert(PSQTBuckets % PsqtTileHeight == 0, "PsqtTileHeight must divide PSQTBuckets");
+
+    // Register k of the weights from w on, widened to 16 bit lanes
+    static vec_t load_weights(const WeightType* w, IndexType k) {
+        return vec_load_weights(&w[k * (sizeof(vec_t) / sizeof(BiasType))]);
+    }
+#endif
+
+#if defined(NNUE_FT_INT8)
+    static constexpr IndexType ScaleBlock = 64;
+    static_assert(HalfDimensions % ScaleBlock == 0);
 #endif
 
    public:
@@ -256,28 +309,114 @@ class FeatureTransformer {
 #endif
     }
 
-    void permute_weights([[maybe_unused]] void (*order_fn)(uint64_t*)) const {
+    // Applies order_fn to count rows of HalfDimensions 16 bit values
+    static void permute_rows([[maybe_unused]] std::int16_t* rows,
+                             [[maybe_unused]] IndexType     count,
+                             [[maybe_unused]] void (*order_fn)(uint64_t*)) {
 #if defined(USE_AVX2)
     #if defined(USE_AVX512)
         constexpr IndexType di = 16;
     #else
         constexpr IndexType di = 8;
     #endif
-        uint64_t* b = reinterpret_cast<uint64_t*>(const_cast<BiasType*>(&biases[0]));
-        for (IndexType i = 0; i < HalfDimensions * sizeof(BiasType) / sizeof(uint64_t); i += di)
-            order_fn(&b[i]);
-
-        for (IndexType j = 0; j < InputDimensions; ++j)
+        // Copied through a buffer, as the rows may not be accessed as uint64_t
+        uint64_t buf[di];
+        for (std::int16_t* r = rows; r < rows + count * HalfDimensions; r += sizeof(buf) / 2)
         {
-            uint64_t* w =
-              reinterpret_cast<uint64_t*>(const_cast<WeightType*>(&weights[j * HalfDimensions]));
-            for (IndexType i = 0; i < HalfDimensions * sizeof(WeightType) / sizeof(uint64_t);
-                 i += di)
-                order_fn(&w[i]);
+            std::memcpy(buf, r, sizeof(buf));
+            order_fn(buf);
+            std::memcpy(r, buf, sizeof(buf));
         }
 #endif
     }
 
+#if defined(NNUE_FT_INT8)
+    // Rounds v to the nearest multiple of scale, in units of scale
+    static int quantize(int v, int scale) {
+        return v >= 0 ? (v + scale / 2) / scale : -((scale / 2 - v) / scale);
+    }
+
+    // Read network parameters. The 16 bit weights are scaled per block of outputs
+    // so that they fit in 8 bits. The blocks are taken in file order, so that all
+    // builds quantize the same way.
+    bool read_parameters(std::istream& stream) {
+
+        std::vector<std::int16_t> w(std::size_t(HalfDimensions) * InputDimensions);
+        std::vector<BiasType>     b(HalfDimensions);
+
+        read_leb_128<BiasType>(stream, b.data(), HalfDimensions);
+        read_leb_128<std::int16_t>(stream, w.data(), w.size());
+        read_leb_128<PSQTWeightType>(stream, psqtWeights, PSQTBuckets * InputDimensions);
+
+        for (auto& v : w)
+            v *= 2;
+        for (auto& v : b)
+            v *= 2;
+
+        int maxAbs[HalfDimensions / ScaleBlock] = {};
+        for (std::size_t i = 0; i < w.size(); ++i)
+            maxAbs[i % HalfDimensions / ScaleBlock] =
+              std::max(maxAbs[i % HalfDimensions / ScaleBlock], std::abs(int(w[i])));
+
+        for (IndexType i = 0; i < HalfDimensions; ++i)
+        {
+            int shift = 0;
+            while ((maxAbs[i / ScaleBlock] + (1 << shift >> 1)) >> shift > 127)
+                ++shift;
+
+            weightScales[i] = std::int16_t(1 << shift);
+            clampLimits[i]  = std::int16_t((254 >> shift) + 1);
+        }
+
+        permute_rows(b.data(), 1, inverse_order_packs);
+        permute_rows(w.data(), InputDimensions, inverse_order_packs);
+        permute_rows(weightScales, 1, inverse_order_packs);
+        permute_rows(clampLimits, 1, inverse_order_packs);
+
+        std::size_t rounded = 0;
+        for (std::size_t i = 0; i < w.size(); ++i)
+        {
+            const int scale = weightScales[i % HalfDimensions];
+            weights[i]      = WeightType(quantize(w[i], scale));
+            rounded += weights[i] * scale != w[i];
+        }
+
+        for (IndexType i = 0; i < HalfDimensions; ++i)
+            biases[i] = BiasType(quantize(b[i], weightScales[i]));
+
+        roundedWeights = double(rounded) / w.size();
+        return !stream.fail();
+    }
+
+    // Write network parameters, as the 16 bit weights they stand for
+    bool write_parameters(std::ostream& stream) const {
+
+        std::vector<std::int16_t> w(std::size_t(HalfDimensions) * InputDimensions);
+        std::vector<BiasType>     b(HalfDimensions);
+
+        for (std::size_t i = 0; i < w.size(); ++i)
+            w[i] = std::int16_t(weights[i] * weightScales[i % HalfDimensions] / 2);
+        for (IndexType i = 0; i < HalfDimensions; ++i)
+            b[i] = BiasType(biases[i] * weightScales[i] / 2);
+
+        permute_rows(b.data(), 1, order_packs);
+        permute_rows(w.data(), InputDimensions, order_packs);
+
+        write_leb_128<BiasType>(stream, b.data(), HalfDimensions);
+        write_leb_128<std::int16_t>(stream, w.data(), w.size());
+        write_leb_128<PSQTWeightType>(stream, psqtWeights, PSQTBuckets * InputDimensions);
+
+        return !stream.fail();
+    }
+
+    // Fraction of the weights which 8 bits could not hold exactly
+    double rounded_weights() const { return roundedWeights; }
+#else
+    void permute_weights(void (*order_fn)(uint64_t*)) const {
+        permute_rows(const_cast<BiasType*>(biases), 1, order_fn);
+        permute_rows(const_cast<WeightType*>(weights), InputDimensions, order_fn);
+    }
+
     inline void scale_weights(bool read) const {
         for (IndexType j = 0; j < InputDimensions; ++j)
         {
@@ -318,21 +457,35 @@ class FeatureTransformer {
         return !stream.fail();
     }
 
+    double rounded_weights() const { return 0; }
+#endif
+
+    static constexpr std::size_t WeightsSize =
+      sizeof(WeightType) * HalfDimensions * InputDimensions;
+
+    // The accumulator of the given state
+    static Accumulator<HalfDimensions>& accumulator(StateInfo* st) { return st->acc->*accPtr; }
+    static const Accumulator<HalfDimensions>& accumulator(const StateInfo* st) {
+        return st->acc->*accPtr;
+    }
+
     // Convert input features
     std::int32_t transform(const Position&                           pos,
                            AccumulatorCaches::Cache<HalfDimensions>* cache,
                            OutputType*                               output,
                            int                                       bucket) const {
+        assert(pos.state()->acc);
+
         update_accumulator<WHITE>(pos, cache);
         update_accumulator<BLACK>(pos, cache);
 
         const Color perspectives[2]  = {pos.side_to_move(), ~pos.side_to_move()};
-        const auto& psqtAccumulation = (pos.state()->*accPtr).psqtAccumulation;
+        const auto& psqtAccumulation = (pos.state()->acc->*accPtr).psqtAccumulation;
         const auto  psqt =
           (psqtAccumulation[perspectives[0]][bucket] - psqtAccumulation[perspectives[1]][bucket])
           / 2;
 
-        const auto& accumulation = (pos.state()->*accPtr).accumulation;
+        const auto& accumulation = (pos.state()->acc->*accPtr).accumulation;
 
         for (IndexType p = 0; p < 2; ++p)
         {
@@ -352,6 +505,21 @@ class FeatureTransformer {
               reinterpret_cast<const vec_t*>(&(accumulation[perspectives[p]][HalfDimensions / 2]));
             vec_t* out = reinterpret_cast<vec_t*>(output + offset);
 
+    #if defined(NNUE_FT_INT8)
+            // Back from the units of the block scales, clamping first so that
+            // the products cannot overflow
+            const vec_t* scale0 = reinterpret_cast<const vec_t*>(&weightScales[0]);
+            const vec_t* scale1 = reinterpret_cast<const vec_t*>(&weightScales[HalfDimensions / 2]);
+            const vec_t* limit0 = reinterpret_cast<const vec_t*>(&clampLimits[0]);
+            const vec_t* limit1 = reinterpret_cast<const vec_t*>(&clampLimits[HalfDimensions / 2]);
+
+            const auto unscale = [&](const vec_t* in, const vec_t* scale, const vec_t* limit,
+                                     IndexType i) {
+                return vec_mullo_16(
+                  vec_max_16(vec_min_16(in[i], limit[i]), vec_sub_16(Zero, limit[i])), scale[i]);
+            };
+    #endif
+
             for (IndexType j = 0; j < NumOutputChunks; ++j)
             {
                     // What we want to do is multiply inputs in a pairwise manner (after clipping), and then shift right by 9.
@@ -367,12 +535,21 @@ class FeatureTransformer {
     #else
                 constexpr int shift = 6;
     #endif
-                const vec_t sum0a =
-                  vec_slli_16(vec_max_16(vec_min_16(in0[j * 2 + 0], One), Zero), shift);
-                const vec_t sum0b =
-                  vec_slli_16(vec_max_16(vec_min_16(in0[j * 2 + 1], One), Zero), shift);
-                const vec_t sum1a = vec_min_16(in1[j * 2 + 0], One);
-                const vec_t sum1b = vec_min_16(in1[j * 2 + 1], One);
+    #if defined(NNUE_FT_INT8)
+                const vec_t in0a = unscale(in0, scale0, limit0, j * 2 + 0);
+                const vec_t in0b = unscale(in0, scale0, limit0, j * 2 + 1);
+                const vec_t in1a = unscale(in1, scale1, limit1, j * 2 + 0);
+                const vec_t in1b = unscale(in1, scale1, limit1, j * 2 + 1);
+    #else
+                const vec_t in0a = in0[j * 2 + 0];
+                const vec_t in0b = in0[j * 2 + 1];
+                const vec_t in1a = in1[j * 2 + 0];
+                const vec_t in1b = in1[j * 2 + 1];
+    #endif
+                const vec_t sum0a = vec_slli_16(vec_max_16(vec_min_16(in0a, One), Zero), shift);
+                const vec_t sum0b = vec_slli_16(vec_max_16(vec_min_16(in0b, One), Zero), shift);
+                const vec_t sum1a = vec_min_16(in1a, One);
+                const vec_t sum1b = vec_min_16(in1b, One);
 
                 const vec_t pa = vec_mulhi_16(sum0a, sum1a);
                 const vec_t pb = vec_mulhi_16(sum0b, sum1b);
@@ -384,11 +561,19 @@ class FeatureTransformer {
 
             for (IndexType j = 0; j < HalfDimensions / 2; ++j)
             {
+    #if defined(NNUE_FT_INT8)
+                int sum0 = accumulation[static_cast<int>(perspectives[p])][j + 0] * weightScales[j];
+                int sum1 = accumulation[static_cast<int>(perspectives[p])][j + HalfDimensions / 2]
+                         * weightScales[j + HalfDimensions / 2];
+                sum0     = std::clamp(sum0, 0, 127 * 2);
+                sum1     = std::clamp(sum1, 0, 127 * 2);
+    #else
                 BiasType sum0 = accumulation[static_cast<int>(perspectives[p])][j + 0];
                 BiasType sum1 =
                   accumulation[static_cast<int>(perspectives[p])][j + HalfDimensions / 2];
-                sum0               = std::clamp<BiasType>(sum0, 0, 127 * 2);
-                sum1               = std::clamp<BiasType>(sum1, 0, 127 * 2);
+                sum0          = std::clamp<BiasType>(sum0, 0, 127 * 2);
+                sum1          = std::clamp<BiasType>(sum1, 0, 127 * 2);
+    #endif
                 output[offset + j] = static_cast<OutputType>(unsigned(sum0 * sum1) / 512);
             }
 
@@ -404,6 +589,20 @@ class FeatureTransformer {
         hint_common_access_for_perspective<BLACK>(pos, cache);
     }
 
+    // The two stages of transform() before the output, timed apart by bench nnue:
+    // the accumulators updated as in the search, or refreshed from the cache.
+    void update_accumulators(const Position&                           pos,
+                             AccumulatorCaches::Cache<HalfDimensions>* cache) const {
+        update_accumulator<WHITE>(pos, cache);
+        update_accumulator<BLACK>(pos, cache);
+    }
+
+    void refresh_accumulators(const Position&                           pos,
+                              AccumulatorCaches::Cache<HalfDimensions>* cache) const {
+        update_accumulator_refresh_cache<WHITE>(pos, cache);
+        update_accumulator_refresh_cache<BLACK>(pos, cache);
+    }
+
    private:
     template<Color Perspective>
     [[nodiscard]] std::pair<StateInfo*, StateInfo*>
@@ -412,7 +611,7 @@ class FeatureTransformer {
         // of the estimated gain in terms of features to be added/subtracted.
         StateInfo *st = pos.state(), *next = nullptr;
         int        gain = FeatureSet::refresh_cost(pos);
-        while (st->previous && !(st->*accPtr).computed[Perspective])
+        while (st->previous && st->previous->acc && !(st->acc->*accPtr).computed[Perspective])
         {
             // This governs when a full feature refresh is needed and how many
             // updates are better than just one full refresh.
@@ -425,6 +624,35 @@ class FeatureTransformer {
         return {st, next};
     }
 
+    // Drops the features which are both removed and added over several plies,
+    // as when a piece moves on again or back, so that their columns are not read.
+    static void cancel_pairs(FeatureSet::IndexList& removed, FeatureSet::IndexList& added) {
+        bool                  cancelled[FeatureSet::MaxActiveDimensions] = {};
+        FeatureSet::IndexList keptRemoved, keptAdded;
+
+        for (const auto index : removed)
+        {
+            std::size_t j = 0;
+            while (j < added.size() && (cancelled[j] || added[j] != index))
+                ++j;
+
+            if (j < added.size())
+                cancelled[j] = true;
+            else
+                keptRemoved.push_back(index);
+        }
+
+        if (keptRemoved.size() == removed.size())
+            return;
+
+        for (std::size_t j = 0; j < added.size(); ++j)
+            if (!cancelled[j])
+                keptAdded.push_back(added[j]);
+
+        removed = keptRemoved;
+        added   = keptAdded;
+    }
+
     // NOTE: The parameter states_to_update is an array of position states.
     //       All states must be sequential, that is states_to_update[i] must either be reachable
     //       by repeatedly applying ->previous from states_to_update[i+1].
@@ -463,13 +691,15 @@ class FeatureTransformer {
 
         for (int i = N - 1; i >= 0; --i)
         {
-            (states_to_update[i]->*accPtr).computed[Perspective] = true;
+            (states_to_update[i]->acc->*accPtr).computed[Perspective] = true;
 
             const StateInfo* end_state = i == 0 ? computed_st : states_to_update[i - 1];
 
             for (StateInfo* st2 = states_to_update[i]; st2 != end_state; st2 = st2->previous)
                 FeatureSet::append_changed_indices<Perspective>(ksq, st2->dirtyPiece, removed[i],
                                                                 added[i]);
+
+            cancel_pairs(removed[i], added[i]);
         }
 
         StateInfo* st = computed_st;
@@ -482,36 +712,38 @@ class FeatureTransformer {
             assert(states_to_update[0]);
 
             auto accIn =
-              reinterpret_cast<const vec_t*>(&(st->*accPtr).accumulation[Perspective][0]);
+              reinterpret_cast<const vec_t*>(&(st->acc->*accPtr).accumulation[Perspective][0]);
             auto accOut = reinterpret_cast<vec_t*>(
-              &(states_to_update[0]->*accPtr).accumulation[Perspective][0]);
+              &(states_to_update[0]->acc->*accPtr).accumulation[Perspective][0]);
 
             const IndexType offsetR0 = HalfDimensions * removed[0][0];
-            auto            columnR0 = reinterpret_cast<const vec_t*>(&weights[offsetR0]);
+            auto            columnR0 = &weights[offsetR0];
             const IndexType offsetA  = HalfDimensions * added[0][0];
-            auto            columnA  = reinterpret_cast<const vec_t*>(&weights[offsetA]);
+            auto            columnA  = &weights[offsetA];
 
             if (removed[0].size() == 1)
             {
                 for (IndexType k = 0; k < HalfDimensions * sizeof(std::int16_t) / sizeof(vec_t);
                      ++k)
-                    accOut[k] = vec_add_16(vec_sub_16(accIn[k], columnR0[k]), columnA[k]);
+                    accOut[k] = vec_add_16(vec_sub_16(accIn[k], load_weights(columnR0, k)),
+                                           load_weights(columnA, k));
             }
             else
             {
                 const IndexType offsetR1 = HalfDimensions * removed[0][1];
-                auto            columnR1 = reinterpret_cast<const vec_t*>(&weights[offsetR1]);
+                auto            columnR1 = &weights[offsetR1];
 
                 for (IndexType k = 0; k < HalfDimensions * sizeof(std::int16_t) / sizeof(vec_t);
                      ++k)
-                    accOut[k] = vec_sub_16(vec_add_16(accIn[k], columnA[k]),
-                                           vec_add_16(columnR0[k], columnR1[k]));
+                    accOut[k] =
+                      vec_sub_16(vec_add_16(accIn[k], load_weights(columnA, k)),
+                                 vec_add_16(load_weights(columnR0, k), load_weights(columnR1, k)));
             }
 
-            auto accPsqtIn =
-              reinterpret_cast<const psqt_vec_t*>(&(st->*accPtr).psqtAccumulation[Perspective][0]);
+            auto accPsqtIn  = reinterpret_cast<const psqt_vec_t*>(
+              &(st->acc->*accPtr).psqtAccumulation[Perspective][0]);
             auto accPsqtOut = reinterpret_cast<psqt_vec_t*>(
-              &(states_to_update[0]->*accPtr).psqtAccumulation[Perspective][0]);
+              &(states_to_update[0]->acc->*accPtr).psqtAccumulation[Perspective][0]);
 
             const IndexType offsetPsqtR0 = PSQTBuckets * removed[0][0];
             auto columnPsqtR0 = reinterpret_cast<const psqt_vec_t*>(&psqtWeights[offsetPsqtR0]);
@@ -543,7 +775,7 @@ class FeatureTransformer {
             {
                 // Load accumulator
                 auto accTileIn = reinterpret_cast<const vec_t*>(
-                  &(st->*accPtr).accumulation[Perspective][j * TileHeight]);
+                  &(st->acc->*accPtr).accumulation[Perspective][j * TileHeight]);
                 for (IndexType k = 0; k < NumRegs; ++k)
                     acc[k] = vec_load(&accTileIn[k]);
 
@@ -553,23 +785,24 @@ class FeatureTransformer {
                     for (const auto index : removed[i])
                     {
                         const IndexType offset = HalfDimensions * index + j * TileHeight;
-                        auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+                        auto            column = &weights[offset];
                         for (IndexType k = 0; k < NumRegs; ++k)
-                            acc[k] = vec_sub_16(acc[k], column[k]);
+                            acc[k] = vec_sub_16(acc[k], load_weights(column, k));
                     }
 
                     // Difference calculation for the activated features
                     for (const auto index : added[i])
                     {
                         const IndexType offset = HalfDimensions * index + j * TileHeight;
-                        auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+                        auto            column = &weights[offset];
                         for (IndexType k = 0; k < NumRegs; ++k)
-                            acc[k] = vec_add_16(acc[k], column[k]);
+                            acc[k] = vec_add_16(acc[k], load_weights(column, k));
                     }
 
                     // Store accumulator
-                    auto accTileOut = reinterpret_cast<vec_t*>(
-                      &(states_to_update[i]->*accPtr).accumulation[Perspective][j * TileHeight]);
+                    auto accTileOut =
+                      reinterpret_cast<vec_t*>(&(states_to_update[i]->acc->*accPtr)
+                                                  .accumulation[Perspective][j * TileHeight]);
                     for (IndexType k = 0; k < NumRegs; ++k)
                         vec_store(&accTileOut[k], acc[k]);
                 }
@@ -579,7 +812,7 @@ class FeatureTransformer {
             {
                 // Load accumulator
                 auto accTilePsqtIn = reinterpret_cast<const psqt_vec_t*>(
-                  &(st->*accPtr).psqtAccumulation[Perspective][j * PsqtTileHeight]);
+                  &(st->acc->*accPtr).psqtAccumulation[Perspective][j * PsqtTileHeight]);
                 for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                     psqt[k] = vec_load_psqt(&accTilePsqtIn[k]);
 
@@ -605,7 +838,7 @@ class FeatureTransformer {
 
                     // Store accumulator
                     auto accTilePsqtOut = reinterpret_cast<psqt_vec_t*>(
-                      &(states_to_update[i]->*accPtr)
+                      &(states_to_update[i]->acc->*accPtr)
                          .psqtAccumulation[Perspective][j * PsqtTileHeight]);
                     for (std::size_t k = 0; k < NumPsqtRegs; ++k)
                         vec_store_psqt(&accTilePsqtOut[k], psqt[k]);
@@ -615,12 +848,13 @@ class FeatureTransformer {
 #else
         for (IndexType i = 0; i < N; ++i)
         {
-            std::memcpy((states_to_update[i]->*accPtr).accumulation[Perspective],
-                        (st->*accPtr).accumulation[Perspective], HalfDimensions * sizeof(BiasType));
+            std::memcpy((states_to_update[i]->acc->*accPtr).accumulation[Perspective],
+                        (st->acc->*accPtr).accumulation[Perspective],
+                        HalfDimensions * sizeof(BiasType));
 
             for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                (states_to_update[i]->*accPtr).psqtAccumulation[Perspective][k] =
-                  (st->*accPtr).psqtAccumulation[Perspective][k];
+                (states_to_update[i]->acc->*accPtr).psqtAccumulation[Perspective][k] =
+                  (st->acc->*accPtr).psqtAccumulation[Perspective][k];
 
             st = states_to_update[i];
 
@@ -629,10 +863,10 @@ class FeatureTransformer {
             {
                 const IndexType offset = HalfDimensions * index;
                 for (IndexType j = 0; j < HalfDimensions; ++j)
-                    (st->*accPtr).accumulation[Perspective][j] -= weights[offset + j];
+                    (st->acc->*accPtr).accumulation[Perspective][j] -= weights[offset + j];
 
                 for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                    (st->*accPtr).psqtAccumulation[Perspective][k] -=
+                    (st->acc->*accPtr).psqtAccumulation[Perspective][k] -=
                       psqtWeights[index * PSQTBuckets + k];
             }
 
@@ -641,10 +875,10 @@ class FeatureTransformer {
             {
                 const IndexType offset = HalfDimensions * index;
                 for (IndexType j = 0; j < HalfDimensions; ++j)
-                    (st->*accPtr).accumulation[Perspective][j] += weights[offset + j];
+                    (st->acc->*accPtr).accumulation[Perspective][j] += weights[offset + j];
 
                 for (std::size_t k = 0; k < PSQTBuckets; ++k)
-                    (st->*accPtr).psqtAccumulation[Perspective][k] +=
+                    (st->acc->*accPtr).psqtAccumulation[Perspective][k] +=
                       psqtWeights[index * PSQTBuckets + k];
             }
         }
@@ -657,7 +891,7 @@ class FeatureTransformer {
         assert(cache != nullptr);
 
         Square                ksq   = pos.square<KING>(Perspective);
-        auto&                 entry = (*cache)[ksq][Perspective];
+        auto&                 entry = cache->get(ksq, Perspective, biases);
         FeatureSet::IndexList removed, added;
 
         for (Color c : {WHITE, BLACK})
@@ -683,7 +917,12 @@ class FeatureTransformer {
             }
         }
 
-        auto& accumulator                 = pos.state()->*accPtr;
+#ifdef USE_STATS
+        cache->refreshDiffs[std::min(int(removed.size() + added.size()),
+                                     AccumulatorCaches::MaxDiff - 1)] += 1;
+#endif
+
+        auto& accumulator                 = pos.state()->acc->*accPtr;
         accumulator.computed[Perspective] = true;
 
 #ifdef VECTOR
@@ -704,31 +943,32 @@ class FeatureTransformer {
             {
                 IndexType       indexR  = removed[i];
                 const IndexType offsetR = HalfDimensions * indexR + j * TileHeight;
-                auto            columnR = reinterpret_cast<const vec_t*>(&weights[offsetR]);
+                auto            columnR = &weights[offsetR];
                 IndexType       indexA  = added[i];
                 const IndexType offsetA = HalfDimensions * indexA + j * TileHeight;
-                auto            columnA = reinterpret_cast<const vec_t*>(&weights[offsetA]);
+                auto            columnA = &weights[offsetA];
 
                 for (unsigned k = 0; k < NumRegs; ++k)
-                    acc[k] = vec_add_16(acc[k], vec_sub_16(columnA[k], columnR[k]));
+                    acc[k] = vec_add_16(
+                      acc[k], vec_sub_16(load_weights(columnA, k), load_weights(columnR, k)));
             }
             for (; i < int(removed.size()); ++i)
             {
                 IndexType       index  = removed[i];
                 const IndexType offset = HalfDimensions * index + j * TileHeight;
-                auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+                auto            column = &weights[offset];
 
                 for (unsigned k = 0; k < NumRegs; ++k)
-                    acc[k] = vec_sub_16(acc[k], column[k]);
+                    acc[k] = vec_sub_16(acc[k], load_weights(column, k));
             }
             for (; i < int(added.size()); ++i)
             {
                 IndexType       index  = added[i];
                 const IndexType offset = HalfDimensions * index + j * TileHeight;
-                auto            column = reinterpret_cast<const vec_t*>(&weights[offset]);
+                auto            column = &weights[offset];
 
                 for (unsigned k = 0; k < NumRegs; ++k)
-                    acc[k] = vec_add_16(acc[k], column[k]);
+                    acc[k] = vec_add_16(acc[k], load_weights(column, k));
             }
 
             for (IndexType k = 0; k < NumRegs; k++)
@@ -820,19 +1060,23 @@ class FeatureTransformer {
         // Look for a usable accumulator of an earlier position. We keep track
         // of the estimated gain in terms of features to be added/subtracted.
         // Fast early exit.
-        if ((pos.state()->*accPtr).computed[Perspective])
+        if ((pos.state()->acc->*accPtr).computed[Perspective])
             return;
 
         auto [oldest_st, _] = try_find_computed_accumulator<Perspective>(pos);
 
-        if ((oldest_st->*accPtr).computed[Perspective])
+        if ((oldest_st->acc->*accPtr).computed[Perspective])
         {
             // Only update current position accumulator to minimize work.
             StateInfo* states_to_update[1] = {pos.state()};
             update_accumulator_incremental<Perspective, 1>(pos, oldest_st, states_to_update);
+            cache->incrementalUpdates += 1;
         }
         else
+        {
             update_accumulator_refresh_cache<Perspective>(pos, cache);
+            cache->refreshes += 1;
+        }
     }
 
     template<Color Perspective>
@@ -841,31 +1085,38 @@ class FeatureTransformer {
 
         auto [oldest_st, next] = try_find_computed_accumulator<Perspective>(pos);
 
-        if ((oldest_st->*accPtr).computed[Perspective])
+        if ((oldest_st->acc->*accPtr).computed[Perspective])
         {
             if (next == nullptr)
                 return;
 
             // Now update the accumulators listed in states_to_update[], where the last element is a sentinel.
-            // Currently we update 2 accumulators.
+            // Currently we update 2 accumulators when the computed one is of the grandparent.
             //     1. for the current position
-            //     2. the next accumulator after the computed one
+            //     2. the next accumulator after the computed one, the parent
+            // Further back, as after null moves or cutoffs without evaluation, the
+            // plies in between are fused into one update of the current position.
             // The heuristic may change in the future.
-            if (next == pos.state())
+            if (next == pos.state() || next != pos.state()->previous)
             {
-                StateInfo* states_to_update[1] = {next};
+                StateInfo* states_to_update[1] = {pos.state()};
 
                 update_accumulator_incremental<Perspective, 1>(pos, oldest_st, states_to_update);
+                cache->incrementalUpdates += 1;
             }
             else
             {
                 StateInfo* states_to_update[2] = {next, pos.state()};
 
                 update_accumulator_incremental<Perspective, 2>(pos, oldest_st, states_to_update);
+                cache->incrementalUpdates += 2;
             }
         }
         else
+        {
             update_accumulator_refresh_cache<Perspective>(pos, cache);
+            cache->refreshes += 1;
+        }
     }
 
     template<IndexType Size>
@@ -874,6 +1125,14 @@ class FeatureTransformer {
     alignas(CacheLineSize) BiasType biases[HalfDimensions];
     alignas(CacheLineSize) WeightType weights[HalfDimensions * InputDimensions];
     alignas(CacheLineSize) PSQTWeightType psqtWeights[InputDimensions * PSQTBuckets];
+
+#if defined(NNUE_FT_INT8)
+    // Scale of the block of each output, and the bound beyond which the clamp
+    // of transform() does not change anymore, in units of that scale
+    alignas(CacheLineSize) std::int16_t weightScales[HalfDimensions];
+    alignas(CacheLineSize) std::int16_t clampLimits[HalfDimensions];
+    double roundedWeights;
+#endif
 };
 
 }  // namespace Stockfish::Eval::NNUE
@@ -145,10 +145,10 @@ trace(Position& pos, const Eval::NNUE::Networks& networks, Eval::NNUE::Accumulat
 
             if (pc != NO_PIECE && type_of(pc) != KING)
             {
-                auto st = pos.state();
+                auto& accumulator = pos.state()->acc->accumulatorBig;
 
                 pos.remove_piece(sq);
-                st->accumulatorBig.computed[WHITE] = st->accumulatorBig.computed[BLACK] = false;
+                accumulator.computed[WHITE] = accumulator.computed[BLACK] = false;
 
                 std::tie(psqt, positional) = networks.big.evaluate(pos, &caches.big);
                 Value eval                 = psqt + positional;
@@ -156,7 +156,7 @@ trace(Position& pos, const Eval::NNUE::Networks& networks, Eval::NNUE::Accumulat
                 v                          = base - eval;
 
                 pos.put_piece(pc, sq);
-                st->accumulatorBig.computed[WHITE] = st->accumulatorBig.computed[BLACK] = false;
+                accumulator.computed[WHITE] = accumulator.computed[BLACK] = false;
             }
 
             writeSquare(f, r, pc, v);
@@ -23,6 +23,7 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
@@ -914,6 +915,26 @@ class NumaConfig {
         th.join();
     }
 
+    // Copies size bytes with a thread bound to each node writing its share of
+    // the pages, so that with first touch placement the copy is interleaved.
+    void copy_interleaved(void* dst, const void* src, size_t size) const {
+        constexpr size_t PageSize = 2 * 1024 * 1024;
+
+        const size_t pages = (size + PageSize - 1) / PageSize;
+        const size_t n     = num_numa_nodes();
+
+        for (NumaIndex i = 0; i < n; ++i)
+            execute_on_numa_node(i, [=]() {
+                for (size_t page = i; page < pages; page += n)
+                {
+                    const size_t begin = page * PageSize;
+                    std::memcpy(static_cast<char*>(dst) + begin,
+                                static_cast<const char*>(src) + begin,
+                                std::min(PageSize, size - begin));
+                }
+            });
+    }
+
    private:
     std::vector<std::set<CpuIndex>> nodes;
     std::map<CpuIndex, NumaIndex>   nodeByCpu;
@@ -1040,7 +1061,9 @@ class NumaReplicatedBase {
 template<typename T>
 class NumaReplicated: public NumaReplicatedBase {
    public:
-    using ReplicatorFuncType = std::function<T(const T&)>;
+    // Makes the copy of the source for node n, on that node. The copy of the
+    // first node is given for the others, so that they can share parts of it.
+    using ReplicatorFuncType = std::function<T(const T& source, NumaIndex n, const T* first)>;
 
     NumaReplicated(NumaReplicationContext& ctx) :
         NumaReplicatedBase(ctx) {
@@ -1055,12 +1078,14 @@ class NumaReplicated: public NumaReplicatedBase {
     NumaReplicated(const NumaReplicated&) = delete;
     NumaReplicated(NumaReplicated&& other) noexcept :
         NumaReplicatedBase(std::move(other)),
-        instances(std::exchange(other.instances, {})) {}
+        instances(std::exchange(other.instances, {})),
+        replicator(std::move(other.replicator)) {}
 
     NumaReplicated& operator=(const NumaReplicated&) = delete;
     NumaReplicated& operator=(NumaReplicated&& other) noexcept {
         NumaReplicatedBase::operator=(*this, std::move(other));
-        instances = std::exchange(other.instances, {});
+        instances  = std::exchange(other.instances, {});
+        replicator = std::move(other.replicator);
 
         return *this;
     }
@@ -1082,6 +1107,23 @@ class NumaReplicated: public NumaReplicatedBase {
 
     const T* operator->() const { return instances[0].get(); }
 
+    // Write access to the copy of one node, for objects that the threads of each
+    // node keep updating (see Search::SharedHistories). The copies then drift apart,
+    // and after a change of the NUMA config they all restart from the first one.
+    T& local(NumaReplicatedAccessToken token) {
+        assert(token.get_numa_index() < instances.size());
+        return *(instances[token.get_numa_index()]);
+    }
+
+    size_t   size() const { return instances.size(); }
+    const T& instance(NumaIndex n) const { return *(instances[n]); }
+
+    // Replaces the copy constructor of T for the copies of each node, and copies again
+    void set_replicator(ReplicatorFuncType f) {
+        replicator = std::move(f);
+        on_numa_config_changed();
+    }
+
     template<typename FuncT>
     void modify_and_replicate(FuncT&& f) {
         auto source = std::move(instances[0]);
@@ -1098,6 +1140,7 @@ class NumaReplicated: public NumaReplicatedBase {
 
    private:
     std::vector<std::unique_ptr<T>> instances;
+    ReplicatorFuncType              replicator;
 
     void replicate_from(T&& source) {
         instances.clear();
@@ -1107,8 +1150,13 @@ class NumaReplicated: public NumaReplicatedBase {
         {
             for (NumaIndex n = 0; n < cfg.num_numa_nodes(); ++n)
             {
-                cfg.execute_on_numa_node(
-                  n, [this, &source]() { instances.emplace_back(std::make_unique<T>(source)); });
+                cfg.execute_on_numa_node(n, [this, &source, n]() {
+                    if (replicator)
+                        instances.emplace_back(std::make_unique<T>(
+                          replicator(source, n, n ? instances[0].get() : nullptr)));
+                    else
+                        instances.emplace_back(std::make_unique<T>(source));
+                });
             }
         }
         else
@@ -19,10 +19,19 @@
 #ifndef PERFT_H_INCLUDED
 #define PERFT_H_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "misc.h"
 #include "movegen.h"
 #include "position.h"
+#include "thread.h"
 #include "types.h"
 #include "uci.h"
 
@@ -34,7 +43,6 @@ template<bool Root>
 uint64_t perft(Position& pos, Depth depth) {
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     uint64_t   cnt, nodes = 0;
     const bool leaf = (depth == 2);
@@ -57,12 +65,160 @@ uint64_t perft(Position& pos, Depth depth) {
 }
 
 inline uint64_t perft(const std::string& fen, Depth depth, bool isChess960) {
-    StateListPtr states(new std::deque<StateInfo>(1));
+    StateListPtr states = std::make_unique<StateList>(1);
     Position     p;
     p.set(fen, isChess960, &states->back());
 
     return perft<true>(p, depth);
 }
+
+// Hash table of subtree leaf counts, keyed on the position key and the depth,
+// shared by all perft threads. An entry stores key ^ data next to data, so that
+// a torn entry written concurrently by two threads fails verification.
+class PerftTable {
+    struct Entry {
+        std::atomic<uint64_t> keyXorData{0}, data{0};
+    };
+
+   public:
+    explicit PerftTable(size_t mbSize) :
+        table(std::max<size_t>(mbSize * 1024 * 1024 / sizeof(Entry), 1)) {}
+
+    bool probe(Key key, Depth depth, uint64_t& nodes) const {
+        const Entry&   e    = table[mul_hi64(key, table.size())];
+        const uint64_t data = e.data.load(std::memory_order_relaxed);
+
+        if ((e.keyXorData.load(std::memory_order_relaxed) ^ data) != key
+            || Depth(data & 0xFF) != depth)
+            return false;
+
+        nodes = data >> 8;
+        return true;
+    }
+
+    void store(Key key, Depth depth, uint64_t nodes) {
+        Entry&         e    = table[mul_hi64(key, table.size())];
+        const uint64_t data = nodes << 8 | uint64_t(depth);
+
+        e.keyXorData.store(key ^ data, std::memory_order_relaxed);
+        e.data.store(data, std::memory_order_relaxed);
+    }
+
+   private:
+    std::vector<Entry> table;
+};
+
+// Like perft<false>, but reusing the counts of transposed subtrees when a table is given
+inline uint64_t perft(Position& pos, Depth depth, PerftTable* table) {
+
+    if (depth == 1)
+        return MoveList<LEGAL>(pos).size();
+
+    uint64_t nodes = 0;
+
+    if (table && table->probe(pos.key(), depth, nodes))
+        return nodes;
+
+    StateInfo st;
+
+    for (const auto& m : MoveList<LEGAL>(pos))
+    {
+        pos.do_move(m, st);
+        nodes += perft(pos, depth - 1, table);
+        pos.undo_move(m);
+    }
+
+    if (table)
+        table->store(pos.key(), depth, nodes);
+
+    return nodes;
+}
+
+// Parallel perft. The root moves, and for deeper runs their replies as well,
+// are turned into a list of subtrees which idle threads pick up one by one,
+// so that threads finishing small subtrees early steal the remaining work.
+// The per move output is the same as for the sequential version.
+inline uint64_t perft(const std::string& fen,
+                      Depth              depth,
+                      bool               isChess960,
+                      ThreadPool&        threads,
+                      size_t             threadCount,
+                      size_t             hashMB) {
+
+    threadCount = std::min(threadCount, threads.num_threads());
+
+    if (depth <= 1 || (threadCount <= 1 && !hashMB))
+        return perft(fen, depth, isChess960);
+
+    struct Subtree {
+        size_t rootIdx;
+        Move   moves[2];
+    };
+
+    StateListPtr states = std::make_unique<StateList>(1);
+    Position     p;
+    p.set(fen, isChess960, &states->back());
+
+    const MoveList<LEGAL>  rootMoves(p);
+    const bool             split = depth >= 3;
+    std::vector<Subtree>   subtrees;
+    std::atomic<size_t>    nextSubtree{0};
+    std::deque<std::atomic<uint64_t>> rootCounts(rootMoves.size());
+    std::unique_ptr<PerftTable>       table(hashMB ? new PerftTable(hashMB) : nullptr);
+
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        if (!split)
+        {
+            subtrees.push_back({i, {rootMoves.begin()[i], Move::none()}});
+            continue;
+        }
+
+        StateInfo st;
+        p.do_move(rootMoves.begin()[i], st);
+        for (const auto& m : MoveList<LEGAL>(p))
+            subtrees.push_back({i, {rootMoves.begin()[i], m}});
+        p.undo_move(rootMoves.begin()[i]);
+    }
+
+    const Depth subtreeDepth = depth - (split ? 2 : 1);
+
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.run_on_thread(t, [&]() {
+            StateInfo rootSt, st[2];
+            Position  pos;
+            pos.set(fen, isChess960, &rootSt);
+
+            for (size_t idx; (idx = nextSubtree.fetch_add(1)) < subtrees.size();)
+            {
+                const Subtree& s = subtrees[idx];
+
+                pos.do_move(s.moves[0], st[0]);
+                if (split)
+                    pos.do_move(s.moves[1], st[1]);
+
+                rootCounts[s.rootIdx] += perft(pos, subtreeDepth, table.get());
+
+                if (split)
+                    pos.undo_move(s.moves[1]);
+                pos.undo_move(s.moves[0]);
+            }
+        });
+
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.wait_on_thread(t);
+
+    uint64_t nodes = 0;
+
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        nodes += rootCounts[i];
+        sync_cout << UCIEngine::move(rootMoves.begin()[i], isChess960) << ": " << rootCounts[i]
+                  << sync_endl;
+    }
+
+    return nodes;
+}
 }
 
 #endif  // PERFT_H_INCLUDED
@@ -27,6 +27,7 @@
 #include <initializer_list>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string_view>
 #include <utility>
@@ -39,6 +40,10 @@
 #include "tt.h"
 #include "uci.h"
 
+#if defined(USE_AVX2)
+    #include <immintrin.h>
+#endif
+
 using std::string;
 
 namespace Stockfish {
@@ -83,13 +88,17 @@ std::ostream& operator<<(std::ostream& os, const Position& pos) {
     if (int(Tablebases::MaxCardinality) >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
         StateInfo st;
-        ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
         Position p;
         p.set(pos.fen(), pos.is_chess960(), &st);
         Tablebases::ProbeState s1, s2;
         Tablebases::WDLScore   wdl = Tablebases::probe_wdl(p, &s1);
         int                    dtz = Tablebases::probe_dtz(p, &s2);
+
+        // An answer of the WDL cache is as good as one read from the files
+        if (s1 == Tablebases::CACHED)
+            s1 = Tablebases::OK;
+
         os << "\nTablebases WDL: " << std::setw(4) << wdl << " (" << s1 << ")"
            << "\nTablebases DTZ: " << std::setw(4) << dtz << " (" << s2 << ")";
     }
@@ -199,10 +208,17 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si) {
     Square             sq = SQ_A8;
     std::istringstream ss(fenStr);
 
+    AccumulatorState* stack     = accumulators;
+    size_t            stackSize = accumulatorCount;
+
     std::memset(this, 0, sizeof(Position));
     std::memset(si, 0, sizeof(StateInfo));
     st = si;
 
+    accumulators     = stack;
+    accumulatorCount = stackSize;
+    take_accumulator(*st);
+
     ss >> std::noskipws;
 
     // 1. Piece placement
@@ -286,6 +302,7 @@ Position& Position::set(const string& fenStr, bool isChess960, StateInfo* si) {
 
     chess960 = isChess960;
     set_state();
+    store_key(gamePly, st->key);
 
     assert(pos_is_ok());
 
@@ -313,14 +330,20 @@ void Position::set_castling_right(Color c, Square rfrom) {
 
 
 // Sets king attacks to detect if a move gives check
+void Position::set_check_info() const {
+
+    sideToMove == WHITE ? set_check_info<WHITE>() : set_check_info<BLACK>();
+}
+
+template<Color Us>
 void Position::set_check_info() const {
 
     update_slider_blockers(WHITE);
     update_slider_blockers(BLACK);
 
-    Square ksq = square<KING>(~sideToMove);
+    Square ksq = square<KING>(~Us);
 
-    st->checkSquares[PAWN]   = pawn_attacks_bb(~sideToMove, ksq);
+    st->checkSquares[PAWN]   = pawn_attacks_bb(~Us, ksq);
     st->checkSquares[KNIGHT] = attacks_bb<KNIGHT>(ksq);
     st->checkSquares[BISHOP] = attacks_bb<BISHOP>(ksq, pieces());
     st->checkSquares[ROOK]   = attacks_bb<ROOK>(ksq, pieces());
@@ -661,6 +684,19 @@ bool Position::gives_check(Move m) const {
 // moves should be filtered out before this function is called.
 void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
+    sideToMove == WHITE ? do_move<WHITE>(m, newSt, givesCheck)
+                        : do_move<BLACK>(m, newSt, givesCheck);
+}
+
+// The make move proper, specialized on the side to move so that the
+// colour dependent lookups below are resolved at compile time.
+template<Color Us>
+void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
+
+    constexpr Color Them = ~Us;
+
+    assert(sideToMove == Us);
+
     assert(m.is_ok());
     assert(&newSt != st);
 
@@ -671,7 +707,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
     // our state pointer to point to the new (ready to be updated) state.
     std::memcpy(&newSt, st, offsetof(StateInfo, key));
     newSt.previous = st;
-    st             = &newSt;
+    newSt.seeCount = 0;
+    take_accumulator(newSt);
+    st = &newSt;
 
     // Increment ply counters. In particular, rule50 will be reset to zero later on
     // in case of a capture or a pawn move.
@@ -679,31 +717,25 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
     ++st->rule50;
     ++st->pliesFromNull;
 
-    // Used by NNUE
-    st->accumulatorBig.computed[WHITE]     = st->accumulatorBig.computed[BLACK] =
-      st->accumulatorSmall.computed[WHITE] = st->accumulatorSmall.computed[BLACK] = false;
-
     auto& dp     = st->dirtyPiece;
     dp.dirty_num = 1;
 
-    Color  us       = sideToMove;
-    Color  them     = ~us;
     Square from     = m.from_sq();
     Square to       = m.to_sq();
     Piece  pc       = piece_on(from);
-    Piece  captured = m.type_of() == EN_PASSANT ? make_piece(them, PAWN) : piece_on(to);
+    Piece  captured = m.type_of() == EN_PASSANT ? make_piece(Them, PAWN) : piece_on(to);
 
-    assert(color_of(pc) == us);
-    assert(captured == NO_PIECE || color_of(captured) == (m.type_of() != CASTLING ? them : us));
+    assert(color_of(pc) == Us);
+    assert(captured == NO_PIECE || color_of(captured) == (m.type_of() != CASTLING ? Them : Us));
     assert(type_of(captured) != KING);
 
     if (m.type_of() == CASTLING)
     {
-        assert(pc == make_piece(us, KING));
-        assert(captured == make_piece(us, ROOK));
+        assert(pc == make_piece(Us, KING));
+        assert(captured == make_piece(Us, ROOK));
 
         Square rfrom, rto;
-        do_castling<true>(us, from, to, rfrom, rto);
+        do_castling<Us, true>(from, to, rfrom, rto);
 
         k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
         captured = NO_PIECE;
@@ -719,19 +751,19 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
         {
             if (m.type_of() == EN_PASSANT)
             {
-                capsq -= pawn_push(us);
+                capsq -= pawn_push(Us);
 
-                assert(pc == make_piece(us, PAWN));
+                assert(pc == make_piece(Us, PAWN));
                 assert(to == st->epSquare);
-                assert(relative_rank(us, to) == RANK_6);
+                assert(relative_rank(Us, to) == RANK_6);
                 assert(piece_on(to) == NO_PIECE);
-                assert(piece_on(capsq) == make_piece(them, PAWN));
+                assert(piece_on(capsq) == make_piece(Them, PAWN));
             }
 
             st->pawnKey ^= Zobrist::psq[captured][capsq];
         }
         else
-            st->nonPawnMaterial[them] -= PieceValue[captured];
+            st->nonPawnMaterial[Them] -= PieceValue[captured];
 
         dp.dirty_num = 2;  // 1 piece moved, 1 piece captured
         dp.piece[1]  = captured;
@@ -781,17 +813,17 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
     {
         // Set en passant square if the moved pawn can be captured
         if ((int(to) ^ int(from)) == 16
-            && (pawn_attacks_bb(us, to - pawn_push(us)) & pieces(them, PAWN)))
+            && (pawn_attacks_bb(Us, to - pawn_push(Us)) & pieces(Them, PAWN)))
         {
-            st->epSquare = to - pawn_push(us);
+            st->epSquare = to - pawn_push(Us);
             k ^= Zobrist::enpassant[file_of(st->epSquare)];
         }
 
         else if (m.type_of() == PROMOTION)
         {
-            Piece promotion = make_piece(us, m.promotion_type());
+            Piece promotion = make_piece(Us, m.promotion_type());
 
-            assert(relative_rank(us, to) == RANK_8);
+            assert(relative_rank(Us, to) == RANK_8);
             assert(type_of(promotion) >= KNIGHT && type_of(promotion) <= QUEEN);
 
             remove_piece(to);
@@ -811,7 +843,7 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
               Zobrist::psq[promotion][pieceCount[promotion] - 1] ^ Zobrist::psq[pc][pieceCount[pc]];
 
             // Update material
-            st->nonPawnMaterial[us] += PieceValue[promotion];
+            st->nonPawnMaterial[Us] += PieceValue[promotion];
         }
 
         // Update pawn hash key
@@ -828,31 +860,23 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
     st->key = k;
 
     // Calculate checkers bitboard (if move gives check)
-    st->checkersBB = givesCheck ? attackers_to(square<KING>(them)) & pieces(us) : 0;
+    st->checkersBB = givesCheck ? attackers_to(square<KING>(Them)) & pieces(Us) : 0;
 
-    sideToMove = ~sideToMove;
+    sideToMove = Them;
 
     // Update king attacks used for fast check detection
-    set_check_info();
+    set_check_info<Them>();
+
+    st->ringKey = *key_ring(gamePly);
+    store_key(gamePly, k);
 
     // Calculate the repetition info. It is the ply distance from the previous
     // occurrence of the same position, negative in the 3-fold case, or zero
     // if the position was not repeated.
     st->repetition = 0;
     int end        = std::min(st->rule50, st->pliesFromNull);
-    if (end >= 4)
-    {
-        StateInfo* stp = st->previous->previous;
-        for (int i = 4; i <= end; i += 2)
-        {
-            stp = stp->previous->previous;
-            if (stp->key == st->key)
-            {
-                st->repetition = stp->repetition ? -i : i;
-                break;
-            }
-        }
-    }
+    if (int i = end >= 4 ? repetition_distance(end) : 0)
+        st->repetition = previous_state(i)->repetition ? -i : i;
 
     assert(pos_is_ok());
 }
@@ -860,13 +884,19 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
 // Unmakes a move. When it returns, the position should
 // be restored to exactly the same state as before the move was made.
+void Position::undo_move(Move m) {
+
+    sideToMove == BLACK ? undo_move<WHITE>(m) : undo_move<BLACK>(m);
+}
+
+template<Color Us>
 void Position::undo_move(Move m) {
 
     assert(m.is_ok());
+    assert(sideToMove == ~Us);
 
-    sideToMove = ~sideToMove;
+    sideToMove = Us;
 
-    Color  us   = sideToMove;
     Square from = m.from_sq();
     Square to   = m.to_sq();
     Piece  pc   = piece_on(to);
@@ -876,19 +906,19 @@ void Position::undo_move(Move m) {
 
     if (m.type_of() == PROMOTION)
     {
-        assert(relative_rank(us, to) == RANK_8);
+        assert(relative_rank(Us, to) == RANK_8);
         assert(type_of(pc) == m.promotion_type());
         assert(type_of(pc) >= KNIGHT && type_of(pc) <= QUEEN);
 
         remove_piece(to);
-        pc = make_piece(us, PAWN);
+        pc = make_piece(Us, PAWN);
         put_piece(pc, to);
     }
 
     if (m.type_of() == CASTLING)
     {
         Square rfrom, rto;
-        do_castling<false>(us, from, to, rfrom, rto);
+        do_castling<Us, false>(from, to, rfrom, rto);
     }
     else
     {
@@ -900,19 +930,21 @@ void Position::undo_move(Move m) {
 
             if (m.type_of() == EN_PASSANT)
             {
-                capsq -= pawn_push(us);
+                capsq -= pawn_push(Us);
 
                 assert(type_of(pc) == PAWN);
                 assert(to == st->previous->epSquare);
-                assert(relative_rank(us, to) == RANK_6);
+                assert(relative_rank(Us, to) == RANK_6);
                 assert(piece_on(capsq) == NO_PIECE);
-                assert(st->capturedPiece == make_piece(~us, PAWN));
+                assert(st->capturedPiece == make_piece(~Us, PAWN));
             }
 
             put_piece(st->capturedPiece, capsq);  // Restore the captured piece
         }
     }
 
+    store_key(gamePly, st->ringKey);
+
     // Finally point our state pointer back to the previous state
     st = st->previous;
     --gamePly;
@@ -923,21 +955,21 @@ void Position::undo_move(Move m) {
 
 // Helper used to do/undo a castling move. This is a bit
 // tricky in Chess960 where from/to squares can overlap.
-template<bool Do>
-void Position::do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto) {
+template<Color Us, bool Do>
+void Position::do_castling(Square from, Square& to, Square& rfrom, Square& rto) {
 
     bool kingSide = to > from;
     rfrom         = to;  // Castling is encoded as "king captures friendly rook"
-    rto           = relative_square(us, kingSide ? SQ_F1 : SQ_D1);
-    to            = relative_square(us, kingSide ? SQ_G1 : SQ_C1);
+    rto           = relative_square(Us, kingSide ? SQ_F1 : SQ_D1);
+    to            = relative_square(Us, kingSide ? SQ_G1 : SQ_C1);
 
     if (Do)
     {
         auto& dp     = st->dirtyPiece;
-        dp.piece[0]  = make_piece(us, KING);
+        dp.piece[0]  = make_piece(Us, KING);
         dp.from[0]   = from;
         dp.to[0]     = to;
-        dp.piece[1]  = make_piece(us, ROOK);
+        dp.piece[1]  = make_piece(Us, ROOK);
         dp.from[1]   = rfrom;
         dp.to[1]     = rto;
         dp.dirty_num = 2;
@@ -948,8 +980,8 @@ void Position::do_castling(Color us, Square from, Square& to, Square& rfrom, Squ
     remove_piece(Do ? rfrom : rto);
     board[Do ? from : to] = board[Do ? rfrom : rto] =
       NO_PIECE;  // remove_piece does not do this for us
-    put_piece(make_piece(us, KING), Do ? to : from);
-    put_piece(make_piece(us, ROOK), Do ? rto : rfrom);
+    put_piece(make_piece(Us, KING), Do ? to : from);
+    put_piece(make_piece(Us, ROOK), Do ? rto : rfrom);
 }
 
 
@@ -960,15 +992,15 @@ void Position::do_null_move(StateInfo& newSt, TranspositionTable& tt) {
     assert(!checkers());
     assert(&newSt != st);
 
-    std::memcpy(&newSt, st, offsetof(StateInfo, accumulatorBig));
+    std::memcpy(&newSt, st, offsetof(StateInfo, acc));
 
     newSt.previous = st;
-    st             = &newSt;
+    newSt.seeCount = 0;
+    take_accumulator(newSt);
+    st = &newSt;
 
-    st->dirtyPiece.dirty_num               = 0;
-    st->dirtyPiece.piece[0]                = NO_PIECE;  // Avoid checks in UpdateAccumulator()
-    st->accumulatorBig.computed[WHITE]     = st->accumulatorBig.computed[BLACK] =
-      st->accumulatorSmall.computed[WHITE] = st->accumulatorSmall.computed[BLACK] = false;
+    st->dirtyPiece.dirty_num = 0;
+    st->dirtyPiece.piece[0]  = NO_PIECE;  // Avoid checks in UpdateAccumulator()
 
     if (st->epSquare != SQ_NONE)
     {
@@ -986,6 +1018,9 @@ void Position::do_null_move(StateInfo& newSt, TranspositionTable& tt) {
 
     set_check_info();
 
+    // The null move does not advance gamePly, so its key takes the slot of the
+    // position before it until undo_null_move() puts that one back.
+    store_key(gamePly, st->key);
     st->repetition = 0;
 
     assert(pos_is_ok());
@@ -999,6 +1034,8 @@ void Position::undo_null_move() {
 
     st         = st->previous;
     sideToMove = ~sideToMove;
+
+    store_key(gamePly, st->key);
 }
 
 
@@ -1043,6 +1080,64 @@ bool Position::see_ge(Move m, int threshold) const {
     if (swap <= 0)
         return true;
 
+    // The move picker and the pruning in search test the same move with
+    // different thresholds, so the bounds found so far often decide it.
+    constexpr int CacheSize = StateInfo::SeeCacheSize;
+
+    int n = std::min(st->seeCount, CacheSize), i = 0;
+    while (i < n && st->seeMove[i] != m)
+        ++i;
+
+    if (i < n)
+    {
+        if (threshold <= st->seePass[i])
+            return true;
+
+        if (threshold >= st->seeFail[i])
+            return false;
+    }
+    else
+    {
+        i              = st->seeCount++ % CacheSize;
+        st->seeMove[i] = m;
+        st->seePass[i] = std::numeric_limits<int>::min();
+        st->seeFail[i] = std::numeric_limits<int>::max();
+    }
+
+    const bool res = see_exchange(from, to, swap);
+
+    if (res)
+        st->seePass[i] = std::max(st->seePass[i], threshold);
+    else
+        st->seeFail[i] = std::min(st->seeFail[i], threshold);
+
+    return res;
+}
+
+bool Position::see_ge_uncached(Move m, int threshold) const {
+
+    assert(m.is_ok());
+
+    if (m.type_of() != NORMAL)
+        return VALUE_ZERO >= threshold;
+
+    Square from = m.from_sq(), to = m.to_sq();
+
+    int swap = PieceValue[piece_on(to)] - threshold;
+    if (swap < 0)
+        return false;
+
+    swap = PieceValue[piece_on(from)] - swap;
+    if (swap <= 0)
+        return true;
+
+    return see_exchange(from, to, swap);
+}
+
+// Plays out the captures on 'to' after the move from 'from', given the
+// balance 'swap' of see_ge() after the first two captures.
+bool Position::see_exchange(Square from, Square to, int swap) const {
+
     assert(color_of(piece_on(from)) == sideToMove);
     Bitboard occupied  = pieces() ^ from ^ to;  // xoring to is important for pinned piece logic
     Color    stm       = sideToMove;
@@ -1126,6 +1221,132 @@ bool Position::see_ge(Move m, int threshold) const {
     return bool(res);
 }
 
+// Stores the key of the position at the given ply in the key ring
+void Position::store_key(int ply, Key k) {
+
+    Key* ring = keyRing[ply & 1];
+    int  j    = (ply >> 1) & (KeyRingSize - 1);
+
+    ring[j] = ring[j + KeyRingSize] = k;
+}
+
+
+// Returns the slot of the given ply in the upper half of its ring, so that
+// ring[-t] is the key of the position 2 * t plies earlier, for t < KeyRingSize.
+const Key* Position::key_ring(int ply) const {
+    return keyRing[ply & 1] + ((ply >> 1) & (KeyRingSize - 1)) + KeyRingSize;
+}
+
+
+// Returns the StateInfo of the position the given number of plies ago
+const StateInfo* Position::previous_state(int plies) const {
+
+    const StateInfo* stp = st;
+
+    while (plies--)
+        stp = stp->previous;
+
+    return stp;
+}
+
+
+// Copies si to the state of the position, except for its accumulators, and
+// refills the key ring from the earlier states si links to.
+void Position::set_root_state(const StateInfo& si) {
+
+    AccumulatorState* acc = st->acc;
+
+    *st     = si;
+    st->acc = acc;
+
+    load_key_history();
+}
+
+
+void Position::set_accumulators(AccumulatorState* stack, size_t size) {
+
+    accumulators     = stack;
+    accumulatorCount = size;
+}
+
+
+// Gives newSt the accumulators of the ply after the current state, or of the
+// first ply for the state set up by set(), and marks them as not computed.
+void Position::take_accumulator(StateInfo& newSt) const {
+
+    size_t i  = &newSt == st ? 0 : st->acc ? size_t(st->acc - accumulators) + 1 : accumulatorCount;
+    newSt.acc = i < accumulatorCount ? &accumulators[i] : nullptr;
+
+    if (!newSt.acc)
+        return;
+
+    newSt.acc->accumulatorBig.computed[WHITE]     = newSt.acc->accumulatorBig.computed[BLACK] =
+      newSt.acc->accumulatorSmall.computed[WHITE] = newSt.acc->accumulatorSmall.computed[BLACK] =
+        false;
+#if defined(INCREMENTAL_L1)
+    newSt.acc->accumulatorBig.l1Bucket = newSt.acc->accumulatorSmall.l1Bucket = 0;
+#endif
+}
+
+
+// Refills the key ring from the StateInfo chain
+void Position::load_key_history() {
+
+    const int        end = std::min({st->rule50, st->pliesFromNull, MaxRingPlies});
+    const StateInfo* stp = st;
+
+    for (int i = 0; i <= end; ++i, stp = stp->previous)
+        store_key(gamePly - i, stp->key);
+}
+
+
+// Returns the ply distance, even and at least 4, to the nearest earlier
+// occurrence of the current position within the last 'end' plies, or zero.
+// The keys with the same side to move are contiguous in the key ring, so they
+// are compared four at a time with AVX2.
+int Position::repetition_distance(int end) const {
+
+    const Key key = st->key;
+
+    if (end > MaxRingPlies)
+    {
+        StateInfo* stp = st->previous->previous;
+        for (int i = 4; i <= end; i += 2)
+        {
+            stp = stp->previous->previous;
+            if (stp->key == key)
+                return i;
+        }
+        return 0;
+    }
+
+    const Key* ring = key_ring(gamePly);
+    const int  n    = end / 2;
+    int        t    = 2;
+
+#if defined(USE_AVX2)
+    const __m256i k = _mm256_set1_epi64x(int64_t(key));
+
+    for (; t + 3 <= n; t += 4)
+    {
+        // Lane l holds the key 2 * (t + 3 - l) plies ago, so the highest set
+        // lane is the nearest occurrence.
+        __m256i keys = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ring - t - 3));
+        int     mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(keys, k)));
+
+        if (mask)
+            return 2 * (t + 3 - int(msb(Bitboard(mask))));
+    }
+#endif
+
+    for (; t <= n; ++t)
+        if (ring[-t] == key)
+            return 2 * t;
+
+    return 0;
+}
+
+
 // Tests whether the position is drawn by 50-move rule
 // or by repetition. It does not detect stalemates.
 bool Position::is_draw(int ply) const {
@@ -1167,14 +1388,15 @@ bool Position::has_game_cycle(int ply) const {
     if (end < 3)
         return false;
 
+    // The keys of the earlier positions with the other side to move are read
+    // from the key ring when it holds them all.
     Key        originalKey = st->key;
+    const Key* ring        = end <= MaxRingPlies ? key_ring(gamePly - 1) : nullptr;
     StateInfo* stp         = st->previous;
 
     for (int i = 3; i <= end; i += 2)
     {
-        stp = stp->previous->previous;
-
-        Key moveKey = originalKey ^ stp->key;
+        Key moveKey = originalKey ^ (ring ? ring[-(i / 2)] : (stp = stp->previous->previous)->key);
         if ((j = H1(moveKey), cuckoo[j] == moveKey) || (j = H2(moveKey), cuckoo[j] == moveKey))
         {
             Move   move = cuckooMove[j];
@@ -1194,7 +1416,7 @@ bool Position::has_game_cycle(int ply) const {
                     continue;
 
                 // For repetitions before or at the root, require one more
-                if (stp->repetition)
+                if (previous_state(i)->repetition)
                     return true;
             }
         }
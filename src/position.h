@@ -20,10 +20,10 @@
 #define POSITION_H_INCLUDED
 
 #include <cassert>
-#include <deque>
 #include <iosfwd>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "bitboard.h"
 #include "nnue/nnue_accumulator.h"
@@ -33,6 +33,15 @@
 namespace Stockfish {
 
 class TranspositionTable;
+struct StateInfo;
+
+// The NNUE accumulators of a position. They are several KB each, so they are
+// kept out of StateInfo, in a stack indexed by ply which is owned by whoever
+// evaluates the positions, and StateInfo only points to its entry.
+struct AccumulatorState {
+    Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsBig>   accumulatorBig;
+    Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsSmall> accumulatorSmall;
+};
 
 // StateInfo struct stores information needed to restore a Position object to
 // its previous state when we retract a move. Whenever a move is made on the
@@ -58,19 +67,57 @@ struct StateInfo {
     Bitboard   checkSquares[PIECE_TYPE_NB];
     Piece      capturedPiece;
     int        repetition;
+    Key        ringKey;  // The key this position took the slot of in the key ring
 
-    // Used by NNUE
-    Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsBig>   accumulatorBig;
-    Eval::NNUE::Accumulator<Eval::NNUE::TransformedFeatureDimensionsSmall> accumulatorSmall;
-    DirtyPiece                                                             dirtyPiece;
+    // SEE thresholds known to pass and to fail for the last moves tested by
+    // Position::see_ge() in this position.
+    static constexpr int SeeCacheSize = 4;
+
+    Move seeMove[SeeCacheSize];
+    int  seePass[SeeCacheSize], seeFail[SeeCacheSize];
+    int  seeCount;
+
+    // Used by NNUE. The accumulators are null beyond the end of the stack of
+    // the position, and for positions without one.
+    AccumulatorState* acc;
+    DirtyPiece        dirtyPiece;
 };
 
 
 // A list to keep track of the position states along the setup moves (from the
 // start position to the position just before the search starts). Needed by
-// 'draw by repetition' detection. Use a std::deque because pointers to
-// elements are not invalidated upon list resizing.
-using StateListPtr = std::unique_ptr<std::deque<StateInfo>>;
+// 'draw by repetition' detection. The states live in blocks which are never
+// moved, so pointers to elements stay valid when the list grows, and which are
+// kept when it shrinks, so that a list reused for the next position only
+// allocates for the moves beyond the deepest one it ever held. Elements are
+// not initialized, Position::set() and Position::do_move() fill them.
+class StateList {
+   public:
+    explicit StateList(size_t n = 0) { resize(n); }
+
+    size_t     size() const { return count; }
+    StateInfo& operator[](size_t i) { return blocks[i / BlockSize][i % BlockSize]; }
+    StateInfo& back() { return (*this)[count - 1]; }
+
+    StateInfo& emplace_back() {
+        resize(count + 1);
+        return back();
+    }
+
+    void resize(size_t n) {
+        while (blocks.size() * BlockSize < n)
+            blocks.emplace_back(new StateInfo[BlockSize]);
+        count = n;
+    }
+
+   private:
+    static constexpr size_t BlockSize = 32;
+
+    std::vector<std::unique_ptr<StateInfo[]>> blocks;
+    size_t                                    count = 0;
+};
+
+using StateListPtr = std::unique_ptr<StateList>;
 
 
 // Position class stores information regarding the board representation as
@@ -142,8 +189,10 @@ class Position {
     void do_null_move(StateInfo& newSt, TranspositionTable& tt);
     void undo_null_move();
 
-    // Static Exchange Evaluation
+    // Static Exchange Evaluation. see_ge_uncached() skips the results kept in
+    // StateInfo, for the SEE benchmark.
     bool see_ge(Move m, int threshold = 0) const;
+    bool see_ge_uncached(Move m, int threshold = 0) const;
 
     // Accessing hash keys
     Key key() const;
@@ -169,6 +218,13 @@ class Position {
     // Used by NNUE
     StateInfo* state() const;
 
+    // Takes the fields of si which a fen string does not give, as the root
+    // positions of the search threads do from the last setup state.
+    void set_root_state(const StateInfo& si);
+
+    // The stack of accumulators of the plies from the position set, kept by set()
+    void set_accumulators(AccumulatorState* stack, size_t size);
+
     void put_piece(Piece pc, Square s);
     void remove_piece(Square s);
 
@@ -177,14 +233,38 @@ class Position {
     void set_castling_right(Color c, Square rfrom);
     void set_state() const;
     void set_check_info() const;
+    template<Color Us>
+    void set_check_info() const;
 
     // Other helpers
     void move_piece(Square from, Square to);
-    template<bool Do>
-    void do_castling(Color us, Square from, Square& to, Square& rfrom, Square& rto);
+    template<Color Us>
+    void do_move(Move m, StateInfo& newSt, bool givesCheck);
+    template<Color Us>
+    void undo_move(Move m);
+    template<Color Us, bool Do>
+    void do_castling(Square from, Square& to, Square& rfrom, Square& rto);
     template<bool AfterMove>
     Key adjust_key50(Key k) const;
 
+    void take_accumulator(StateInfo& newSt) const;
+    bool see_exchange(Square from, Square to, int swap) const;
+
+    // Repetition detection helpers
+    void             load_key_history();
+    void             store_key(int ply, Key k);
+    const Key*       key_ring(int ply) const;
+    const StateInfo* previous_state(int plies) const;
+    int              repetition_distance(int end) const;
+
+    // The key ring holds the keys of the last 2 * KeyRingSize plies, by parity
+    // of the ply, so that the repetition checks read them from a few cache lines
+    // instead of chasing StateInfo::previous through the accumulators. A move
+    // takes the slot of the position 2 * KeyRingSize plies before it, whose key
+    // undo_move() puts back, so that the ring stays exact after take backs.
+    static constexpr int KeyRingSize  = 64;
+    static constexpr int MaxRingPlies = 2 * KeyRingSize - 1;
+
     // Data members
     Piece      board[SQUARE_NB];
     Bitboard   byTypeBB[PIECE_TYPE_NB];
@@ -197,6 +277,13 @@ class Position {
     int        gamePly;
     Color      sideToMove;
     bool       chess960;
+
+    // Each key is stored twice, KeyRingSize apart, so that the keys of the
+    // plies before any ply are contiguous below its slot in the upper half.
+    Key keyRing[2][2 * KeyRingSize];
+
+    AccumulatorState* accumulators     = nullptr;
+    size_t            accumulatorCount = 0;
 };
 
 std::ostream& operator<<(std::ostream& os, const Position& pos);
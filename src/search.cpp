@@ -25,7 +25,9 @@
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <fstream>
 #include <initializer_list>
+#include <sstream>
 #include <string>
 #include <utility>
 
@@ -55,9 +57,6 @@ using namespace Search;
 
 namespace {
 
-static constexpr double EvalLevel[10] = {0.981, 0.956, 0.895, 0.949, 0.913,
-                                         0.942, 0.933, 0.890, 0.984, 0.941};
-
 // Futility margin
 Value futility_margin(Depth d, bool noTtCutNode, bool improving, bool oppWorsening) {
     Value futilityMult       = 109 - 40 * noTtCutNode;
@@ -73,7 +72,7 @@ constexpr int futility_move_count(bool improving, Depth depth) {
 
 // Add correctionHistory value to raw staticEval and guarantee evaluation does not hit the tablebase range
 Value to_corrected_static_eval(Value v, const Worker& w, const Position& pos) {
-    auto cv = w.correctionHistory[pos.side_to_move()][pawn_structure_index<Correction>(pos)];
+    int cv = (*w.correctionHistory)[pos.side_to_move()][pawn_structure_index<Correction>(pos)];
     v += cv / 10;
     return std::clamp(v, VALUE_TB_LOSS_IN_MAX_PLY + 1, VALUE_TB_WIN_IN_MAX_PLY - 1);
 }
@@ -139,6 +138,7 @@ Search::Worker::Worker(SharedState&                    sharedState,
                        std::unique_ptr<ISearchManager> sm,
                        size_t                          threadId,
                        NumaReplicatedAccessToken       token) :
+    accumulators(MAX_PLY + 1),
     // Unpack the SharedState struct into member variables
     threadIdx(threadId),
     numaAccessToken(token),
@@ -147,22 +147,62 @@ Search::Worker::Worker(SharedState&                    sharedState,
     threads(sharedState.threads),
     tt(sharedState.tt),
     networks(sharedState.networks),
+    sharedHistories(sharedState.sharedHistories),
     refreshTable(networks[token]) {
+    rootPos.set_accumulators(accumulators.data(), accumulators.size());
     clear();
 }
 
 void Search::Worker::start_searching() {
 
+    threads.note_search_start();
+
     // Non-main threads go directly to iterative_deepening()
     if (!is_mainthread())
     {
         iterative_deepening();
+        threads.flush_nodes(*this);
+
+        if (threadIdx < threads.rootGroups)
+            threads.groupsDone++;
+
+        if (threads.deterministic)
+            threads.leave_epochs(false);
         return;
     }
 
-    main_manager()->tm.init(limits, rootPos.side_to_move(), rootPos.game_ply(), options,
-                            main_manager()->originalTimeAdjust);
-    tt.new_search();
+    SearchManager* mainThread = main_manager();
+    const Color    us         = rootPos.side_to_move();
+
+    // Log the time decisions for TimeManagement::replay(), which cannot know
+    // when a ponderhit arrives, so searches started as ponder are not logged.
+    mainThread->stopReason = nullptr;
+    mainThread->tmLog.clear();
+    if (limits.use_time_management() && !limits.ponderMode
+        && !std::string(options["TMLog"]).empty())
+    {
+        std::ostringstream ss;
+        ss << "move ply " << rootPos.game_ply() << " time " << limits.time[us] << " inc "
+           << limits.inc[us] << " movestogo " << limits.movestogo << " overhead "
+           << int(options["Move Overhead"]) << " ponder " << bool(options["Ponder"])
+           << " nodestime " << int(options["nodestime"]) << " adjust "
+           << mainThread->originalTimeAdjust << " reduction " << mainThread->previousTimeReduction;
+        mainThread->tmLog = ss.str();
+    }
+
+    mainThread->tm.init(limits, us, rootPos.game_ply(), options, mainThread->originalTimeAdjust);
+    tt.new_search(rootPos.game_ply());
+
+    // A GUI waiting for 'stop' or 'ponderhit' takes the deadline off
+    const TimePoint sla    = TimePoint(int(options["LatencySLA"]));
+    mainThread->deadline   = sla && !limits.ponderMode && !limits.infinite
+                             ? std::max(TimePoint(1), sla - mainThread->stopMargin)
+                             : 0;
+    mainThread->deadlineHit = 0;
+
+    if (!mainThread->tmLog.empty())
+        mainThread->tmLog += " optimum " + std::to_string(mainThread->tm.optimum()) + " maximum "
+                           + std::to_string(mainThread->tm.maximum()) + "\n";
 
     if (rootMoves.empty())
     {
@@ -174,6 +214,8 @@ void Search::Worker::start_searching() {
     {
         threads.start_searching();  // start non-main threads
         iterative_deepening();      // main thread start searching
+        threads.flush_nodes(*this);
+        threads.groupsDone++;
     }
 
     // When we reach the maximum depth, we can arrive here without a raise of
@@ -181,16 +223,38 @@ void Search::Worker::start_searching() {
     // the UCI protocol states that we shouldn't print the best move before the
     // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
     // until the GUI sends one of those commands.
+    const bool waitForGui = main_manager()->ponder || limits.infinite;
+
+    // With SplitRootMoves, the first thread of every group stops at the depth
+    // limit. Wait for the other groups to get there too, still checking the time.
+    const bool waitForGroups = limits.depth && threads.rootGroups > 1;
+
+    // In DeterministicSMP mode the other threads are stopped at the end of the
+    // current epoch, after the same number of nodes whatever the timing.
+    if (threads.deterministic)
+        threads.leave_epochs(!waitForGui && !waitForGroups);
+
+    while (waitForGroups && !threads.stop && threads.groupsDone < threads.rootGroups)
+        mainThread->check_time(*this);
+
+    // Reaching the maximum depth is the only way to get here without a stop
+    if (!mainThread->stopReason)
+        mainThread->stopReason = threads.stop ? "stop" : "depth";
+
     while (!threads.stop && (main_manager()->ponder || limits.infinite))
     {}  // Busy wait for a stop or a ponder reset
 
     // Stop the threads if not already stopped (also raise the stop if
     // "ponderhit" just reset threads.ponder).
-    threads.stop = true;
+    if (!threads.deterministic || waitForGui || waitForGroups)
+        threads.stop = true;
 
     // Wait until all threads have finished
     threads.wait_for_search_finished();
 
+    if (threads.deterministic)
+        threads.flush_tt_buffers();
+
     // When playing in 'nodes as time' mode, subtract the searched nodes from
     // the available ones before exiting.
     if (limits.npmsec)
@@ -201,15 +265,25 @@ void Search::Worker::start_searching() {
     Skill   skill =
       Skill(options["Skill Level"], options["UCI_LimitStrength"] ? int(options["UCI_Elo"]) : 0);
 
+    // Each group of threads only searched some of the root moves, collect them all
+    const bool mergedRootMoves = threads.rootGroups > 1 && !skill.enabled();
+    if (mergedRootMoves)
+        threads.merge_root_moves();
+
+    // A deeper line found by another node replaces our best one
+    const bool remoteLine =
+      threads.cluster && threads.cluster->stop_search(rootPos, rootMoves, completedDepth);
+
     if (int(options["MultiPV"]) == 1 && !limits.depth && !limits.mate && !skill.enabled()
-        && rootMoves[0].pv[0] != Move::none())
+        && !remoteLine && rootMoves[0].pv[0] != Move::none())
         bestThread = threads.get_best_thread()->worker.get();
 
     main_manager()->bestPreviousScore        = bestThread->rootMoves[0].score;
     main_manager()->bestPreviousAverageScore = bestThread->rootMoves[0].averageScore;
 
-    // Send again PV info if we have a new best thread
-    if (bestThread != this)
+    // Send again PV info if we have a new best thread or the lines of all groups,
+    // and in DeterministicSMP mode so that the last info has the final node count.
+    if (bestThread != this || mergedRootMoves || remoteLine || threads.deterministic)
         main_manager()->pv(*bestThread, threads, tt, bestThread->completedDepth);
 
     std::string ponder;
@@ -218,8 +292,38 @@ void Search::Worker::start_searching() {
         || bestThread->rootMoves[0].extract_ponder_from_tt(tt, rootPos))
         ponder = UCIEngine::move(bestThread->rootMoves[0].pv[1], rootPos.is_chess960());
 
+    const TimePoint elapsed = mainThread->tm.elapsed_time();
+
     auto bestmove = UCIEngine::move(bestThread->rootMoves[0].pv[0], rootPos.is_chess960());
     main_manager()->updates.onBestmove(bestmove, ponder);
+
+    if (mainThread->deadline)
+    {
+        const TimePoint sent = now();
+
+        // The margin follows the slowest recent stops, and shrinks slowly back
+        if (mainThread->deadlineHit)
+            mainThread->stopMargin =
+              std::max({TimePoint(1), sent - mainThread->deadlineHit,
+                        mainThread->stopMargin - mainThread->stopMargin / 8});
+
+        threads.note_response(sent - limits.startTime, sla);
+    }
+
+    // Logged once the move is out, so that the files do not delay it
+    if (!mainThread->tmLog.empty())
+    {
+        const std::string path = options["TMLog"];
+        std::ofstream     log(path, std::ios::app);
+        log << mainThread->tmLog << "end elapsed " << elapsed << " depth "
+            << bestThread->completedDepth << " nodes " << threads.nodes_searched() << " reason "
+            << mainThread->stopReason << std::endl;
+    }
+
+    // Appends the sampled nodes of all threads, unless no search was needed
+    if (SearchTrace::Enabled && !std::string(options["SearchTrace"]).empty()
+        && rootMoves[0].pv[0] != Move::none())
+        threads.write_search_trace(options["SearchTrace"], int(options["SearchTraceRate"]));
 }
 
 // Main iterative deepening loop. It calls search()
@@ -229,6 +333,9 @@ void Search::Worker::iterative_deepening() {
 
     SearchManager* mainThread = (is_mainthread() ? main_manager() : nullptr);
 
+    prefetchDistance = int(options["PrefetchDistance"]);
+    trace.start(std::string(options["SearchTrace"]).empty() ? 0 : int(options["SearchTraceRate"]));
+
     Move pv[MAX_PLY + 1];
 
     Depth lastBestMoveDepth = 0;
@@ -277,11 +384,19 @@ void Search::Worker::iterative_deepening() {
 
     multiPV = std::min(multiPV, rootMoves.size());
 
+    // With MultiPVOnePass, all the lines come from a single root search in which
+    // alpha is the score of the last of the best lines found so far. The moves
+    // of different tablebase ranks are still searched apart.
+    onePassLines = multiPV > 1 && options["MultiPVOnePass"]
+                      && rootMoves.front().tbRank == rootMoves.back().tbRank
+                   ? multiPV
+                   : 0;
+
     int searchAgainCounter = 0;
 
     // Iterative deepening loop until requested to stop or the target depth is reached
     while (++rootDepth < MAX_PLY && !threads.stop
-           && !(limits.depth && mainThread && rootDepth > limits.depth))
+           && !(limits.depth && threadIdx < threads.rootGroups && rootDepth > limits.depth))
     {
         // Age out PV variability metric
         if (mainThread)
@@ -312,11 +427,14 @@ void Search::Worker::iterative_deepening() {
             // Reset UCI info selDepth for each depth and each PV line
             selDepth = 0;
 
-            // Reset aspiration window starting size
-            Value avg = rootMoves[pvIdx].averageScore;
-            delta     = 9 + avg * avg / 10182;
-            alpha     = std::max(avg - delta, -VALUE_INFINITE);
-            beta      = std::min(avg + delta, VALUE_INFINITE);
+            // Reset aspiration window starting size. A single pass window goes
+            // from the last line to the first one.
+            Value avg  = rootMoves[pvIdx].averageScore;
+            Value low  = onePassLines ? rootMoves[onePassLines - 1].averageScore : avg;
+            Value high = onePassLines ? std::max(avg, low) : avg;
+            delta      = 9 + avg * avg / 10182;
+            alpha      = std::max(low - delta, -VALUE_INFINITE);
+            beta       = std::min(high + delta, VALUE_INFINITE);
 
             // Adjust optimism based on root move's averageScore (~4 Elo)
             optimism[us]  = 127 * avg / (std::abs(avg) + 86);
@@ -355,9 +473,18 @@ void Search::Worker::iterative_deepening() {
                     && elapsed_time() > 3000)
                     main_manager()->pv(*this, threads, tt, rootDepth);
 
+                // A single pass fails low when fewer lines than needed beat alpha
+                if (onePassLines && bestValue > alpha && bestValue < beta
+                    && rootMoves[onePassLines - 1].score == -VALUE_INFINITE)
+                {
+                    alpha = std::max(alpha - delta, -VALUE_INFINITE);
+                    if (mainThread)
+                        mainThread->stopOnPonderhit = false;
+                }
+
                 // In case of failing low/high increase aspiration window and
                 // re-search, otherwise exit the loop.
-                if (bestValue <= alpha)
+                else if (bestValue <= alpha)
                 {
                     beta  = (alpha + beta) / 2;
                     alpha = std::max(bestValue - delta, -VALUE_INFINITE);
@@ -382,6 +509,9 @@ void Search::Worker::iterative_deepening() {
             // Sort the PV lines searched so far and update the GUI
             std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
+            if (onePassLines)
+                pvIdx = multiPV - 1;  // All the lines are done
+
             if (mainThread
                 && (threads.stop || pvIdx + 1 == multiPV || elapsed_time() > 3000)
                 // A thread that aborted search can have mated-in/TB-loss PV and score
@@ -426,7 +556,14 @@ void Search::Worker::iterative_deepening() {
                 || (rootMoves[0].score != -VALUE_INFINITE
                     && rootMoves[0].score <= VALUE_MATED_IN_MAX_PLY
                     && VALUE_MATE + rootMoves[0].score <= 2 * limits.mate)))
-            threads.stop = true;
+        {
+            // In DeterministicSMP mode the others stop at the end of the epoch
+            if (threads.deterministic)
+                break;
+
+            threads.stop           = true;
+            mainThread->stopReason = "mate";
+        }
 
         // If the skill level is enabled and time is up, pick a sub-optimal best move
         if (skill.enabled() && skill.time_to_pick(rootDepth))
@@ -442,45 +579,56 @@ void Search::Worker::iterative_deepening() {
         // Do we have time for the next iteration? Can we stop searching now?
         if (limits.use_time_management() && !threads.stop && !mainThread->stopOnPonderhit)
         {
-            int nodesEffort = rootMoves[0].effort * 100 / std::max(size_t(1), size_t(nodes));
-
-            double fallingEval = (1067 + 223 * (mainThread->bestPreviousAverageScore - bestValue)
-                                  + 97 * (mainThread->iterValue[iterIdx] - bestValue))
-                               / 10000.0;
-            fallingEval = std::clamp(fallingEval, 0.580, 1.667);
-
-            // If the bestMove is stable over several iterations, reduce time accordingly
-            timeReduction    = lastBestMoveDepth + 8 < completedDepth ? 1.495 : 0.687;
-            double reduction = (1.48 + mainThread->previousTimeReduction) / (2.17 * timeReduction);
-            double bestMoveInstability = 1 + 1.88 * totBestMoveChanges / threads.size();
-            int    el                  = std::clamp((bestValue + 750) / 150, 0, 9);
-            double recapture           = limits.capSq == rootMoves[0].pv[0].to_sq() ? 0.955 : 1.005;
-
-            double totalTime = mainThread->tm.optimum() * fallingEval * reduction
-                             * bestMoveInstability * EvalLevel[el] * recapture;
-
-            // Cap used time in case of a single legal move for a better viewer experience
-            if (rootMoves.size() == 1)
-                totalTime = std::min(500.0, totalTime);
-
-            auto elapsedTime = elapsed();
-
-            if (completedDepth >= 10 && nodesEffort >= 97 && elapsedTime > totalTime * 0.739
-                && !mainThread->ponder)
-                threads.stop = true;
-
-            // Stop the search if we have exceeded the totalTime
-            if (elapsedTime > totalTime)
+            TimeManagement::Iteration it;
+            it.depth             = completedDepth;
+            it.lastBestMoveDepth = lastBestMoveDepth;
+            it.nodesEffort     = rootMoves[0].effort * 100 / std::max(size_t(1), size_t(nodes));
+            it.value           = bestValue;
+            it.previousAverage = mainThread->bestPreviousAverageScore;
+            it.previousValue   = mainThread->iterValue[iterIdx];
+            it.bestMoveChanges = totBestMoveChanges;
+            it.threads         = threads.size();
+            it.recapture       = limits.capSq == rootMoves[0].pv[0].to_sq();
+            it.singleMove      = rootMoves.size() == 1 && threads.rootGroups == 1;
+            it.elapsed         = elapsed();
+
+            double totalTime =
+              mainThread->tm.iteration_time(it, mainThread->previousTimeReduction, timeReduction);
+
+            const auto verdict = TimeManagement::verdict(it, totalTime, mainThread->ponder);
+
+            switch (verdict)
             {
+            case TimeManagement::STOP_EFFORT :
+                threads.stop           = true;
+                mainThread->stopReason = "effort";
+                break;
+
+            case TimeManagement::STOP_OPTIMUM :
                 // If we are allowed to ponder do not stop the search now but
                 // keep pondering until the GUI sends "ponderhit" or "stop".
                 if (mainThread->ponder)
                     mainThread->stopOnPonderhit = true;
                 else
                     threads.stop = true;
+                mainThread->stopReason = "optimum";
+                break;
+
+            default :
+                threads.increaseDepth = verdict == TimeManagement::CONTINUE;
+            }
+
+            if (!mainThread->tmLog.empty())
+            {
+                std::ostringstream line;
+                line << "iter depth " << it.depth << " elapsed " << it.elapsed << " nodes "
+                     << size_t(nodes) << " effort " << it.nodesEffort << " value " << it.value
+                     << " average " << it.previousAverage << " previous " << it.previousValue
+                     << " lastbest " << it.lastBestMoveDepth << " changes " << it.bestMoveChanges
+                     << " threads " << it.threads << " recapture " << it.recapture << " single "
+                     << it.singleMove << " total " << TimePoint(totalTime) << "\n";
+                mainThread->tmLog += line.str();
             }
-            else
-                threads.increaseDepth = mainThread->ponder || elapsedTime <= totalTime * 0.506;
         }
 
         mainThread->iterValue[iterIdx] = bestValue;
@@ -499,12 +647,48 @@ void Search::Worker::iterative_deepening() {
                              skill.best ? skill.best : skill.pick_best(rootMoves, multiPV)));
 }
 
+Search::SharedHistories::SharedHistories() :
+    pawn(std::make_unique<PawnHistory>()),
+    correction(std::make_unique<CorrectionHistory>()) {
+    clear();
+}
+
+Search::SharedHistories::SharedHistories(const SharedHistories& other) :
+    pawn(std::make_unique<PawnHistory>(*other.pawn)),
+    correction(std::make_unique<CorrectionHistory>(*other.correction)) {}
+
+void Search::SharedHistories::clear() {
+    pawn->fill(-1193);
+    correction->fill(0);
+}
+
+// DeterministicSMP ignores SharedHistory: threads updating the same tables at
+// their own pace would make every search different.
+void Search::Worker::select_histories() {
+
+    if (options["SharedHistory"] && !threads.deterministic)
+        ownHistories.reset();
+
+    else if (!ownHistories)
+        ownHistories = std::make_unique<SharedHistories>();
+
+    SharedHistories& h = ownHistories ? *ownHistories : sharedHistories.local(numaAccessToken);
+    pawnHistory        = h.pawn.get();
+    correctionHistory  = h.correction.get();
+}
+
 void Search::Worker::clear() {
     counterMoves.fill(Move::none());
     mainHistory.fill(0);
     captureHistory.fill(0);
-    pawnHistory.fill(-1193);
-    correctionHistory.fill(0);
+
+    // Shared tables are cleared by each of their threads, which is harmless
+    select_histories();
+    pawnHistory->fill(-1193);
+    correctionHistory->fill(0);
+    stats.clear();
+    prefetchesIssued = prefetchesUsed = 0;
+    tbProbes = tbCacheHits = 0;
 
     for (bool inCheck : {false, true})
         for (StatsType c : {NoCaptures, Captures})
@@ -515,9 +699,25 @@ void Search::Worker::clear() {
     for (size_t i = 1; i < reductions.size(); ++i)
         reductions[i] = int((19.26 + std::log(size_t(options["Threads"])) / 2) * std::log(i));
 
+    refreshTable.evals.resize(size_t(options["EvalCache"]));
     refreshTable.clear(networks[numaAccessToken]);
 }
 
+inline void Search::Worker::count_node() {
+    if ((nodes.fetch_add(1, std::memory_order_relaxed) & (ThreadPool::NodesFlushInterval - 1))
+        == ThreadPool::NodesFlushInterval - 1)
+        threads.flush_nodes(*this);
+}
+
+void Search::Worker::clear_refresh_table(bool big) {
+    if (big)
+        refreshTable.big.clear(networks[numaAccessToken].big);
+    else
+        refreshTable.small.clear(networks[numaAccessToken].small);
+
+    refreshTable.evals.clear();
+}
+
 
 // Main search function for both PV and non-PV nodes.
 template<NodeType nodeType>
@@ -534,13 +734,21 @@ Value Search::Worker::search(
     // Limit the depth if extensions made it too large
     depth = std::min(depth, MAX_PLY - 1);
 
+    SearchTrace::Node traceNode(trace, ss->ply, depth,
+                                rootNode ? SearchTrace::RootNode
+                                : PvNode ? SearchTrace::PvNode
+                                         : SearchTrace::NonPvNode);
+
     // Check if we have an upcoming move that draws by repetition, or
     // if the opponent had an alternative move earlier to this position.
     if (!rootNode && alpha < VALUE_DRAW && pos.has_game_cycle(ss->ply))
     {
         alpha = value_draw(this->nodes);
         if (alpha >= beta)
+        {
+            traceNode.exit(SearchTrace::Draw);
             return alpha;
+        }
     }
 
     assert(-VALUE_INFINITE <= alpha && alpha < beta && beta <= VALUE_INFINITE);
@@ -550,7 +758,6 @@ Value Search::Worker::search(
 
     Move      pv[MAX_PLY + 1], capturesSearched[32], quietsSearched[32];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     Key   posKey;
     Move  move, excludedMove, bestMove;
@@ -575,6 +782,10 @@ Value Search::Worker::search(
     if (is_mainthread())
         main_manager()->check_time(*thisThread);
 
+    // In DeterministicSMP mode, wait for the other threads at the end of each epoch
+    if (thisThread->ttBuffer && thisThread->nodes >= thisThread->epochEnd)
+        threads.end_epoch(*thisThread);
+
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
     if (PvNode && thisThread->selDepth < ss->ply + 1)
         thisThread->selDepth = ss->ply + 1;
@@ -584,10 +795,14 @@ Value Search::Worker::search(
         // Step 2. Check for aborted search and immediate draw
         if (threads.stop.load(std::memory_order_relaxed) || pos.is_draw(ss->ply)
             || ss->ply >= MAX_PLY)
+        {
+            traceNode.exit(threads.stop.load(std::memory_order_relaxed) ? SearchTrace::Aborted
+                                                                        : SearchTrace::Draw);
             return (ss->ply >= MAX_PLY && !ss->inCheck)
                    ? evaluate(networks[numaAccessToken], pos, refreshTable,
                               thisThread->optimism[us])
                    : value_draw(thisThread->nodes);
+        }
 
         // Step 3. Mate distance pruning. Even if we mate at the next move our score
         // would be at best mate_in(ss->ply + 1), but if alpha is already bigger because
@@ -598,7 +813,10 @@ Value Search::Worker::search(
         alpha = std::max(mated_in(ss->ply), alpha);
         beta  = std::min(mate_in(ss->ply + 1), beta);
         if (alpha >= beta)
+        {
+            traceNode.exit(SearchTrace::MateDistance);
             return alpha;
+        }
     }
 
     assert(0 <= ss->ply && ss->ply < MAX_PLY);
@@ -609,10 +827,17 @@ Value Search::Worker::search(
     Square prevSq = ((ss - 1)->currentMove).is_ok() ? ((ss - 1)->currentMove).to_sq() : SQ_NONE;
     ss->statScore = 0;
 
+    if (rootNode)
+        thisThread->onePassScores.clear();
+
     // Step 4. Transposition table lookup.
     excludedMove                   = ss->excludedMove;
     posKey                         = pos.key();
-    auto [ttHit, ttData, ttWriter] = tt.probe(posKey);
+    auto [ttHit, ttData, ttWriter] = tt.probe(posKey, ttBuffer.get());
+    stats.inc(SearchStats::TTProbes);
+    if (ttHit)
+        stats.inc(SearchStats::TTHits);
+    traceNode.tt(ttHit, ttData.depth);
     // Need further processing of the saved data
     ss->ttHit    = ttHit;
     ttData.move  = rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
@@ -647,7 +872,10 @@ Value Search::Worker::search(
         // Partial workaround for the graph history interaction problem
         // For high rule50 counts don't produce transposition table cutoffs.
         if (pos.rule50_count() < 90)
+        {
+            traceNode.exit(SearchTrace::TTCutoff);
             return ttData.value;
+        }
     }
 
     // Step 5. Tablebases probe
@@ -666,6 +894,9 @@ Value Search::Worker::search(
             if (is_mainthread())
                 main_manager()->callsCnt = 0;
 
+            tbProbes++;
+            tbCacheHits += err == TB::ProbeState::CACHED;
+
             if (err != TB::ProbeState::FAIL)
             {
                 thisThread->tbHits.fetch_add(1, std::memory_order_relaxed);
@@ -689,6 +920,7 @@ Value Search::Worker::search(
                                    std::min(MAX_PLY - 1, depth + 6), Move::none(), VALUE_NONE,
                                    tt.generation());
 
+                    traceNode.exit(SearchTrace::Tablebase);
                     return value;
                 }
 
@@ -753,7 +985,7 @@ Value Search::Worker::search(
         int bonus = std::clamp(-10 * int((ss - 1)->staticEval + ss->staticEval), -1590, 1371) + 800;
         thisThread->mainHistory[~us][((ss - 1)->currentMove).from_to()] << bonus;
         if (type_of(pos.piece_on(prevSq)) != PAWN && ((ss - 1)->currentMove).type_of() != PROMOTION)
-            thisThread->pawnHistory[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
+            (*thisThread->pawnHistory)[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
               << bonus / 2;
     }
 
@@ -768,6 +1000,8 @@ Value Search::Worker::search(
 
     opponentWorsening = ss->staticEval + (ss - 1)->staticEval > 2;
 
+    traceNode.eval(ss->staticEval);
+
     // Step 7. Razoring (~1 Elo)
     // If eval is really low check with qsearch if it can exceed alpha, if it can't,
     // return a fail low.
@@ -775,7 +1009,10 @@ Value Search::Worker::search(
     {
         value = qsearch<NonPV>(pos, ss, alpha - 1, alpha);
         if (value < alpha && std::abs(value) < VALUE_TB_WIN_IN_MAX_PLY)
+        {
+            traceNode.exit(SearchTrace::Razoring);
             return value;
+        }
     }
 
     // Step 8. Futility pruning: child node (~40 Elo)
@@ -785,7 +1022,10 @@ Value Search::Worker::search(
                - (ss - 1)->statScore / 263
              >= beta
         && eval >= beta && eval < VALUE_TB_WIN_IN_MAX_PLY && (!ttData.move || ttCapture))
+    {
+        traceNode.exit(SearchTrace::Futility);
         return beta > VALUE_TB_LOSS_IN_MAX_PLY ? beta + (eval - beta) / 3 : eval;
+    }
 
     // Step 9. Null move search with verification search (~35 Elo)
     if (!PvNode && (ss - 1)->currentMove != Move::null() && (ss - 1)->statScore < 14369
@@ -802,6 +1042,7 @@ Value Search::Worker::search(
         ss->continuationHistory = &thisThread->continuationHistory[0][0][NO_PIECE][0];
 
         pos.do_null_move(st, tt);
+        stats.inc(SearchStats::NullMoveTries);
 
         Value nullValue = -search<NonPV>(pos, ss + 1, -beta, -beta + 1, depth - R, !cutNode);
 
@@ -811,7 +1052,11 @@ Value Search::Worker::search(
         if (nullValue >= beta && nullValue < VALUE_TB_WIN_IN_MAX_PLY)
         {
             if (thisThread->nmpMinPly || depth < 16)
+            {
+                stats.inc(SearchStats::NullMoveCutoffs);
+                traceNode.exit(SearchTrace::NullMove);
                 return nullValue;
+            }
 
             assert(!thisThread->nmpMinPly);  // Recursive verification is not allowed
 
@@ -824,7 +1069,11 @@ Value Search::Worker::search(
             thisThread->nmpMinPly = 0;
 
             if (v >= beta)
+            {
+                stats.inc(SearchStats::NullMoveCutoffs);
+                traceNode.exit(SearchTrace::NullMove);
                 return nullValue;
+            }
         }
     }
 
@@ -838,7 +1087,10 @@ Value Search::Worker::search(
 
     // Use qsearch if depth <= 0.
     if (depth <= 0)
+    {
+        traceNode.exit(SearchTrace::ToQsearch);
         return qsearch<PV>(pos, ss, alpha, beta);
+    }
 
     // For cutNodes, if depth is high enough, decrease depth by 2 if there is no ttMove, or
     // by 1 if there is a ttMove with an upper bound.
@@ -875,7 +1127,7 @@ Value Search::Worker::search(
                   &this
                      ->continuationHistory[ss->inCheck][true][pos.moved_piece(move)][move.to_sq()];
 
-                thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
+                thisThread->count_node();
                 pos.do_move(move, st);
 
                 // Perform a preliminary qsearch to verify that the move holds
@@ -893,6 +1145,7 @@ Value Search::Worker::search(
                     // Save ProbCut data into transposition table
                     ttWriter.write(posKey, value_to_tt(value, ss->ply), ss->ttPv, BOUND_LOWER,
                                    depth - 3, move, unadjustedStaticEval, tt.generation());
+                    traceNode.exit(SearchTrace::ProbCut);
                     return std::abs(value) < VALUE_TB_WIN_IN_MAX_PLY ? value - (probCutBeta - beta)
                                                                      : value;
                 }
@@ -909,7 +1162,10 @@ moves_loop:  // When in check, search starts here
         && ttData.depth >= depth - 4 && ttData.value >= probCutBeta
         && std::abs(ttData.value) < VALUE_TB_WIN_IN_MAX_PLY
         && std::abs(beta) < VALUE_TB_WIN_IN_MAX_PLY)
+    {
+        traceNode.exit(SearchTrace::InCheckProbCut);
         return probCutBeta;
+    }
 
     const PieceToHistory* contHist[] = {(ss - 1)->continuationHistory,
                                         (ss - 2)->continuationHistory,
@@ -922,7 +1178,7 @@ moves_loop:  // When in check, search starts here
       prevSq != SQ_NONE ? thisThread->counterMoves[pos.piece_on(prevSq)][prevSq] : Move::none();
 
     MovePicker mp(pos, ttData.move, depth, &thisThread->mainHistory, &thisThread->captureHistory,
-                  contHist, &thisThread->pawnHistory, countermove, ss->killers);
+                  contHist, thisThread->pawnHistory, countermove, ss->killers);
 
     value            = bestValue;
     moveCountPruning = false;
@@ -935,6 +1191,9 @@ moves_loop:  // When in check, search starts here
     {
         assert(move.is_ok());
 
+        if (prefetchDistance)
+            prefetch_upcoming(mp, pos);
+
         if (move == excludedMove)
             continue;
 
@@ -1009,7 +1268,7 @@ moves_loop:  // When in check, search starts here
                 int history =
                   (*contHist[0])[movedPiece][move.to_sq()]
                   + (*contHist[1])[movedPiece][move.to_sq()]
-                  + thisThread->pawnHistory[pawn_structure_index(pos)][movedPiece][move.to_sq()];
+                  + (*thisThread->pawnHistory)[pawn_structure_index(pos)][movedPiece][move.to_sq()];
 
                 // Continuation history based pruning (~2 Elo)
                 if (lmrDepth < 6 && history < -4151 * depth)
@@ -1087,7 +1346,10 @@ moves_loop:  // When in check, search starts here
                 // we assume this expected cut-node is not singular (multiple moves fail high),
                 // and we can prune the whole subtree by returning a softbound.
                 else if (singularBeta >= beta)
+                {
+                    traceNode.exit(SearchTrace::MultiCut, moveCount);
                     return singularBeta;
+                }
 
                 // Negative extensions
                 // If other moves failed high over (ttValue - margin) without the ttMove on a reduced search,
@@ -1126,7 +1388,8 @@ moves_loop:  // When in check, search starts here
         uint64_t nodeCount = rootNode ? uint64_t(nodes) : 0;
 
         // Step 16. Make the move
-        thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
+        thisThread->count_node();
+        prefetchesUsed += prefetchDistance && mp.last_move_was_upcoming();
         pos.do_move(move, st, givesCheck);
 
         // These reduction adjustments have proven non-linear scaling.
@@ -1181,6 +1444,7 @@ moves_loop:  // When in check, search starts here
             Depth d = std::max(1, std::min(newDepth - r, newDepth + 1));
 
             value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, d, true);
+            stats.inc(SearchStats::LmrSearches);
 
             // Do a full-depth search when reduced LMR search fails high
             if (value > alpha && d < newDepth)
@@ -1193,7 +1457,10 @@ moves_loop:  // When in check, search starts here
                 newDepth += doDeeperSearch - doShallowerSearch;
 
                 if (newDepth > d)
+                {
                     value = -search<NonPV>(pos, ss + 1, -(alpha + 1), -alpha, newDepth, !cutNode);
+                    stats.inc(SearchStats::LmrResearches);
+                }
 
                 // Post LMR continuation history updates (~1 Elo)
                 int bonus = value <= alpha ? -stat_malus(newDepth)
@@ -1235,7 +1502,10 @@ moves_loop:  // When in check, search starts here
         // the search cannot be trusted, and we return immediately without
         // updating best move, PV and TT.
         if (threads.stop.load(std::memory_order_relaxed))
+        {
+            traceNode.exit(SearchTrace::Aborted, moveCount);
             return VALUE_ZERO;
+        }
 
         if (rootNode)
         {
@@ -1275,8 +1545,20 @@ moves_loop:  // When in check, search starts here
                 // We record how often the best move has been changed in each iteration.
                 // This information is used for time management. In MultiPV mode,
                 // we must take care to only do this for the first PV line.
-                if (moveCount > 1 && !thisThread->pvIdx)
+                if (moveCount > 1 && !thisThread->pvIdx
+                    && (!thisThread->onePassLines || value > bestValue))
                     ++thisThread->bestMoveChanges;
+
+                // Keep the scores of the best lines, the last one is the new alpha
+                if (thisThread->onePassLines)
+                {
+                    auto& scores = thisThread->onePassScores;
+                    scores.insert(std::upper_bound(scores.begin(), scores.end(), value,
+                                                   std::greater<Value>()),
+                                  value);
+                    if (scores.size() > thisThread->onePassLines)
+                        scores.pop_back();
+                }
             }
             else
                 // All other moves but the PV, are set to the lowest value: this
@@ -1305,10 +1587,11 @@ moves_loop:  // When in check, search starts here
                 if (value >= beta)
                 {
                     ss->cutoffCnt += 1 + !ttData.move - (extension >= 2);
+                    stats.inc_cutoff(moveCount);
                     assert(value >= beta);  // Fail high
                     break;
                 }
-                else
+                else if (!(rootNode && thisThread->onePassLines))
                 {
                     // Reduce other moves if we have found at least one score improvement (~2 Elo)
                     if (depth > 2 && depth < 13 && std::abs(value) < VALUE_TB_WIN_IN_MAX_PLY)
@@ -1320,6 +1603,11 @@ moves_loop:  // When in check, search starts here
             }
         }
 
+        // In a single pass MultiPV search, alpha only rises once enough lines are found
+        if (rootNode && thisThread->onePassLines
+            && thisThread->onePassScores.size() == thisThread->onePassLines)
+            alpha = std::max(alpha, thisThread->onePassScores.back());
+
         // If the move is worse than some previously searched move,
         // remember it, to update its stats later.
         if (move != bestMove && moveCount <= 32)
@@ -1365,7 +1653,7 @@ moves_loop:  // When in check, search starts here
 
 
         if (type_of(pos.piece_on(prevSq)) != PAWN && ((ss - 1)->currentMove).type_of() != PROMOTION)
-            thisThread->pawnHistory[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
+            (*thisThread->pawnHistory)[pawn_structure_index(pos)][pos.piece_on(prevSq)][prevSq]
               << stat_bonus(depth) * bonus / 25;
     }
 
@@ -1380,11 +1668,19 @@ moves_loop:  // When in check, search starts here
     // Write gathered information in transposition table
     // Static evaluation is saved as it was before correction history
     if (!excludedMove && !(rootNode && thisThread->pvIdx))
-        ttWriter.write(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv,
-                       bestValue >= beta    ? BOUND_LOWER
-                       : PvNode && bestMove ? BOUND_EXACT
-                                            : BOUND_UPPER,
-                       depth, bestMove, unadjustedStaticEval, tt.generation());
+    {
+        Bound bound = bestValue >= beta    ? BOUND_LOWER
+                    : PvNode && bestMove ? BOUND_EXACT
+                                         : BOUND_UPPER;
+
+        ttWriter.write(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv, bound, depth, bestMove,
+                       unadjustedStaticEval, tt.generation());
+
+        // Share the deep entries with the other nodes of a distributed search
+        if (depth >= tt.export_depth())
+            tt.export_entry(posKey, value_to_tt(bestValue, ss->ply), ss->ttPv, bound, depth,
+                            bestMove, unadjustedStaticEval);
+    }
 
     // Adjust correction history
     if (!ss->inCheck && (!bestMove || !pos.capture(bestMove))
@@ -1393,15 +1689,44 @@ moves_loop:  // When in check, search starts here
     {
         auto bonus = std::clamp(int(bestValue - ss->staticEval) * depth / 8,
                                 -CORRECTION_HISTORY_LIMIT / 4, CORRECTION_HISTORY_LIMIT / 4);
-        thisThread->correctionHistory[us][pawn_structure_index<Correction>(pos)] << bonus;
+        (*thisThread->correctionHistory)[us][pawn_structure_index<Correction>(pos)] << bonus;
     }
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
+    traceNode.exit(bestValue >= beta           ? SearchTrace::FailHigh
+                   : bestMove                  ? SearchTrace::Exact
+                   : moveCount || excludedMove ? SearchTrace::FailLow
+                   : ss->inCheck               ? SearchTrace::Mated
+                                               : SearchTrace::Draw,
+                   moveCount);
     return bestValue;
 }
 
 
+void Search::Worker::prefetch_upcoming(MovePicker& mp, const Position& pos) {
+
+    Move      upcoming[MaxPrefetchDistance];
+    const int count = mp.upcoming_moves(prefetchDistance, upcoming);
+    const Color us  = pos.side_to_move();
+
+    for (int i = 0; i < count; ++i)
+    {
+        const Move m = upcoming[i];
+
+        prefetch(tt.first_entry(pos.key_after(m)));
+
+        // A king move changes the accumulator cache entry used on refresh
+        if (type_of(pos.moved_piece(m)) == KING && m.type_of() != CASTLING)
+        {
+            prefetch(refreshTable.big.find(m.to_sq(), us));
+            prefetch(refreshTable.small.find(m.to_sq(), us));
+        }
+    }
+
+    prefetchesIssued += count;
+}
+
 // Quiescence search function, which is called by the main search function with zero depth, or
 // recursively with further decreasing depth per call. With depth <= 0, we "should" be using
 // static eval only, but tactical moves may confuse the static eval. To fight this horizon effect,
@@ -1418,18 +1743,23 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
     assert(PvNode || (alpha == beta - 1));
     assert(depth <= 0);
 
+    SearchTrace::Node traceNode(trace, ss->ply, depth,
+                                PvNode ? SearchTrace::QsPvNode : SearchTrace::QsNonPvNode);
+
     // Check if we have an upcoming move that draws by repetition, or if
     // the opponent had an alternative move earlier to this position. (~1 Elo)
     if (alpha < VALUE_DRAW && pos.has_game_cycle(ss->ply))
     {
         alpha = value_draw(this->nodes);
         if (alpha >= beta)
+        {
+            traceNode.exit(SearchTrace::Draw);
             return alpha;
+        }
     }
 
     Move      pv[MAX_PLY + 1];
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     Key   posKey;
     Move  move, bestMove;
@@ -1456,9 +1786,12 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
 
     // Step 2. Check for an immediate draw or maximum ply reached
     if (pos.is_draw(ss->ply) || ss->ply >= MAX_PLY)
+    {
+        traceNode.exit(SearchTrace::Draw);
         return (ss->ply >= MAX_PLY && !ss->inCheck)
                ? evaluate(networks[numaAccessToken], pos, refreshTable, thisThread->optimism[us])
                : VALUE_DRAW;
+    }
 
     assert(0 <= ss->ply && ss->ply < MAX_PLY);
 
@@ -1469,18 +1802,25 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
 
     // Step 3. Transposition table lookup
     posKey                         = pos.key();
-    auto [ttHit, ttData, ttWriter] = tt.probe(posKey);
+    auto [ttHit, ttData, ttWriter] = tt.probe(posKey, ttBuffer.get());
+    stats.inc(SearchStats::TTProbes);
+    if (ttHit)
+        stats.inc(SearchStats::TTHits);
     // Need further processing of the saved data
     ss->ttHit    = ttHit;
     ttData.move  = ttHit ? ttData.move : Move::none();
     ttData.value = ttHit ? value_from_tt(ttData.value, ss->ply, pos.rule50_count()) : VALUE_NONE;
     pvHit        = ttHit && ttData.is_pv;
+    traceNode.tt(ttHit, ttData.depth);
 
     // At non-PV nodes we check for an early TT cutoff
     if (!PvNode && ttData.depth >= qsTtDepth
         && ttData.value != VALUE_NONE  // Can happen when !ttHit or when access race in probe()
         && (ttData.bound & (ttData.value >= beta ? BOUND_LOWER : BOUND_UPPER)))
+    {
+        traceNode.exit(SearchTrace::TTCutoff);
         return ttData.value;
+    }
 
     // Step 4. Static evaluation of the position
     Value unadjustedStaticEval = VALUE_NONE;
@@ -1514,6 +1854,8 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
               to_corrected_static_eval(unadjustedStaticEval, *thisThread, pos);
         }
 
+        traceNode.eval(ss->staticEval);
+
         // Stand pat. Return immediately if static value is at least beta
         if (bestValue >= beta)
         {
@@ -1523,6 +1865,7 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
                 ttWriter.write(posKey, value_to_tt(bestValue, ss->ply), false, BOUND_LOWER,
                                DEPTH_UNSEARCHED, Move::none(), unadjustedStaticEval,
                                tt.generation());
+            traceNode.exit(SearchTrace::StandPat);
             return bestValue;
         }
 
@@ -1542,13 +1885,16 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
     // which would result in only a single stage of QS movegen.)
     Square     prevSq = ((ss - 1)->currentMove).is_ok() ? ((ss - 1)->currentMove).to_sq() : SQ_NONE;
     MovePicker mp(pos, ttData.move, depth, &thisThread->mainHistory, &thisThread->captureHistory,
-                  contHist, &thisThread->pawnHistory);
+                  contHist, thisThread->pawnHistory);
 
     // Step 5. Loop through all pseudo-legal moves until no moves remain or a beta cutoff occurs.
     while ((move = mp.next_move()) != Move::none())
     {
         assert(move.is_ok());
 
+        if (prefetchDistance)
+            prefetch_upcoming(mp, pos);
+
         // Check for legality
         if (!pos.legal(move))
             continue;
@@ -1599,8 +1945,8 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
             if (!capture
                 && (*contHist[0])[pos.moved_piece(move)][move.to_sq()]
                        + (*contHist[1])[pos.moved_piece(move)][move.to_sq()]
-                       + thisThread->pawnHistory[pawn_structure_index(pos)][pos.moved_piece(move)]
-                                                [move.to_sq()]
+                       + (*thisThread->pawnHistory)[pawn_structure_index(pos)]
+                                                   [pos.moved_piece(move)][move.to_sq()]
                      <= 4452)
                 continue;
 
@@ -1619,7 +1965,9 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
              ->continuationHistory[ss->inCheck][capture][pos.moved_piece(move)][move.to_sq()];
 
         // Step 7. Make and search the move
-        thisThread->nodes.fetch_add(1, std::memory_order_relaxed);
+        thisThread->count_node();
+        prefetchesUsed += prefetchDistance && mp.last_move_was_upcoming();
+        stats.inc(SearchStats::QNodes);
         pos.do_move(move, st, givesCheck);
         value = -qsearch<nodeType>(pos, ss + 1, -beta, -alpha, depth - 1);
         pos.undo_move(move);
@@ -1652,6 +2000,7 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
     if (ss->inCheck && bestValue == -VALUE_INFINITE)
     {
         assert(!MoveList<LEGAL>(pos).size());
+        traceNode.exit(SearchTrace::Mated);
         return mated_in(ss->ply);  // Plies to mate from the root
     }
 
@@ -1666,6 +2015,10 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta,
 
     assert(bestValue > -VALUE_INFINITE && bestValue < VALUE_INFINITE);
 
+    traceNode.exit(bestValue >= beta ? SearchTrace::FailHigh
+                   : bestMove        ? SearchTrace::Exact
+                                     : SearchTrace::FailLow,
+                   moveCount);
     return bestValue;
 }
 
@@ -1683,7 +2036,7 @@ Depth Search::Worker::reduction(bool i, Depth d, int mn, int delta) const {
 // This function is intended for use only when printing PV outputs, and not used
 // for making decisions within the search algorithm itself.
 TimePoint Search::Worker::elapsed() const {
-    return main_manager()->tm.elapsed([this]() { return threads.nodes_searched(); });
+    return main_manager()->tm.elapsed([this]() { return threads.nodes_counted(*this); });
 }
 
 TimePoint Search::Worker::elapsed_time() const { return main_manager()->tm.elapsed_time(); }
@@ -1851,7 +2204,7 @@ void update_quiet_histories(
     update_continuation_histories(ss, pos.moved_piece(move), move.to_sq(), bonus);
 
     int pIndex = pawn_structure_index(pos);
-    workerThread.pawnHistory[pIndex][pos.moved_piece(move)][move.to_sq()] << bonus / 2;
+    (*workerThread.pawnHistory)[pIndex][pos.moved_piece(move)][move.to_sq()] << bonus / 2;
 }
 
 // Updates move sorting heuristics
@@ -1907,7 +2260,7 @@ void SearchManager::check_time(Search::Worker& worker) {
 
     static TimePoint lastInfoTime = now();
 
-    TimePoint elapsed = tm.elapsed([&worker]() { return worker.threads.nodes_searched(); });
+    TimePoint elapsed = tm.elapsed([&worker]() { return worker.threads.nodes_counted(worker); });
     TimePoint tick    = worker.limits.startTime + elapsed;
 
     if (tick - lastInfoTime >= 1000)
@@ -1916,18 +2269,54 @@ void SearchManager::check_time(Search::Worker& worker) {
         dbg_print();
     }
 
+    // With a deadline, check about 4 times per millisecond at the speed so far,
+    // so that it is overshot by a fraction of a millisecond whatever the nps. The
+    // deadline is hard, it does not wait for a completed iteration: when it is hit
+    // during the first one, the best move may be a root move not searched at all,
+    // which is what LatencySLA trades for the response time. With a small node
+    // limit callsCnt may already be 0.
+    if (deadline)
+    {
+        const TimePoint wall = tm.elapsed_time();
+
+        callsCnt = std::clamp(int(worker.nodes / std::max(TimePoint(1), wall) / 4), 1,
+                              std::max(1, callsCnt));
+
+        if (wall >= deadline && !worker.threads.stop)
+        {
+            deadlineHit         = now();
+            stopReason          = "deadline";
+            worker.threads.stop = worker.threads.abortedSearch = true;
+            return;
+        }
+    }
+
     // We should not stop pondering until told so by the GUI
     if (ponder)
         return;
 
-    if (
-      // Later we rely on the fact that we can at least use the mainthread previous
-      // root-search score and PV in a multithreaded environment to prove mated-in scores.
-      worker.completedDepth >= 1
-      && ((worker.limits.use_time_management() && (elapsed > tm.maximum() || stopOnPonderhit))
-          || (worker.limits.movetime && elapsed >= worker.limits.movetime)
-          || (worker.limits.nodes && worker.threads.nodes_searched() >= worker.limits.nodes)))
+    // Later we rely on the fact that we can at least use the mainthread previous
+    // root-search score and PV in a multithreaded environment to prove mated-in scores.
+    if (worker.completedDepth < 1)
+        return;
+
+    const char* reason = nullptr;
+
+    if (worker.limits.use_time_management() && elapsed > tm.maximum())
+        reason = "maximum";
+    else if (worker.limits.use_time_management() && stopOnPonderhit)
+        reason = "optimum";
+    else if (worker.limits.movetime && elapsed >= worker.limits.movetime)
+        reason = "movetime";
+    else if (worker.limits.nodes && !worker.threads.deterministic
+             && worker.threads.nodes_counted(worker) >= worker.limits.nodes)
+        reason = "nodes";
+
+    if (reason)
+    {
+        stopReason          = reason;
         worker.threads.stop = worker.threads.abortedSearch = true;
+    }
 }
 
 void SearchManager::pv(const Search::Worker&     worker,
@@ -1935,7 +2324,7 @@ void SearchManager::pv(const Search::Worker&     worker,
                        const TranspositionTable& tt,
                        Depth                     depth) const {
 
-    const auto  nodes     = threads.nodes_searched();
+    const auto  nodes     = threads.nodes_counted(worker);
     const auto& rootMoves = worker.rootMoves;
     const auto& pos       = worker.rootPos;
     size_t      pvIdx     = worker.pvIdx;
@@ -1980,7 +2369,8 @@ void SearchManager::pv(const Search::Worker&     worker,
         info.score    = {v, pos};
         info.wdl      = wdl;
 
-        if (i == pvIdx && !tb && updated)  // tablebase- and previous-scores are exact
+        // Tablebase- and previous-scores are exact, all lines of a single pass may be bounds
+        if ((i == pvIdx || worker.onePassLines) && !tb && updated)
             info.bound = bound;
 
         info.timeMs   = time;
@@ -2001,7 +2391,6 @@ void SearchManager::pv(const Search::Worker&     worker,
 bool RootMove::extract_ponder_from_tt(const TranspositionTable& tt, Position& pos) {
 
     StateInfo st;
-    ASSERT_ALIGNED(&st, Eval::NNUE::CacheLineSize);
 
     assert(pv.size() == 1);
     if (pv[0] == Move::none())
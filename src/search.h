@@ -37,8 +37,11 @@
 #include "numa.h"
 #include "position.h"
 #include "score.h"
+#include "searchstats.h"
+#include "searchtrace.h"
 #include "syzygy/tbprobe.h"
 #include "timeman.h"
+#include "tt.h"
 #include "types.h"
 
 namespace Stockfish {
@@ -50,7 +53,6 @@ enum NodeType {
     Root
 };
 
-class TranspositionTable;
 class ThreadPool;
 class OptionsMap;
 
@@ -113,6 +115,8 @@ struct LimitsType {
     LimitsType() {
         time[WHITE] = time[BLACK] = inc[WHITE] = inc[BLACK] = npmsec = movetime = TimePoint(0);
         movestogo = depth = mate = perft = infinite = 0;
+        perftThreads                                = 1;
+        perftHash                                   = 0;
         nodes                                       = 0;
         ponderMode                                  = false;
     }
@@ -122,28 +126,49 @@ struct LimitsType {
     std::vector<std::string> searchmoves;
     TimePoint                time[COLOR_NB], inc[COLOR_NB], npmsec, movetime, startTime;
     int                      movestogo, depth, mate, perft, infinite;
+    size_t                   perftThreads, perftHash;
     uint64_t                 nodes;
     bool                     ponderMode;
     Square                   capSq;
 };
 
 
+// The pawn and correction histories of a thread. With SharedHistory all threads
+// on the same NUMA node use the same ones, kept by the engine in a NumaReplicated
+// with a copy per node, so that helpers do not each relearn the same pawn
+// structures. The tables are heap allocated to keep copies off the stack.
+struct SharedHistories {
+    SharedHistories();
+    SharedHistories(const SharedHistories&);
+    SharedHistories(SharedHistories&&) = default;
+
+    SharedHistories& operator=(const SharedHistories&) = delete;
+
+    void clear();
+
+    std::unique_ptr<PawnHistory>       pawn;
+    std::unique_ptr<CorrectionHistory> correction;
+};
+
 // The UCI stores the uci options, thread pool, and transposition table.
 // This struct is used to easily forward data to the Search::Worker class.
 struct SharedState {
     SharedState(const OptionsMap&                           optionsMap,
                 ThreadPool&                                 threadPool,
                 TranspositionTable&                         transpositionTable,
-                const NumaReplicated<Eval::NNUE::Networks>& nets) :
+                const NumaReplicated<Eval::NNUE::Networks>& nets,
+                NumaReplicated<SharedHistories>&            histories) :
         options(optionsMap),
         threads(threadPool),
         tt(transpositionTable),
-        networks(nets) {}
+        networks(nets),
+        sharedHistories(histories) {}
 
     const OptionsMap&                           options;
     ThreadPool&                                 threads;
     TranspositionTable&                         tt;
     const NumaReplicated<Eval::NNUE::Networks>& networks;
+    NumaReplicated<SharedHistories>&            sharedHistories;
 };
 
 class Worker;
@@ -218,6 +243,15 @@ class SearchManager: public ISearchManager {
     Value                bestPreviousAverageScore;
     bool                 stopOnPonderhit;
 
+    // Telemetry of the current search for the TMLog option
+    std::string tmLog;
+    const char* stopReason;
+
+    // LatencySLA: the search stops at deadline, which leaves stopMargin for the
+    // threads to stop and the bestmove to be sent. stopMargin is learnt from the
+    // time this took after the previous deadlines, measured from deadlineHit.
+    TimePoint deadline, stopMargin, deadlineHit;
+
     size_t id;
 
     const UpdateContext& updates;
@@ -240,19 +274,29 @@ class Worker {
     // Reset histories, usually before a new game
     void clear();
 
+    // Reset the accumulator refresh cache of one net, and the eval cache, after
+    // that net has been replaced
+    void clear_refresh_table(bool big);
+
+    // Point pawnHistory and correctionHistory to the tables of the NUMA node with
+    // SharedHistory, otherwise to those of the thread
+    void select_histories();
+
     // Called when the program receives the UCI 'go' command.
     // It searches from the root position and outputs the "bestmove".
     void start_searching();
 
     bool is_mainthread() const { return threadIdx == 0; }
 
+    static constexpr int MaxPrefetchDistance = 16;
+
     // Public because they need to be updatable by the stats
     CounterMoveHistory    counterMoves;
     ButterflyHistory      mainHistory;
     CapturePieceToHistory captureHistory;
     ContinuationHistory   continuationHistory[2][2];
-    PawnHistory           pawnHistory;
-    CorrectionHistory     correctionHistory;
+    PawnHistory*          pawnHistory;
+    CorrectionHistory*    correctionHistory;
 
    private:
     void iterative_deepening();
@@ -267,6 +311,10 @@ class Worker {
 
     Depth reduction(bool i, Depth d, int mn, int delta) const;
 
+    // Prefetch the TT clusters, and for king moves the accumulator cache entries,
+    // of the next prefetchDistance moves the move picker is going to return.
+    void prefetch_upcoming(MovePicker& mp, const Position& pos);
+
     // Get a pointer to the search manager, only allowed to be called by the
     // main thread.
     SearchManager* main_manager() const {
@@ -280,14 +328,41 @@ class Worker {
     LimitsType limits;
 
     size_t                pvIdx, pvLast;
+
+    // Lines of a MultiPVOnePass search, 0 when each line has its own root search,
+    // and the best scores found so far in the current root search.
+    size_t             onePassLines = 0;
+    std::vector<Value> onePassScores;
     std::atomic<uint64_t> nodes, tbHits, bestMoveChanges;
     int                   selDepth, nmpMinPly;
 
+    // Nodes already added to the counter of the NUMA node, see ThreadPool::flush_nodes()
+    uint64_t flushedNodes = 0;
+    void     count_node();
+
+    SearchStats stats;
+    SearchTrace trace;
+
+    int      prefetchDistance = 0;
+    uint64_t prefetchesIssued = 0, prefetchesUsed = 0;
+
+    // Tablebase probes of search() and how many of them the WDL cache answered
+    uint64_t tbProbes = 0, tbCacheHits = 0;
+
     Value optimism[COLOR_NB];
 
+    // DeterministicSMP: the writes to keep from the table until the end of the
+    // epoch, and the node count at which the epoch ends.
+    std::unique_ptr<TTBuffer> ttBuffer;
+    uint64_t                  epochEnd;
+
     Position  rootPos;
     StateInfo rootState;
     RootMoves rootMoves;
+
+    // The accumulators of the root position and of each ply of the search
+    std::vector<AccumulatorState> accumulators;
+
     Depth     rootDepth, completedDepth;
     Value     rootDelta;
 
@@ -306,6 +381,10 @@ class Worker {
     ThreadPool&                                 threads;
     TranspositionTable&                         tt;
     const NumaReplicated<Eval::NNUE::Networks>& networks;
+    NumaReplicated<SharedHistories>&            sharedHistories;
+
+    // The tables of the thread, when they are not shared
+    std::unique_ptr<SharedHistories> ownHistories;
 
     // Used by NNUE
     Eval::NNUE::AccumulatorCaches refreshTable;
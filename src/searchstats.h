@@ -0,0 +1,95 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCHSTATS_H_INCLUDED
+#define SEARCHSTATS_H_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Stockfish::Search {
+
+// Hot path counters of a single Search::Worker. Only the owning thread writes
+// them, so an increment is a plain relaxed load and store, and the struct is
+// cache line aligned so that workers never share a line. ThreadPool sums them
+// on demand for the "stats" command. Unless compiled with USE_STATS (make
+// stats=yes), inc() is empty and no counting code is generated at all.
+struct alignas(64) SearchStats {
+
+    enum Counter {
+        TTProbes,
+        TTHits,
+        QNodes,            // Moves made in qsearch
+        NullMoveTries,
+        NullMoveCutoffs,
+        LmrSearches,
+        LmrResearches,     // Full depth re-searches after a reduced search failed high
+        Cutoffs,
+        CutoffsFirstMove,  // Cutoffs by move index: 1, 2, 3, 4, 5-8, 9+
+        CutoffsMove2,
+        CutoffsMove3,
+        CutoffsMove4,
+        CutoffsMove5To8,
+        CutoffsMove9Plus,
+        COUNTER_NB
+    };
+
+    using Snapshot = std::array<uint64_t, COUNTER_NB>;
+
+    static constexpr bool Enabled =
+#ifdef USE_STATS
+      true;
+#else
+      false;
+#endif
+
+    void inc([[maybe_unused]] Counter c) {
+#ifdef USE_STATS
+        counters[c].store(counters[c].load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+#endif
+    }
+
+    void inc_cutoff([[maybe_unused]] int moveCount) {
+#ifdef USE_STATS
+        inc(Cutoffs);
+        inc(moveCount <= 4 ? Counter(CutoffsFirstMove + moveCount - 1)
+            : moveCount <= 8 ? CutoffsMove5To8
+                             : CutoffsMove9Plus);
+#endif
+    }
+
+    void add_to(Snapshot& s) const {
+        for (size_t i = 0; i < COUNTER_NB; ++i)
+            s[i] += counters[i].load(std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (auto& c : counters)
+            c.store(0, std::memory_order_relaxed);
+    }
+
+   private:
+    std::array<std::atomic<uint64_t>, COUNTER_NB> counters{};
+};
+
+}  // namespace Stockfish::Search
+
+#endif  // #ifndef SEARCHSTATS_H_INCLUDED
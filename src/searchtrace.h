@@ -0,0 +1,209 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2024 The Stockfish developers (see AUTHORS file)
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCHTRACE_H_INCLUDED
+#define SEARCHTRACE_H_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "types.h"
+
+namespace Stockfish::Search {
+
+// Samples one in every 'rate' nodes of a single Search::Worker into a ring
+// buffer which only the owning thread writes, for offline profiling of where
+// the nodes go. After each search the buffers of all threads are appended to
+// the SearchTrace file. Unless compiled with USE_TRACE (make trace=yes), the
+// Node guards are empty and no tracing code is generated at all.
+//
+// The file is a sequence of blocks, one per search, all little endian:
+//
+//   BlockHeader, then for each thread a ThreadHeader followed by its records,
+//   oldest first. Once a thread has sampled more than Capacity nodes, only the
+//   last Capacity records are kept.
+class SearchTrace {
+   public:
+    enum NodeKind : uint8_t {
+        RootNode,
+        PvNode,
+        NonPvNode,
+        QsPvNode,
+        QsNonPvNode
+    };
+
+    // How the node was left
+    enum Reason : uint8_t {
+        Aborted,
+        Draw,             // Repetition, 50 moves rule or maximum ply
+        MateDistance,
+        TTCutoff,
+        Tablebase,
+        Razoring,
+        Futility,         // Reverse futility pruning in search
+        NullMove,
+        ProbCut,
+        InCheckProbCut,
+        ToQsearch,        // Internal iterative reductions left no depth
+        MultiCut,         // Singular extension search failed high
+        StandPat,
+        FailHigh,
+        FailLow,
+        Exact,
+        Mated,
+    };
+
+    struct Record {
+        int16_t  depth;
+        int16_t  ttDepth;    // DEPTH_ENTRY_OFFSET unless the TT had an entry for the position
+        int16_t  eval;       // Corrected static evaluation, VALUE_NONE if not evaluated
+        uint16_t moveCount;  // Moves searched
+        uint8_t  ply;
+        uint8_t  kind;
+        uint8_t  reason;
+        uint8_t  padding;
+    };
+
+    static_assert(sizeof(Record) == 12);
+
+    struct BlockHeader {
+        char     magic[4];  // "SFST"
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t threads;
+        uint32_t rate;
+        uint32_t padding;
+    };
+
+    struct ThreadHeader {
+        uint32_t thread;
+        uint32_t records;
+        uint64_t sampled;  // Nodes sampled, more than the records if the ring wrapped
+    };
+
+    static constexpr uint32_t Version  = 1;
+    static constexpr size_t   Capacity = 1 << 16;
+
+    static constexpr bool Enabled =
+#ifdef USE_TRACE
+      true;
+#else
+      false;
+#endif
+
+    // Called by each thread before it starts searching. A rate of 0 disables
+    // the sampling, otherwise the buffer is emptied.
+    void start([[maybe_unused]] int samplingRate) {
+#ifdef USE_TRACE
+        rate = countdown = samplingRate;
+        sampled          = 0;
+
+        if (rate && ring.empty())
+            ring.resize(Capacity);
+#endif
+    }
+
+    void write(std::ostream& os, uint32_t thread) const {
+        const size_t records = std::min<uint64_t>(sampled, Capacity);
+        const size_t first   = sampled % Capacity;
+
+        const ThreadHeader header{thread, uint32_t(records), sampled};
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        // Oldest first, which is the start of the buffer until it wraps
+        if (records == Capacity)
+            os.write(reinterpret_cast<const char*>(ring.data() + first),
+                     std::streamsize((Capacity - first) * sizeof(Record)));
+
+        os.write(reinterpret_cast<const char*>(ring.data()),
+                 std::streamsize((records == Capacity ? first : records) * sizeof(Record)));
+    }
+
+    // Lives for the duration of a node of search() or qsearch(). If the node is
+    // sampled, its record is filled by the calls below and stored on destruction.
+    class Node {
+       public:
+        Node([[maybe_unused]] SearchTrace& t,
+             [[maybe_unused]] int          ply,
+             [[maybe_unused]] Depth        depth,
+             [[maybe_unused]] NodeKind     kind) {
+#ifdef USE_TRACE
+            if (t.rate && !--t.countdown)
+            {
+                t.countdown = t.rate;
+                trace       = &t;
+                record      = {int16_t(depth), DEPTH_ENTRY_OFFSET, VALUE_NONE, 0,
+                               uint8_t(ply),   kind,               Aborted,    0};
+            }
+#endif
+        }
+
+        ~Node() {
+#ifdef USE_TRACE
+            if (trace)
+                trace->ring[trace->sampled++ % Capacity] = record;
+#endif
+        }
+
+        Node(const Node&)            = delete;
+        Node& operator=(const Node&) = delete;
+
+        void tt([[maybe_unused]] bool hit, [[maybe_unused]] Depth d) {
+#ifdef USE_TRACE
+            if (trace && hit)
+                record.ttDepth = int16_t(d);
+#endif
+        }
+
+        void eval([[maybe_unused]] Value v) {
+#ifdef USE_TRACE
+            if (trace)
+                record.eval = int16_t(v);
+#endif
+        }
+
+        void exit([[maybe_unused]] Reason r, [[maybe_unused]] int moveCount = 0) {
+#ifdef USE_TRACE
+            if (trace)
+            {
+                record.reason    = r;
+                record.moveCount = uint16_t(moveCount);
+            }
+#endif
+        }
+
+       private:
+#ifdef USE_TRACE
+        SearchTrace* trace = nullptr;
+        Record       record;
+#endif
+    };
+
+   private:
+    std::vector<Record> ring;
+    uint64_t            sampled   = 0;
+    int                 rate      = 0;
+    int                 countdown = 0;
+};
+
+}  // namespace Stockfish::Search
+
+#endif  // #ifndef SEARCHTRACE_H_INCLUDED
@@ -41,6 +41,7 @@
 #include "../movegen.h"
 #include "../position.h"
 #include "../search.h"
+#include "../thread.h"
 #include "../types.h"
 #include "../ucioption.h"
 
@@ -201,6 +202,9 @@ class TBFile: public std::ifstream {
     // C:\tb\wdl345;C:\tb\wdl6;D:\tb\dtz345;D:\tb\dtz6
     static std::string Paths;
 
+    // SyzygyIO: read the compressed blocks with pread() instead of from the mapping
+    static bool ReadBlocks;
+
     TBFile(const std::string& f) {
 
 #ifndef _WIN32
@@ -302,6 +306,15 @@ class TBFile: public std::ifstream {
         return data + 4;  // Skip Magics's header
     }
 
+    // With SyzygyIO set to pread, the descriptor the compressed blocks are read from
+    int open_for_read() const {
+#ifndef _WIN32
+        return ReadBlocks ? ::open(fname.c_str(), O_RDONLY) : -1;
+#else
+        return -1;
+#endif
+    }
+
     static void unmap(void* baseAddress, uint64_t mapping) {
 
 #ifndef _WIN32
@@ -309,11 +322,29 @@ class TBFile: public std::ifstream {
 #else
         UnmapViewOfFile(baseAddress);
         CloseHandle((HANDLE) mapping);
+#endif
+    }
+
+    // Ask the OS to start reading the whole mapped file into the page cache,
+    // and optionally lock it in memory. Returns true if the file got locked.
+    static bool preload(void* baseAddress, uint64_t mapping, bool lock) {
+
+#ifndef _WIN32
+    #if defined(MADV_WILLNEED)
+        madvise(baseAddress, mapping, MADV_WILLNEED);
+    #endif
+        return lock && mlock(baseAddress, mapping) == 0;
+#else
+        (void) baseAddress;
+        (void) mapping;
+        (void) lock;
+        return false;
 #endif
     }
 };
 
 std::string TBFile::Paths;
+bool        TBFile::ReadBlocks = false;
 
 // struct PairsData contains low-level indexing information to access TB data.
 // There are 8, 4, or 2 PairsData records for each TBTable, according to the type
@@ -332,6 +363,8 @@ struct PairsData {
     SparseEntry* sparseIndex;   // Partial indices into blockLength[]
     size_t       sparseIndexSize;  // Size of SparseIndex[] table
     uint8_t*     data;             // Start of Huffman compressed data
+    int          fd;               // File to pread() the data from, or -1
+    uint64_t     dataOffset;       // Offset of data in the file
     std::vector<uint64_t>
       base64;  // base64[l - min_sym_len] is the 64bit-padded lowest symbol of length l
     std::vector<uint8_t>
@@ -356,6 +389,7 @@ struct TBTable {
     void*            baseAddress;
     uint8_t*         map;
     uint64_t         mapping;
+    int              fd = -1;  // See TBFile::open_for_read()
     Key              key;
     Key              key2;
     int              pieceCount;
@@ -375,6 +409,10 @@ struct TBTable {
     ~TBTable() {
         if (baseAddress)
             TBFile::unmap(baseAddress, mapping);
+#ifndef _WIN32
+        if (fd != -1)
+            ::close(fd);
+#endif
     }
 };
 
@@ -443,6 +481,7 @@ class TBTables {
 
     std::deque<TBTable<WDL>> wdlTable;
     std::deque<TBTable<DTZ>> dtzTable;
+    std::vector<std::string> codes;  // Same order as wdlTable, like "KRvK"
 
     void insert(Key key, TBTable<WDL>* wdl, TBTable<DTZ>* dtz) {
         uint32_t homeBucket = uint32_t(key) & (Size - 1);
@@ -486,9 +525,11 @@ class TBTables {
         memset(hashTable, 0, sizeof(hashTable));
         wdlTable.clear();
         dtzTable.clear();
+        codes.clear();
     }
     size_t size() const { return wdlTable.size(); }
     void   add(const std::vector<PieceType>& pieces);
+    void   preload(bool dtz);
 };
 
 TBTables TBTables;
@@ -513,12 +554,315 @@ void TBTables::add(const std::vector<PieceType>& pieces) {
 
     wdlTable.emplace_back(code);
     dtzTable.emplace_back(wdlTable.back());
+    codes.push_back(code);
 
     // Insert into the hash keys for both colors: KRvK with KR white and black
     insert(wdlTable.back().key, &wdlTable.back(), &dtzTable.back());
     insert(wdlTable.back().key2, &wdlTable.back(), &dtzTable.back());
 }
 
+// WDLCache is a direct mapped cache of the WDL probe results shared by all
+// the threads and keyed by Position::key(), so that a position probed by one
+// thread costs the others no table access. Each slot packs the upper bits of
+// the key with the score in one atomic word, written and read without locks,
+// so that a torn entry is never seen. Unlike the TT it only holds WDL results,
+// which deep search entries cannot evict. The size is set with the
+// "SyzygyWDLCache" UCI option, 0 disables it.
+class WDLCache {
+
+    static constexpr uint64_t ScoreMask = 7;
+
+   public:
+    void resize(size_t mbSize) {
+        const size_t count = mbSize * 1024 * 1024 / sizeof(uint64_t);
+
+        slots.reset();
+        mask = 0;
+
+        if (count)
+        {
+            slots = std::make_unique<std::atomic<uint64_t>[]>(size_t(1) << msb(count));
+            mask  = (size_t(1) << msb(count)) - 1;
+            clear();
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; slots && i <= mask; ++i)
+            slots[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool probe(Key key, WDLScore* wdl) const {
+        if (!slots)
+            return false;
+
+        const uint64_t e = slots[key & mask].load(std::memory_order_relaxed);
+
+        if (!(e & ScoreMask) || ((e ^ key) & ~ScoreMask))
+            return false;
+
+        *wdl = WDLScore(int(e & ScoreMask) - 3);
+        return true;
+    }
+
+    void store(Key key, WDLScore wdl) {
+        if (slots)
+            slots[key & mask].store((key & ~ScoreMask) | uint64_t(wdl + 3),
+                                    std::memory_order_relaxed);
+    }
+
+   private:
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    size_t                                   mask = 0;
+};
+
+WDLCache TheWDLCache;
+
+// The compressed block of d. With SyzygyIO set to pread the block is read from
+// the file into a per-thread buffer instead of being accessed through the
+// mapping: the read then costs one system call for the block, served from the
+// page cache when the block is there, instead of a page fault that brings in
+// the whole page and maps it into the engine. The buffer is zero padded, as
+// the decoding may read a word past the end of the block. Returns nullptr if
+// the block could not be read whole, and the probe then fails.
+uint32_t* block_data(const PairsData* d, uint32_t block) {
+
+    const uint64_t offset = uint64_t(block) * d->sizeofBlock;
+
+#ifndef _WIN32
+    if (d->fd != -1)
+    {
+        thread_local std::vector<uint32_t> buffer;
+        buffer.assign(d->sizeofBlock / sizeof(uint32_t) + 2, 0);
+
+        if (pread(d->fd, buffer.data(), d->sizeofBlock, off_t(d->dataOffset + offset))
+            != ssize_t(d->sizeofBlock))
+            return nullptr;
+
+        // In debug builds the block read must be the one in the mapping
+        assert(!std::memcmp(buffer.data(), d->data + offset, d->sizeofBlock));
+        return buffer.data();
+    }
+#endif
+
+    return (uint32_t*) (d->data + offset);
+}
+
+// BlockCache is a small per-thread, 4-way set associative cache with LRU
+// replacement of the decoded Huffman symbols of recently probed blocks, keyed
+// by (PairsData, block). A hit replaces the linear Huffman decoding of the block
+// with a binary search over the symbols' end offsets. Only blocks of up to 64
+// bytes are cached, as each symbol takes at least one bit: that is all the WDL
+// blocks, while DTZ tables with bigger blocks are decoded as before. An entry
+// has room for the 512 symbols of such a block and takes about 2 KB, so each MB
+// of the "SyzygyBlockCache" UCI option caches some 500 blocks, i.e. 32 KB of
+// compressed data, per thread. 0 disables the cache.
+std::atomic<size_t>   BlockCacheSize{0};   // In entries, per thread
+std::atomic<uint32_t> BlockCacheEpoch{0};  // Bumped when tables are re-created
+
+class BlockCache {
+
+    static constexpr int Ways       = 4;
+    static constexpr int MaxSymbols = 512;  // Enough for any 64 byte WDL block
+
+    struct Entry {
+        const PairsData* d;
+        uint32_t         block;
+        uint32_t         lastUse;
+        int              count;
+        Sym              sym[MaxSymbols];
+        uint16_t         last[MaxSymbols];  // Offset in the block of the last value of sym[i]
+    };
+
+    std::vector<Entry> entries;
+    uint32_t           epoch = 0, useCount = 0;
+
+    static bool decode(const PairsData* d, uint32_t block, Entry& e);
+
+   public:
+    static constexpr size_t EntrySize = sizeof(Entry);
+
+    // Look for the symbol covering the value at offset in the block, decoding
+    // and caching the block on a miss. On success offset is made relative to
+    // the start of the returned symbol, as decompress_pairs() expects.
+    bool probe(const PairsData* d, uint32_t block, int& offset, Sym& sym);
+};
+
+bool BlockCache::decode(const PairsData* d, uint32_t block, Entry& e) {
+
+    uint32_t* ptr = block_data(d, block);
+
+    if (!ptr)
+        return false;
+
+    uint64_t       buf64     = number<uint64_t, BigEndian>(ptr);
+    int            buf64Size = 64;
+    uint32_t       total     = 0;
+    const uint32_t values    = uint32_t(d->blockLength[block]) + 1;
+
+    ptr += 2;
+    e.count = 0;
+
+    while (true)
+    {
+        int len = 0;
+        while (buf64 < d->base64[len])
+            ++len;
+
+        Sym sym = Sym((buf64 - d->base64[len]) >> (64 - len - d->minSymLen));
+        sym += number<Sym, LittleEndian>(&d->lowestSym[len]);
+
+        if (e.count == MaxSymbols)
+            return false;
+
+        // A block holds at most 65536 values, so the offsets fit in 16 bits
+        total += d->symlen[sym] + 1;
+        e.sym[e.count]    = sym;
+        e.last[e.count++] = uint16_t(std::min(total, values) - 1);
+
+        if (total >= values)
+            return true;
+
+        len += d->minSymLen;
+        buf64 <<= len;
+        buf64Size -= len;
+
+        if (buf64Size <= 32)
+        {
+            buf64Size += 32;
+            buf64 |= uint64_t(number<uint32_t, BigEndian>(ptr++)) << (64 - buf64Size);
+        }
+    }
+}
+
+bool BlockCache::probe(const PairsData* d, uint32_t block, int& offset, Sym& sym) {
+
+    const size_t size = BlockCacheSize.load(std::memory_order_relaxed) / Ways * Ways;
+
+    if (!size || d->sizeofBlock * 8 > MaxSymbols)
+        return false;
+
+    if (entries.size() != size || epoch != BlockCacheEpoch.load(std::memory_order_relaxed))
+    {
+        entries.assign(size, Entry{});
+        epoch = BlockCacheEpoch.load(std::memory_order_relaxed);
+    }
+
+    const uint64_t h   = (uint64_t(uintptr_t(d)) ^ (uint64_t(block) << 24)) * 0x9E3779B97F4A7C15ULL;
+    Entry*         set = &entries[mul_hi64(h, size / Ways) * Ways];
+    Entry*         e   = nullptr;
+
+    for (int i = 0; i < Ways; ++i)
+        if (set[i].d == d && set[i].block == block)
+            e = &set[i];
+
+    if (!e)
+    {
+        e = std::min_element(set, set + Ways, [](const Entry& a, const Entry& b) {
+            return a.lastUse < b.lastUse;
+        });
+
+        if (!decode(d, block, *e))
+        {
+            e->d = nullptr;
+            return false;
+        }
+
+        e->d     = d;
+        e->block = block;
+    }
+
+    e->lastUse = ++useCount;
+
+    const int i = int(std::lower_bound(e->last, e->last + e->count, offset) - e->last);
+    offset -= i ? int(e->last[i - 1]) + 1 : 0;
+    sym = e->sym[i];
+    return true;
+}
+
+thread_local BlockCache blockCache;
+
+// Now we have our symbol that expands into d->symlen[sym] + 1 symbols.
+// We binary-search for our value recursively expanding into the left and
+// right child symbols until we reach a leaf node where symlen[sym] + 1 == 1
+// that will store the value we need.
+int expand_symbol(PairsData* d, Sym sym, int offset) {
+
+    while (d->symlen[sym])
+    {
+        Sym left = d->btree[sym].get<LR::Left>();
+
+        // If a symbol contains 36 sub-symbols (d->symlen[sym] + 1 = 36) and
+        // expands in a pair (d->symlen[left] = 23, d->symlen[right] = 11), then
+        // we know that, for instance, the tenth value (offset = 10) will be on
+        // the left side because in Recursive Pairing child symbols are adjacent.
+        if (offset < d->symlen[left] + 1)
+            sym = left;
+        else
+        {
+            offset -= d->symlen[left] + 1;
+            sym = d->btree[sym].get<LR::Right>();
+        }
+    }
+
+    return d->btree[sym].get<LR::Left>();
+}
+
+// Decodes the canonical Huffman symbols of the block from its start, up to the
+// symbol covering the value at offset. On return offset is relative to the start
+// of that symbol. Returns false if the block could not be read.
+bool decode_symbol(const PairsData* d, uint32_t block, int& offset, Sym& sym) {
+
+    // Find the start address of our block of canonical Huffman symbols
+    uint32_t* ptr = block_data(d, block);
+
+    if (!ptr)
+        return false;
+
+    // Read the first 64 bits in our block, this is a (truncated) sequence of
+    // unknown number of symbols of unknown length but we know the first one
+    // is at the beginning of this 64-bit sequence.
+    uint64_t buf64 = number<uint64_t, BigEndian>(ptr);
+    ptr += 2;
+    int buf64Size = 64;
+
+    while (true)
+    {
+        int len = 0;  // This is the symbol length - d->min_sym_len
+
+        // Now get the symbol length. For any symbol s64 of length l right-padded
+        // to 64 bits we know that d->base64[l-1] >= s64 >= d->base64[l] so we
+        // can find the symbol length iterating through base64[].
+        while (buf64 < d->base64[len])
+            ++len;
+
+        // All the symbols of a given length are consecutive integers (numerical
+        // sequence property), so we can compute the offset of our symbol of
+        // length len, stored at the beginning of buf64.
+        sym = Sym((buf64 - d->base64[len]) >> (64 - len - d->minSymLen));
+
+        // Now add the value of the lowest symbol of length len to get our symbol
+        sym += number<Sym, LittleEndian>(&d->lowestSym[len]);
+
+        // If our offset is within the number of values represented by symbol sym,
+        // we are done.
+        if (offset < d->symlen[sym] + 1)
+            return true;
+
+        // ...otherwise update the offset and continue to iterate
+        offset -= d->symlen[sym] + 1;
+        len += d->minSymLen;  // Get the real length
+        buf64 <<= len;        // Consume the just processed symbol
+        buf64Size -= len;
+
+        if (buf64Size <= 32)
+        {  // Refill the buffer
+            buf64Size += 32;
+            buf64 |= uint64_t(number<uint32_t, BigEndian>(ptr++)) << (64 - buf64Size);
+        }
+    }
+}
+
 // TB tables are compressed with canonical Huffman code. The compressed data is divided into
 // blocks of size d->sizeofBlock, and each block stores a variable number of symbols.
 // Each symbol represents either a WDL or a (remapped) DTZ value, or a pair of other symbols
@@ -579,75 +923,24 @@ int decompress_pairs(PairsData* d, uint64_t idx) {
     while (offset > d->blockLength[block])
         offset -= d->blockLength[block++] + 1;
 
-    // Finally, we find the start address of our block of canonical Huffman symbols
-    uint32_t* ptr = (uint32_t*) (d->data + (uint64_t(block) * d->sizeofBlock));
-
-    // Read the first 64 bits in our block, this is a (truncated) sequence of
-    // unknown number of symbols of unknown length but we know the first one
-    // is at the beginning of this 64-bit sequence.
-    uint64_t buf64 = number<uint64_t, BigEndian>(ptr);
-    ptr += 2;
-    int buf64Size = 64;
     Sym sym;
+    int cachedOffset = offset;
 
-    while (true)
+    if (blockCache.probe(d, block, cachedOffset, sym))
     {
-        int len = 0;  // This is the symbol length - d->min_sym_len
-
-        // Now get the symbol length. For any symbol s64 of length l right-padded
-        // to 64 bits we know that d->base64[l-1] >= s64 >= d->base64[l] so we
-        // can find the symbol length iterating through base64[].
-        while (buf64 < d->base64[len])
-            ++len;
-
-        // All the symbols of a given length are consecutive integers (numerical
-        // sequence property), so we can compute the offset of our symbol of
-        // length len, stored at the beginning of buf64.
-        sym = Sym((buf64 - d->base64[len]) >> (64 - len - d->minSymLen));
-
-        // Now add the value of the lowest symbol of length len to get our symbol
-        sym += number<Sym, LittleEndian>(&d->lowestSym[len]);
-
-        // If our offset is within the number of values represented by symbol sym,
-        // we are done.
-        if (offset < d->symlen[sym] + 1)
-            break;
-
-        // ...otherwise update the offset and continue to iterate
-        offset -= d->symlen[sym] + 1;
-        len += d->minSymLen;  // Get the real length
-        buf64 <<= len;        // Consume the just processed symbol
-        buf64Size -= len;
-
-        if (buf64Size <= 32)
-        {  // Refill the buffer
-            buf64Size += 32;
-            buf64 |= uint64_t(number<uint32_t, BigEndian>(ptr++)) << (64 - buf64Size);
-        }
+#ifndef NDEBUG
+        // Every hit must give the symbol found by decoding the block itself
+        Sym uncached;
+        assert(!decode_symbol(d, block, offset, uncached)
+               || (uncached == sym && offset == cachedOffset));
+#endif
+        return expand_symbol(d, sym, cachedOffset);
     }
 
-    // Now we have our symbol that expands into d->symlen[sym] + 1 symbols.
-    // We binary-search for our value recursively expanding into the left and
-    // right child symbols until we reach a leaf node where symlen[sym] + 1 == 1
-    // that will store the value we need.
-    while (d->symlen[sym])
-    {
-        Sym left = d->btree[sym].get<LR::Left>();
-
-        // If a symbol contains 36 sub-symbols (d->symlen[sym] + 1 = 36) and
-        // expands in a pair (d->symlen[left] = 23, d->symlen[right] = 11), then
-        // we know that, for instance, the tenth value (offset = 10) will be on
-        // the left side because in Recursive Pairing child symbols are adjacent.
-        if (offset < d->symlen[left] + 1)
-            sym = left;
-        else
-        {
-            offset -= d->symlen[left] + 1;
-            sym = d->btree[sym].get<LR::Right>();
-        }
-    }
+    if (!decode_symbol(d, block, offset, sym))
+        return -1;  // The block could not be read, the probe fails
 
-    return d->btree[sym].get<LR::Left>();
+    return expand_symbol(d, sym, offset);
 }
 
 bool check_dtz_stm(TBTable<WDL>*, int, File) { return true; }
@@ -917,7 +1210,12 @@ encode_remaining:
     }
 
     // Now that we have the index, decompress the pair and get the score
-    return map_score(entry, tbFile, decompress_pairs(d, idx), wdl);
+    const int value = decompress_pairs(d, idx);
+
+    if (value < 0)
+        return *result = FAIL, Ret();
+
+    return map_score(entry, tbFile, value, wdl);
 }
 
 // Group together pieces that will be encoded together. The general rule is that
@@ -1184,6 +1482,8 @@ void set(T& e, uint8_t* data) {
         {
             data = (uint8_t*) ((uintptr_t(data) + 0x3F) & ~0x3F);  // 64 byte alignment
             (d = e.get(i, f))->data = data;
+            d->fd                   = e.fd;
+            d->dataOffset           = uint64_t(data - (uint8_t*) e.baseAddress);
             data += d->blocksNum * d->sizeofBlock;
         }
 }
@@ -1218,15 +1518,55 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
     fname =
       (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w) + (Type == WDL ? ".rtbw" : ".rtbz");
 
-    uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
+    TBFile   file(fname);
+    uint8_t* data = file.map(&e.baseAddress, &e.mapping, Type);
 
     if (data)
+    {
+        e.fd = file.open_for_read();
         set(e, data);
+    }
 
     e.ready.store(true, std::memory_order_release);
     return e.baseAddress;
 }
 
+// Memory map all the WDL tables, and the DTZ tables too if requested, at init
+// time instead of at the first probe, and hint the OS to read them in. The WDL
+// tables of up to 5 pieces are small and the most frequently probed ones, so
+// they are also locked in memory when allowed by the system limits.
+void TBTables::preload(bool dtz) {
+
+    size_t mappedSize = 0, lockedSize = 0;
+
+    for (size_t i = 0; i < wdlTable.size(); ++i)
+    {
+        StateInfo st;
+        Position  pos;
+        pos.set(codes[i], WHITE, &st);
+
+        if (mapped(wdlTable[i], pos))
+        {
+            const bool lock = wdlTable[i].pieceCount <= 5;
+
+            mappedSize += wdlTable[i].mapping;
+            if (TBFile::preload(wdlTable[i].baseAddress, wdlTable[i].mapping, lock))
+                lockedSize += wdlTable[i].mapping;
+        }
+
+        if (dtz && mapped(dtzTable[i], pos))
+        {
+            mappedSize += dtzTable[i].mapping;
+            TBFile::preload(dtzTable[i].baseAddress, dtzTable[i].mapping, false);
+        }
+    }
+
+#ifndef _WIN32
+    sync_cout << "info string Preloaded " << mappedSize / (1024 * 1024)
+              << "MB of tablebases, locked " << lockedSize / (1024 * 1024) << "MB" << sync_endl;
+#endif
+}
+
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
 Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
@@ -1319,10 +1659,13 @@ WDLScore search(Position& pos, ProbeState* result) {
 
 // Called at startup and after every change to
 // "SyzygyPath" UCI option to (re)create the various tables. It is not thread
-// safe, nor it needs to be.
-void Tablebases::init(const std::string& paths) {
+// safe, nor it needs to be. With preload set to WDL or All, the WDL (or all)
+// files are memory mapped right away, see TBTables::preload().
+void Tablebases::init(const std::string& paths, Preload preload) {
 
     TBTables.clear();
+    TheWDLCache.clear();
+    BlockCacheEpoch++;
     MaxCardinality = 0;
     TBFile::Paths  = paths;
 
@@ -1467,8 +1810,23 @@ void Tablebases::init(const std::string& paths) {
     }
 
     sync_cout << "info string Found " << TBTables.size() << " tablebases" << sync_endl;
+
+    if (preload != Preload::None)
+        TBTables.preload(preload == Preload::All);
 }
 
+// Sets the size in MB of the per-thread cache of decoded tablebase blocks
+// and returns the number of blocks this caches per thread.
+size_t Tablebases::set_block_cache_size(size_t mbSize) {
+    return BlockCacheSize = mbSize * 1024 * 1024 / BlockCache::EntrySize;
+}
+
+// Applies to the tables mapped from then on, init() maps them again
+void Tablebases::set_read_blocks(bool pread) { TBFile::ReadBlocks = pread; }
+
+// Not to be called while searching
+void Tablebases::set_wdl_cache_size(size_t mbSize) { TheWDLCache.resize(mbSize); }
+
 // Probe the WDL table for a particular position.
 // If *result != FAIL, the probe was successful.
 // The return value is from the point of view of the side to move:
@@ -1479,8 +1837,18 @@ void Tablebases::init(const std::string& paths) {
 //  2 : win
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+    WDLScore wdl;
+
+    if (TheWDLCache.probe(pos.key(), &wdl))
+        return *result = CACHED, wdl;
+
     *result = OK;
-    return search<false>(pos, result);
+    wdl     = search<false>(pos, result);
+
+    if (*result != FAIL)
+        TheWDLCache.store(pos.key(), wdl);
+
+    return wdl;
 }
 
 // Probe the DTZ table for a particular position.
@@ -1570,14 +1938,56 @@ int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
     return minDTZ == 0xFFFF ? -1 : minDTZ;
 }
 
+// Calls rank(pos, move) for each root move, which probes the position after the
+// move. With a thread pool the moves are shared out among its idle threads, each
+// one ranking every n-th move on its own copy of the root position: with cold
+// mmaps the probes mostly wait for the disk, and then wait together. Returns
+// false if a call failed.
+template<typename Rank>
+bool rank_each(Position& pos, Search::RootMoves& rootMoves, ThreadPool* threads, Rank rank) {
+
+    const size_t n = threads ? std::min(threads->num_threads(), rootMoves.size()) : 1;
+
+    if (n <= 1)
+    {
+        for (auto& m : rootMoves)
+            if (!rank(pos, m))
+                return false;
+
+        return true;
+    }
+
+    const std::string fen = pos.fen();
+    std::atomic_bool  ok  = true;
+
+    for (size_t k = 0; k < n; ++k)
+        threads->run_on_thread(k, [&, k]() {
+            // As in ThreadPool::start_thinking(), the copy of the root StateInfo
+            // links it to the shared earlier states for the repetition checks.
+            StateInfo rootState;
+            Position  p;
+            p.set(fen, pos.is_chess960(), &rootState);
+            p.set_root_state(*pos.state());
+
+            for (size_t i = k; i < rootMoves.size() && ok; i += n)
+                if (!rank(p, rootMoves[i]))
+                    ok = false;
+        });
+
+    for (size_t k = 0; k < n; ++k)
+        threads->wait_on_thread(k);
+
+    return ok;
+}
+
 
 // Use the DTZ tables to rank root moves.
 //
 // A return value false indicates that not all probes were successful.
-bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, bool rule50) {
-
-    ProbeState result = OK;
-    StateInfo  st;
+bool Tablebases::root_probe(Position&          pos,
+                            Search::RootMoves& rootMoves,
+                            bool               rule50,
+                            ThreadPool*        threads) {
 
     // Obtain 50-move counter for the root position
     int cnt50 = pos.rule50_count();
@@ -1585,21 +1995,24 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, bool ru
     // Check whether a position was repeated since the last zeroing move.
     bool rep = pos.has_repeated();
 
-    int dtz, bound = rule50 ? (MAX_DTZ - 100) : 1;
+    int bound = rule50 ? (MAX_DTZ - 100) : 1;
 
     // Probe and rank each move
-    for (auto& m : rootMoves)
-    {
-        pos.do_move(m.pv[0], st);
+    return rank_each(pos, rootMoves, threads, [=](Position& p, Search::RootMove& m) {
+        ProbeState result = OK;
+        StateInfo  st;
+        int        dtz;
+
+        p.do_move(m.pv[0], st);
 
         // Calculate dtz for the current move counting from the root position
-        if (pos.rule50_count() == 0)
+        if (p.rule50_count() == 0)
         {
             // In case of a zeroing move, dtz is one of -101/-1/0/1/101
-            WDLScore wdl = -probe_wdl(pos, &result);
+            WDLScore wdl = -probe_wdl(p, &result);
             dtz          = dtz_before_zeroing(wdl);
         }
-        else if (pos.is_draw(1))
+        else if (p.is_draw(1))
         {
             // In case a root move leads to a draw by repetition or 50-move rule,
             // we set dtz to zero. Note: since we are only 1 ply from the root,
@@ -1609,15 +2022,15 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, bool ru
         else
         {
             // Otherwise, take dtz for the new position and correct by 1 ply
-            dtz = -probe_dtz(pos, &result);
+            dtz = -probe_dtz(p, &result);
             dtz = dtz > 0 ? dtz + 1 : dtz < 0 ? dtz - 1 : dtz;
         }
 
         // Make sure that a mating move is assigned a dtz value of 1
-        if (pos.checkers() && dtz == 2 && MoveList<LEGAL>(pos).size() == 0)
+        if (p.checkers() && dtz == 2 && MoveList<LEGAL>(p).size() == 0)
             dtz = 1;
 
-        pos.undo_move(m.pv[0]);
+        p.undo_move(m.pv[0]);
 
         if (result == FAIL)
             return false;
@@ -1637,9 +2050,8 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, bool ru
                   : r == 0     ? VALUE_DRAW
                   : r > -bound ? Value((std::min(-3, r + (MAX_DTZ - 200)) * int(PawnValue)) / 200)
                                : -VALUE_MATE + MAX_PLY + 1;
-    }
-
-    return true;
+        return true;
+    });
 }
 
 
@@ -1647,26 +2059,27 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves, bool ru
 // This is a fallback for the case that some or all DTZ tables are missing.
 //
 // A return value false indicates that not all probes were successful.
-bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, bool rule50) {
+bool Tablebases::root_probe_wdl(Position&          pos,
+                                Search::RootMoves& rootMoves,
+                                bool               rule50,
+                                ThreadPool*        threads) {
 
     static const int WDL_to_rank[] = {-MAX_DTZ, -MAX_DTZ + 101, 0, MAX_DTZ - 101, MAX_DTZ};
 
-    ProbeState result = OK;
-    StateInfo  st;
-    WDLScore   wdl;
-
-
     // Probe and rank each move
-    for (auto& m : rootMoves)
-    {
-        pos.do_move(m.pv[0], st);
+    return rank_each(pos, rootMoves, threads, [=](Position& p, Search::RootMove& m) {
+        ProbeState result = OK;
+        StateInfo  st;
+        WDLScore   wdl;
 
-        if (pos.is_draw(1))
+        p.do_move(m.pv[0], st);
+
+        if (p.is_draw(1))
             wdl = WDLDraw;
         else
-            wdl = -probe_wdl(pos, &result);
+            wdl = -probe_wdl(p, &result);
 
-        pos.undo_move(m.pv[0]);
+        p.undo_move(m.pv[0]);
 
         if (result == FAIL)
             return false;
@@ -1676,14 +2089,14 @@ bool Tablebases::root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, boo
         if (!rule50)
             wdl = wdl > WDLDraw ? WDLWin : wdl < WDLDraw ? WDLLoss : WDLDraw;
         m.tbScore = WDL_to_value[wdl + 2];
-    }
-
-    return true;
+        return true;
+    });
 }
 
 Config Tablebases::rank_root_moves(const OptionsMap&  options,
                                    Position&          pos,
-                                   Search::RootMoves& rootMoves) {
+                                   Search::RootMoves& rootMoves,
+                                   ThreadPool*        threads) {
     Config config;
 
     if (rootMoves.empty())
@@ -1707,13 +2120,14 @@ Config Tablebases::rank_root_moves(const OptionsMap&  options,
     if (config.cardinality >= popcount(pos.pieces()) && !pos.can_castle(ANY_CASTLING))
     {
         // Rank moves using DTZ tables
-        config.rootInTB = root_probe(pos, rootMoves, options["Syzygy50MoveRule"]);
+        config.rootInTB = root_probe(pos, rootMoves, options["Syzygy50MoveRule"], threads);
 
         if (!config.rootInTB)
         {
             // DTZ tables are missing; try to rank moves using WDL tables
             dtz_available   = false;
-            config.rootInTB = root_probe_wdl(pos, rootMoves, options["Syzygy50MoveRule"]);
+            config.rootInTB =
+              root_probe_wdl(pos, rootMoves, options["Syzygy50MoveRule"], threads);
         }
     }
 
@@ -19,6 +19,7 @@
 #ifndef TBPROBE_H
 #define TBPROBE_H
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
@@ -26,6 +27,7 @@
 namespace Stockfish {
 class Position;
 class OptionsMap;
+class ThreadPool;
 
 using Depth = int;
 
@@ -57,18 +59,36 @@ enum ProbeState {
     FAIL              = 0,   // Probe failed (missing file table)
     OK                = 1,   // Probe successful
     CHANGE_STM        = -1,  // DTZ should check the other side
-    ZEROING_BEST_MOVE = 2    // Best move zeroes DTZ (capture or pawn move)
+    ZEROING_BEST_MOVE = 2,   // Best move zeroes DTZ (capture or pawn move)
+    CACHED            = 3    // WDL probe answered by the WDL cache
+};
+
+// Which files Tablebases::init() memory maps right away
+enum class Preload {
+    None,
+    WDL,
+    All
 };
 
 extern int MaxCardinality;
 
 
-void     init(const std::string& paths);
+void     init(const std::string& paths, Preload preload = Preload::None);
+size_t   set_block_cache_size(size_t mbSize);
+void     set_wdl_cache_size(size_t mbSize);
+void     set_read_blocks(bool pread);
 WDLScore probe_wdl(Position& pos, ProbeState* result);
 int      probe_dtz(Position& pos, ProbeState* result);
-bool     root_probe(Position& pos, Search::RootMoves& rootMoves, bool rule50);
-bool     root_probe_wdl(Position& pos, Search::RootMoves& rootMoves, bool rule50);
-Config   rank_root_moves(const OptionsMap& options, Position& pos, Search::RootMoves& rootMoves);
+bool
+root_probe(Position& pos, Search::RootMoves& rootMoves, bool rule50, ThreadPool* threads = nullptr);
+bool   root_probe_wdl(Position&          pos,
+                      Search::RootMoves& rootMoves,
+                      bool               rule50,
+                      ThreadPool*        threads = nullptr);
+Config rank_root_moves(const OptionsMap&  options,
+                       Position&          pos,
+                       Search::RootMoves& rootMoves,
+                       ThreadPool*        threads = nullptr);
 
 }  // namespace Stockfish::Tablebases
 
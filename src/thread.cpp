@@ -21,11 +21,13 @@
 #include <algorithm>
 #include <cassert>
 #include <deque>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <utility>
 
+#include "distributed.h"
 #include "movegen.h"
 #include "search.h"
 #include "syzygy/tbprobe.h"
@@ -34,16 +36,35 @@
 #include "uci.h"
 #include "ucioption.h"
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+#endif
+
 namespace Stockfish {
 
+namespace {
+
+// Hint to the CPU that we are in a spin-wait loop
+inline void cpu_relax() {
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    __builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#endif
+}
+
+}  // namespace
+
 // Constructor launches the thread and waits until it goes to sleep
 // in idle_loop(). Note that 'searching' and 'exit' should be already set.
 Thread::Thread(Search::SharedState&                    sharedState,
                std::unique_ptr<Search::ISearchManager> sm,
                size_t                                  n,
-               OptionalThreadToNumaNodeBinder          binder) :
+               OptionalThreadToNumaNodeBinder          binder,
+               const ThreadPool&                       threadPool) :
     idx(n),
     nthreads(sharedState.options["Threads"]),
+    pool(threadPool),
     stdThread(&Thread::idle_loop, this) {
 
     wait_for_search_finished();
@@ -93,16 +114,29 @@ void Thread::wait_for_search_finished() {
     cv.wait(lk, [&] { return !searching; });
 }
 
+bool Thread::is_searching() {
+
+    std::unique_lock<std::mutex> lk(mutex);
+    return searching;
+}
+
 void Thread::run_custom_job(std::function<void()> f) {
-    {
-        std::unique_lock<std::mutex> lk(mutex);
-        cv.wait(lk, [&] { return !searching; });
-        jobFunc   = std::move(f);
-        searching = true;
-    }
-    cv.notify_one();
+    post_job(std::move(f));
+    jobPosted.store(true, std::memory_order_release);
+    wake();
 }
 
+// Hands a job to the thread without waking it up, see ThreadPool::start_searching()
+void Thread::post_job(std::function<void()> f) {
+
+    std::unique_lock<std::mutex> lk(mutex);
+    cv.wait(lk, [&] { return !searching; });
+    jobFunc   = std::move(f);
+    searching = true;
+}
+
+void Thread::wake() { cv.notify_one(); }
+
 // Thread gets parked here, blocked on the
 // condition variable, when it has no work to do.
 
@@ -111,7 +145,26 @@ void Thread::idle_loop() {
     {
         std::unique_lock<std::mutex> lk(mutex);
         searching = false;
+        jobPosted = false;
         cv.notify_one();  // Wake up anyone waiting for search finished
+
+        // Waking up a thread blocked on the condition variable takes tens of
+        // microseconds, so first poll for a new job for the IdleSpin budget.
+        if (const int budget = pool.idleSpin.load(std::memory_order_relaxed))
+        {
+            const uint64_t epoch    = pool.startEpoch.load(std::memory_order_acquire);
+            const auto     deadline = std::chrono::steady_clock::now()
+                                + std::chrono::microseconds(budget);
+            lk.unlock();
+
+            while (!jobPosted.load(std::memory_order_acquire)
+                   && pool.startEpoch.load(std::memory_order_acquire) == epoch
+                   && std::chrono::steady_clock::now() < deadline)
+                cpu_relax();
+
+            lk.lock();
+        }
+
         cv.wait(lk, [&] { return searching; });
 
         if (exit)
@@ -129,9 +182,151 @@ void Thread::idle_loop() {
 
 Search::SearchManager* ThreadPool::main_manager() { return main_thread()->worker->main_manager(); }
 
-uint64_t ThreadPool::nodes_searched() const { return accumulate(&Search::Worker::nodes); }
+uint64_t ThreadPool::nodes_searched() const {
+    return accumulate(&Search::Worker::nodes) + (cluster ? cluster->nodes_searched() : 0);
+}
 uint64_t ThreadPool::tb_hits() const { return accumulate(&Search::Worker::tbHits); }
 
+// Sum the tablebase probe counters of search() over all threads
+uint64_t ThreadPool::tb_probes() const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+        sum += th->worker->tbProbes;
+    return sum;
+}
+
+uint64_t ThreadPool::tb_cache_hits() const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+        sum += th->worker->tbCacheHits;
+    return sum;
+}
+
+// Called by the thread of self, or once self has finished searching
+uint64_t ThreadPool::nodes_counted(const Search::Worker& self) const {
+
+    uint64_t sum = self.nodes.load(std::memory_order_relaxed) - self.flushedNodes;
+    for (size_t i = 0; i < numaNodes; ++i)
+        sum += nodeCounters[i].nodes.load(std::memory_order_relaxed);
+    return sum + (cluster ? cluster->nodes_searched() : 0);
+}
+
+// Called by the thread of worker only
+void ThreadPool::flush_nodes(Search::Worker& worker) {
+
+    const uint64_t n = worker.nodes.load(std::memory_order_relaxed);
+    nodeCounters[worker.numaAccessToken.get_numa_index()].nodes.fetch_add(
+      n - worker.flushedNodes, std::memory_order_relaxed);
+    worker.flushedNodes = n;
+}
+
+// Sum the NNUE accumulator statistics of the given net over all threads
+uint64_t ThreadPool::accumulator_updates(bool big) const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+    {
+        const auto& caches = th->worker->refreshTable;
+        sum += big ? caches.big.incrementalUpdates : caches.small.incrementalUpdates;
+    }
+    return sum;
+}
+
+uint64_t ThreadPool::accumulator_refreshes(bool big) const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+    {
+        const auto& caches = th->worker->refreshTable;
+        sum += big ? caches.big.refreshes : caches.small.refreshes;
+    }
+    return sum;
+}
+
+uint64_t ThreadPool::accumulator_evictions(bool big) const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+    {
+        const auto& caches = th->worker->refreshTable;
+        sum += big ? caches.big.evictions : caches.small.evictions;
+    }
+    return sum;
+}
+
+std::array<uint64_t, Eval::NNUE::AccumulatorCaches::MaxDiff>
+ThreadPool::accumulator_refresh_diffs(bool big) const {
+
+    std::array<uint64_t, Eval::NNUE::AccumulatorCaches::MaxDiff> sum{};
+    for (auto&& th : threads)
+    {
+        const auto& caches = th->worker->refreshTable;
+        const auto& diffs  = big ? caches.big.refreshDiffs : caches.small.refreshDiffs;
+
+        for (size_t i = 0; i < sum.size(); ++i)
+            sum[i] += diffs[i];
+    }
+    return sum;
+}
+
+// Sum the MovePicker lookahead prefetch counters over all threads
+uint64_t ThreadPool::prefetches_issued() const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+        sum += th->worker->prefetchesIssued;
+    return sum;
+}
+
+uint64_t ThreadPool::prefetches_used() const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+        sum += th->worker->prefetchesUsed;
+    return sum;
+}
+
+uint64_t ThreadPool::eval_cache_probes() const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+        sum += th->worker->refreshTable.evals.probes;
+    return sum;
+}
+
+uint64_t ThreadPool::eval_cache_hits() const {
+
+    uint64_t sum = 0;
+    for (auto&& th : threads)
+        sum += th->worker->refreshTable.evals.hits;
+    return sum;
+}
+
+Search::SearchStats::Snapshot ThreadPool::search_stats() const {
+
+    Search::SearchStats::Snapshot sum{};
+    for (auto&& th : threads)
+        th->worker->stats.add_to(sum);
+    return sum;
+}
+
+void ThreadPool::write_search_trace(const std::string& path, int rate) const {
+
+    using Trace = Search::SearchTrace;
+
+    std::ofstream            file(path, std::ios::binary | std::ios::app);
+    const Trace::BlockHeader header{
+      {'S', 'F', 'S', 'T'}, Trace::Version, uint32_t(sizeof(Trace::Record)),
+      uint32_t(threads.size()), uint32_t(rate), 0};
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i]->worker->trace.write(file, uint32_t(i));
+}
+
 // Creates/destroys threads to match the requested number.
 // Created and launched threads will immediately go to sleep in idle_loop.
 // Upon resizing, threads are recreated to allow for binding if necessary.
@@ -174,6 +369,11 @@ void ThreadPool::set(const NumaConfig&                           numaConfig,
                                 ? numaConfig.distribute_threads_among_numa_nodes(requested)
                                 : std::vector<NumaIndex>{};
 
+        numaNodes = 1;
+        for (NumaIndex n : boundThreadToNumaNode)
+            numaNodes = std::max(numaNodes, size_t(n) + 1);
+        nodeCounters = std::make_unique<NodeCounter[]>(numaNodes);
+
         while (threads.size() < requested)
         {
             const size_t    threadId = threads.size();
@@ -190,7 +390,7 @@ void ThreadPool::set(const NumaConfig&                           numaConfig,
                                         : OptionalThreadToNumaNodeBinder(numaId);
 
             threads.emplace_back(
-              std::make_unique<Thread>(sharedState, std::move(manager), threadId, binder));
+              std::make_unique<Thread>(sharedState, std::move(manager), threadId, binder, *this));
         }
 
         clear();
@@ -215,12 +415,34 @@ void ThreadPool::clear() {
     main_manager()->bestPreviousAverageScore = VALUE_INFINITE;
     main_manager()->previousTimeReduction    = 0.85;
 
+    startCount = startLatencySum = startLatencyMax = 0;
+    responseStats                                  = ResponseStats{};
+
     main_manager()->callsCnt           = 0;
+    main_manager()->stopMargin         = 1;
     main_manager()->bestPreviousScore  = VALUE_INFINITE;
     main_manager()->originalTimeAdjust = -1;
     main_manager()->tm.clear();
 }
 
+// Only invalidates what depends on the given net, so that swapping a net
+// keeps the histories and the time management state.
+void ThreadPool::clear_refresh_tables(bool big) {
+    for (auto&& th : threads)
+        th->run_custom_job([&th, big]() { th->worker->clear_refresh_table(big); });
+
+    for (auto&& th : threads)
+        th->wait_for_search_finished();
+}
+
+void ThreadPool::resize_eval_caches(size_t kb) {
+    for (auto&& th : threads)
+        th->run_custom_job([&th, kb]() { th->worker->refreshTable.evals.resize(kb); });
+
+    for (auto&& th : threads)
+        th->wait_for_search_finished();
+}
+
 void ThreadPool::run_on_thread(size_t threadId, std::function<void()> f) {
     assert(threads.size() > threadId);
     threads[threadId]->run_custom_job(std::move(f));
@@ -242,11 +464,19 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
 
     main_thread()->wait_for_search_finished();
 
+    goTime = std::chrono::steady_clock::now();
+
     main_manager()->stopOnPonderhit = stop = abortedSearch = false;
     main_manager()->ponder                                 = limits.ponderMode;
 
     increaseDepth = true;
 
+    idleSpin           = int(options["IdleSpin"]);
+    deterministic      = options["DeterministicSMP"];
+    epochMembers       = threads.size();
+    epochArrived       = 0;
+    epochStopRequested = false;
+
     Search::RootMoves rootMoves;
     const auto        legalmoves = MoveList<LEGAL>(pos);
 
@@ -262,7 +492,7 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
         for (const auto& m : legalmoves)
             rootMoves.emplace_back(m);
 
-    Tablebases::Config tbConfig = Tablebases::rank_root_moves(options, pos, rootMoves);
+    Tablebases::Config tbConfig = Tablebases::rank_root_moves(options, pos, rootMoves, this);
 
     // After ownership transfer 'states' becomes empty, so if we stop the search
     // and call 'go' again without setting a new position states.get() == nullptr.
@@ -271,22 +501,53 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
     if (states.get())
         setupStates = std::move(states);  // Ownership transfer, states is now empty
 
+    // With SplitRootMoves, instead of all threads searching every root move, the
+    // threads form groups and group g searches the moves whose index is g modulo
+    // the number of groups. Threads of the same group share the work Lazy SMP style.
+    // It is meant for analysis and ignored for searches with a clock: the time
+    // management of the main thread only sees the best move changes and score
+    // stability of its own group, and groups reach different depths.
+    rootGroups = options["SplitRootMoves"] && !limits.use_time_management()
+                 ? std::clamp(rootMoves.size(), size_t(1), size())
+                 : 1;
+    groupsDone = 0;
+
+    std::vector<Search::RootMoves> groupMoves(rootGroups);
+
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+        groupMoves[i % rootGroups].push_back(rootMoves[i]);
+
     // We use Position::set() to set root position across threads. But there are
     // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
     // be deduced from a fen string, so set() clears them and they are set from
     // setupStates->back() later. The rootState is per thread, earlier states are shared
     // since they are read-only.
-    for (auto&& th : threads)
+    const std::string fen = pos.fen();
+
+    for (size_t i = 0; i < numaNodes; ++i)
+        nodeCounters[i].nodes = 0;
+
+    for (size_t i = 0; i < threads.size(); ++i)
     {
-        th->run_custom_job([&]() {
+        auto& th = threads[i];
+        th->run_custom_job([&, i]() {
             th->worker->limits = limits;
             th->worker->nodes = th->worker->tbHits = th->worker->nmpMinPly =
               th->worker->bestMoveChanges          = 0;
+            th->worker->flushedNodes               = 0;
             th->worker->rootDepth = th->worker->completedDepth = 0;
-            th->worker->rootMoves                              = rootMoves;
-            th->worker->rootPos.set(pos.fen(), pos.is_chess960(), &th->worker->rootState);
-            th->worker->rootState = setupStates->back();
+            th->worker->rootMoves                              = groupMoves[i % rootGroups];
+            th->worker->rootPos.set(fen, pos.is_chess960(), &th->worker->rootState);
+            th->worker->rootPos.set_root_state(setupStates->back());
             th->worker->tbConfig  = tbConfig;
+            th->worker->epochEnd  = EpochNodes;
+            th->worker->select_histories();
+
+            // Allocated by the thread itself, on its NUMA node
+            if (!deterministic)
+                th->worker->ttBuffer.reset();
+            else if (!th->worker->ttBuffer || th->worker->ttBuffer->partitions() != size())
+                th->worker->ttBuffer = std::make_unique<TTBuffer>(size());
         });
     }
 
@@ -296,6 +557,10 @@ void ThreadPool::start_thinking(const OptionsMap&  options,
     main_thread()->start_searching();
 }
 
+StateListPtr ThreadPool::release_setup_states() {
+    return main_thread()->is_searching() ? nullptr : std::move(setupStates);
+}
+
 Thread* ThreadPool::get_best_thread() const {
 
     Thread* bestThread = threads.front().get();
@@ -363,13 +628,185 @@ Thread* ThreadPool::get_best_thread() const {
 }
 
 
+// With SplitRootMoves the main thread only has the lines of its own group. Called
+// after the search, this replaces them with the lines of all groups, each group
+// represented by its deepest thread, so that MultiPV output covers every root move.
+// The lines are ranked by score although the groups may have completed different
+// depths, so a shallower line can outrank a deeper one. They are reported at the
+// smallest of these depths. With a depth limit, the first thread of each group
+// stops at that depth and the main thread waits for all of them, so each group is
+// represented by its first thread and all the lines come from that depth.
+void ThreadPool::merge_root_moves() {
+
+    const Depth depthLimit = main_thread()->worker->limits.depth;
+
+    std::vector<Search::Worker*> deepest(rootGroups, nullptr);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        auto& best = deepest[i % rootGroups];
+        if (!best
+            || (!depthLimit && threads[i]->worker->completedDepth > best->completedDepth))
+            best = threads[i]->worker.get();
+    }
+
+    Search::RootMoves merged;
+    Depth             depth = MAX_PLY;
+
+    for (Search::Worker* w : deepest)
+    {
+        merged.insert(merged.end(), w->rootMoves.begin(), w->rootMoves.end());
+        depth = std::min(depth, w->completedDepth);
+    }
+
+    std::stable_sort(merged.begin(), merged.end());
+
+    Search::Worker& mainWorker = *main_thread()->worker;
+    mainWorker.rootMoves       = std::move(merged);
+    mainWorker.completedDepth  = depth;
+}
+
+
 // Start non-main threads
-// Will be invoked by main thread after it has started searching
+// Will be invoked by main thread after it has started searching. The search is
+// posted to every thread first, then a single increment of startEpoch releases
+// the spinning ones together and only the blocked ones need a wake-up.
 void ThreadPool::start_searching() {
 
     for (auto&& th : threads)
         if (th != threads.front())
-            th->start_searching();
+        {
+            Thread* t = th.get();
+            t->post_job([t]() { t->worker->start_searching(); });
+        }
+
+    startEpoch.fetch_add(1, std::memory_order_release);
+
+    for (auto&& th : threads)
+        if (th != threads.front())
+            th->wake();
+}
+
+// Called by each thread as it starts searching
+void ThreadPool::note_search_start() {
+
+    const auto elapsed = std::chrono::steady_clock::now() - goTime;
+    const auto latency =
+      uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+    startCount.fetch_add(1, std::memory_order_relaxed);
+    startLatencySum.fetch_add(latency, std::memory_order_relaxed);
+
+    uint64_t peak = startLatencyMax.load(std::memory_order_relaxed);
+    while (peak < latency && !startLatencyMax.compare_exchange_weak(peak, latency))
+    {}
+}
+
+// Called by the main thread after sending the bestmove of a search with a deadline
+void ThreadPool::note_response(TimePoint response, TimePoint sla) {
+
+    responseStats.searches++;
+    responseStats.sum += response;
+    responseStats.max = std::max(responseStats.max, response);
+
+    if (response > sla)
+    {
+        responseStats.misses++;
+        responseStats.overshootSum += response - sla;
+        responseStats.overshootMax = std::max(responseStats.overshootMax, response - sla);
+    }
+}
+
+
+// Called by a searching thread every EpochNodes nodes in DeterministicSMP mode.
+// Once all threads are here, they apply the buffered writes of the epoch together,
+// each one taking the next partition of the table still to be done.
+void ThreadPool::end_epoch(Search::Worker& worker) {
+
+    std::unique_lock lk(epochMutex);
+
+    if (stop)
+        return;
+
+    const uint64_t epoch = epochCount;
+
+    ++epochArrived;
+
+    if (!close_epoch())
+        epochCv.wait(lk, [&] { return epochCount != epoch; });
+
+    lk.unlock();
+    apply_tt_buffers();
+    lk.lock();
+
+    const uint64_t applied = epochApplied;
+
+    if (--epochAppliers == 0)
+    {
+        for (auto&& th : threads)
+            th->worker->ttBuffer->clear();
+
+        ++epochApplied;
+        epochCv.notify_all();
+    }
+    else
+        epochCv.wait(lk, [&] { return epochApplied != applied; });
+
+    worker.epochEnd = worker.nodes + EpochNodes;
+}
+
+// Called by a thread which stops searching. With stopOthers set, the other threads
+// stop at the end of the current epoch. The writes it has buffered so far are
+// applied with those of the other threads.
+void ThreadPool::leave_epochs(bool stopOthers) {
+
+    std::lock_guard lk(epochMutex);
+
+    --epochMembers;
+    epochStopRequested |= stopOthers;
+    close_epoch();
+}
+
+// Closes the current epoch if all threads still searching have ended it. This is
+// the only place where the search is stopped in DeterministicSMP mode, when no
+// time limit is used, so that all threads stop after the same number of nodes.
+bool ThreadPool::close_epoch() {
+
+    if (!epochArrived || epochArrived != epochMembers)
+        return false;
+
+    const Search::Worker& main = *main_thread()->worker;
+
+    if (epochStopRequested)
+        stop = true;
+
+    else if (main.limits.nodes && main.completedDepth >= 1
+             && nodes_searched() >= main.limits.nodes)
+        stop = abortedSearch = true;
+
+    epochAppliers = epochArrived;
+    epochArrived  = 0;
+    nextPartition = 0;
+    ++epochCount;
+    epochCv.notify_all();
+    return true;
+}
+
+void ThreadPool::apply_tt_buffers() {
+
+    for (size_t p; (p = nextPartition++) < size();)
+        for (auto&& th : threads)
+            th->worker->ttBuffer->apply(p);
+}
+
+// Store the writes still buffered when the search is over
+void ThreadPool::flush_tt_buffers() {
+
+    nextPartition = 0;
+    apply_tt_buffers();
+
+    for (auto&& th : threads)
+        th->worker->ttBuffer->clear();
 }
 
 
@@ -401,4 +838,9 @@ std::vector<size_t> ThreadPool::get_bound_thread_count_by_numa_node() const {
     return counts;
 }
 
+// Returns the NUMA node the given thread is bound to, or 0 when threads are not bound.
+NumaIndex ThreadPool::get_bound_numa_node(size_t threadId) const {
+    return boundThreadToNumaNode.empty() ? 0 : boundThreadToNumaNode[threadId];
+}
+
 }  // namespace Stockfish
@@ -19,7 +19,9 @@
 #ifndef THREAD_H_INCLUDED
 #define THREAD_H_INCLUDED
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
@@ -37,6 +39,10 @@ namespace Stockfish {
 
 
 class OptionsMap;
+class ThreadPool;
+namespace Distributed {
+class Master;
+}
 using Value = int;
 
 // Sometimes we don't want to actually bind the threads, but the recipent still
@@ -70,18 +76,22 @@ class OptionalThreadToNumaNodeBinder {
 // waiting for a signal to start searching.
 // When the signal is received, the thread starts searching and when
 // the search is finished, it goes back to idle_loop() waiting for a new signal.
+// With IdleSpin the thread polls for the signal for a while before blocking.
 class Thread {
    public:
     Thread(Search::SharedState&,
            std::unique_ptr<Search::ISearchManager>,
            size_t,
-           OptionalThreadToNumaNodeBinder);
+           OptionalThreadToNumaNodeBinder,
+           const ThreadPool&);
     virtual ~Thread();
 
     void idle_loop();
     void start_searching();
     void clear_worker();
     void run_custom_job(std::function<void()> f);
+    void post_job(std::function<void()> f);
+    void wake();
 
     // Thread has been slightly altered to allow running custom jobs, so
     // this name is no longer correct. However, this class (and ThreadPool)
@@ -89,6 +99,7 @@ class Thread {
     // appropriate specificity regarding search, from the point of view of an
     // outside user, so renaming of this function in left for whenever that happens.
     void   wait_for_search_finished();
+    bool   is_searching();
     size_t id() const { return idx; }
 
     std::unique_ptr<Search::Worker> worker;
@@ -99,6 +110,8 @@ class Thread {
     std::condition_variable   cv;
     size_t                    idx, nthreads;
     bool                      exit = false, searching = true;  // Set before starting std::thread
+    std::atomic_bool          jobPosted{false};
+    const ThreadPool&         pool;
     NativeThread              stdThread;
     NumaReplicatedAccessToken numaAccessToken;
 };
@@ -128,10 +141,14 @@ class ThreadPool {
     ThreadPool& operator=(ThreadPool&&)      = delete;
 
     void   start_thinking(const OptionsMap&, Position&, StateListPtr&, Search::LimitsType);
+    // Gives back the setup states of the last search once it is over, nullptr otherwise
+    StateListPtr release_setup_states();
     void   run_on_thread(size_t threadId, std::function<void()> f);
     void   wait_on_thread(size_t threadId);
     size_t num_threads() const;
     void   clear();
+    void   clear_refresh_tables(bool big);
+    void   resize_eval_caches(size_t kb);
     void   set(const NumaConfig& numaConfig,
                Search::SharedState,
                const Search::SearchManager::UpdateContext&);
@@ -139,15 +156,83 @@ class ThreadPool {
     Search::SearchManager* main_manager();
     Thread*                main_thread() const { return threads.front().get(); }
     uint64_t               nodes_searched() const;
+    uint64_t               nodes_counted(const Search::Worker& self) const;
+    void                   flush_nodes(Search::Worker& worker);
     uint64_t               tb_hits() const;
+    uint64_t               tb_probes() const;
+    uint64_t               tb_cache_hits() const;
+    uint64_t               accumulator_updates(bool big) const;
+    uint64_t               accumulator_refreshes(bool big) const;
+    uint64_t               accumulator_evictions(bool big) const;
+    std::array<uint64_t, Eval::NNUE::AccumulatorCaches::MaxDiff>
+    accumulator_refresh_diffs(bool big) const;
+    uint64_t               prefetches_issued() const;
+    uint64_t               prefetches_used() const;
+    uint64_t               eval_cache_probes() const;
+    uint64_t               eval_cache_hits() const;
+
+    Search::SearchStats::Snapshot search_stats() const;
+    // Appends the nodes sampled by each thread in the last search to a file
+    void                   write_search_trace(const std::string& path, int rate) const;
     Thread*                get_best_thread() const;
+    void                   merge_root_moves();
     void                   start_searching();
     void                   wait_for_search_finished() const;
 
+    // IdleSpin: microseconds an idle thread polls for a new job before blocking.
+    // The helpers are started together by a single increment of startEpoch.
+    std::atomic<int>      idleSpin{0};
+    std::atomic<uint64_t> startEpoch{0};
+
+    // Time from 'go' to the start of the search of each thread, in microseconds
+    void     note_search_start();
+    uint64_t search_starts() const { return startCount; }
+    uint64_t start_latency_sum() const { return startLatencySum; }
+    uint64_t start_latency_max() const { return startLatencyMax; }
+
+    // LatencySLA: response times from 'go' to 'bestmove' of the searches run
+    // with a deadline, in milliseconds. Only the main thread updates them.
+    struct ResponseStats {
+        uint64_t  searches, misses;
+        TimePoint sum, max, overshootSum, overshootMax;
+    };
+    void                 note_response(TimePoint response, TimePoint sla);
+    const ResponseStats& response_stats() const { return responseStats; }
+
     std::vector<size_t> get_bound_thread_count_by_numa_node() const;
+    NumaIndex           get_bound_numa_node(size_t threadId) const;
 
     std::atomic_bool stop, abortedSearch, increaseDepth;
 
+    // Number of groups of threads searching disjoint subsets of the root moves
+    // (SplitRootMoves), 1 when all threads search the whole root move list.
+    size_t rootGroups = 1;
+
+    // Groups whose first thread, the one honouring a depth limit, has finished its
+    // iterative deepening. The main thread waits for all of them with a depth limit.
+    std::atomic<size_t> groupsDone{0};
+
+    // Other nodes searching the same position (ClusterNodes), owned by the engine
+    Distributed::Master* cluster = nullptr;
+
+    // DeterministicSMP: the threads search in epochs of EpochNodes nodes. A thread
+    // ending an epoch waits in end_epoch() until every other thread has ended it too
+    // or has left with leave_epochs(), then the TT writes buffered during the epoch
+    // are applied in thread order and the node limit is checked.
+    static constexpr uint64_t EpochNodes = 4096;
+
+    // The threads add their nodes to a counter per NUMA node every NodesFlushInterval
+    // nodes, and at the end of their search. nodes_counted() sums these counters
+    // instead of the nodes of every thread. With the nodes of the calling thread
+    // itself, it is exact with one thread, and otherwise behind by less than
+    // NodesFlushInterval nodes per other thread while they search.
+    static constexpr uint64_t NodesFlushInterval = 1024;
+
+    bool deterministic = false;
+    void end_epoch(Search::Worker&);
+    void leave_epochs(bool stopOthers);
+    void flush_tt_buffers();
+
     auto cbegin() const noexcept { return threads.cbegin(); }
     auto begin() noexcept { return threads.begin(); }
     auto end() noexcept { return threads.end(); }
@@ -160,6 +245,26 @@ class ThreadPool {
     std::vector<std::unique_ptr<Thread>> threads;
     std::vector<NumaIndex>               boundThreadToNumaNode;
 
+    bool close_epoch();
+    void apply_tt_buffers();
+
+    std::mutex              epochMutex;
+    std::condition_variable epochCv;
+    size_t                  epochMembers = 0, epochArrived = 0, epochAppliers = 0;
+    uint64_t                epochCount = 0, epochApplied = 0;
+    bool                    epochStopRequested = false;
+    std::atomic<size_t>     nextPartition;
+
+    struct alignas(64) NodeCounter {
+        std::atomic<uint64_t> nodes{0};
+    };
+    std::unique_ptr<NodeCounter[]> nodeCounters;
+    size_t                         numaNodes = 0;
+
+    std::chrono::steady_clock::time_point goTime;
+    std::atomic<uint64_t>                 startCount{0}, startLatencySum{0}, startLatencyMax{0};
+    ResponseStats                         responseStats{};
+
     uint64_t accumulate(std::atomic<uint64_t> Search::Worker::*member) const {
 
         uint64_t sum = 0;
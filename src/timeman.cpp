@@ -22,12 +22,24 @@
 #include <cassert>
 #include <cmath>
 #include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
 
 #include "search.h"
 #include "ucioption.h"
 
 namespace Stockfish {
 
+namespace {
+
+constexpr double EvalLevel[10] = {0.981, 0.956, 0.895, 0.949, 0.913,
+                                  0.942, 0.933, 0.890, 0.984, 0.941};
+
+}
+
 TimePoint TimeManagement::optimum() const { return optimumTime; }
 TimePoint TimeManagement::maximum() const { return maximumTime; }
 
@@ -49,7 +61,17 @@ void TimeManagement::init(Search::LimitsType& limits,
                           int                 ply,
                           const OptionsMap&   options,
                           double&             originalTimeAdjust) {
-    TimePoint npmsec = TimePoint(options["nodestime"]);
+    init(limits, us, ply, TimePoint(options["nodestime"]), TimePoint(options["Move Overhead"]),
+         options["Ponder"], originalTimeAdjust);
+}
+
+void TimeManagement::init(Search::LimitsType& limits,
+                          Color               us,
+                          int                 ply,
+                          TimePoint           npmsec,
+                          TimePoint           moveOverhead,
+                          bool                ponder,
+                          double&             originalTimeAdjust) {
 
     // If we have no time, we don't need to fully initialize TM.
     // startTime is used by movetime and useNodesTime is used in elapsed calls.
@@ -59,8 +81,6 @@ void TimeManagement::init(Search::LimitsType& limits,
     if (limits.time[us] == 0)
         return;
 
-    TimePoint moveOverhead = TimePoint(options["Move Overhead"]);
-
     // optScale is a percentage of available time to use for the current move.
     // maxScale is a multiplier applied to optimumTime.
     double optScale, maxScale;
@@ -133,8 +153,203 @@ void TimeManagement::init(Search::LimitsType& limits,
     maximumTime =
       TimePoint(std::min(0.825 * limits.time[us] - moveOverhead, maxScale * optimumTime)) - 10;
 
-    if (options["Ponder"])
+    if (ponder)
         optimumTime += optimumTime / 4;
 }
 
+double TimeManagement::iteration_time(const Iteration& it,
+                                      double           previousTimeReduction,
+                                      double&          timeReduction) const {
+
+    double fallingEval = (1067 + 223 * (it.previousAverage - it.value)
+                          + 97 * (it.previousValue - it.value))
+                       / 10000.0;
+    fallingEval = std::clamp(fallingEval, 0.580, 1.667);
+
+    // If the bestMove is stable over several iterations, reduce time accordingly
+    timeReduction              = it.lastBestMoveDepth + 8 < it.depth ? 1.495 : 0.687;
+    double reduction           = (1.48 + previousTimeReduction) / (2.17 * timeReduction);
+    double bestMoveInstability = 1 + 1.88 * it.bestMoveChanges / it.threads;
+    int    el                  = std::clamp((it.value + 750) / 150, 0, 9);
+    double recapture           = it.recapture ? 0.955 : 1.005;
+
+    double totalTime =
+      optimumTime * fallingEval * reduction * bestMoveInstability * EvalLevel[el] * recapture;
+
+    // Cap used time in case of a single legal move for a better viewer experience
+    if (it.singleMove)
+        totalTime = std::min(500.0, totalTime);
+
+    return totalTime;
+}
+
+TimeManagement::Verdict
+TimeManagement::verdict(const Iteration& it, double totalTime, bool ponder) {
+
+    if (it.depth >= 10 && it.nodesEffort >= 97 && it.elapsed > totalTime * 0.739 && !ponder)
+        return STOP_EFFORT;
+
+    // Stop the search if we have exceeded the totalTime
+    if (it.elapsed > totalTime)
+        return STOP_OPTIMUM;
+
+    return ponder || it.elapsed <= totalTime * 0.506 ? CONTINUE : CONTINUE_SAME_DEPTH;
+}
+
+// A TMLog file has three kinds of lines, made of space separated names and values:
+//   move ply <n> time <ms> inc <ms> movestogo <n> overhead <ms> ponder <0/1>
+//        nodestime <n> adjust <x> reduction <x> optimum <ms> maximum <ms>
+//   iter depth <n> elapsed <ms> nodes <n> effort <%> value <v> average <v>
+//        previous <v> lastbest <n> changes <x> threads <n> recapture <0/1> single <0/1>
+//   end elapsed <ms> depth <n> nodes <n> reason <why the search stopped>
+// adjust and reduction are the state carried over from the previous moves, adjust
+// is negative at the first move of a game. The iterations are those after which
+// the time decisions were taken. The replay takes them in order and stops at the
+// first one the current decisions stop after, or at the current maximum time.
+// It cannot know what deeper searches than logged would have done, nor the effect
+// of searching the same depth again, so a replay which goes on past the logged
+// iterations ends with the logged search. Lines with a value which is not a number,
+// other than the reason, are skipped.
+std::string TimeManagement::replay(const std::string& path) {
+
+    std::ifstream in(path);
+    if (!in)
+        return "Could not open " + path;
+
+    using Fields      = std::map<std::string, std::string>;
+    const auto number = [](const std::string& s, double& d) {
+        char* end;
+        d = std::strtod(s.c_str(), &end);
+        return end != s.c_str() && !*end;
+    };
+    const auto get = [&](const Fields& f, const char* name) {
+        const auto it = f.find(name);
+        double     d;
+        return it != f.end() && number(it->second, d) ? d : 0.0;
+    };
+
+    std::stringstream ss;
+    TimeManagement    tm;
+    double            adjust = -1, previousReduction = 0.85, timeReduction = 1;
+    TimePoint         npmsec = 0, inc = 0, used = 0, loggedTotal = 0, replayedTotal = 0;
+    int               depth = 0, lastDepth = 0, moves = 0, skipped = 0;
+    std::string       reason, line, type, name, value;
+
+    while (std::getline(in, line))
+    {
+        std::istringstream ls(line);
+        Fields             f;
+
+        if (!(ls >> type))
+            continue;
+        while (ls >> name >> value)
+            f[name] = value;
+
+        double d;
+        if (std::any_of(f.begin(), f.end(), [&](const auto& field) {
+                return field.first != "reason" && !number(field.second, d);
+            }))
+        {
+            skipped++;
+            continue;
+        }
+
+        if (type == "move")
+        {
+            // A new game resets what the moves carry over, a log starting in
+            // the middle of a game gives it at its first move.
+            if (get(f, "adjust") < 0 || !moves)
+            {
+                adjust            = get(f, "adjust");
+                previousReduction = get(f, "reduction");
+                tm.clear();
+            }
+
+            Search::LimitsType limits;
+            limits.time[WHITE] = TimePoint(get(f, "time"));
+            limits.inc[WHITE]  = TimePoint(get(f, "inc"));
+            limits.movestogo   = int(get(f, "movestogo"));
+            limits.startTime   = now();
+            npmsec             = TimePoint(get(f, "nodestime"));
+            inc                = limits.inc[WHITE];
+
+            tm.init(limits, WHITE, int(get(f, "ply")), npmsec, TimePoint(get(f, "overhead")),
+                    get(f, "ponder") != 0, adjust);
+
+            timeReduction = 1;
+            depth = lastDepth = 0;
+            reason.clear();
+
+            ss << "ply " << int(get(f, "ply")) << ": optimum " << tm.optimum() << " (logged "
+               << f["optimum"] << "), maximum " << tm.maximum() << " (logged " << f["maximum"]
+               << ")";
+        }
+        else if (type == "iter" && reason.empty())
+        {
+            Iteration it;
+            it.depth             = int(get(f, "depth"));
+            it.lastBestMoveDepth = int(get(f, "lastbest"));
+            it.nodesEffort       = int(get(f, "effort"));
+            it.value             = Value(get(f, "value"));
+            it.previousAverage   = Value(get(f, "average"));
+            it.previousValue     = Value(get(f, "previous"));
+            it.bestMoveChanges   = get(f, "changes");
+            it.threads           = size_t(get(f, "threads"));
+            it.recapture         = get(f, "recapture") != 0;
+            it.singleMove        = get(f, "single") != 0;
+            it.elapsed           = TimePoint(get(f, "elapsed"));
+
+            if (it.elapsed > tm.maximum())
+            {
+                used   = tm.maximum();
+                depth  = lastDepth;
+                reason = "maximum";
+                continue;
+            }
+
+            const Verdict v = verdict(it, tm.iteration_time(it, previousReduction, timeReduction),
+                                      false);
+            lastDepth       = it.depth;
+
+            if (v == STOP_EFFORT || v == STOP_OPTIMUM)
+            {
+                used   = it.elapsed;
+                depth  = it.depth;
+                reason = v == STOP_EFFORT ? "effort" : "optimum";
+            }
+        }
+        else if (type == "end")
+        {
+            const TimePoint logged = TimePoint(get(f, "elapsed"));
+
+            if (reason.empty())
+            {
+                used   = std::min(logged, tm.maximum());
+                depth  = int(get(f, "depth"));
+                reason = logged > tm.maximum() ? "maximum" : f["reason"] + ", as logged";
+            }
+
+            previousReduction = timeReduction;
+            if (npmsec)
+                tm.advance_nodes_time(used - inc);
+
+            moves += 1;
+            loggedTotal += logged;
+            replayedTotal += used;
+
+            ss << ", logged " << logged << " depth " << f["depth"] << " (" << f["reason"]
+               << "), replayed " << used << " depth " << depth << " (" << reason << ")\n";
+        }
+    }
+
+    ss << moves << " moves, logged " << loggedTotal << ", replayed " << replayedTotal;
+    if (loggedTotal)
+        ss << " (" << std::fixed << std::setprecision(1) << 100.0 * replayedTotal / loggedTotal
+           << "%)";
+    if (skipped)
+        ss << ", " << skipped << " malformed lines skipped";
+
+    return ss.str();
+}
+
 }  // namespace Stockfish
@@ -20,6 +20,7 @@
 #define TIMEMAN_H_INCLUDED
 
 #include <cstdint>
+#include <string>
 
 #include "misc.h"
 #include "types.h"
@@ -41,6 +42,41 @@ class TimeManagement {
               int                 ply,
               const OptionsMap&   options,
               double&             originalTimeAdjust);
+    void init(Search::LimitsType& limits,
+              Color               us,
+              int                 ply,
+              TimePoint           npmsec,
+              TimePoint           moveOverhead,
+              bool                ponder,
+              double&             originalTimeAdjust);
+
+    // The state after an iteration of the main thread which the time decisions
+    // depend on. It is logged with the TMLog option and read back by replay().
+    struct Iteration {
+        int       depth, lastBestMoveDepth, nodesEffort;
+        Value     value, previousAverage, previousValue;
+        double    bestMoveChanges;
+        size_t    threads;
+        bool      recapture, singleMove;
+        TimePoint elapsed;
+    };
+
+    enum Verdict {
+        CONTINUE,
+        CONTINUE_SAME_DEPTH,
+        STOP_EFFORT,
+        STOP_OPTIMUM
+    };
+
+    // Time to spend on the move after the iteration, also setting the time
+    // reduction that carries over to the next move
+    double
+    iteration_time(const Iteration& it, double previousTimeReduction, double& timeReduction) const;
+    static Verdict verdict(const Iteration& it, double totalTime, bool ponder);
+
+    // Replays the time decisions of a TMLog file with the current ones, and
+    // returns a comparison of the time used per move
+    static std::string replay(const std::string& path);
 
     TimePoint optimum() const;
     TimePoint maximum() const;
@@ -18,10 +18,13 @@
 
 #include "tt.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 
 #include "memory.h"
@@ -34,7 +37,7 @@ namespace Stockfish {
 
 // TTEntry struct is the 10 bytes transposition table entry, defined as below:
 //
-// key        16 bit
+// key        16 bit (32 bit check, see below, when compiled with TT_WIDE_KEY)
 // depth       8 bit
 // generation  5 bit
 // pv node     1 bit
@@ -45,6 +48,9 @@ namespace Stockfish {
 //
 // These fields are in the same order as accessed by TT::probe(), since memory is fastest sequentially.
 // Equally, the store order in save() matches this order.
+//
+// With TT_WIDE_KEY (make widekey=yes) the entry takes 12 bytes and a cluster of five fills a cache
+// line, for tables so large and searches so long that 16 bit collisions do show up.
 
 struct TTEntry {
 
@@ -56,21 +62,49 @@ struct TTEntry {
     }
 
     bool is_occupied() const;
-    void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8);
+    bool matches(Key k) const;
+    void save(Key     k,
+              Value   v,
+              bool    pv,
+              Bound   b,
+              Depth   d,
+              Move    m,
+              Value   ev,
+              uint8_t generation8,
+              bool    pathAging = false);
     // The returned age is a multiple of TranspositionTable::GENERATION_DELTA
     uint8_t relative_age(const uint8_t generation8) const;
 
    private:
     friend class TranspositionTable;
 
+#if defined(TT_WIDE_KEY)
+    // The low 32 bits of the key xored with the 64 data bits folded in two, so
+    // that a torn entry, half written by two threads, does not match either key.
+    uint32_t check32;
+    uint32_t fold() const;
+#else
     uint16_t key16;
-    uint8_t  depth8;
-    uint8_t  genBound8;
-    Move     move16;
-    int16_t  value16;
-    int16_t  eval16;
+#endif
+    uint8_t depth8;
+    uint8_t genBound8;
+    Move    move16;
+    int16_t value16;
+    int16_t eval16;
 };
 
+#if defined(TT_WIDE_KEY)
+inline uint32_t TTEntry::fold() const {
+    uint32_t data[2];
+    std::memcpy(data, &depth8, sizeof(data));
+    return data[0] ^ data[1];
+}
+
+inline bool TTEntry::matches(Key k) const { return check32 == (uint32_t(k) ^ fold()); }
+#else
+inline bool TTEntry::matches(Key k) const { return key16 == uint16_t(k); }
+#endif
+
 // `genBound8` is where most of the details are. We use the following constants to manipulate 5 leading generation bits
 // and 3 trailing miscellaneous bits.
 
@@ -90,26 +124,43 @@ bool TTEntry::is_occupied() const { return bool(depth8); }
 
 // Populates the TTEntry with a new node's data, possibly
 // overwriting an old position. The update is not atomic and can be racy.
-void TTEntry::save(
-  Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
+// With path aging the data of the same position is not replaced for being
+// old, as it was written from another root of the same analysis.
+void TTEntry::save(Key     k,
+                   Value   v,
+                   bool    pv,
+                   Bound   b,
+                   Depth   d,
+                   Move    m,
+                   Value   ev,
+                   uint8_t generation8,
+                   bool    pathAging) {
+
+    const bool sameKey = matches(k);
 
     // Preserve the old ttmove if we don't have a new one
-    if (m || uint16_t(k) != key16)
+    if (m || !sameKey)
         move16 = m;
 
     // Overwrite less valuable entries (cheapest checks first)
-    if (b == BOUND_EXACT || uint16_t(k) != key16 || d - DEPTH_ENTRY_OFFSET + 2 * pv > depth8 - 4
-        || relative_age(generation8))
+    if (b == BOUND_EXACT || !sameKey || d - DEPTH_ENTRY_OFFSET + 2 * pv > depth8 - 4
+        || (!pathAging && relative_age(generation8)))
     {
         assert(d > DEPTH_ENTRY_OFFSET);
         assert(d < 256 + DEPTH_ENTRY_OFFSET);
 
-        key16     = uint16_t(k);
+#if !defined(TT_WIDE_KEY)
+        key16 = uint16_t(k);
+#endif
         depth8    = uint8_t(d - DEPTH_ENTRY_OFFSET);
         genBound8 = uint8_t(generation8 | uint8_t(pv) << 2 | b);
         value16   = int16_t(v);
         eval16    = int16_t(ev);
     }
+
+#if defined(TT_WIDE_KEY)
+    check32 = uint32_t(k) ^ fold();
+#endif
 }
 
 
@@ -124,12 +175,17 @@ uint8_t TTEntry::relative_age(const uint8_t generation8) const {
 
 
 // TTWriter is but a very thin wrapper around the pointer
-TTWriter::TTWriter(TTEntry* tte) :
-    entry(tte) {}
+TTWriter::TTWriter(TTEntry* tte, TTBuffer* buf, bool aging) :
+    entry(tte),
+    buffer(buf),
+    pathAging(aging) {}
 
 void TTWriter::write(
   Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev, uint8_t generation8) {
-    entry->save(k, v, pv, b, d, m, ev, generation8);
+    if (buffer)
+        buffer->save(entry, k, v, pv, b, d, m, ev, generation8, pathAging);
+    else
+        entry->save(k, v, pv, b, d, m, ev, generation8, pathAging);
 }
 
 
@@ -137,6 +193,20 @@ void TTWriter::write(
 // of TTEntry. Each non-empty TTEntry contains information on exactly one position. The size of a Cluster should
 // divide the size of a cache line for best performance, as the cacheline is prefetched when possible.
 
+#if defined(TT_WIDE_KEY)
+
+// With 12 byte entries, a cluster is a whole cache line
+static constexpr int ClusterSize = 5;
+
+struct Cluster {
+    TTEntry entry[ClusterSize];
+    char    padding[4];  // Pad to 64 bytes
+};
+
+static_assert(sizeof(Cluster) == 64, "Suboptimal Cluster size");
+
+#else
+
 static constexpr int ClusterSize = 3;
 
 struct Cluster {
@@ -146,43 +216,249 @@ struct Cluster {
 
 static_assert(sizeof(Cluster) == 32, "Suboptimal Cluster size");
 
+#endif
+
+
+namespace {
+
+// A key goes to cluster mul_hi64(key, n) of a table of n clusters, so the keys of
+// cluster j go from ceil(j * 2^64 / n) to the first key of cluster j + 1. This
+// walks these bounds over consecutive clusters without 128 bit arithmetic.
+class ClusterKeys {
+   public:
+    ClusterKeys(uint64_t firstIndex, uint64_t n) :
+        count(n),
+        index(firstIndex) {
+
+        // 2^64 = q * n + r
+        q = ~uint64_t(0) / n;
+        r = ~uint64_t(0) % n + 1;
+        if (r == n)
+            q++, r = 0;
+
+        // index * r = whole * n + frac, by doubling and adding
+        for (int bit = 63; bit >= 0; --bit)
+        {
+            whole *= 2;
+            if (frac >= n - frac)
+                frac -= n - frac, whole++;
+            else
+                frac += frac;
+
+            if ((index >> bit) & 1)
+            {
+                if (frac >= n - r)
+                    frac -= n - r, whole++;
+                else
+                    frac += r;
+            }
+        }
+    }
+
+    // Wraps to 0 for the end of the table, as the last key is 2^64 - 1
+    uint64_t first_key() const { return index * q + whole + (frac != 0); }
+
+    void next() {
+        index++;
+        if (frac >= count - r)
+            frac -= count - r, whole++;
+        else
+            frac += r;
+    }
+
+   private:
+    uint64_t count, index, q, r, whole = 0, frac = 0;
+};
+
+}
+
 
 // Sets the size of the transposition table,
 // measured in megabytes. Transposition table consists
 // of clusters and each cluster consists of ClusterSize number of TTEntry.
-void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
-    aligned_large_pages_free(table);
+// With numaSharded set, the table is split into one equally sized shard per
+// NUMA node that has bound threads, each first-touched by that node's threads.
+// The entries of the previous table are rehashed into the new one, so that a
+// running analysis keeps its work; only when both tables do not fit in memory
+// together the new one starts empty. Required huge pages which the system does
+// not have are replaced by normal pages, so that a setoption does not end the
+// engine, and not asked for again until the layout changes.
+bool TranspositionTable::resize(size_t      mbSize,
+                                ThreadPool& threads,
+                                bool        numaSharded,
+                                size_t      pageSize,
+                                bool        pagesRequired) {
+
+    std::vector<NumaIndex> numaNodes(1, 0);
+
+    if (numaSharded)
+    {
+        const std::vector<size_t> counts = threads.get_bound_thread_count_by_numa_node();
+
+        numaNodes.clear();
+        for (NumaIndex n = 0; n < counts.size(); ++n)
+            if (counts[n] > 0)
+                numaNodes.push_back(n);
+
+        if (numaNodes.size() <= 1)
+            numaNodes.assign(1, 0);
+    }
 
-    clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+    const size_t shardCount = numaNodes.size();
+    const size_t newShardClusterCount = mbSize * 1024 * 1024 / sizeof(Cluster) / shardCount;
+
+    // Nothing to do when the layout does not change
+    if (!shards.empty() && numaNodes == shardNumaNodes && newShardClusterCount == shardClusterCount
+        && pageSize == hugePageSize && pagesRequired == hugePagesRequired)
+        return true;
+
+    std::vector<Cluster*> oldShards = std::move(shards);
+    const size_t          oldShardClusterCount = shardClusterCount;
+    const size_t          oldClusterCount      = clusterCount;
+
+    shards.clear();
+    shardNumaNodes    = numaNodes;
+    shardClusterCount = newShardClusterCount;
+    clusterCount      = shardClusterCount * shardCount;
+    hugePageSize      = pageSize;
+    hugePagesRequired = pagesRequired;
+
+    bool required = pagesRequired;
+
+    auto allocate = [&]() {
+        for (size_t i = 0; i < shardCount; ++i)
+        {
+            shards.push_back(static_cast<Cluster*>(aligned_huge_pages_alloc(
+              shardClusterCount * sizeof(Cluster), hugePageSize, required)));
+
+            if (!shards.back())
+            {
+                shards.pop_back();
+                free();
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (!allocate())
+    {
+        for (Cluster* shard : oldShards)
+            aligned_large_pages_free(shard);
+        oldShards.clear();
+
+        // Retry on normal pages rather than give up the engine
+        if (!allocate() && required)
+        {
+            required = false;
+            allocate();
+        }
+
+        if (shards.empty())
+        {
+            std::cerr << "Failed to allocate " << mbSize << "MB for transposition table."
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
+    table = shards[0];
 
-    if (!table)
+    if (oldShards.empty())
     {
-        std::cerr << "Failed to allocate " << mbSize << "MB for transposition table." << std::endl;
-        exit(EXIT_FAILURE);
+        clear(threads);
+        return required == pagesRequired;
     }
 
-    clear(threads);
+    // Each thread fills its part of the new table, taking for every cluster the
+    // most valuable entries among the old clusters holding keys of that cluster.
+    // When an old cluster straddles two new ones, or when the table grows, its
+    // entries are copied to each of them.
+    run_on_shards(threads, [&](size_t s, size_t start, size_t len) {
+        ClusterKeys keys(s * shardClusterCount + start, clusterCount);
+        uint64_t    firstKey = keys.first_key();
+
+        auto worth = [&](const TTEntry& e) {
+            return e.is_occupied() ? e.depth8 - age(e) * 2 : -1024;
+        };
+
+        for (size_t j = start; j < start + len; ++j)
+        {
+            keys.next();
+            const uint64_t lastKey = keys.first_key() - 1;
+
+            Cluster& cluster = shards[s][j];
+            std::memset(&cluster, 0, sizeof(Cluster));
+
+            for (size_t i = mul_hi64(firstKey, oldClusterCount);
+                 i <= mul_hi64(lastKey, oldClusterCount); ++i)
+                for (const TTEntry& e :
+                     oldShards[i / oldShardClusterCount][i % oldShardClusterCount].entry)
+                {
+                    TTEntry* replace = cluster.entry;
+                    for (TTEntry& c : cluster.entry)
+                        if (worth(c) < worth(*replace))
+                            replace = &c;
+
+                    if (worth(e) > worth(*replace))
+                        *replace = e;
+                }
+
+            firstKey = lastKey + 1;
+        }
+    });
+
+    for (Cluster* shard : oldShards)
+        aligned_large_pages_free(shard);
+
+    return true;
 }
 
 
-// Initializes the entire transposition table to zero,
-// in a multi-threaded way.
-void TranspositionTable::clear(ThreadPool& threads) {
-    generation8              = 0;
+size_t TranspositionTable::size_bytes() const { return clusterCount * sizeof(Cluster); }
+
+size_t TranspositionTable::huge_page_bytes() const {
+
+    size_t bytes = 0;
+    for (Cluster* shard : shards)
+        bytes += large_page_bytes(shard, shardClusterCount * sizeof(Cluster));
+    return bytes;
+}
+
+
+void TranspositionTable::free() {
+    for (Cluster* shard : shards)
+        aligned_large_pages_free(shard);
+
+    shards.clear();
+    table = nullptr;
+}
+
+
+// Runs f(shard, start, length) on all the threads, each one getting a slice
+// of a shard. A shard is only handled by the threads bound to its NUMA node,
+// so that its pages are allocated on that node.
+void TranspositionTable::run_on_shards(ThreadPool&                                       threads,
+                                       const std::function<void(size_t, size_t, size_t)>& f) {
     const size_t threadCount = threads.num_threads();
 
-    for (size_t i = 0; i < threadCount; ++i)
+    for (size_t s = 0; s < shards.size(); ++s)
     {
-        threads.run_on_thread(i, [this, i, threadCount]() {
-            // Each thread will zero its part of the hash table
-            const size_t stride = clusterCount / threadCount;
-            const size_t start  = stride * i;
-            const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
-
-            std::memset(&table[start], 0, len * sizeof(Cluster));
-        });
+        std::vector<size_t> shardThreads;
+        for (size_t i = 0; i < threadCount; ++i)
+            if (shards.size() == 1 || threads.get_bound_numa_node(i) == shardNumaNodes[s])
+                shardThreads.push_back(i);
+
+        for (size_t k = 0; k < shardThreads.size(); ++k)
+        {
+            threads.run_on_thread(shardThreads[k], [this, &f, s, k, n = shardThreads.size()]() {
+                const size_t stride = shardClusterCount / n;
+                const size_t start  = stride * k;
+                const size_t len    = k + 1 != n ? stride : shardClusterCount - start;
+
+                f(s, start, len);
+            });
+        }
     }
 
     for (size_t i = 0; i < threadCount; ++i)
@@ -190,24 +466,49 @@ void TranspositionTable::clear(ThreadPool& threads) {
 }
 
 
+// Initializes the entire transposition table to zero,
+// in a multi-threaded way. Each thread will zero its part of a shard.
+void TranspositionTable::clear(ThreadPool& threads) {
+    generation8 = 0;
+
+    run_on_shards(threads, [this](size_t s, size_t start, size_t len) {
+        std::memset(&shards[s][start], 0, len * sizeof(Cluster));
+    });
+}
+
+
 // Returns an approximation of the hashtable
 // occupation during a search. The hash is x permill full, as per UCI protocol.
-// Only counts entries which match the current generation.
-int TranspositionTable::hashfull() const {
+// Only counts entries whose age is at most maxAge, by default those which match
+// the current generation.
+int TranspositionTable::hashfull(int maxAge) const {
 
     int cnt = 0;
     for (int i = 0; i < 1000; ++i)
         for (int j = 0; j < ClusterSize; ++j)
             cnt += table[i].entry[j].is_occupied()
-                && (table[i].entry[j].genBound8 & GENERATION_MASK) == generation8;
+                && age(table[i].entry[j]) <= maxAge * GENERATION_DELTA;
 
     return cnt / ClusterSize;
 }
 
 
-void TranspositionTable::new_search() {
-    // increment by delta to keep lower bits as is
-    generation8 += GENERATION_DELTA;
+void TranspositionTable::new_search(int rootGamePly) {
+    // With path aging the generation is the game ply of the root, modulo the
+    // generation cycle. Otherwise increment by delta to keep lower bits as is.
+    if (pathAging)
+        generation8 = uint8_t(rootGamePly * GENERATION_DELTA);
+    else
+        generation8 += GENERATION_DELTA;
+}
+
+
+// The age of an entry, as a multiple of GENERATION_DELTA. With path aging an
+// entry written from a root later in the game is as old as one written from a
+// root that many plies earlier.
+int TranspositionTable::age(const TTEntry& e) const {
+    const int a = e.relative_age(generation8);
+    return pathAging ? std::min(a, 256 - a) : a;
 }
 
 
@@ -220,30 +521,197 @@ uint8_t TranspositionTable::generation() const { return generation8; }
 // to be replaced later. The replace value of an entry is calculated as its depth
 // minus 8 times its relative age. TTEntry t1 is considered more valuable than
 // TTEntry t2 if its replace value is greater than that of t2.
-std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key) const {
+std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key,
+                                                             TTBuffer* buffer) const {
+
+    // Our own writes of the current epoch, which are not in the table yet
+    if (buffer)
+    {
+        const TTBuffer::Slot& slot = buffer->cache[key & (TTBuffer::CacheSize - 1)];
+
+        if (slot.epoch == buffer->epoch && slot.key == key)
+        {
+            TTEntry entry;
+            std::memcpy(&entry, slot.copy, sizeof(entry));
+            return {entry.is_occupied(), entry.read(), TTWriter(slot.entry, buffer, pathAging)};
+        }
+    }
 
-    TTEntry* const tte   = first_entry(key);
-    const uint16_t key16 = uint16_t(key);  // Use the low 16 bits as key inside the cluster
+    TTEntry* const tte = first_entry(key);
 
+#if defined(TT_WIDE_KEY)
+    // Check the copy, not the shared entry, so that the data we return is the
+    // data whose check matched.
     for (int i = 0; i < ClusterSize; ++i)
-        if (tte[i].key16 == key16)
+    {
+        const TTEntry entry = tte[i];
+        if (entry.matches(key))
+            return {entry.is_occupied(), entry.read(), TTWriter(&tte[i], buffer, pathAging)};
+    }
+#else
+    for (int i = 0; i < ClusterSize; ++i)
+        if (tte[i].matches(key))  // Use the low 16 bits as key inside the cluster
             // This gap is the main place for read races.
             // After `read()` completes that copy is final, but may be self-inconsistent.
-            return {tte[i].is_occupied(), tte[i].read(), TTWriter(&tte[i])};
+            return {tte[i].is_occupied(), tte[i].read(), TTWriter(&tte[i], buffer, pathAging)};
+#endif
 
     // Find an entry to be replaced according to the replacement strategy
     TTEntry* replace = tte;
     for (int i = 1; i < ClusterSize; ++i)
-        if (replace->depth8 - replace->relative_age(generation8) * 2
-            > tte[i].depth8 - tte[i].relative_age(generation8) * 2)
+        if (replace->depth8 - age(*replace) * 2 > tte[i].depth8 - age(tte[i]) * 2)
             replace = &tte[i];
 
-    return {false, replace->read(), TTWriter(replace)};
+    return {false, replace->read(), TTWriter(replace, buffer, pathAging)};
+}
+
+
+TTBuffer::TTBuffer(size_t partitions) :
+    writes(partitions),
+    cache(CacheSize, Slot{0, nullptr, 0, {}}) {
+    static_assert(sizeof(TTEntry) <= sizeof(Slot::copy));
+}
+
+// The partition of an entry is that of its cluster, so writes to the same entry
+// always end up in the same list, in the order they were made.
+void TTBuffer::save(TTEntry* tte,
+                    Key      k,
+                    Value    v,
+                    bool     pv,
+                    Bound    b,
+                    Depth    d,
+                    Move     m,
+                    Value    ev,
+                    uint8_t  gen,
+                    bool     pathAging) {
+
+    Slot&   slot = cache[k & (CacheSize - 1)];
+    TTEntry entry;
+
+    if (slot.epoch == epoch && slot.key == k && slot.entry == tte)
+        std::memcpy(&entry, slot.copy, sizeof(entry));
+    else
+        entry = *tte;
+
+    entry.save(k, v, pv, b, d, m, ev, gen, pathAging);
+    slot = {k, tte, epoch, {}};
+    std::memcpy(slot.copy, &entry, sizeof(entry));
+
+    writes[uintptr_t(tte) / sizeof(Cluster) % writes.size()].push_back(
+      {tte, k, v, ev, d, m, b, pv, gen, pathAging});
+}
+
+void TTBuffer::apply(size_t partition) const {
+    for (const Write& w : writes[partition])
+        w.entry->save(w.key, w.value, w.pv, w.bound, w.depth, w.move, w.eval, w.generation8,
+                      w.pathAging);
+}
+
+void TTBuffer::clear() {
+    for (auto& list : writes)
+        list.clear();
+
+    ++epoch;  // Invalidates the cache
+}
+
+
+// A snapshot is a small header followed by the raw clusters, shard after shard,
+// which is the same byte sequence as an unsharded table of the same size.
+constexpr uint32_t SnapshotMagic   = 0x54544653;  // "SFTT"
+constexpr uint32_t SnapshotVersion = 1;
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t clusterCount;
+    uint32_t clusterSize;
+    uint8_t  generation8;
+    uint8_t  padding[3];
+};
+
+
+bool TranspositionTable::save(const std::string& filename) const {
+    std::ofstream stream(filename, std::ios::binary);
+
+    const SnapshotHeader header{
+      SnapshotMagic, SnapshotVersion, clusterCount, uint32_t(sizeof(Cluster)), generation8, {}};
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const Cluster* shard : shards)
+        stream.write(reinterpret_cast<const char*>(shard),
+                     std::streamsize(shardClusterCount * sizeof(Cluster)));
+
+    return bool(stream);
+}
+
+
+bool TranspositionTable::load(const std::string& filename) {
+    std::ifstream  stream(filename, std::ios::binary);
+    SnapshotHeader header;
+
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != SnapshotMagic || header.version != SnapshotVersion
+        || header.clusterSize != sizeof(Cluster) || header.clusterCount != clusterCount)
+        return false;
+
+    for (Cluster* shard : shards)
+        if (!stream.read(reinterpret_cast<char*>(shard),
+                         std::streamsize(shardClusterCount * sizeof(Cluster))))
+        {
+            // Do not leave a partially loaded table behind
+            for (Cluster* s : shards)
+                std::memset(s, 0, shardClusterCount * sizeof(Cluster));
+            generation8 = 0;
+            return false;
+        }
+
+    generation8 = header.generation8;
+    return true;
 }
 
 
 TTEntry* TranspositionTable::first_entry(const Key key) const {
-    return &table[mul_hi64(key, clusterCount)].entry[0];
+    if (shards.size() == 1)
+        return &table[mul_hi64(key, clusterCount)].entry[0];
+
+    // Shards are consecutive slices of the table, so the index is the same as unsharded,
+    // mul_hi64(key, clusterCount). The high half of key * shards.size() is the shard and
+    // its low half, scaled like the key, the cluster in it, which avoids the division.
+    const uint64_t scaled = key * shards.size();
+    return &shards[mul_hi64(key, shards.size())][mul_hi64(scaled, shardClusterCount)].entry[0];
+}
+
+
+void TranspositionTable::export_entry(
+  Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+
+    // Drop entries rather than grow without bound when the peers fall behind
+    constexpr size_t MaxQueued = 1 << 16;
+
+    std::lock_guard<std::mutex> lock(exportMutex);
+
+    if (exports.size() < MaxQueued)
+        exports.push_back({k, m.raw(), int16_t(v), int16_t(ev), uint8_t(d), uint8_t(pv << 2 | b)});
+}
+
+std::vector<TTExport> TranspositionTable::take_exports() {
+
+    std::vector<TTExport> taken;
+
+    std::lock_guard<std::mutex> lock(exportMutex);
+    taken.swap(exports);
+    return taken;
+}
+
+void TranspositionTable::import_entries(const std::vector<TTExport>& entries) {
+
+    for (const TTExport& e : entries)
+    {
+        auto [ttHit, ttData, ttWriter] = probe(e.key);
+        ttWriter.write(e.key, Value(e.value), bool(e.pvBound & 0x4), Bound(e.pvBound & 0x3),
+                       Depth(e.depth), Move(e.move), Value(e.eval), generation8);
+    }
 }
 
 }  // namespace Stockfish
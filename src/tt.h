@@ -19,16 +19,23 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #include "memory.h"
+#include "numa.h"
 #include "types.h"
 
 namespace Stockfish {
 
 class ThreadPool;
+class TTBuffer;
 struct TTEntry;
 struct Cluster;
 
@@ -54,6 +61,17 @@ struct TTData {
 };
 
 
+// An entry as exchanged between the nodes of a distributed search, with the
+// value already adjusted by value_to_tt().
+struct TTExport {
+    Key      key;
+    uint16_t move;
+    int16_t  value, eval;
+    uint8_t  depth;
+    uint8_t  pvBound;  // pv << 2 | bound
+};
+
+
 // This is used to make racy writes to the global TT.
 struct TTWriter {
    public:
@@ -61,36 +79,153 @@ struct TTWriter {
 
    private:
     friend class TranspositionTable;
-    TTEntry* entry;
-    TTWriter(TTEntry* tte);
+    TTEntry*  entry;
+    TTBuffer* buffer;
+    bool      pathAging;
+    TTWriter(TTEntry* tte, TTBuffer* buf = nullptr, bool aging = false);
 };
 
 
-class TranspositionTable {
-
+// In DeterministicSMP mode the threads do not write to the table while they search.
+// Each thread collects its writes in a TTBuffer, and at the end of every epoch the
+// buffers are applied in thread order (see ThreadPool::end_epoch()), so that what a
+// thread reads from the table only depends on node counts, not on timing. Meanwhile
+// its own latest writes stay visible to the thread through a small direct-mapped cache.
+class TTBuffer {
    public:
-    ~TranspositionTable() { aligned_large_pages_free(table); }
+    // The writes are kept in one list per partition of the table, so that the
+    // partitions can be applied in parallel.
+    explicit TTBuffer(size_t partitions);
+
+    size_t partitions() const { return writes.size(); }
+    void   apply(size_t partition) const;  // Store the writes to one partition
+    void   clear();                        // Forget all writes once they are stored
+
+    // Memory of a buffer once it has held the given number of writes in an epoch
+    static size_t bytes(size_t writeCount) {
+        return sizeof(TTBuffer) + CacheSize * sizeof(Slot) + writeCount * sizeof(Write);
+    }
+
+   private:
+    friend class TranspositionTable;
+    friend struct TTWriter;
+
+    void save(TTEntry* tte,
+              Key      k,
+              Value    v,
+              bool     pv,
+              Bound    b,
+              Depth    d,
+              Move     m,
+              Value    ev,
+              uint8_t  gen,
+              bool     pathAging);
+
+    struct Write {
+        TTEntry* entry;
+        Key      key;
+        Value    value, eval;
+        Depth    depth;
+        Move     move;
+        Bound    bound;
+        bool     pv;
+        uint8_t  generation8;
+        bool     pathAging;
+    };
+
+    // The entry as it is after this thread's writes of the current epoch
+    struct Slot {
+        Key      key;
+        TTEntry* entry;
+        uint64_t epoch;
+        char     copy[16];  // TTEntry is private to tt.cpp
+    };
+
+    static constexpr size_t CacheSize = 4096;
+
+    std::vector<std::vector<Write>> writes;
+    std::vector<Slot>               cache;
+    uint64_t                        epoch = 1;
+};
 
-    void resize(size_t mbSize, ThreadPool& threads);  // Set TT size
-    void clear(ThreadPool& threads);                  // Re-initialize memory, multithreaded
-    int  hashfull()
-      const;  // Approximate what fraction of entries (permille) have been written to during this root search
 
-    void
-    new_search();  // This must be called at the beginning of each root search to track entry aging
+class TranspositionTable {
+
+   public:
+    ~TranspositionTable() { free(); }
+
+    // Set TT size, keeping the entries. When numaSharded is set and the threads are
+    // bound to more than one NUMA node, the table is split into one shard per node.
+    // A hugePageSize of 2MB or 1GB asks for explicit huge pages of that size, which
+    // with hugePagesRequired the table must get, see aligned_huge_pages_alloc().
+    // Returns false if it could not, the table then uses normal pages instead.
+    bool   resize(size_t     mbSize,
+                  ThreadPool& threads,
+                  bool        numaSharded       = false,
+                  size_t      hugePageSize      = 0,
+                  bool        hugePagesRequired = false);
+    size_t size_bytes() const;
+    size_t huge_page_bytes() const;  // How much of the table is backed by huge pages
+    void clear(ThreadPool& threads);  // Re-initialize memory, multithreaded
+    // Approximate what fraction of entries (permille) have been written to during this root
+    // search, or with maxAge during the last maxAge + 1 root searches (plies with path aging)
+    int hashfull(int maxAge = 0) const;
+
+    // This must be called at the beginning of each root search to track entry aging.
+    // With path aging the age of an entry is the distance in plies between the root it
+    // was written from and the current root, instead of the number of searches since,
+    // so that an analysis going back and forth through a game keeps its deep entries.
+    void    new_search(int rootGamePly);
+    void    set_path_aging(bool enabled) { pathAging = enabled; }
+    bool    path_aging() const { return pathAging; }
     uint8_t generation() const;  // The current age, used when writing new data to the TT
     std::tuple<bool, TTData, TTWriter>
-    probe(const Key key) const;  // The main method, whose retvals separate local vs global objects
+    probe(const Key key,  // The main method, whose retvals separate local vs global objects
+          TTBuffer* buffer = nullptr) const;
     TTEntry* first_entry(const Key key)
       const;  // This is the hash function; its only external use is memory prefetching.
 
+    // Snapshot the table to disk and back. Loading requires the same cluster count.
+    bool save(const std::string& filename) const;
+    bool load(const std::string& filename);
+
+    // Distributed search: entries written by search() with a depth of at least
+    // export_depth() are queued by export_entry() until take_exports() collects
+    // them, and import_entries() stores the entries received from other nodes.
+    static constexpr Depth NoExport = MAX_PLY + 1;
+
+    // Read by every searching thread while the UCI thread may change it
+    void  set_export_depth(Depth d) { exportDepth.store(d, std::memory_order_relaxed); }
+    Depth export_depth() const { return exportDepth.load(std::memory_order_relaxed); }
+
+    void                  export_entry(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+    std::vector<TTExport> take_exports();
+    void                  import_entries(const std::vector<TTExport>& entries);
+
    private:
     friend struct TTEntry;
 
-    size_t   clusterCount;
-    Cluster* table = nullptr;
+    void free();
+    void run_on_shards(ThreadPool& threads, const std::function<void(size_t, size_t, size_t)>& f);
+    int  age(const TTEntry& e) const;
+
+    size_t   clusterCount = 0;
+    Cluster* table = nullptr;  // Equal to shards[0]
+
+    // Each shard is a separate allocation holding shardClusterCount consecutive
+    // clusters of the table, first-touched by threads bound to the matching node.
+    std::vector<Cluster*>  shards;
+    std::vector<NumaIndex> shardNumaNodes;
+    size_t                 shardClusterCount = 0;
+    size_t                 hugePageSize      = 0;
+    bool                   hugePagesRequired = false;
 
     uint8_t generation8 = 0;  // Size must be not bigger than TTEntry::genBound8
+    bool    pathAging   = false;
+
+    std::atomic<Depth>    exportDepth{NoExport};
+    std::mutex            exportMutex;
+    std::vector<TTExport> exports;
 };
 
 }  // namespace Stockfish
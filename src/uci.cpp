@@ -19,21 +19,35 @@
 #include "uci.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "benchmark.h"
+#include "book.h"
+#include "distributed.h"
 #include "engine.h"
 #include "movegen.h"
+#include "numa.h"
 #include "position.h"
 #include "score.h"
 #include "search.h"
+#include "timeman.h"
 #include "types.h"
 #include "ucioption.h"
 
@@ -48,36 +62,197 @@ struct overload: Ts... {
 template<typename... Ts>
 overload(Ts...) -> overload<Ts...>;
 
+namespace {
+
+// Writes complete lines to std::cout, each one preceded by the prefix. Callers
+// hold the IO lock, so lines of different server instances never interleave.
+class PrefixedBuffer: public std::streambuf {
+   public:
+    explicit PrefixedBuffer(const std::string& p) :
+        prefix(p) {}
+
+   protected:
+    int overflow(int c) override {
+        if (c == traits_type::eof())
+            return traits_type::not_eof(c);
+
+        line += char(c);
+        if (c == '\n')
+        {
+            std::cout << prefix << line;
+            line.clear();
+        }
+        return c;
+    }
+
+    int sync() override {
+        std::cout.flush();
+        return 0;
+    }
+
+   private:
+    std::string prefix, line;
+};
+
+}
+
+// Writes the lines posted by a single producer from a dedicated thread, in
+// batches with a single flush, so that the producer never waits for the stream
+// or the IO lock. The producer only waits when the ring is full.
+class AsyncWriter {
+   public:
+    using Job = std::function<void(std::ostream&)>;
+
+    explicit AsyncWriter(std::ostream& s) :
+        os(s),
+        thread(&AsyncWriter::loop, this) {}
+
+    ~AsyncWriter() {
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            exit = true;
+        }
+        cv.notify_one();
+        thread.join();
+    }
+
+    void post(Job job) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+
+        while (t - head.load(std::memory_order_acquire) == Capacity)
+            std::this_thread::yield();
+
+        ring[t % Capacity] = std::move(job);
+        tail.store(t + 1);
+
+        if (sleeping)
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            cv.notify_one();
+        }
+    }
+
+    // Waits until all the lines posted so far are written
+    void flush() {
+        std::unique_lock<std::mutex> lk(mutex);
+        drained.wait(lk, [&] { return head.load() == tail.load(); });
+    }
+
+   private:
+    static constexpr size_t Capacity = 1024;
+
+    void loop() {
+        while (true)
+        {
+            size_t       h = head.load(std::memory_order_relaxed);
+            const size_t t = tail.load(std::memory_order_acquire);
+
+            if (h == t)
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                drained.notify_all();
+
+                if (exit)
+                    return;
+
+                sleeping = true;
+                cv.wait(lk, [&] { return exit || tail.load() != head.load(); });
+                sleeping = false;
+                continue;
+            }
+
+            os << IO_LOCK;
+
+            for (; h != t; ++h)
+            {
+                ring[h % Capacity](os);
+                os << '\n';
+                ring[h % Capacity] = nullptr;
+            }
+
+            os << std::flush << IO_UNLOCK;
+            head.store(h, std::memory_order_release);
+        }
+    }
+
+    std::ostream&             os;
+    std::array<Job, Capacity> ring;
+    std::atomic<size_t>       head{0}, tail{0};
+    std::atomic_bool          sleeping{false};
+    bool                      exit = false;
+    std::mutex                mutex;
+    std::condition_variable   cv, drained;
+    std::thread               thread;
+};
+
+// The members are destroyed before the engine, but its search may still write
+// its lines through them, up to the best move.
+UCIEngine::~UCIEngine() {
+    engine.stop();
+    engine.wait_for_search_finished();
+
+    if (writer)
+        writer->flush();
+}
+
+// Writes a line of the search, from the writer thread with AsyncOutput
+void UCIEngine::emit(OutputJob job) {
+
+    if (writer)
+        writer->post(std::move(job));
+    else
+    {
+        out << IO_LOCK;
+        job(out);
+        out << sync_endl;
+    }
+}
+
 void UCIEngine::print_info_string(const std::string& str) {
-    sync_cout_start();
+    out << IO_LOCK;
     for (auto& line : split(str, "\n"))
     {
         if (!is_whitespace(line))
         {
-            std::cout << "info string " << line << '\n';
+            out << "info string " << line << '\n';
         }
     }
-    sync_cout_end();
+    out << IO_UNLOCK;
 }
 
 UCIEngine::UCIEngine(int argc, char** argv) :
     engine(argv[0]),
-    cli(argc, argv) {
+    cli(argc, argv),
+    out(std::cout.rdbuf()) {
+
+    init_listeners();
+}
 
-    engine.get_options().add_info_listener([](const std::optional<std::string>& str) {
+UCIEngine::UCIEngine(UCIEngine& host, const std::string& prefix) :
+    engine(host.cli.argv[0], &host.engine),
+    cli(host.cli),
+    outputBuffer(std::make_unique<PrefixedBuffer>(prefix)),
+    out(outputBuffer.get()) {
+
+    init_listeners();
+}
+
+void UCIEngine::init_listeners() {
+
+    engine.get_options().add_info_listener([this](const std::optional<std::string>& str) {
         if (str.has_value())
             print_info_string(*str);
     });
 
-    engine.set_on_iter([](const auto& i) { on_iter(i); });
-    engine.set_on_update_no_moves([](const auto& i) { on_update_no_moves(i); });
+    engine.set_on_iter([this](const auto& i) { on_iter(i); });
+    engine.set_on_update_no_moves([this](const auto& i) { on_update_no_moves(i); });
     engine.set_on_update_full(
       [this](const auto& i) { on_update_full(i, engine.get_options()["UCI_ShowWDL"]); });
-    engine.set_on_bestmove([](const auto& bm, const auto& p) { on_bestmove(bm, p); });
+    engine.set_on_bestmove([this](const auto& bm, const auto& p) { on_bestmove(bm, p); });
 }
 
 void UCIEngine::loop() {
-    std::string token, cmd;
+    std::string cmd;
 
     for (int i = 1; i < cli.argc; ++i)
         cmd += std::string(cli.argv[i]) + " ";
@@ -87,82 +262,286 @@ void UCIEngine::loop() {
         if (cli.argc == 1
             && !getline(std::cin, cmd))  // Wait for an input or an end-of-file (EOF) indication
             cmd = "quit";
+    } while (execute(cmd) && cli.argc == 1);  // The command-line arguments are one-shot
+}
+
+// Runs a single command, returns false after 'quit'
+bool UCIEngine::execute(const std::string& cmd) {
+    std::istringstream is(cmd);
+    std::string        token;
+
+    is >> std::skipws >> token;
+
+    // Keep the order of the lines of the search and of the reply to this command
+    if (writer)
+        writer->flush();
+
+    if (token == "quit" || token == "stop")
+        engine.stop();
+
+    // The GUI sends 'ponderhit' to tell that the user has played the expected move.
+    // So, 'ponderhit' is sent if pondering was done on the same move that the user
+    // has played. The search should continue, but should also switch from pondering
+    // to the normal search.
+    else if (token == "ponderhit")
+        engine.set_ponderhit(false);
+
+    else if (token == "uci")
+    {
+        out << IO_LOCK << "id name " << engine_info(true) << "\n"
+            << engine.get_options() << sync_endl;
+
+        print_info_string(engine.numa_config_information_as_string());
+        print_info_string(engine.thread_binding_information_as_string());
+        print_info_string(engine.network_memory_information_as_string());
+
+        out << IO_LOCK << "uciok" << sync_endl;
+    }
+
+    else if (token == "setoption")
+        setoption(is);
+    else if (token == "go")
+        go(is);
+    else if (token == "position")
+        position(is);
+    else if (token == "ucinewgame")
+        engine.search_clear();
+    else if (token == "isready")
+        out << IO_LOCK << "readyok" << sync_endl;
+
+    // Add custom non-UCI commands, mainly for debugging purposes.
+    // These commands must not be used during a search!
+    else if (token == "flip")
+        engine.flip();
+    else if (token == "bench")
+        bench(is);
+    else if (token == "analyse")
+        analyse(is);
+    else if (token == "gensfen")
+        gensfen(is);
+    else if (token == "d")
+        out << IO_LOCK << engine.visualize() << sync_endl;
+    else if (token == "eval")
+        engine.trace_eval();
+    else if (token == "compiler")
+        out << IO_LOCK << compiler_info() << sync_endl;
+    else if (token == "export_net" || token == "export_net_image")
+    {
+        std::pair<std::optional<std::string>, std::string> files[2];
+
+        if (is >> std::skipws >> files[0].second)
+            files[0].first = files[0].second;
+
+        if (is >> std::skipws >> files[1].second)
+            files[1].first = files[1].second;
+
+        if (token == "export_net")
+            engine.save_network(files);
+        else
+            engine.save_network_image(files);
+    }
+    else if (token == "server")
+    {
+        server();
+        token = "quit";  // Leaving server mode ends the process
+    }
+    else if (token == "cluster")
+    {
+        int port = 0;
+
+        if (!(is >> port) || port <= 0 || port > 65535)
+            out << IO_LOCK << "Usage: cluster <port>" << sync_endl;
+        else
+        {
+            cluster(port);
+            token = "quit";  // Leaving cluster mode ends the process
+        }
+    }
+    else if (token == "stats")
+        print_info_string(engine.search_statistics_as_string());
+    else if (token == "hashfull")
+        print_info_string(engine.hashfull_statistics_as_string());
+    else if (token == "memory")
+        print_info_string(engine.memory_information_as_string());
+    else if (token == "tune" && is >> std::skipws >> token && token == "threads")
+        tune_threads(is);
+    else if (token == "savehash" || token == "loadhash")
+    {
+        std::string file;
+
+        if (!(is >> std::skipws >> file))
+            out << IO_LOCK << "Usage: " << token << " <file>" << sync_endl;
+        else if (token == "savehash")
+            engine.save_hash(file);
+        else
+            engine.load_hash(file);
+    }
+    else if (token == "makebook")
+    {
+        std::string epd, book;
+
+        if (!(is >> std::skipws >> epd >> book))
+            out << IO_LOCK << "Usage: makebook <epd file> <book file>" << sync_endl;
+        else
+            out << IO_LOCK << Book::build(epd, book) << sync_endl;
+    }
+    else if (token == "tmreplay")
+    {
+        std::string file;
+
+        if (!(is >> std::skipws >> file))
+            out << IO_LOCK << "Usage: tmreplay <file>" << sync_endl;
+        else
+            out << IO_LOCK << TimeManagement::replay(file) << sync_endl;
+    }
+    else if (token == "--help" || token == "help" || token == "--license" || token == "license")
+        out << IO_LOCK
+          << "\nStockfish is a powerful chess engine for playing and analyzing."
+             "\nIt is released as free software licensed under the GNU GPLv3 License."
+             "\nStockfish is normally used with a graphical user interface (GUI) and implements"
+             "\nthe Universal Chess Interface (UCI) protocol to communicate with a GUI, an API, etc."
+             "\nFor any further information, visit https://github.com/official-stockfish/Stockfish#readme"
+             "\nor read the corresponding README.md and Copying.txt files distributed along with this program.\n"
+          << sync_endl;
+    else if (!token.empty() && token[0] != '#')
+        out << IO_LOCK << "Unknown command: '" << cmd << "'. Type help for more information."
+            << sync_endl;
+
+    return token != "quit";
+}
+
+// Hosts any number of independent engines in this process. They share the networks,
+// the NUMA configuration and the tablebases of this engine, but have their own
+// options, threads and transposition table. Every input line is either 'new', which
+// creates an instance and answers 'instance <id>', or '<id> <command>', where
+// '<id> quit' destroys the instance. All output of an instance is prefixed by its id.
+void UCIEngine::server() {
+    if (outputBuffer)
+    {
+        out << IO_LOCK << "Already in server mode" << sync_endl;
+        return;
+    }
+
+    std::map<int, std::unique_ptr<UCIEngine>> instances;
+    std::string                               cmd, token;
+    int                                       nextId = 1;
 
+    while (getline(std::cin, cmd))
+    {
         std::istringstream is(cmd);
 
-        token.clear();  // Avoid a stale if getline() returns nothing or a blank line
+        token.clear();
         is >> std::skipws >> token;
 
-        if (token == "quit" || token == "stop")
-            engine.stop();
+        if (token == "quit")
+            break;
 
-        // The GUI sends 'ponderhit' to tell that the user has played the expected move.
-        // So, 'ponderhit' is sent if pondering was done on the same move that the user
-        // has played. The search should continue, but should also switch from pondering
-        // to the normal search.
-        else if (token == "ponderhit")
-            engine.set_ponderhit(false);
+        if (token == "new")
+        {
+            const int id  = nextId++;
+            instances[id] = std::make_unique<UCIEngine>(*this, std::to_string(id) + " ");
+            out << IO_LOCK << "instance " << id << sync_endl;
+            continue;
+        }
 
-        else if (token == "uci")
+        if (token.empty() || token[0] == '#')
+            continue;
+
+        auto it = instances.end();
+        if (token.size() < 9
+            && std::all_of(token.begin(), token.end(),
+                           [](unsigned char c) { return std::isdigit(c); }))
+            it = instances.find(std::stoi(token));
+
+        if (it == instances.end())
         {
-            sync_cout << "id name " << engine_info(true) << "\n"
-                      << engine.get_options() << sync_endl;
+            out << IO_LOCK << "Unknown instance: '" << token << "'" << sync_endl;
+            continue;
+        }
 
-            print_info_string(engine.numa_config_information_as_string());
-            print_info_string(engine.thread_binding_information_as_string());
+        std::string rest;
+        getline(is >> std::ws, rest);
 
-            sync_cout << "uciok" << sync_endl;
+        bool alive;
+        {
+            // Messages printed by lower layers, e.g. perft divide or hash and net
+            // loading, are tagged with the id like the rest of the output
+            SyncCoutRedirect redirect(it->second->out);
+            alive = it->second->execute(rest);
         }
 
-        else if (token == "setoption")
-            setoption(is);
-        else if (token == "go")
-            go(is);
-        else if (token == "position")
-            position(is);
-        else if (token == "ucinewgame")
-            engine.search_clear();
-        else if (token == "isready")
-            sync_cout << "readyok" << sync_endl;
-
-        // Add custom non-UCI commands, mainly for debugging purposes.
-        // These commands must not be used during a search!
-        else if (token == "flip")
-            engine.flip();
-        else if (token == "bench")
-            bench(is);
-        else if (token == "d")
-            sync_cout << engine.visualize() << sync_endl;
-        else if (token == "eval")
-            engine.trace_eval();
-        else if (token == "compiler")
-            sync_cout << compiler_info() << sync_endl;
-        else if (token == "export_net")
+        if (!alive)
+            instances.erase(it);  // Engine destructor waits for a running search
+    }
+
+    for (auto& [id, instance] : instances)
+        instance->engine.stop();
+}
+
+// Serves as a node of the distributed search of the masters connecting to port
+// on the ClusterBind address, one after the other. A session carries the commands
+// a master sends, i.e. position, go, stop and ucinewgame, plus "tt <hex>" lines
+// with the TT entries of the other nodes, and ends with the master sending 'quit'
+// or closing the connection. Anyone who can connect may send them, so any other
+// command, e.g. one writing files, is ignored.
+void UCIEngine::cluster(int port) {
+    if (!Distributed::Supported)
+    {
+        out << IO_LOCK << "Distributed search is not supported on this platform" << sync_endl;
+        return;
+    }
+
+    const std::string     address = engine.get_options()["ClusterBind"];
+    Distributed::Listener listener(address, port);
+
+    if (!listener.is_open())
+    {
+        out << IO_LOCK << "Cannot listen on " << address << " port " << port << sync_endl;
+        return;
+    }
+
+    out << IO_LOCK << "Waiting for masters on " << address << " port " << port << sync_endl;
+
+    while (auto connection = listener.accept())
+    {
+        Distributed::OutputBuffer buffer(*connection);
+        std::streambuf*           previous = out.rdbuf(&buffer);
+        std::string               line;
+
+        engine.set_tt_export_depth(int(engine.get_options()["ClusterTTDepth"]));
+
         {
-            std::pair<std::optional<std::string>, std::string> files[2];
+            Distributed::Exchange exchange([this]() { return engine.take_tt_exports(); },
+                                           [&](const std::string& s) { connection->write(s); });
 
-            if (is >> std::skipws >> files[0].second)
-                files[0].first = files[0].second;
+            while (connection->read_line(line))
+            {
+                std::istringstream is(line);
+                std::string        token;
+                is >> token;
 
-            if (is >> std::skipws >> files[1].second)
-                files[1].first = files[1].second;
+                if (token == "tt")
+                    engine.import_tt_entries(
+                      Distributed::decode_entries(std::string_view(line).substr(3)));
 
-            engine.save_network(files);
+                else if (token == "quit")
+                    break;
+
+                else if (token == "position" || token == "go" || token == "stop"
+                         || token == "ucinewgame")
+                    execute(line);
+
+                else
+                    sync_cout << "info string Ignored from master: " << line << sync_endl;
+            }
+
+            engine.stop();
+            engine.wait_for_search_finished();
         }
-        else if (token == "--help" || token == "help" || token == "--license" || token == "license")
-            sync_cout
-              << "\nStockfish is a powerful chess engine for playing and analyzing."
-                 "\nIt is released as free software licensed under the GNU GPLv3 License."
-                 "\nStockfish is normally used with a graphical user interface (GUI) and implements"
-                 "\nthe Universal Chess Interface (UCI) protocol to communicate with a GUI, an API, etc."
-                 "\nFor any further information, visit https://github.com/official-stockfish/Stockfish#readme"
-                 "\nor read the corresponding README.md and Copying.txt files distributed along with this program.\n"
-              << sync_endl;
-        else if (!token.empty() && token[0] != '#')
-            sync_cout << "Unknown command: '" << cmd << "'. Type help for more information."
-                      << sync_endl;
-
-    } while (token != "quit" && cli.argc == 1);  // The command-line arguments are one-shot
+
+        engine.set_tt_export_depth(TranspositionTable::NoExport);
+        out.rdbuf(previous);
+    }
 }
 
 Search::LimitsType UCIEngine::parse_limits(std::istream& is) {
@@ -196,6 +575,10 @@ Search::LimitsType UCIEngine::parse_limits(std::istream& is) {
             is >> limits.mate;
         else if (token == "perft")
             is >> limits.perft;
+        else if (token == "threads")  // Only used by perft
+            is >> limits.perftThreads;
+        else if (token == "hash")  // Only used by perft, in MB
+            is >> limits.perftHash;
         else if (token == "infinite")
             limits.infinite = 1;
         else if (token == "ponder")
@@ -208,6 +591,12 @@ void UCIEngine::go(std::istringstream& is) {
 
     Search::LimitsType limits = parse_limits(is);
 
+    if (bool(engine.get_options()["AsyncOutput"]) != bool(writer))
+    {
+        engine.wait_for_search_finished();
+        writer = writer ? nullptr : std::make_unique<AsyncWriter>(out);
+    }
+
     if (limits.perft)
         perft(limits);
     else
@@ -220,6 +609,25 @@ void UCIEngine::bench(std::istream& args) {
     uint64_t    nodesSearched = 0;
     const auto& options       = engine.get_options();
 
+    const auto argsStart = args.tellg();
+    if (args >> token && token == "json")
+    {
+        bench_json(args);
+        return;
+    }
+    if (token == "see")
+    {
+        bench_see(args);
+        return;
+    }
+    if (token == "nnue")
+    {
+        bench_nnue(args);
+        return;
+    }
+    args.clear();
+    args.seekg(argsStart);
+
     engine.set_on_update_full([&](const auto& i) {
         nodesSearched = i.nodes;
         on_update_full(i, options["UCI_ShowWDL"]);
@@ -274,15 +682,409 @@ void UCIEngine::bench(std::istream& args) {
 
     dbg_print();
 
-    std::cerr << "\n==========================="    //
-              << "\nTotal time (ms) : " << elapsed  //
-              << "\nNodes searched  : " << nodes    //
-              << "\nNodes/second    : " << 1000 * nodes / elapsed << std::endl;
+    std::cerr << "\n==========================="                   //
+              << "\nTotal time (ms) : " << elapsed                 //
+              << "\nNodes searched  : " << nodes                   //
+              << "\nNodes/second    : " << 1000 * nodes / elapsed  //
+              << engine.accumulator_statistics_as_string()       //
+              << engine.prefetch_statistics_as_string()            //
+              << engine.eval_cache_statistics_as_string()          //
+              << engine.tablebase_statistics_as_string()           //
+              << engine.start_latency_statistics_as_string()       //
+              << engine.response_statistics_as_string()            //
+              << engine.history_statistics_as_string()             //
+              << engine.feature_weights_statistics_as_string() << std::endl;
 
     // reset callback, to not capture a dangling reference to nodesSearched
     engine.set_on_update_full([&](const auto& i) { on_update_full(i, options["UCI_ShowWDL"]); });
 }
 
+namespace {
+
+double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n == 0 ? 0 : n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+double stddev(const std::vector<double>& v) {
+    if (v.size() < 2)
+        return 0;
+
+    double mean = 0, sq = 0;
+    for (double x : v)
+        mean += x / v.size();
+    for (double x : v)
+        sq += (x - mean) * (x - mean);
+    return std::sqrt(sq / (v.size() - 1));
+}
+
+}
+
+// Machine-readable variant of bench: "bench json [runs N] <bench arguments>".
+// The whole benchmark is repeated N times and a single JSON document with
+// per-position statistics of every run, plus the median and standard deviation
+// of the totals over the runs, is written to stdout as a single line. Search
+// output is suppressed while it runs, so the document is the last line printed.
+// Only search limits are supported (no perft or eval).
+void UCIEngine::bench_json(std::istream& args) {
+    std::string token;
+    size_t      runs = 1;
+
+    const auto argsStart = args.tellg();
+    if (args >> token && token == "runs")
+        args >> runs;
+    else
+    {
+        args.clear();
+        args.seekg(argsStart);
+    }
+
+    const std::vector<std::string> list = Benchmark::setup_bench(engine.fen(), args);
+
+    Engine::InfoFull lastInfo{};
+
+    engine.get_options().add_info_listener([](const std::optional<std::string>&) {});
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_update_full([&](const auto& i) { lastInfo = i; });
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+
+    std::vector<double> runNodes, runTimes, runNps;
+    std::stringstream   json;
+
+    json << "{\"runs\":[";
+
+    for (size_t run = 0; run < runs; ++run)
+    {
+        uint64_t  nodes = 0;
+        TimePoint total = 0;
+        bool      first = true;
+
+        json << (run ? "," : "") << "{\"positions\":[";
+
+        for (const auto& cmd : list)
+        {
+            std::istringstream is(cmd);
+            is >> std::skipws >> token;
+
+            if (token == "go")
+            {
+                Search::LimitsType limits = parse_limits(is);
+
+                if (limits.perft)
+                {
+                    init_listeners();
+                    out << IO_LOCK << "bench json does not support perft" << sync_endl;
+                    return;
+                }
+
+                const std::string fen = engine.fen();
+                uint64_t          updates[2], refreshes[2];
+
+                for (bool big : {true, false})
+                {
+                    updates[big]   = engine.accumulator_updates(big);
+                    refreshes[big] = engine.accumulator_refreshes(big);
+                }
+
+                lastInfo              = {};
+                const TimePoint start = now();
+
+                engine.go(limits);
+                engine.wait_for_search_finished();
+
+                const TimePoint elapsed = now() - start + 1;
+
+                nodes += lastInfo.nodes;
+                total += elapsed;
+
+                json << (first ? "" : ",") << "{\"fen\":\"" << fen << "\""
+                     << ",\"nodes\":" << lastInfo.nodes << ",\"time\":" << elapsed
+                     << ",\"nps\":" << 1000 * lastInfo.nodes / elapsed
+                     << ",\"depth\":" << lastInfo.depth << ",\"seldepth\":" << lastInfo.selDepth
+                     << ",\"hashfull\":" << lastInfo.hashfull << ",\"tbhits\":" << lastInfo.tbHits;
+
+                for (bool big : {true, false})
+                    json << ",\"" << (big ? "big" : "small")
+                         << "\":{\"incremental\":" << engine.accumulator_updates(big) - updates[big]
+                         << ",\"refreshes\":" << engine.accumulator_refreshes(big) - refreshes[big]
+                         << "}";
+
+                json << "}";
+                first = false;
+            }
+            else if (token == "setoption")
+                setoption(is);
+            else if (token == "position")
+                position(is);
+            else if (token == "ucinewgame")
+                engine.search_clear();
+        }
+
+        json << "],\"nodes\":" << nodes << ",\"time\":" << total
+             << ",\"nps\":" << 1000 * nodes / std::max<TimePoint>(total, 1) << "}";
+
+        runNodes.push_back(double(nodes));
+        runTimes.push_back(double(total));
+        runNps.push_back(1000.0 * nodes / std::max<TimePoint>(total, 1));
+    }
+
+    json << "],\"summary\":{";
+    json << "\"nodes_median\":" << median(runNodes) << ",\"nodes_stddev\":" << stddev(runNodes)
+         << ",\"time_median\":" << median(runTimes) << ",\"time_stddev\":" << stddev(runTimes)
+         << ",\"nps_median\":" << median(runNps) << ",\"nps_stddev\":" << stddev(runNps) << "}}";
+
+    init_listeners();
+
+    out << IO_LOCK << json.str() << sync_endl;
+}
+
+// SEE microbenchmark: "bench see [rounds N] <bench arguments>". Every legal
+// move of the bench positions is tested against a few thresholds, N times
+// with and N times without the results kept in StateInfo, cleared for each
+// round. The number of passing tests only changes with the SEE itself.
+void UCIEngine::bench_see(std::istream& args) {
+    size_t rounds = 1000;
+
+    const std::vector<std::string> fens         = bench_positions(args, rounds);
+    constexpr int                  Thresholds[] = {-300, -100, 0, 100, 300};
+
+    const bool chess960 = engine.get_options()["UCI_Chess960"];
+    uint64_t   moves = 0, passes[2] = {};
+    double     ns[2] = {};
+
+    for (const auto& fen : fens)
+    {
+        StateInfo st;
+        Position  pos;
+        pos.set(fen, chess960, &st);
+
+        const MoveList<LEGAL> legal(pos);
+        moves += legal.size();
+
+        for (bool cached : {false, true})
+            for (size_t r = 0; r < rounds; ++r)
+            {
+                pos.set(fen, chess960, &st);
+
+                const auto start = std::chrono::steady_clock::now();
+
+                for (const auto& m : legal)
+                    for (int threshold : Thresholds)
+                        passes[cached] += cached ? pos.see_ge(m, threshold)
+                                                 : pos.see_ge_uncached(m, threshold);
+
+                ns[cached] += std::chrono::duration<double, std::nano>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+            }
+    }
+
+    const double calls = double(std::max<uint64_t>(moves * std::size(Thresholds) * rounds, 1));
+
+    out << IO_LOCK << "SEE positions   : " << fens.size() << " positions, " << moves
+        << " moves, " << std::size(Thresholds) << " thresholds, " << rounds << " rounds"
+        << std::fixed << std::setprecision(1)                                  //
+        << "\nSEE uncached    : " << ns[false] / calls << " ns per call"         //
+        << "\nSEE cached      : " << ns[true] / calls << " ns per call"          //
+        << "\nSEE passing     : " << passes[false] << " of " << uint64_t(calls) << " calls";
+
+    if (passes[true] != passes[false])
+        out << ", " << passes[true] << " with the cache";
+
+    out << sync_endl;
+}
+
+// NNUE microbenchmark: "bench nnue [rounds N] <bench arguments>". The positions
+// after each legal move of the bench positions go through every stage of the
+// evaluation by both networks, one stage at a time, N times.
+void UCIEngine::bench_nnue(std::istream& args) {
+    size_t rounds = 100;
+
+    const std::vector<std::string> fens   = bench_positions(args, rounds);
+    const std::string              report = engine.nnue_benchmark_as_string(fens, rounds);
+
+    out << IO_LOCK << report << sync_endl;
+}
+
+// Reads "[rounds N] <bench arguments>" of the microbenchmarks and returns the
+// FENs of the bench positions, with the options of the bench applied
+std::vector<std::string> UCIEngine::bench_positions(std::istream& args, size_t& rounds) {
+    std::string token;
+
+    const auto argsStart = args.tellg();
+    if (args >> token && token == "rounds")
+        args >> rounds;
+    else
+    {
+        args.clear();
+        args.seekg(argsStart);
+    }
+
+    const std::vector<std::string> list = Benchmark::setup_bench(engine.fen(), args);
+    std::vector<std::string>       fens;
+
+    for (const auto& cmd : list)
+    {
+        std::istringstream is(cmd);
+        is >> std::skipws >> token;
+
+        if (token == "position")
+        {
+            position(is);
+            fens.push_back(engine.fen());
+        }
+        else if (token == "setoption")
+            setoption(is);
+    }
+
+    return fens;
+}
+
+// Thread tuning: "tune threads [apply] [movetime ms] [positions N]". Searches the
+// first N positions of the bench (4 by default) for the given time (1000 ms by
+// default) with several thread counts: all the hardware threads, half of them as
+// the physical cores of a machine with SMT, a quarter of them and the current
+// count. With more than one NUMA node, each count is tried with the threads bound
+// to the nodes and unbound. The best configuration is reported, and kept with
+// apply, which also clears the hash and the histories as for a new game. The book
+// is not used while tuning. The TT hit rate is reported too when compiled with
+// stats=yes.
+void UCIEngine::tune_threads(std::istream& args) {
+    std::string token;
+    bool        apply    = false;
+    TimePoint   movetime = 1000;
+    size_t      count    = 4;
+
+    while (args >> token)
+        if (token == "apply")
+            apply = true;
+        else if (token == "movetime")
+            args >> movetime;
+        else if (token == "positions")
+            args >> count;
+
+    auto&             options        = engine.get_options();
+    const std::string initialPolicy  = options["NumaPolicy"];
+    const size_t      initialThreads = size_t(options["Threads"]);
+    const std::string initialBook    = options["BookFile"];
+
+    const auto [initialFen, initialMoves] = engine.get_position();
+
+    const NumaConfig system = NumaConfig::from_system();
+    const size_t     cpus   = std::min<size_t>(system.num_cpus(), 1024);
+
+    std::vector<size_t> threadCounts = {cpus, cpus / 2, cpus / 4, initialThreads};
+    threadCounts.erase(std::remove(threadCounts.begin(), threadCounts.end(), size_t(0)),
+                       threadCounts.end());
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+    std::vector<std::string> policies = {initialPolicy};
+    if (system.num_numa_nodes() > 1)
+        policies = {"system", "none"};
+
+    // The positions of the default bench
+    std::istringstream       benchArgs("16 1 1 default");
+    std::vector<std::string> fens;
+
+    for (const auto& cmd : Benchmark::setup_bench(engine.fen(), benchArgs))
+        if (cmd.find("position fen ") == 0 && fens.size() < count)
+            fens.push_back(cmd.substr(13));
+
+    Engine::InfoFull lastInfo{};
+
+    options.add_info_listener([](const std::optional<std::string>&) {});
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_update_full([&](const auto& i) { lastInfo = i; });
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+
+    auto set = [&](const std::string& name, const std::string& value) {
+        std::istringstream is("name " + name + " value " + value);
+        setoption(is);
+    };
+
+    // A book move would be played without searching
+    if (!initialBook.empty())
+        set("BookFile", "");
+
+    struct Result {
+        std::string policy;
+        size_t      threads;
+        uint64_t    nps;
+    };
+
+    std::vector<Result> results;
+    std::stringstream   report;
+
+    for (const auto& policy : policies)
+        for (size_t threadCount : threadCounts)
+        {
+            set("NumaPolicy", policy);
+            set("Threads", std::to_string(threadCount));
+            engine.search_clear();
+
+            uint64_t  nodes    = 0;
+            TimePoint total    = 0;
+            int       hashfull = 0;
+
+            for (const auto& fen : fens)
+            {
+                engine.set_position(fen, {});
+
+                Search::LimitsType limits;
+                limits.movetime  = movetime;
+                limits.startTime = now();
+                lastInfo         = {};
+                engine.go(limits);
+                engine.wait_for_search_finished();
+
+                nodes += lastInfo.nodes;
+                total += now() - limits.startTime;
+                hashfull = std::max(hashfull, lastInfo.hashfull);
+            }
+
+            const auto stats = engine.search_stats();
+            const auto nps   = 1000 * nodes / std::max<TimePoint>(total, 1);
+
+            results.push_back({policy, threadCount, nps});
+            report << "NumaPolicy " << policy << " Threads " << threadCount << ": " << nps
+                   << " nps, " << nps / threadCount << " nps/thread, hashfull " << hashfull;
+
+            if (Search::SearchStats::Enabled)
+                report << ", TT hits " << std::fixed << std::setprecision(1)
+                       << 100.0 * stats[Search::SearchStats::TTHits]
+                            / std::max<uint64_t>(stats[Search::SearchStats::TTProbes], 1)
+                       << "%";
+
+            report << "\n";
+        }
+
+    // More threads search more redundant nodes, so they must bring 10% more nps
+    std::stable_sort(results.begin(), results.end(),
+                     [](const Result& a, const Result& b) { return a.threads < b.threads; });
+
+    Result best = results[0];
+    for (const Result& r : results)
+        if ((r.threads == best.threads && r.nps > best.nps) || r.nps * 10 > best.nps * 11)
+            best = r;
+
+    report << (apply ? "Applied" : "Suggested") << ": NumaPolicy " << best.policy << " Threads "
+           << best.threads;
+
+    set("NumaPolicy", apply ? best.policy : initialPolicy);
+    set("Threads", std::to_string(apply ? best.threads : initialThreads));
+    if (!initialBook.empty())
+        set("BookFile", initialBook);
+    if (apply)
+        engine.search_clear();
+    engine.set_position(initialFen, initialMoves);
+
+    init_listeners();
+    print_info_string(report.str());
+}
 
 void UCIEngine::setoption(std::istringstream& is) {
     engine.wait_for_search_finished();
@@ -290,11 +1092,435 @@ void UCIEngine::setoption(std::istringstream& is) {
 }
 
 std::uint64_t UCIEngine::perft(const Search::LimitsType& limits) {
-    auto nodes = engine.perft(engine.fen(), limits.perft, engine.get_options()["UCI_Chess960"]);
-    sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+    auto nodes = engine.perft(engine.fen(), limits.perft, engine.get_options()["UCI_Chess960"],
+                              limits.perftThreads, limits.perftHash);
+    out << IO_LOCK << "\nNodes searched: " << nodes << "\n" << sync_endl;
     return nodes;
 }
 
+// Searches each position of a FEN or EPD file (one per line, EPD operations are
+// ignored) to the given depth or node count. The positions are spread over as
+// many single threaded engines as our Threads, each with its own histories and
+// a share of our Hash, and one CSV line, or JSON object with 'json', is written
+// per position as soon as its search ends. The index field gives the line of
+// the position in the file, counting from 0.
+void UCIEngine::analyse(std::istream& args) {
+    std::string        file, token;
+    Search::LimitsType limits;
+    bool               json = false;
+
+    args >> file;
+
+    while (args >> token)
+        if (token == "depth")
+            args >> limits.depth;
+        else if (token == "nodes")
+            args >> limits.nodes;
+        else if (token == "json")
+            json = true;
+
+    std::ifstream input(file);
+
+    if (file.empty() || (!limits.depth && !limits.nodes))
+    {
+        out << IO_LOCK << "Usage: analyse <file> depth <n>|nodes <n> [json]" << sync_endl;
+        return;
+    }
+
+    if (!input)
+    {
+        out << IO_LOCK << "Unable to open file " << file << sync_endl;
+        return;
+    }
+
+    struct Slot {
+        std::unique_ptr<Engine> engine;
+        size_t                  index;
+        std::string             fen, score, pv, bestmove;
+        int                     depth;
+        size_t                  nodes;
+    };
+
+    const auto&       hostOptions = engine.get_options();
+    const int         count       = hostOptions["Threads"];
+    const std::string hashMB      = std::to_string(std::max(1, int(hostOptions["Hash"]) / count));
+
+    std::vector<Slot>       slots(count);
+    std::vector<size_t>     finished;
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        Slot& slot  = slots[i];
+        slot.engine = std::make_unique<Engine>(cli.argv[0], &engine);
+
+        auto& options = slot.engine->get_options();
+        options.add_info_listener([](const std::optional<std::string>&) {});
+        options["Hash"] = hashMB;
+        for (auto name : {"UCI_Chess960", "Syzygy50MoveRule"})
+            options[name] = std::string(hostOptions[name] ? "true" : "false");
+        for (auto name : {"SyzygyProbeDepth", "SyzygyProbeLimit"})
+            options[name] = std::to_string(int(hostOptions[name]));
+
+        slot.engine->verify_networks();  // Report them now, not among the results
+        slot.engine->set_on_iter([](const auto&) {});
+        slot.engine->set_on_update_no_moves([&slot](const auto& info) {
+            slot.depth = info.depth;
+            slot.score = format_score(info.score);
+        });
+        slot.engine->set_on_update_full([&slot](const auto& info) {
+            if (info.multiPV != 1)
+                return;
+            slot.depth = info.depth;
+            slot.score = format_score(info.score);
+            slot.nodes = info.nodes;
+            slot.pv    = info.pv;
+        });
+        slot.engine->set_on_bestmove([&, i](std::string_view bestmove, std::string_view) {
+            slots[i].bestmove = bestmove;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(i);
+            cv.notify_one();
+        });
+    }
+
+    size_t lineCount = 0, running = 0;
+
+    // Starts the search of the next position of the file, if any
+    auto start_next = [&](Slot& slot) {
+        std::string line;
+
+        while (std::getline(input, line))
+        {
+            std::istringstream is(line.substr(0, line.find(';')));
+            std::string        fen;
+            int                fields = 0;
+
+            // An EPD has 4 fields, followed by operations rather than move counters
+            while (is >> token
+                   && (fields < 4 || std::all_of(token.begin(), token.end(), ::isdigit)))
+                fen += (fields++ ? " " : "") + token;
+
+            slot.index = lineCount++;
+
+            if (fields < 4)
+                continue;
+
+            slot.fen   = fen;
+            slot.score = slot.pv = "";
+            slot.depth           = 0;
+            slot.nodes           = 0;
+
+            Search::LimitsType l = limits;
+            l.startTime          = now();
+
+            slot.engine->wait_for_search_finished();
+            slot.engine->set_position(fen, {});
+            slot.engine->go(l);
+            running++;
+            return;
+        }
+    };
+
+    if (!json)
+        out << IO_LOCK << "index,fen,depth,score,nodes,bestmove,pv" << sync_endl;
+
+    for (Slot& slot : slots)
+        start_next(slot);
+
+    while (running)
+    {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return !finished.empty(); });
+            i = finished.back();
+            finished.pop_back();
+        }
+
+        Slot& slot = slots[i];
+        running--;
+
+        if (json)
+            out << IO_LOCK << "{\"index\":" << slot.index << ",\"fen\":\"" << slot.fen
+                << "\",\"depth\":" << slot.depth << ",\"score\":\"" << slot.score
+                << "\",\"nodes\":" << slot.nodes << ",\"bestmove\":\"" << slot.bestmove
+                << "\",\"pv\":\"" << slot.pv << "\"}" << sync_endl;
+        else
+            out << IO_LOCK << slot.index << "," << slot.fen << "," << slot.depth << ","
+                << slot.score << "," << slot.nodes << "," << slot.bestmove << "," << slot.pv
+                << sync_endl;
+
+        start_next(slot);
+    }
+}
+
+namespace {
+
+// A position of the training data written by gensfen, 32 bytes in the byte order
+// of the machine. The pieces of the occupied squares, from a1 to h8, are packed
+// two per byte, low nibble first, as Piece values. The score, in centipawns as
+// reported by UCI (+-32000 minus the plies for a mate, +-20000 minus the plies
+// for a tablebase win), and the result are for the side to move. The move is the
+// best move found, as Move::raw().
+struct PackedSfen {
+    uint64_t occupied;
+    uint8_t  pieces[16];
+    int16_t  score;
+    uint16_t move;
+    uint8_t  flags;  // Side to move in bit 0, castling rights in bits 1 to 4
+    uint8_t  epSquare;
+    uint8_t  rule50;
+    int8_t   result;  // 1 win, 0 draw, -1 loss
+};
+
+static_assert(sizeof(PackedSfen) == 32);
+
+PackedSfen pack_sfen(const Position& pos, const Score& score, Move move) {
+    PackedSfen sfen{};
+
+    Bitboard b    = pos.pieces();
+    sfen.occupied = b;
+
+    for (int i = 0; b; ++i)
+        sfen.pieces[i / 2] |= uint8_t(pos.piece_on(pop_lsb(b)) << (4 * (i & 1)));
+
+    sfen.score = int16_t(score.visit(overload{
+      [](Score::Mate mate) { return mate.plies > 0 ? 32000 - mate.plies : -32000 - mate.plies; },
+      [](Score::Tablebase tb) { return tb.win ? 20000 - tb.plies : -20000 - tb.plies; },
+      [](Score::InternalUnits units) { return std::clamp(units.value, -19000, 19000); }}));
+
+    sfen.move  = move.raw();
+    sfen.flags = uint8_t(pos.side_to_move());
+    for (CastlingRights cr : {WHITE_OO, WHITE_OOO, BLACK_OO, BLACK_OOO})
+        sfen.flags |= uint8_t(pos.can_castle(cr)) << (1 + lsb(cr));
+
+    sfen.epSquare = uint8_t(pos.ep_square());
+    sfen.rule50   = uint8_t(std::min(pos.rule50_count(), 255));
+    return sfen;
+}
+
+}
+
+// Generates training data by self-play: "gensfen <file> nodes <n> games <n>
+// [randommoves <n>] [maxply <n>] [seed <n>]". As in analyse, the games are spread
+// over as many single threaded engines as our Threads, each with its own
+// histories and a share of our Hash, cleared for every game. A game starts with
+// randommoves (8 by default) random legal moves from the start position, then
+// each move is searched to the given number of nodes. It ends by mate, stalemate,
+// a draw by the rules or insufficient material, a mate score, or a draw after
+// maxply plies (400 by default). The positions after the random moves are then
+// appended to the file with the result of the game, as PackedSfen records.
+void UCIEngine::gensfen(std::istream& args) {
+    std::string file, token;
+    uint64_t    nodes = 0, games = 0, seed = 1;
+    int         randomMoves = 8, maxPly = 400;
+
+    args >> file;
+
+    while (args >> token)
+        if (token == "nodes")
+            args >> nodes;
+        else if (token == "games")
+            args >> games;
+        else if (token == "randommoves")
+            args >> randomMoves;
+        else if (token == "maxply")
+            args >> maxPly;
+        else if (token == "seed")
+            args >> seed;
+
+    if (file.empty() || !nodes || !games)
+    {
+        out << IO_LOCK
+            << "Usage: gensfen <file> nodes <n> games <n> [randommoves <n>] [maxply <n>] [seed <n>]"
+            << sync_endl;
+        return;
+    }
+
+    std::ofstream output(file, std::ios::binary | std::ios::app);
+
+    if (!output)
+    {
+        out << IO_LOCK << "Unable to open file " << file << sync_endl;
+        return;
+    }
+
+    struct Slot {
+        std::unique_ptr<Engine>  engine;
+        Position                 pos;
+        StateListPtr             states;
+        std::vector<std::string> moves;
+        std::vector<PackedSfen>  sfens;
+        std::optional<Score>     score;
+        std::string              bestmove;
+    };
+
+    const auto&       hostOptions = engine.get_options();
+    const int         count       = hostOptions["Threads"];
+    const std::string hashMB      = std::to_string(std::max(1, int(hostOptions["Hash"]) / count));
+
+    std::vector<Slot>       slots(count);
+    std::vector<size_t>     finished;
+    std::mutex              mutex;
+    std::condition_variable cv;
+    PRNG                    rng(seed ? seed : 1);
+
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        Slot& slot  = slots[i];
+        slot.engine = std::make_unique<Engine>(cli.argv[0], &engine);
+
+        auto& options = slot.engine->get_options();
+        options.add_info_listener([](const std::optional<std::string>&) {});
+        options["Hash"] = hashMB;
+
+        slot.engine->verify_networks();
+        slot.engine->set_on_iter([](const auto&) {});
+        slot.engine->set_on_update_no_moves([](const auto&) {});
+        slot.engine->set_on_update_full([&slot](const auto& info) {
+            if (info.multiPV == 1)
+                slot.score = info.score;
+        });
+        slot.engine->set_on_bestmove([&, i](std::string_view bestmove, std::string_view) {
+            slots[i].bestmove = bestmove;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(i);
+            cv.notify_one();
+        });
+    }
+
+    uint64_t        started = 0, played = 0, written = 0;
+    size_t          running = 0;
+    const TimePoint start   = now();
+
+    auto do_move = [](Slot& slot, Move m) {
+        slot.moves.push_back(UCIEngine::move(m, false));
+        slot.pos.do_move(m, slot.states->emplace_back());
+    };
+
+    // The result of the game for the side to move, if it is over
+    auto game_result = [&](Slot& slot) -> std::optional<int> {
+        if (!MoveList<LEGAL>(slot.pos).size())
+            return slot.pos.checkers() ? -1 : 0;
+
+        if (slot.pos.is_draw(0) || slot.pos.count<ALL_PIECES>() == 2
+            || int(slot.moves.size()) >= maxPly)
+            return 0;
+
+        return std::nullopt;
+    };
+
+    auto start_game = [&](Slot& slot) {
+        do
+        {
+            slot.states = std::make_unique<StateList>(1);
+            slot.pos.set(StartFEN, false, &slot.states->back());
+            slot.moves.clear();
+            slot.sfens.clear();
+
+            for (int i = 0; i < randomMoves && !game_result(slot); ++i)
+            {
+                MoveList<LEGAL> legal(slot.pos);
+                do_move(slot, *(legal.begin() + rng.rand<uint64_t>() % legal.size()));
+            }
+        } while (game_result(slot));
+
+        slot.engine->search_clear();
+        started++;
+    };
+
+    // Searches the next move of the game
+    auto search = [&](Slot& slot) {
+        Search::LimitsType limits;
+        limits.nodes     = nodes;
+        limits.startTime = now();
+
+        slot.score.reset();
+        slot.engine->set_position(StartFEN, slot.moves);
+        slot.engine->go(limits);
+        running++;
+    };
+
+    // Writes the positions of a game with its result, seen from the side to move
+    // of the final position, and starts the next game if any
+    auto end_game = [&](Slot& slot, int result) {
+        const Color us = slot.pos.side_to_move();
+
+        for (PackedSfen& sfen : slot.sfens)
+            sfen.result = int8_t(Color(sfen.flags & 1) == us ? result : -result);
+
+        output.write(reinterpret_cast<const char*>(slot.sfens.data()),
+                     std::streamsize(slot.sfens.size() * sizeof(PackedSfen)));
+
+        written += slot.sfens.size();
+
+        if (++played % 100 == 0)
+            print_info_string("gensfen games " + std::to_string(played) + " positions "
+                              + std::to_string(written) + " positions/second "
+                              + std::to_string(1000 * written / (now() - start + 1)));
+
+        if (started < games)
+        {
+            start_game(slot);
+            search(slot);
+        }
+    };
+
+    for (Slot& slot : slots)
+        if (started < games)
+        {
+            start_game(slot);
+            search(slot);
+        }
+
+    while (running)
+    {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return !finished.empty(); });
+            i = finished.back();
+            finished.pop_back();
+        }
+
+        Slot& slot = slots[i];
+        running--;
+        slot.engine->wait_for_search_finished();
+
+        const Move m = UCIEngine::to_move(slot.pos, slot.bestmove);
+
+        if (m == Move::none() || !slot.score)
+        {
+            end_game(slot, 0);
+            continue;
+        }
+
+        slot.sfens.push_back(pack_sfen(slot.pos, *slot.score, m));
+
+        // A mate score decides the game, no need to play it out
+        if (slot.score->is<Score::Mate>())
+        {
+            end_game(slot, slot.score->get<Score::Mate>().plies > 0 ? 1 : -1);
+            continue;
+        }
+
+        do_move(slot, m);
+
+        if (auto result = game_result(slot))
+            end_game(slot, *result);
+        else
+            search(slot);
+    }
+
+    output.flush();
+    print_info_string("gensfen done, games " + std::to_string(played) + " positions "
+                      + std::to_string(written) + " in " + std::to_string(now() - start) + " ms");
+}
+
 void UCIEngine::position(std::istringstream& is) {
     std::string token, fen;
 
@@ -357,6 +1583,15 @@ int win_rate_model(Value v, const Position& pos) {
 }
 }
 
+// Inverse of to_cp(), clamped below the tablebase scores
+Value UCIEngine::to_value(int cp, const Position& pos) {
+
+    auto [a, b] = win_rate_params(pos);
+
+    return std::clamp(int(std::round(cp * a / 100)), VALUE_TB_LOSS_IN_MAX_PLY + 1,
+                      VALUE_TB_WIN_IN_MAX_PLY - 1);
+}
+
 std::string UCIEngine::format_score(const Score& s) {
     constexpr int TB_CP = 20000;
     const auto    format =
@@ -442,50 +1677,85 @@ Move UCIEngine::to_move(const Position& pos, std::string str) {
 }
 
 void UCIEngine::on_update_no_moves(const Engine::InfoShort& info) {
-    sync_cout << "info depth " << info.depth << " score " << format_score(info.score) << sync_endl;
+    emit([info](std::ostream& os) {
+        os << "info depth " << info.depth << " score " << format_score(info.score);
+    });
 }
 
+// The lines may be formatted later by the writer thread, so they own their strings
 void UCIEngine::on_update_full(const Engine::InfoFull& info, bool showWDL) {
-    std::stringstream ss;
-
-    ss << "info";
-    ss << " depth " << info.depth                 //
-       << " seldepth " << info.selDepth           //
-       << " multipv " << info.multiPV             //
-       << " score " << format_score(info.score);  //
+    OutputJob line = [info, showWDL, wdl = std::string(info.wdl), bound = std::string(info.bound),
+                      pv = std::string(info.pv)](std::ostream& os) {
+        os << "info";
+        os << " depth " << info.depth                 //
+           << " seldepth " << info.selDepth           //
+           << " multipv " << info.multiPV             //
+           << " score " << format_score(info.score);  //
+
+        if (showWDL)
+            os << " wdl " << wdl;
+
+        if (!bound.empty())
+            os << " " << bound;
+
+        os << " nodes " << info.nodes        //
+           << " nps " << info.nps            //
+           << " hashfull " << info.hashfull  //
+           << " tbhits " << info.tbHits      //
+           << " time " << info.timeMs        //
+           << " pv " << pv;                  //
+    };
+
+    // The lines of all the multipv of an iteration are shown or left out together
+    if (info.multiPV == 1)
+    {
+        const int interval = engine.get_options()["InfoInterval"];
 
-    if (showWDL)
-        ss << " wdl " << info.wdl;
+        infoShown = !interval || now() - lastInfoTime >= interval;
 
-    if (!info.bound.empty())
-        ss << " " << info.bound;
+        if (infoShown)
+        {
+            lastInfoTime = now();
+            pendingInfo.clear();
+        }
+    }
 
-    ss << " nodes " << info.nodes        //
-       << " nps " << info.nps            //
-       << " hashfull " << info.hashfull  //
-       << " tbhits " << info.tbHits      //
-       << " time " << info.timeMs        //
-       << " pv " << info.pv;             //
+    if (infoShown)
+        emit(std::move(line));
+    else
+    {
+        if (pendingInfo.size() < info.multiPV)
+            pendingInfo.resize(info.multiPV);
 
-    sync_cout << ss.str() << sync_endl;
+        pendingInfo[info.multiPV - 1] = std::move(line);
+    }
 }
 
 void UCIEngine::on_iter(const Engine::InfoIter& info) {
-    std::stringstream ss;
-
-    ss << "info";
-    ss << " depth " << info.depth                     //
-       << " currmove " << info.currmove               //
-       << " currmovenumber " << info.currmovenumber;  //
-
-    sync_cout << ss.str() << sync_endl;
+    emit([info, currmove = std::string(info.currmove)](std::ostream& os) {
+        os << "info";
+        os << " depth " << info.depth                     //
+           << " currmove " << currmove                    //
+           << " currmovenumber " << info.currmovenumber;  //
+    });
 }
 
 void UCIEngine::on_bestmove(std::string_view bestmove, std::string_view ponder) {
-    sync_cout << "bestmove " << bestmove;
-    if (!ponder.empty())
-        std::cout << " ponder " << ponder;
-    std::cout << sync_endl;
+
+    // The last info lines left out by InfoInterval go before the best move
+    for (auto& line : pendingInfo)
+        if (line)
+            emit(std::move(line));
+
+    pendingInfo.clear();
+    lastInfoTime = 0;
+    infoShown = true;
+
+    emit([bestmove = std::string(bestmove), ponder = std::string(ponder)](std::ostream& os) {
+        os << "bestmove " << bestmove;
+        if (!ponder.empty())
+            os << " ponder " << ponder;
+    });
 }
 
 }  // namespace Stockfish
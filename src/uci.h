@@ -20,9 +20,13 @@
 #define UCI_H_INCLUDED
 
 #include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <streambuf>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "engine.h"
 #include "misc.h"
@@ -35,14 +39,21 @@ class Move;
 class Score;
 enum Square : int;
 using Value = int;
+class AsyncWriter;
 
 class UCIEngine {
    public:
     UCIEngine(int argc, char** argv);
+    // Server instance, sharing the networks of host and prefixing its output with prefix
+    UCIEngine(UCIEngine& host, const std::string& prefix);
+    ~UCIEngine();
 
     void loop();
+    void server();
+    void cluster(int port);
 
     static int         to_cp(Value v, const Position& pos);
+    static Value       to_value(int cp, const Position& pos);
     static std::string format_score(const Score& s);
     static std::string square(Square s);
     static std::string move(Move m, bool chess960);
@@ -58,18 +69,42 @@ class UCIEngine {
     Engine      engine;
     CommandLine cli;
 
-    static void print_info_string(const std::string& str);
+    std::unique_ptr<std::streambuf> outputBuffer;  // Only set for server instances
+    std::ostream                    out;
+
+    // With AsyncOutput the lines of the search are written by the writer thread.
+    // With InfoInterval the info lines are rate limited, the ones left out are
+    // kept in pendingInfo, by multipv, to be written before the best move.
+    using OutputJob = std::function<void(std::ostream&)>;
+
+    std::unique_ptr<AsyncWriter> writer;
+    std::vector<OutputJob>       pendingInfo;
+    TimePoint                    lastInfoTime = 0;
+    bool                         infoShown    = true;
+
+    void emit(OutputJob job);
+    void print_info_string(const std::string& str);
+
+    void init_listeners();
+    bool execute(const std::string& cmd);
 
     void          go(std::istringstream& is);
     void          bench(std::istream& args);
+    void          bench_json(std::istream& args);
+    void          bench_see(std::istream& args);
+    void          bench_nnue(std::istream& args);
+    std::vector<std::string> bench_positions(std::istream& args, size_t& rounds);
+    void          tune_threads(std::istream& args);
+    void          analyse(std::istream& args);
+    void          gensfen(std::istream& args);
     void          position(std::istringstream& is);
     void          setoption(std::istringstream& is);
     std::uint64_t perft(const Search::LimitsType&);
 
-    static void on_update_no_moves(const Engine::InfoShort& info);
-    static void on_update_full(const Engine::InfoFull& info, bool showWDL);
-    static void on_iter(const Engine::InfoIter& info);
-    static void on_bestmove(std::string_view bestmove, std::string_view ponder);
+    void on_update_no_moves(const Engine::InfoShort& info);
+    void on_update_full(const Engine::InfoFull& info, bool showWDL);
+    void on_iter(const Engine::InfoIter& info);
+    void on_bestmove(std::string_view bestmove, std::string_view ponder);
 };
 
 }  // namespace Stockfish
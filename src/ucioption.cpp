@@ -118,7 +118,7 @@ Option::operator int() const {
 }
 
 Option::operator std::string() const {
-    assert(type == "string");
+    assert(type == "string" || type == "combo");
     return currentValue;
 }
 
@@ -58,4 +58,49 @@ done
 
 rm repeat.exp
 
+# with DeterministicSMP a multithreaded search with go nodes $nodes must end
+# with the same last info line and bestmove every time. SharedHistory is
+# set to check that it is ignored in this mode.
+cat << EOF > repeat_smp.exp
+ set timeout 30
+ spawn ./stockfish
+ lassign \$argv nodes
+
+ send "uci\n"
+ expect "uciok"
+
+ send "setoption name Threads value 4\n"
+ send "setoption name DeterministicSMP value true\n"
+ send "setoption name SharedHistory value true\n"
+
+ send "ucinewgame\n"
+ send "position startpos moves e2e4 e7e6\n"
+ send "go nodes \$nodes\n"
+ expect "bestmove"
+
+ send "ucinewgame\n"
+ send "position startpos moves e2e4 e7e6\n"
+ send "go nodes \$nodes\n"
+ expect "bestmove"
+
+ send "quit\n"
+ expect eof
+EOF
+
+for nodes in 10000 50000 200000
+do
+
+  echo "reprosearch testing with DeterministicSMP and $nodes nodes"
+
+  # the info line before each bestmove, without its timings, and the bestmove
+  # should each appear exactly an even number of times
+  expect repeat_smp.exp $nodes 2>&1 \
+    | awk '/^info depth/ { last = $0 }
+           /^bestmove/   { gsub(/ (nps|time) [0-9]+/, "", last); print last; print }' \
+    | sort | uniq -c | awk '{if ($1%2!=0) exit(1)}'
+
+done
+
+rm repeat_smp.exp
+
 echo "reprosearch testing OK"